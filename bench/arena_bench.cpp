@@ -0,0 +1,415 @@
+﻿//
+// tables()/columns()の1回の呼び出しのヒープ確保回数のベンチマーク
+//
+// 実際の処理(catalogfetch.cppのFetchCatalogTables・FetchCatalogColumnsと
+// CatalogTablesToJson・CatalogColumnsToJson、呼び出しのアリーナ)と、アリーナ
+// 導入前の処理(new[]の条件の複製と列の領域・_S2O/trimStringの一時文字列・
+// nlohmann::json)を、ODBCの文の代わりの偽の実装で同じ行を返して実行し、
+// 呼び出しあたりのoperator newの回数・プールの新規確保・処理時間を比べます。
+//
+// 取得条件の複製・SQLTables/SQLColumnsの結果の取得(列ごとのstd::string、
+// vectorの拡張を含む)・JSON化・文字列への出力までを含みます。napiの引数の
+// 読み取りと返却値のNapi::Stringの作成は含みません。
+//
+//   g++ -std=c++11 -O2 -Isrc bench/arena_bench.cpp src/catalogfetch.cpp src/callarena.cpp src/bufferpool.cpp -pthread -o arena_bench
+//   ./arena_bench [行数] [回数]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "catalogfetch.h"
+
+using json = nlohmann::json;
+
+// operator newの回数
+static std::atomic<uint64_t> g_news(0);
+
+// 置き換えたnew・deleteは展開させない(展開するとmalloc・freeとnew・deleteの
+// 組み合わせの不一致として-Wmismatched-new-deleteが誤って警告される)
+#define BENCH_NOINLINE __attribute__((noinline))
+
+BENCH_NOINLINE void *operator new(size_t size)
+{
+  g_news++;
+  void *p = malloc(size ? size : 1);
+  if(!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+BENCH_NOINLINE void operator delete(void *p) noexcept { free(p); }
+BENCH_NOINLINE void operator delete(void *p, size_t) noexcept { free(p); }
+BENCH_NOINLINE void *operator new[](size_t size) { return operator new(size); }
+BENCH_NOINLINE void operator delete[](void *p) noexcept { free(p); }
+BENCH_NOINLINE void operator delete[](void *p, size_t) noexcept { free(p); }
+
+
+//
+// ODBCの文の代わり(SQLTables・SQLColumnsの結果を偽の行で返す)
+//
+// バインドされた領域に書くだけでヒープは使いません。
+//
+
+// 返す行数
+static int g_rowCount = 200;
+// 取得中の結果(0:テーブル 1:カラム)と次の行
+static int g_mode = 0;
+static int g_next = 0;
+// バインドされた列
+static SQLPOINTER g_values[16];
+static SQLLEN g_sizes[16];
+static SQLLEN *g_indicators[16];
+// 文のハンドルの代わり
+static int g_stmt;
+
+SQLRETURN SQLAllocHandle(SQLSMALLINT type, SQLHANDLE input, SQLHANDLE *output)
+{
+  *output = &g_stmt;
+  return SQL_SUCCESS;
+}
+
+SQLRETURN SQLFreeHandle(SQLSMALLINT type, SQLHANDLE handle)
+{
+  return SQL_SUCCESS;
+}
+
+SQLRETURN SQLTables(SQLHSTMT stmt, SQLCHAR *catalog, SQLSMALLINT catalogLength,
+  SQLCHAR *schema, SQLSMALLINT schemaLength, SQLCHAR *table, SQLSMALLINT tableLength,
+  SQLCHAR *tableType, SQLSMALLINT tableTypeLength)
+{
+  g_mode = 0;
+  g_next = 0;
+  return SQL_SUCCESS;
+}
+
+SQLRETURN SQLColumns(SQLHSTMT stmt, SQLCHAR *catalog, SQLSMALLINT catalogLength,
+  SQLCHAR *schema, SQLSMALLINT schemaLength, SQLCHAR *table, SQLSMALLINT tableLength,
+  SQLCHAR *column, SQLSMALLINT columnLength)
+{
+  g_mode = 1;
+  g_next = 0;
+  return SQL_SUCCESS;
+}
+
+SQLRETURN SQLBindCol(SQLHSTMT stmt, SQLUSMALLINT column, SQLSMALLINT ctype,
+  SQLPOINTER value, SQLLEN size, SQLLEN *indicator)
+{
+  g_values[column] = value;
+  g_sizes[column] = size;
+  g_indicators[column] = indicator;
+  return SQL_SUCCESS;
+}
+
+
+/**
+* バインドされた文字列の列に書き込みます
+*
+* @param[in] column 列番号
+* @param[in] text 値(NULLはSQL_NULL_DATA)
+*/
+static void PutText(int column, const char *text)
+{
+  if(!text) {
+    *g_indicators[column] = SQL_NULL_DATA;
+    return;
+  }
+  size_t length = strlen(text);
+  if(length >= (size_t)g_sizes[column]) {
+    length = g_sizes[column] - 1;
+  }
+  memcpy(g_values[column], text, length);
+  ((char *)g_values[column])[length] = '\0';
+  *g_indicators[column] = length;
+}
+
+SQLRETURN SQLFetch(SQLHSTMT stmt)
+{
+  if(g_next >= g_rowCount) {
+    return SQL_NO_DATA;
+  }
+  int i = g_next++;
+  char name[64];
+  // DB2 for iのカタログの備考は固定長(後ろが空白)
+  char remarks[128];
+  if(g_mode == 0) {
+    snprintf(name, sizeof(name), "DEMTABLE%d", i);
+    snprintf(remarks, sizeof(remarks), "Demonstration table number %d for catalog queries          ", i);
+    PutText(1, "S1234567");
+    PutText(2, "DEMQUERY");
+    PutText(3, name);
+    PutText(4, "TABLE");
+    PutText(5, remarks);
+  } else {
+    snprintf(name, sizeof(name), "COLUMN%d", i);
+    snprintf(remarks, sizeof(remarks), "Demonstration column number %d of the catalog table          ", i);
+    PutText(1, "S1234567");
+    PutText(2, "DEMQUERY");
+    PutText(3, "DEMTABLE");
+    PutText(4, name);
+    *(SQLSMALLINT *)g_values[5] = (i % 2) ? SQL_VARCHAR : SQL_INTEGER;
+    *(SQLINTEGER *)g_values[7] = (i % 2) ? 128 : 10;
+    *(SQLSMALLINT *)g_values[9] = 0;
+    *(SQLSMALLINT *)g_values[10] = 10;
+    *(SQLSMALLINT *)g_values[11] = (i % 3) ? SQL_NULLABLE : SQL_NO_NULLS;
+    PutText(12, remarks);
+    PutText(13, (i % 4) ? NULL : "CURRENT_TIMESTAMP");
+  }
+  return SQL_SUCCESS;
+}
+
+// 偽の文はエラーを返さない
+OString OdbcErrorMessage(const OString &api, SQLRETURN retcode, SQLSMALLINT handleType, SQLHANDLE hError)
+{
+  return api;
+}
+
+
+//
+// アリーナ導入前の処理(比較用)
+//
+
+// 文字列長
+#define ODATA_LENGTH 256
+#define OREMARK_LENGTH 1024
+
+// 前後空白削除(旧OmniDb::trimString)
+static OString trimString(const OString &str)
+{
+  OString right = str;
+  right.erase(right.find_last_not_of(_O(" ")) + 1);
+  OString res = right;
+  res.erase(0, res.find_first_not_of(_O(" ")));
+  return res;
+}
+
+// 取得条件の複製(旧NapiStringToSQLTCHAR、napiから読んだstd::stringをnew[]で複製)
+static SQLTCHAR *CopyCondition(const char *value)
+{
+  std::string temp(value);
+  SQLTCHAR *text = new SQLTCHAR[temp.size() + 1];
+  memcpy(text, temp.c_str(), temp.size() + 1);
+  return text;
+}
+
+
+/**
+* アリーナ導入前のtables()
+*
+* @return std::string JSON文字列
+*/
+static std::string TablesBefore()
+{
+  std::unique_ptr<SQLTCHAR[]> catalog(CopyCondition("S1234567"));
+  std::unique_ptr<SQLTCHAR[]> schema(CopyCondition("DEMQUERY"));
+  std::unique_ptr<SQLTCHAR[]> table(CopyCondition("DEM%"));
+  std::unique_ptr<SQLTCHAR[]> tableType(new SQLTCHAR[256]);
+  ostrcpy(tableType.get(), _O("TABLE"));
+
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(NULL));
+  SQLTables(stmt.get(), catalog.get(), SQL_NTS, schema.get(), SQL_NTS, table.get(), SQL_NTS, tableType.get(), SQL_NTS);
+
+  std::unique_ptr<SQLTCHAR[]> colCatalog(new SQLTCHAR[ODATA_LENGTH]);
+  std::unique_ptr<SQLTCHAR[]> colSchema(new SQLTCHAR[ODATA_LENGTH]);
+  std::unique_ptr<SQLTCHAR[]> colTable(new SQLTCHAR[ODATA_LENGTH]);
+  std::unique_ptr<SQLTCHAR[]> colTableType(new SQLTCHAR[ODATA_LENGTH]);
+  std::unique_ptr<SQLTCHAR[]> colRemarks(new SQLTCHAR[OREMARK_LENGTH]);
+  SQLLEN sizCatalog, sizSchema, sizTable, sizTableType, sizRemarks;
+  SQLBindCol(stmt.get(), 1, SQL_C_CHAR, colCatalog.get(), ODATA_LENGTH, &sizCatalog);
+  SQLBindCol(stmt.get(), 2, SQL_C_CHAR, colSchema.get(), ODATA_LENGTH, &sizSchema);
+  SQLBindCol(stmt.get(), 3, SQL_C_CHAR, colTable.get(), ODATA_LENGTH, &sizTable);
+  SQLBindCol(stmt.get(), 4, SQL_C_CHAR, colTableType.get(), ODATA_LENGTH, &sizTableType);
+  SQLBindCol(stmt.get(), 5, SQL_C_CHAR, colRemarks.get(), OREMARK_LENGTH, &sizRemarks);
+
+  json tables = json::array();
+  while(SQLFetch(stmt.get()) == SQL_SUCCESS) {
+    json t = json::object();
+    t["catalog"] = to_jsonstr(_S2O(colCatalog.get()));
+    t["schema"] = to_jsonstr(_S2O(colSchema.get()));
+    t["name"] = to_jsonstr(_S2O(colTable.get()));
+    t["type"] = to_jsonstr(_S2O(colTableType.get()));
+    t["remarks"] = to_jsonstr(trimString(_S2O(colRemarks.get())));
+    tables.push_back(t);
+  }
+  return tables.dump(-1, ' ', true, json::error_handler_t::replace);
+}
+
+
+/**
+* アリーナ導入前のcolumns()
+*
+* @return std::string JSON文字列
+*/
+static std::string ColumnsBefore()
+{
+  std::unique_ptr<SQLTCHAR[]> catalog(CopyCondition("S1234567"));
+  std::unique_ptr<SQLTCHAR[]> schema(CopyCondition("DEMQUERY"));
+  std::unique_ptr<SQLTCHAR[]> table(CopyCondition("DEMTABLE"));
+
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(NULL));
+  SQLColumns(stmt.get(), catalog.get(), SQL_NTS, schema.get(), SQL_NTS, table.get(), SQL_NTS, NULL, 0);
+
+  std::unique_ptr<SQLTCHAR[]> colCatalog(new SQLTCHAR[ODATA_LENGTH]);
+  std::unique_ptr<SQLTCHAR[]> colSchema(new SQLTCHAR[ODATA_LENGTH]);
+  std::unique_ptr<SQLTCHAR[]> colTable(new SQLTCHAR[ODATA_LENGTH]);
+  std::unique_ptr<SQLTCHAR[]> colColumn(new SQLTCHAR[ODATA_LENGTH]);
+  std::unique_ptr<SQLTCHAR[]> colRemarks(new SQLTCHAR[OREMARK_LENGTH]);
+  std::unique_ptr<SQLTCHAR[]> colDefault(new SQLTCHAR[ODATA_LENGTH]);
+  SQLINTEGER colSize;
+  SQLSMALLINT colType, colDecimalDigits, colNumPrec, colNullable;
+  SQLLEN sizCatalog, sizSchema, sizTable, sizColumn, sizType, sizSize;
+  SQLLEN sizDecimalDigits, sizNumPrec, sizNullable, sizRemarks, sizDefault;
+  SQLBindCol(stmt.get(), 1, SQL_C_CHAR, colCatalog.get(), ODATA_LENGTH, &sizCatalog);
+  SQLBindCol(stmt.get(), 2, SQL_C_CHAR, colSchema.get(), ODATA_LENGTH, &sizSchema);
+  SQLBindCol(stmt.get(), 3, SQL_C_CHAR, colTable.get(), ODATA_LENGTH, &sizTable);
+  SQLBindCol(stmt.get(), 4, SQL_C_CHAR, colColumn.get(), ODATA_LENGTH, &sizColumn);
+  SQLBindCol(stmt.get(), 5, SQL_C_SLONG, &colType, 0, &sizType);
+  SQLBindCol(stmt.get(), 7, SQL_C_SLONG, &colSize, 0, &sizSize);
+  SQLBindCol(stmt.get(), 9, SQL_C_SSHORT, &colDecimalDigits, 0, &sizDecimalDigits);
+  SQLBindCol(stmt.get(), 10, SQL_C_SSHORT, &colNumPrec, 0, &sizNumPrec);
+  SQLBindCol(stmt.get(), 11, SQL_C_SSHORT, &colNullable, 0, &sizNullable);
+  SQLBindCol(stmt.get(), 12, SQL_C_CHAR, colRemarks.get(), OREMARK_LENGTH, &sizRemarks);
+  SQLBindCol(stmt.get(), 13, SQL_C_CHAR, colDefault.get(), ODATA_LENGTH, &sizDefault);
+
+  json cols = json::array();
+  while(SQLFetch(stmt.get()) == SQL_SUCCESS) {
+    // 旧版はNULLの既定値でも前の行の値が残っていた(比較のため空にする)
+    if(sizDefault == SQL_NULL_DATA) {
+      colDefault[0] = 0;
+    }
+    // 旧OmniDb::GetTypeName・GetTypeClassName(OStringを返す)
+    OString typeName = OString(_O(""));
+    typeName = _S2O(SqlTypeName(colType));
+    OString className = OString(_O(""));
+    className = _S2O(SqlTypeClassName(colType));
+    json col = json::object();
+    col["catalog"] = to_jsonstr(_S2O(colCatalog.get()));
+    col["schema"] = to_jsonstr(_S2O(colSchema.get()));
+    col["table"] = to_jsonstr(_S2O(colTable.get()));
+    col["name"] = to_jsonstr(_S2O(colColumn.get()));
+    col["type"] = to_jsonstr(typeName);
+    col["typeClass"] = to_jsonstr(className);
+    col["size"] = colSize;
+    col["decimalDigits"] = colDecimalDigits;
+    col["numPrec"] = colNumPrec;
+    col["remarks"] = to_jsonstr(trimString(_S2O(colRemarks.get())));
+    col["defualt"] = to_jsonstr(_S2O(colDefault.get()));
+    col["nullable"] = (colNullable == SQL_NULLABLE) ? true : false;
+    cols.push_back(col);
+  }
+  return cols.dump(-1, ' ', true, json::error_handler_t::replace);
+}
+
+
+//
+// 現在の処理(OmniDb::Tables・Columnsのnapi以外の部分)
+//
+
+/**
+* 現在のtables()
+*
+* @return std::string JSON文字列(Napi::Stringの代わりに複製)
+*/
+static std::string TablesAfter()
+{
+  CallArena arena;
+  CallArenaScope scope(arena);
+
+  SQLTCHAR *tableType = (SQLTCHAR *)arena.Allocate(sizeof(SQLTCHAR) * 256);
+  ostrcpy(tableType, _O("TABLE"));
+  SQLTCHAR *catalog = (SQLTCHAR *)arena.Copy("S1234567", 8);
+  SQLTCHAR *schema = (SQLTCHAR *)arena.Copy("DEMQUERY", 8);
+  SQLTCHAR *table = (SQLTCHAR *)arena.Copy("DEM%", 4);
+
+  std::vector<CatalogTable> tables;
+  OString error;
+  if(!FetchCatalogTables(NULL, catalog, schema, table, tableType, tables, error)) {
+    return std::string();
+  }
+  ArenaString result = CatalogTablesToJson(tables);
+  return std::string(result.data(), result.size());
+}
+
+
+/**
+* 現在のcolumns()
+*
+* @return std::string JSON文字列(Napi::Stringの代わりに複製)
+*/
+static std::string ColumnsAfter()
+{
+  CallArena arena;
+  CallArenaScope scope(arena);
+
+  SQLTCHAR *catalog = (SQLTCHAR *)arena.Copy("S1234567", 8);
+  SQLTCHAR *schema = (SQLTCHAR *)arena.Copy("DEMQUERY", 8);
+  SQLTCHAR *table = (SQLTCHAR *)arena.Copy("DEMTABLE", 8);
+
+  std::vector<CatalogColumn> columns;
+  OString error;
+  if(!FetchCatalogColumns(NULL, catalog, schema, table, NULL, columns, error)) {
+    return std::string();
+  }
+  ArenaString result = CatalogColumnsToJson(columns);
+  return std::string(result.data(), result.size());
+}
+
+
+/**
+* 計測します
+*
+* 返却値のstd::string(Napi::Stringの代わり)の確保1回は両方に含まれます。
+*
+* @param[in] label 表示名
+* @param[in] call 処理
+* @param[in] count 回数
+* @return std::string 最後の結果
+*/
+static std::string Measure(const char *label, std::string (*call)(), int count)
+{
+  // 1回目(プールが空の状態)
+  uint64_t before = g_news;
+  uint64_t pooled = BufferPool::Shared().Stats().allocated;
+  std::string result = call();
+  uint64_t first = g_news - before;
+  uint64_t firstPooled = BufferPool::Shared().Stats().allocated - pooled;
+
+  before = g_news;
+  pooled = BufferPool::Shared().Stats().allocated;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(int i = 0; i < count; i++) {
+    result = call();
+  }
+  double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  uint64_t news = g_news - before;
+  pooled = BufferPool::Shared().Stats().allocated - pooled;
+
+  printf("%-16s first=%6llu(+%llu pool)  per call=%9.1f(+%.1f pool)  %9.1f us/call  (%zu bytes)\n",
+    label, (unsigned long long)first, (unsigned long long)firstPooled,
+    (double)news / count, (double)pooled / count, elapsed / count, result.size());
+  return result;
+}
+
+
+int main(int argc, char *argv[])
+{
+  g_rowCount = argc > 1 ? atoi(argv[1]) : 200;
+  int count = argc > 2 ? atoi(argv[2]) : 1000;
+
+  printf("rows=%d calls=%d (operator new per call, +pool = new blocks from the buffer pool)\n", g_rowCount, count);
+  std::string tablesBefore = Measure("tables  before", TablesBefore, count);
+  std::string tablesAfter = Measure("tables  after", TablesAfter, count);
+  std::string columnsBefore = Measure("columns before", ColumnsBefore, count);
+  std::string columnsAfter = Measure("columns after", ColumnsAfter, count);
+  if(tablesBefore != tablesAfter || columnsBefore != columnsAfter) {
+    printf("results differ\n");
+    return 1;
+  }
+  return 0;
+}
@@ -5,7 +5,7 @@
       "cflags!": [ "-fno-exceptions .source-charset:utf-8" ],
       "cflags_cc!": [ "-fno-exceptions /source-charset:utf-8" ],
       'cflags' : ['-Wall', '-Wextra', '-Wno-unused-parameter', '-DNAPI_DISABLE_CPP_EXCEPTIONS'],
-      "sources": [ "src/omnidb.cpp" ],
+      "sources": [ "src/omnidb.cpp", "src/omnicommon.cpp", "src/catalogcache.cpp", "src/catalogfetch.cpp", "src/catalogindex.cpp", "src/executor.cpp", "src/asyncbridge.cpp", "src/connpool.cpp", "src/omnipool.cpp", "src/bulkexec.cpp", "src/bulkparams.cpp", "src/omniloader.cpp", "src/fetcher.cpp", "src/procedure.cpp", "src/limiter.cpp", "src/hedge.cpp", "src/router.cpp", "src/resultstream.cpp", "src/omnifederation.cpp", "src/cursortable.cpp", "src/keyset.cpp", "src/bufferpool.cpp", "src/callarena.cpp", "src/spillbuffer.cpp" ],
       "include_dirs": [
         "<!@(node -p \"require('node-addon-api').include\")"
       ],
@@ -0,0 +1,28 @@
+const cluster = require('cluster');
+const omnidb = require('../omnidb');
+
+// カタログキャッシュ: 1ホスト内でtables()/columns()を1回だけ取得して共有する
+const CACHE_PATH = '/tmp/omnidb-catalog';
+
+if (cluster.isPrimary) {
+  (async () => {
+    const db = new omnidb();
+    await db.connect('dsn=phpq;uid=qsecofr;pwd=passw0rd;Database=C7054D00;CCSID=1208;EXTCOLINFO=1;');
+    await db.openCatalogCache(CACHE_PATH);
+    console.log('// refreshCatalogCache');
+    console.log(await db.refreshCatalogCache({schema: 'DEMQUERY'}, {maxAge: 3600}));
+    await db.disconnect();
+    for (let i = 0; i < 4; i++) {
+      cluster.fork();
+    }
+  })();
+} else {
+  (async () => {
+    // ワーカーは接続せずにキャッシュを読むだけ
+    const db = new omnidb();
+    await db.openCatalogCache(CACHE_PATH);
+    console.log(process.pid, db.catalogCacheInfo());
+    console.log(process.pid, await db.cachedColumns({schema: 'DEMQUERY', table: 'DEMSHN'}));
+    process.exit(0);
+  })();
+}
@@ -0,0 +1,81 @@
+const omnidb = require('../omnidb');
+
+// 接続プールで複数のSQLを並列に解析する
+(async () => {
+  // initは物理接続ごとに接続直後に1度だけ実行されます
+  const pool = new omnidb.Pool('dsn=phpq;uid=qsecofr;pwd=passw0rd;Database=C7054D00;CCSID=1208;EXTCOLINFO=1;', {
+    max: 8,
+    // 読み取り専用の処理(解析・カタログ・readOnlyのexecute)は処理時間の短い接続先に振り分ける
+    replicas: [
+      'dsn=phpq_r1;uid=qsecofr;pwd=passw0rd;Database=C7054D00;CCSID=1208;EXTCOLINFO=1;',
+      'dsn=phpq_r2;uid=qsecofr;pwd=passw0rd;Database=C7054D00;CCSID=1208;EXTCOLINFO=1;',
+    ],
+    // 1本は対話的な処理(tables/columns/query)のために空けておく
+    reserveInteractive: 1,
+    min: 4,
+    loginTimeout: 10,
+    // ファイアウォールに切られないよう、1分使われていない空き接続を確認
+    healthInterval: 60000,
+    // 処理時間を見ながら同時実行数を調整し、待ちが64を超えたら断る
+    limiter: {algorithm: 'gradient', maxQueue: 64},
+    // p95を過ぎても返らない読み取りは別の接続でも実行(ヘッジは要求の10%まで)
+    hedge: {percentile: 95, budget: 10},
+    init: "SET CURRENT SCHEMA = 'DEMQUERY'; SET PATH = DEMQUERY, SYSTEM PATH",
+  });
+  // 準備完了を報告する前に接続・SQLの準備を済ませておく
+  console.log('// warmup', await pool.warmup({
+    statements: ['INSERT INTO DEMQUERY.LOADTEST (ID, AMOUNT, NAME) VALUES (?, ?, ?)'],
+  }));
+
+  const statements = [
+    'SELECT * FROM DEMQUERY.DEMSHN',
+    'SELECT SHNCD, SHNNM FROM DEMQUERY.DEMSHN WHERE SHNCD = ?',
+    'SELECT * FROM DEMQUERY.NOTFOUND',
+  ];
+  const summary = await pool.describeAll(statements, {parallelism: 4, retries: 2, label: true},
+    (index, error, result) => {
+      // 入力順に呼び出されます
+      console.log(index, error ? error.message : result);
+    },
+    (progress) => {
+      console.log('// progress', progress);
+    });
+  console.log('// summary', summary);
+
+  // 対話的な処理は予約されたスレッドで実行されるのでバッチ処理の後ろで待たされない
+  const bulk = pool.executeBulk('INSERT INTO DEMQUERY.LOADTEST (ID, AMOUNT, NAME) VALUES (?, ?, ?)',
+    [[1, 2, 3], [10.5, 20.5, 30.5], ['a', 'b', 'c']]);
+  console.log(await pool.columns({schema: 'DEMQUERY', table: 'DEMSHN'}));
+  console.log('// bulk', await bulk);
+
+  // ロック待ちで止まった接続があっても先に返った方の結果を使う
+  console.log(await pool.execute('SELECT SHNCD, SHNNM FROM DEMQUERY.DEMSHN', {idempotent: true, maxRows: 10}));
+
+  // テーブルを相対レコード番号で4区画に分けて並列に読む(到着順に1つのストリーム)
+  let scanned = 0;
+  for await (const row of pool.scan('DEMQUERY.DEMSHN', {expression: 'RRN(DEMSHN)', partitions: 4})) {
+    scanned++;
+  }
+  console.log('// scanned', scanned);
+
+  // キーセットページング(表示している間に次のページを先読み)
+  const pager = pool.paginate('SELECT SHNCD, SHNNM FROM DEMQUERY.DEMSHN', {keys: ['SHNCD'], pageSize: 50});
+  console.log('// page 1', (await pager.next()).rows);
+  console.log('// page 2', (await pager.next()).rows);
+  pager.close();
+
+  // 全行を取得してから読む(64MBを超えた分は一時ファイルに書き出し、接続はすぐに返す)
+  let materialized = 0;
+  for await (const row of pool.materialize('SELECT * FROM DEMQUERY.DEMSHN', {memoryBudget: 64 * 1024 * 1024})) {
+    materialized++;
+  }
+  console.log('// materialized', materialized, omnidb.spillStats());
+
+  // 別のセッションを求める場合は初期化済みの接続が優先して使われます
+  console.log(await pool.query('SELECT * FROM DB2DRGS', {session: "SET CURRENT SCHEMA = 'PHPQUERY2'"}));
+  console.log('// stats', pool.stats());
+  pool.close();
+  // 行セット領域は文・接続をまたいで使い回される(使っていない領域は解放できる)
+  console.log('// buffers', omnidb.bufferStats());
+  console.log('// trimmed', omnidb.trimBuffers());
+})();
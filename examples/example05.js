@@ -0,0 +1,34 @@
+const omnidb = require('../omnidb');
+
+// パイプライン一括ローダー: 変換中に前のバッチを実行する
+(async () => {
+  const loader = new omnidb.Loader(
+    'dsn=phpq;uid=qsecofr;pwd=passw0rd;Database=C7054D00;CCSID=1208;EXTCOLINFO=1;',
+    'INSERT INTO DEMQUERY.LOADTEST (ID, AMOUNT, NAME) VALUES (?, ?, ?)',
+    {batchSize: 1000, commitInterval: 50000, depth: 3});
+
+  const rows = 10000;
+  // TypedArrayはコピーせずにバインドするので、add()はそのバッチを実行し終えてから解決する
+  // (毎回新しい配列を作る場合は解決を待たずに次のバッチを変換できる)
+  const pending = [];
+  for (let batch = 0; batch < 100; batch++) {
+    const ids = new Int32Array(rows);
+    const amounts = new Float64Array(rows);
+    const names = [];
+    for (let i = 0; i < rows; i++) {
+      ids[i] = batch * rows + i;
+      amounts[i] = i * 1.5;
+      names.push('NAME' + i);
+    }
+    // 全スロットが実行中の場合は空くまで待つ
+    pending.push(loader.add([ids, amounts, names]));
+    if (pending.length >= 3) {
+      await pending.shift();
+    }
+    if (batch % 10 == 0) {
+      console.log('// stats', loader.stats());
+    }
+  }
+  await Promise.all(pending);
+  console.log('// summary', await loader.finish());
+})();
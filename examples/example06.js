@@ -0,0 +1,23 @@
+const omnidb = require('../omnidb');
+
+// ストアドプロシージャ呼び出し: IN/OUTパラメータ・結果セット・配列呼び出し
+(async () => {
+  const db = new omnidb();
+  await db.connect('dsn=phpq;uid=qsecofr;pwd=passw0rd;Database=C7054D00;CCSID=1208;EXTCOLINFO=1;');
+
+  // パラメータは呼び出し順の配列、またはパラメータ名で指定(OUTパラメータは指定不要)
+  const result = await db.call('DEMQUERY.GET_CUSTOMER', {CUSTNO: 1001}, {maxRows: 100});
+  console.log('// outputs', result.outputs);
+  console.log('// results', result.results);
+
+  // 入力パラメータのみのプロシージャは配列パラメータで一括呼び出し
+  const ids = new Int32Array(5000);
+  const names = [];
+  for (let i = 0; i < ids.length; i++) {
+    ids[i] = i;
+    names.push('NAME' + i);
+  }
+  console.log('// bulk', await db.callBulk('DEMQUERY.ADD_CUSTOMER', [ids, names], {batchSize: 1000}));
+
+  await db.disconnect();
+})();
@@ -0,0 +1,33 @@
+const omnidb = require('../omnidb');
+
+// 並列クエリ: 全区画で同じSQLを実行して1つのストリームで読む
+(async () => {
+  const partitions = ['P01', 'P02', 'P03', 'P04'].map((p) =>
+    'dsn=' + p + ';uid=qsecofr;pwd=passw0rd;Database=C7054D00;CCSID=1208;');
+  const federation = new omnidb.Federation(partitions, {max: 2});
+
+  // 連結: 区画の順に全行
+  const all = await federation.query('SELECT CUSNUM, LSTNAM FROM QIWS.QCUSTCDT').toArray();
+  console.log('// concat', all.length);
+
+  // キー順のマージ: 各区画がORDER BYで並べた結果を1つの順序に
+  const ordered = federation.query('SELECT CUSNUM, BALDUE FROM QIWS.QCUSTCDT ORDER BY BALDUE DESC', {
+    merge: 'ordered',
+    orderBy: [{column: 'BALDUE', desc: true}],
+  });
+  for await (const row of ordered) {
+    console.log(row);
+  }
+
+  // 部分集計の結合: 区画ごとの集計を州ごとに合算
+  const totals = await federation.query(
+    'SELECT STATE, COUNT(*) AS CNT, SUM(BALDUE) AS TOTAL, MAX(CDTLMT) AS MAXLMT FROM QIWS.QCUSTCDT GROUP BY STATE', {
+      merge: 'aggregate',
+      groupBy: ['STATE'],
+      aggregates: {CNT: 'count', TOTAL: 'sum', MAXLMT: 'max'},
+    }).toArray();
+  console.log('// aggregate', totals);
+  console.log('// stats', federation.stats());
+
+  federation.close();
+})();
@@ -8,9 +8,9 @@ class OmniDb {
       resolve(JSON.parse(this._native.drivers()));
     });
   }
-  connect(connectionString) {
+  connect(connectionString, options) {
     return new Promise((resolve) => {
-      resolve(this._native.connect(connectionString));
+      resolve(this._native.connect(connectionString, options));
     });
   }
   disconnect() {
@@ -33,14 +33,553 @@ class OmniDb {
       resolve(JSON.parse(this._native.query(queryString, options)));
     });
   }
-  execute(sql) {
+  execute(sql, options) {
     return new Promise((resolve) => {
-      resolve(JSON.parse(this._native.execute(sql)));
+      resolve(JSON.parse(this._native.execute(sql, options)));
     });
   }
+  executeBulk(sql, columns, options) {
+    return new Promise((resolve) => {
+      resolve(JSON.parse(this._native.executeBulk(sql, columns, options)));
+    });
+  }
+  call(procedure, params, options) {
+    return new Promise((resolve) => {
+      resolve(JSON.parse(this._native.call(procedure, params, options)));
+    });
+  }
+  callBulk(procedure, columns, options) {
+    return new Promise((resolve) => {
+      resolve(JSON.parse(this._native.callBulk(procedure, columns, options)));
+    });
+  }
+  begin() {
+    return new Promise((resolve) => {
+      resolve(this._native.begin());
+    });
+  }
+  commit() {
+    return new Promise((resolve) => {
+      resolve(this._native.commit());
+    });
+  }
+  rollback() {
+    return new Promise((resolve) => {
+      resolve(this._native.rollback());
+    });
+  }
+  groupCommit(options) {
+    return new OmniGroupCommit(this, options);
+  }
+  openCatalogCache(path) {
+    return new Promise((resolve) => {
+      resolve(this._native.openCatalogCache(path));
+    });
+  }
+  refreshCatalogCache(condition, options) {
+    return new Promise((resolve) => {
+      resolve(JSON.parse(this._native.refreshCatalogCache(condition, options)));
+    });
+  }
+  cachedTables(condition) {
+    return new Promise((resolve) => {
+      resolve(JSON.parse(this._native.cachedTables(condition)));
+    });
+  }
+  cachedColumns(condition) {
+    return new Promise((resolve) => {
+      resolve(JSON.parse(this._native.cachedColumns(condition)));
+    });
+  }
+  searchCatalog(query, options) {
+    return JSON.parse(this._native.searchCatalog(query, options));
+  }
+  catalogCacheInfo() {
+    return JSON.parse(this._native.catalogCacheInfo());
+  }
   setLocale(category, locale) {
     return this._native.setLocale(category, locale);
   }
 }
 
+// グループコミット: 複数の論理的な作業単位のコミットを1回のSQLEndTranにまとめる
+//
+// 最初のコミット要求からmaxDelayMs経過するかmaxUnits件たまると受付を締め切り、
+// 実行中の作業単位が全て終わった時点で1回だけコミットします。締め切り中の
+// begin()はコミット後まで待ちます。
+// ※ロールバックは物理トランザクションを破棄するため、同じグループの
+//   他の作業単位も失敗になります。失敗になった作業単位が全て終わるまで
+//   begin()は待ち、それまでの書き込みはもう一度ロールバックして破棄します
+//   (作業単位のexecute等も失敗になります)
+class OmniGroupCommit {
+  constructor(db, options) {
+    options = options || {};
+    this._db = db;
+    this._maxDelayMs = options.maxDelayMs !== undefined ? options.maxDelayMs : 5;
+    this._maxUnits = options.maxUnits !== undefined ? options.maxUnits : 100;
+    this._active = false;
+    this._generation = 0;
+    this._open = 0;
+    this._pending = [];
+    this._closed = false;
+    this._discarding = false;
+    this._timer = null;
+    this._waiters = [];
+    this._stats = {commits: 0, units: 0, rollbacks: 0};
+  }
+  begin() {
+    if (this._closed || this._discarding) {
+      return new Promise((resolve) => this._waiters.push(resolve)).then(() => this.begin());
+    }
+    try {
+      if (!this._active) {
+        this._db._native.begin();
+        this._active = true;
+      }
+    } catch (e) {
+      return Promise.reject(e);
+    }
+    this._open++;
+    return Promise.resolve(new OmniUnitOfWork(this, this._generation));
+  }
+  stats() {
+    return Object.assign({open: this._open, pending: this._pending.length}, this._stats);
+  }
+  _commit(unit) {
+    this._open--;
+    if (unit._generation != this._generation) {
+      this._settle();
+      return Promise.reject(new Error('同じグループの作業単位がロールバックしたため破棄されました'));
+    }
+    return new Promise((resolve, reject) => {
+      this._pending.push({resolve: resolve, reject: reject});
+      if (!this._timer) {
+        this._timer = setTimeout(() => this._close(), this._maxDelayMs);
+      }
+      if (this._pending.length >= this._maxUnits) {
+        this._close();
+      }
+      this._settle();
+    });
+  }
+  _rollback(unit) {
+    this._open--;
+    if (unit._generation != this._generation) {
+      this._settle();
+      return Promise.resolve(true);
+    }
+    const pending = this._pending;
+    this._pending = [];
+    this._generation++;
+    this._stats.rollbacks++;
+    // 締め切りを取り消す(残りの作業単位は全て破棄になる)
+    clearTimeout(this._timer);
+    this._timer = null;
+    this._closed = false;
+    try {
+      this._db._native.rollback();
+      this._active = false;
+      // 実行中の作業単位が自動コミットにならないように開始し直し、
+      // 全て終わるまで新しい作業単位は受け付けない(終われば破棄する)
+      if (this._open > 0) {
+        this._discarding = true;
+        this._db._native.begin();
+        this._active = true;
+      }
+    } catch (e) {
+      pending.forEach((p) => p.reject(e));
+      this._settle();
+      return Promise.reject(e);
+    }
+    const error = new Error('同じグループの作業単位がロールバックしたため破棄されました');
+    pending.forEach((p) => p.reject(error));
+    this._settle();
+    return Promise.resolve(true);
+  }
+  _close() {
+    clearTimeout(this._timer);
+    this._timer = null;
+    this._closed = true;
+    this._settle();
+  }
+  _settle() {
+    // ロールバック後に残っていた作業単位が全て終わったら、その分も破棄
+    if (this._open == 0 && this._pending.length == 0 && (this._active || this._discarding)) {
+      if (this._active) {
+        try {
+          this._db._native.rollback();
+        } catch (ignore) {
+          // 破棄するだけ
+        }
+        this._active = false;
+      }
+      if (this._discarding) {
+        this._discarding = false;
+        this._wake();
+      }
+    }
+    // 締め切り前、または実行中の作業単位が残っている間は待つ
+    if (!this._closed || this._open > 0) {
+      return;
+    }
+    const pending = this._pending;
+    this._pending = [];
+    this._closed = false;
+    try {
+      if (this._active) {
+        this._db._native.commit();
+        this._active = false;
+        this._stats.commits++;
+      }
+      this._stats.units += pending.length;
+      pending.forEach((p) => p.resolve(true));
+    } catch (e) {
+      try {
+        this._db._native.rollback();
+      } catch (ignore) {
+        // コミットの失敗を返す
+      }
+      this._active = false;
+      this._generation++;
+      pending.forEach((p) => p.reject(e));
+    }
+    this._wake();
+  }
+  _wake() {
+    const waiters = this._waiters;
+    this._waiters = [];
+    waiters.forEach((resolve) => resolve());
+  }
+}
+
+// グループコミットの作業単位
+class OmniUnitOfWork {
+  constructor(group, generation) {
+    this._group = group;
+    this._generation = generation;
+    this._done = false;
+  }
+  execute(sql, options) {
+    return this._check() || this._group._db.execute(sql, options);
+  }
+  query(queryString, options) {
+    return this._check() || this._group._db.query(queryString, options);
+  }
+  executeBulk(sql, columns, options) {
+    return this._check() || this._group._db.executeBulk(sql, columns, options);
+  }
+  call(procedure, params, options) {
+    return this._check() || this._group._db.call(procedure, params, options);
+  }
+  // 終了した・破棄された作業単位ではSQLを実行しない(実行できればnull)
+  _check() {
+    if (this._done) {
+      return Promise.reject(new Error('作業単位は終了しています'));
+    }
+    if (this._generation != this._group._generation) {
+      return Promise.reject(new Error('同じグループの作業単位がロールバックしたため破棄されました'));
+    }
+    return null;
+  }
+  commit() {
+    if (this._done) {
+      return Promise.reject(new Error('作業単位は終了しています'));
+    }
+    this._done = true;
+    return this._group._commit(this);
+  }
+  rollback() {
+    if (this._done) {
+      return Promise.reject(new Error('作業単位は終了しています'));
+    }
+    this._done = true;
+    return this._group._rollback(this);
+  }
+}
+
+class OmniPool {
+  constructor(connectionString, options) {
+    this._native = new OmniDbNative.pool(connectionString, options || {});
+  }
+  execute(sql, options) {
+    return this._native.execute(sql, options || {}).then((result) => JSON.parse(result));
+  }
+  tables(condition, options) {
+    return this._native.tables(condition || {}, options || {}).then((result) => JSON.parse(result));
+  }
+  columns(condition, options) {
+    return this._native.columns(condition || {}, options || {}).then((result) => JSON.parse(result));
+  }
+  query(queryString, options) {
+    return this._native.query(queryString, options || {}).then((result) => JSON.parse(result));
+  }
+  describeAll(statements, options, onResult, onProgress) {
+    const results = onResult ? null : new Array(statements.length);
+    const emit = onResult
+      ? (index, error, result) => onResult(index, error, result === null ? null : JSON.parse(result))
+      : (index, error, result) => { results[index] = error ? { error: error } : JSON.parse(result); };
+    const progress = onProgress ? (p) => onProgress(JSON.parse(p)) : undefined;
+    return this._native.describeAll(statements, options || {}, emit, progress).then((summary) => {
+      summary = JSON.parse(summary);
+      if (results) {
+        summary.results = results;
+      }
+      return summary;
+    });
+  }
+  executeBulk(sql, columns, options) {
+    return this._native.executeBulk(sql, columns, options || {}).then((result) => JSON.parse(result));
+  }
+  warmup(options) {
+    return this._native.warmup(options || {}).then((result) => JSON.parse(result));
+  }
+  // テーブルを区画に分けて並列に読む(perPartitionでは区画ごとのストリームの配列)
+  scan(table, options) {
+    options = options || {};
+    const cursors = this._native.scan(table, options);
+    if (Array.isArray(cursors)) {
+      return cursors.map((cursor) => new OmniStream(this._native, cursor, options.fetchRows));
+    }
+    return new OmniStream(this._native, cursors, options.fetchRows);
+  }
+  // SELECTの全行を取得してから読む(メモリ予算を超えた分は一時ファイルに書き出す)
+  materialize(sql, options) {
+    options = options || {};
+    return new OmniStream(this._native, this._native.materialize(sql, options), options.fetchRows);
+  }
+  // キーセットページング(前のページの最後のキーより後を読む)
+  paginate(sql, options) {
+    return new OmniPager(this._native, this._native.paginate(sql, options || {}));
+  }
+  coalescer(options) {
+    return new OmniCoalescer(this, options);
+  }
+  stats() {
+    return JSON.parse(this._native.stats());
+  }
+  close() {
+    return this._native.close();
+  }
+}
+
+// キーセットページング(next()でページ、for await...ofで全ページ)
+class OmniPager {
+  constructor(native, pager) {
+    this._native = native;
+    this._pager = pager;
+    this.done = false;
+  }
+  next() {
+    return this._native.page(this._pager).then((result) => {
+      result = JSON.parse(result);
+      this.done = result.done;
+      return result;
+    });
+  }
+  close() {
+    return this._native.closePager(this._pager);
+  }
+  async *[Symbol.asyncIterator]() {
+    try {
+      while (!this.done) {
+        const page = await this.next();
+        if (page.rows.length > 0) {
+          yield page;
+        }
+      }
+    } finally {
+      this.close();
+    }
+  }
+}
+
+// 同じSQLの1行ずつの実行を短い時間まとめて配列パラメータで実行する
+class OmniCoalescer {
+  constructor(pool, options) {
+    options = options || {};
+    this._pool = pool;
+    this._windowMs = options.windowMs !== undefined ? options.windowMs : 2;
+    this._maxRows = options.maxRows !== undefined ? options.maxRows : 500;
+    this._queues = new Map();
+  }
+  execute(sql, params) {
+    return new Promise((resolve, reject) => {
+      let queue = this._queues.get(sql);
+      if (!queue) {
+        queue = {rows: [], timer: setTimeout(() => this._flush(sql), this._windowMs)};
+        this._queues.set(sql, queue);
+      }
+      queue.rows.push({params: params || [], resolve: resolve, reject: reject});
+      if (queue.rows.length >= this._maxRows) {
+        this._flush(sql);
+      }
+    });
+  }
+  flush() {
+    for (const sql of Array.from(this._queues.keys())) {
+      this._flush(sql);
+    }
+  }
+  _flush(sql) {
+    const queue = this._queues.get(sql);
+    if (!queue) {
+      return;
+    }
+    this._queues.delete(sql);
+    clearTimeout(queue.timer);
+
+    // パラメータ数の違う行はまとめられない
+    const width = queue.rows[0].params.length;
+    const rows = queue.rows.filter((row) => {
+      if (row.params.length != width) {
+        row.reject(new TypeError('パラメータの数が同じSQLの他の実行と一致しません'));
+        return false;
+      }
+      return true;
+    });
+    const columns = [];
+    for (let c = 0; c < width; c++) {
+      columns.push(rows.map((row) => row.params[c]));
+    }
+    this._pool.executeBulk(sql, columns, {batchSize: rows.length, stopOnError: false}).then((result) => {
+      // 行のエラー(診断レコードの行番号)と、その行を含む失敗したバッチ
+      const rowErrors = new Map();
+      (result.rowErrors || []).forEach((e) => {
+        if (!rowErrors.has(e.row)) {
+          rowErrors.set(e.row, e);
+        }
+      });
+      const batchError = (i) => result.errors.find((e) => i >= e.offset && i < e.offset + e.rows);
+      rows.forEach((row, i) => {
+        const status = result.status[i];
+        const failed = rowErrors.get(i) || batchError(i);
+        // 状態を返さないドライバ(UNUSEDのまま)・診断なしは、バッチが成功していれば成功
+        if (status === OmniDb.PARAM_SUCCESS || status === OmniDb.PARAM_SUCCESS_WITH_INFO ||
+          ((status === OmniDb.PARAM_DIAG_UNAVAILABLE || status === OmniDb.PARAM_UNUSED) && !failed)) {
+          row.resolve({status: status, coalesced: rows.length});
+        } else {
+          let message = failed ? failed.message : '行の実行に失敗しました';
+          if (status === OmniDb.PARAM_UNUSED) {
+            message = 'バッチの失敗により実行されませんでした: ' + message;
+          }
+          const error = new Error(message);
+          error.status = status;
+          if (failed) {
+            error.sqlState = failed.sqlState;
+          }
+          row.reject(error);
+        }
+      });
+    }, (error) => {
+      rows.forEach((row) => row.reject(error));
+    });
+  }
+}
+
+class OmniLoader {
+  constructor(connectionString, sql, options) {
+    this._native = new OmniDbNative.loader(connectionString, sql, options || {});
+  }
+  add(columns) {
+    return this._native.add(columns);
+  }
+  finish() {
+    return this._native.finish().then((summary) => JSON.parse(summary));
+  }
+  stats() {
+    return JSON.parse(this._native.stats());
+  }
+  close() {
+    return this._native.close();
+  }
+}
+
+// 複数接続先への並列クエリ(結果はネイティブでマージして1つのストリーム)
+class OmniFederation {
+  constructor(connectionStrings, options) {
+    this._native = new OmniDbNative.federation(connectionStrings, options || {});
+  }
+  query(sql, options) {
+    options = options || {};
+    return new OmniStream(this._native, this._native.query(sql, options), options.fetchRows);
+  }
+  stats() {
+    return JSON.parse(this._native.stats());
+  }
+  close() {
+    return this._native.close();
+  }
+}
+
+// カーソルから順に行を読むストリーム(for await...ofで1行ずつ)
+class OmniStream {
+  constructor(native, cursor, fetchRows) {
+    this._native = native;
+    this._cursor = cursor;
+    this._fetchRows = fetchRows || 1000;
+    this._rows = [];
+    this._done = false;
+    this.columns = null;
+  }
+  // 次の行のまとまり(終わりはnull)
+  async nextBatch() {
+    if (this._rows.length > 0) {
+      const rows = this._rows;
+      this._rows = [];
+      return rows;
+    }
+    while (!this._done) {
+      const result = JSON.parse(await this._native.fetch(this._cursor, this._fetchRows));
+      this.columns = result.columns;
+      this._done = result.done;
+      if (result.rows.length > 0) {
+        return result.rows;
+      }
+    }
+    this.close();
+    return null;
+  }
+  async toArray() {
+    const rows = [];
+    for (let batch = await this.nextBatch(); batch; batch = await this.nextBatch()) {
+      rows.push(...batch);
+    }
+    return rows;
+  }
+  close() {
+    this._done = true;
+    return this._native.closeCursor(this._cursor);
+  }
+  async *[Symbol.asyncIterator]() {
+    try {
+      for (let batch = await this.nextBatch(); batch; batch = await this.nextBatch()) {
+        for (const row of batch) {
+          yield row;
+        }
+      }
+    } finally {
+      this.close();
+    }
+  }
+}
+
+// executeBulkの行ごとの状態(SQL_ATTR_PARAM_STATUS_PTR)
+OmniDb.PARAM_SUCCESS = 0;
+OmniDb.PARAM_DIAG_UNAVAILABLE = 1;
+OmniDb.PARAM_ERROR = 5;
+OmniDb.PARAM_SUCCESS_WITH_INFO = 6;
+OmniDb.PARAM_UNUSED = 7;
+
+OmniDb.Pool = OmniPool;
+OmniDb.Coalescer = OmniCoalescer;
+OmniDb.Loader = OmniLoader;
+OmniDb.Federation = OmniFederation;
+
+// 行セット領域のプール(文・接続をまたいで共有)
+OmniDb.bufferStats = () => JSON.parse(OmniDbNative.bufferStats());
+OmniDb.trimBuffers = (idle) => OmniDbNative.trimBuffers(idle);
+OmniDb.setBufferLimits = (options) => OmniDbNative.setBufferLimits(options || {});
+// 全行の保管(pool.materialize)と結果の全行取得のメモリ予算(プロセス全体)と書き出しの統計
+OmniDb.spillStats = () => JSON.parse(OmniDbNative.spillStats());
+OmniDb.setMemoryBudget = (bytes) => OmniDbNative.setMemoryBudget(bytes);
 module.exports = OmniDb;
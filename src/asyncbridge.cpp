@@ -0,0 +1,89 @@
+﻿#include "asyncbridge.h"
+
+
+/**
+* 完了処理の呼び出し(JSスレッド)
+*/
+static void CallCompletion(Napi::Env env, Napi::Function, AsyncBridge::Completion *completion)
+{
+  if((napi_env)env != nullptr) {
+    (*completion)(env);
+  }
+  delete completion;
+}
+
+
+/**
+* コンストラクタ
+*/
+AsyncBridge::AsyncBridge()
+{
+  m_owner = NULL;
+  m_pending = 0;
+  m_initialized = false;
+}
+
+
+/**
+* 初期化
+*
+* @param[in] env Node.js環境
+* @param[in] owner 処理中に参照を保持するJSオブジェクト
+* @param[in] name リソース名
+*/
+void AsyncBridge::Init(Napi::Env env, Napi::Reference<Napi::Object> *owner, const char *name)
+{
+  m_owner = owner;
+  m_tsfn = Napi::ThreadSafeFunction::New(
+    env, Napi::Function::New(env, [](const Napi::CallbackInfo &) {}), name, 0, 1);
+  // 待ちが無い間はUnrefしてプロセスの終了を妨げない
+  m_tsfn.Unref(env);
+  m_initialized = true;
+}
+
+
+/**
+* 通知先の解放
+*/
+void AsyncBridge::Release()
+{
+  if(m_initialized) {
+    m_tsfn.Release();
+    m_initialized = false;
+  }
+}
+
+
+/**
+* ワーカースレッドから完了処理をJSスレッドに送ります
+*
+* @param[in] completion 完了処理
+*/
+void AsyncBridge::Post(const Completion &completion)
+{
+  m_tsfn.BlockingCall(new Completion(completion), CallCompletion);
+}
+
+
+/**
+* 処理開始(JSスレッド)
+*/
+void AsyncBridge::BeginWork(Napi::Env env)
+{
+  if(m_pending++ == 0) {
+    m_tsfn.Ref(env);
+    m_owner->Ref();
+  }
+}
+
+
+/**
+* 処理終了(JSスレッド)
+*/
+void AsyncBridge::EndWork(Napi::Env env)
+{
+  if(--m_pending == 0) {
+    m_tsfn.Unref(env);
+    m_owner->Unref();
+  }
+}
@@ -0,0 +1,44 @@
+﻿#ifndef _ASYNCBRIDGE_H
+#define _ASYNCBRIDGE_H
+//
+// ワーカースレッド→JSスレッドの完了通知
+//
+// ThreadSafeFunction経由で完了処理をJSスレッドで実行します。処理中は
+// 通知先とJSオブジェクトを参照して、GCとプロセスの終了を抑止します。
+//
+#include <napi.h>
+
+#include <functional>
+
+class AsyncBridge {
+public:
+  // JSスレッドで実行する完了処理
+  typedef std::function<void(Napi::Env)> Completion;
+
+  AsyncBridge();
+
+  // 初期化(ownerは処理中に参照を保持するJSオブジェクト)
+  void Init(Napi::Env env, Napi::Reference<Napi::Object> *owner, const char *name);
+  // 通知先の解放(ワーカースレッド停止後に呼ぶ)
+  void Release();
+
+  // ワーカースレッドから完了処理をJSスレッドに送ります
+  void Post(const Completion &completion);
+  // 処理の開始・終了(JSスレッド)
+  void BeginWork(Napi::Env env);
+  void EndWork(Napi::Env env);
+
+  // 実行中の処理数(JSスレッドのみ)
+  size_t Pending() const { return m_pending; }
+
+private:
+  AsyncBridge(const AsyncBridge &);
+  AsyncBridge &operator=(const AsyncBridge &);
+
+  Napi::ThreadSafeFunction m_tsfn;
+  Napi::Reference<Napi::Object> *m_owner;
+  size_t m_pending;
+  bool m_initialized;
+};
+
+#endif
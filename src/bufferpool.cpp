@@ -0,0 +1,294 @@
+﻿#include "bufferpool.h"
+
+#include <algorithm>
+#include <thread>
+#include <stdlib.h>
+
+// 解放用のスレッドの最短の間隔(ミリ秒)
+#define BUFFER_MIN_TRIM_INTERVAL 100
+
+
+/**
+* 大きさの区分
+*
+* @param[in] bytes 大きさ
+* @return size_t 区分(BUFFER_CLASSESは使い回さない大きさ)
+*/
+static size_t SizeClass(size_t bytes)
+{
+  size_t size = BUFFER_MIN_CLASS;
+  for(size_t cls = 0; cls < BUFFER_CLASSES; cls++, size <<= 1) {
+    if(bytes <= size) {
+      return cls;
+    }
+  }
+  return BUFFER_CLASSES;
+}
+
+
+/**
+* プロセスで共有するプール
+*
+* 終了時に他のスレッドが返却しても壊れないように破棄しません。
+*/
+BufferPool &BufferPool::Shared()
+{
+  static BufferPool *pool = new BufferPool();
+  return *pool;
+}
+
+
+/**
+* コンストラクタ
+*/
+BufferPool::BufferPool()
+{
+  for(size_t cls = 0; cls < BUFFER_CLASSES; cls++) {
+    m_inUse[cls] = 0;
+    m_highWater[cls] = 0;
+  }
+  m_cachedBytes = 0;
+  m_inUseBytes = 0;
+  m_highWaterBytes = 0;
+  m_maxCachedBytes = BUFFER_DEFAULT_MAX_CACHED;
+  m_idleMs = BUFFER_DEFAULT_IDLE;
+  m_lastTrim = std::chrono::steady_clock::now();
+  m_trimming = false;
+  m_allocated = 0;
+  m_reused = 0;
+  m_trimmed = 0;
+}
+
+
+/**
+* デストラクタ
+*/
+BufferPool::~BufferPool()
+{
+  for(size_t cls = 0; cls < BUFFER_CLASSES; cls++) {
+    for(size_t i = 0; i < m_free[cls].size(); i++) {
+      Free(m_free[cls][i]);
+    }
+  }
+}
+
+
+/**
+* 領域を解放します
+*/
+void BufferPool::Free(Block &block)
+{
+  free(block.raw);
+  block.raw = NULL;
+  block.data = NULL;
+}
+
+
+/**
+* bytes以上の領域を借ります
+*
+* 区分の大きさで確保するので、返却後は同じ区分の要求に使い回せます。
+*
+* @param[in] bytes 大きさ
+* @return Block 領域(確保できなければdataがNULL)
+*/
+BufferPool::Block BufferPool::Acquire(size_t bytes)
+{
+  size_t cls = SizeClass(bytes);
+  Block block;
+  bool allocated = false;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(cls < BUFFER_CLASSES && !m_free[cls].empty()) {
+      // 最近返却された領域(キャッシュに残っている可能性が高い)
+      block = m_free[cls].back();
+      m_free[cls].pop_back();
+      m_cachedBytes -= block.size;
+      m_reused++;
+    } else {
+      block.raw = NULL;
+    }
+    if(cls < BUFFER_CLASSES) {
+      m_inUse[cls]++;
+      m_highWater[cls] = std::max(m_highWater[cls], m_inUse[cls]);
+    }
+  }
+
+  if(!block.raw) {
+    block.cls = cls;
+    block.size = cls < BUFFER_CLASSES ? ((size_t)BUFFER_MIN_CLASS << cls) : bytes;
+    block.raw = (char *)malloc(block.size + BUFFER_ALIGN);
+    if(!block.raw) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(cls < BUFFER_CLASSES) {
+        m_inUse[cls]--;
+      }
+      block.data = NULL;
+      block.size = 0;
+      return block;
+    }
+    block.data = (char *)(((uintptr_t)block.raw + BUFFER_ALIGN - 1) & ~(uintptr_t)(BUFFER_ALIGN - 1));
+    allocated = true;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(allocated) {
+    m_allocated++;
+  }
+  m_inUseBytes += block.size;
+  m_highWaterBytes = std::max(m_highWaterBytes, m_inUseBytes);
+  return block;
+}
+
+
+/**
+* 領域を返します
+*
+* 保持する合計が上限を超える場合・使い回さない大きさの場合は解放します。
+* 前回から未使用時間が過ぎていれば使われていない領域も解放します。
+*
+* @param[in,out] block 領域
+*/
+void BufferPool::Release(Block &block)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_inUseBytes -= block.size;
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if(block.cls < BUFFER_CLASSES) {
+    m_inUse[block.cls]--;
+  }
+  if(block.cls >= BUFFER_CLASSES || m_cachedBytes + block.size > m_maxCachedBytes) {
+    Free(block);
+    m_trimmed++;
+  } else {
+    block.lastUsed = now;
+    m_free[block.cls].push_back(block);
+    m_cachedBytes += block.size;
+    StartTrimmer();
+  }
+
+  if(now - m_lastTrim >= std::chrono::milliseconds(m_idleMs)) {
+    TrimLocked(now, m_idleMs);
+  }
+}
+
+
+/**
+* idleMs以上使われていない領域を解放します
+*
+* @param[in] idleMs 未使用時間(ミリ秒、0は保持している全て)
+* @return size_t 解放したバイト数
+*/
+size_t BufferPool::Trim(uint32_t idleMs)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return TrimLocked(std::chrono::steady_clock::now(), idleMs);
+}
+
+
+/**
+* 未使用の領域を解放します(ロック中)
+*/
+size_t BufferPool::TrimLocked(std::chrono::steady_clock::time_point now, uint32_t idleMs)
+{
+  m_lastTrim = now;
+  size_t freed = 0;
+  for(size_t cls = 0; cls < BUFFER_CLASSES; cls++) {
+    std::vector<Block> &list = m_free[cls];
+    // 古い順に並んでいる
+    size_t keep = 0;
+    while(keep < list.size() && now - list[keep].lastUsed >= std::chrono::milliseconds(idleMs)) {
+      keep++;
+    }
+    for(size_t i = 0; i < keep; i++) {
+      freed += list[i].size;
+      Free(list[i]);
+      m_trimmed++;
+    }
+    list.erase(list.begin(), list.begin() + keep);
+  }
+  m_cachedBytes -= freed;
+  return freed;
+}
+
+
+/**
+* 解放用のスレッドを開始します(ロック中)
+*
+* プールはプロセスの終了まで破棄しないので、スレッドは切り離します。
+*/
+void BufferPool::StartTrimmer()
+{
+  if(m_trimming || m_cachedBytes == 0) {
+    return;
+  }
+  m_trimming = true;
+  std::thread(&BufferPool::TrimLoop, this).detach();
+}
+
+
+/**
+* 解放用のスレッド
+*
+* 未使用時間ごとに使われていない領域を解放し、保持している領域が無くなれば
+* 終了します(次に保持した時に再び開始)。
+*/
+void BufferPool::TrimLoop()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for(;;) {
+    uint32_t interval = std::max(m_idleMs, (uint32_t)BUFFER_MIN_TRIM_INTERVAL);
+    m_trimCv.wait_for(lock, std::chrono::milliseconds(interval));
+    TrimLocked(std::chrono::steady_clock::now(), m_idleMs);
+    if(m_cachedBytes == 0) {
+      m_trimming = false;
+      return;
+    }
+  }
+}
+
+
+/**
+* 保持する合計の上限と解放するまでの未使用時間を設定します
+*
+* @param[in] maxCachedBytes 保持する合計の上限(バイト)
+* @param[in] idleMs 解放するまでの未使用時間(ミリ秒)
+*/
+void BufferPool::SetLimits(size_t maxCachedBytes, uint32_t idleMs)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_maxCachedBytes = maxCachedBytes;
+  m_idleMs = idleMs;
+  // 解放用のスレッドを新しい未使用時間で待たせ直す
+  m_trimCv.notify_all();
+}
+
+
+/**
+* 統計
+*/
+BufferPoolStats BufferPool::Stats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  BufferPoolStats stats;
+  stats.cachedBytes = m_cachedBytes;
+  stats.inUseBytes = m_inUseBytes;
+  stats.highWaterBytes = m_highWaterBytes;
+  stats.allocated = m_allocated;
+  stats.reused = m_reused;
+  stats.trimmed = m_trimmed;
+  stats.maxCachedBytes = m_maxCachedBytes;
+  stats.idleMs = m_idleMs;
+  for(size_t cls = 0; cls < BUFFER_CLASSES; cls++) {
+    if(m_highWater[cls] == 0) {
+      continue;
+    }
+    BufferClassStats c;
+    c.size = (size_t)BUFFER_MIN_CLASS << cls;
+    c.cached = m_free[cls].size();
+    c.inUse = m_inUse[cls];
+    c.highWater = m_highWater[cls];
+    stats.classes.push_back(c);
+  }
+  return stats;
+}
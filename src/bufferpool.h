@@ -0,0 +1,156 @@
+﻿#ifndef _BUFFERPOOL_H
+#define _BUFFERPOOL_H
+//
+// 行セット・バインド領域のプール
+//
+// 2のべき乗の大きさの区分ごとに返却された領域を保持し、文・接続をまたいで
+// 使い回します。領域はBUFFER_ALIGNバイト境界に揃えます。保持する合計には
+// 上限があり、一定時間使われていない領域は返却の際と、保持している間だけ
+// 動く解放用のスレッドで解放します(処理が止まったプロセスにも残さない)。
+// napiに依存しません。
+//
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// 領域の境界
+#define BUFFER_ALIGN 64
+// 最小の区分(バイト)
+#define BUFFER_MIN_CLASS 256
+// 区分の数(256バイト〜16MB、超える大きさは使い回さない)
+#define BUFFER_CLASSES 17
+// 既定の保持する合計の上限(バイト)
+#define BUFFER_DEFAULT_MAX_CACHED (64 * 1024 * 1024)
+// 既定の解放するまでの未使用時間(ミリ秒)
+#define BUFFER_DEFAULT_IDLE 30000
+
+// 区分ごとの統計
+struct BufferClassStats {
+  size_t size;
+  // 保持している数
+  size_t cached;
+  // 使用中の数
+  size_t inUse;
+  // 使用中の数の最大
+  size_t highWater;
+};
+
+// 統計
+struct BufferPoolStats {
+  // 保持しているバイト数
+  size_t cachedBytes;
+  // 使用中のバイト数
+  size_t inUseBytes;
+  // 使用中のバイト数の最大
+  size_t highWaterBytes;
+  // 新しく確保した数・使い回した数・解放した数
+  uint64_t allocated;
+  uint64_t reused;
+  uint64_t trimmed;
+  // 保持する合計の上限と解放するまでの未使用時間
+  size_t maxCachedBytes;
+  uint32_t idleMs;
+  std::vector<BufferClassStats> classes;
+};
+
+class BufferPool {
+public:
+  // 領域
+  struct Block {
+    char *raw;
+    char *data;
+    size_t size;
+    // 区分(BUFFER_CLASSESは使い回さない大きさ)
+    size_t cls;
+    std::chrono::steady_clock::time_point lastUsed;
+  };
+
+  // プロセスで共有するプール
+  static BufferPool &Shared();
+
+  BufferPool();
+  ~BufferPool();
+
+  // bytes以上の領域を借ります(失敗はdataがNULL)
+  Block Acquire(size_t bytes);
+  // 領域を返します
+  void Release(Block &block);
+  // idleMs以上使われていない領域を解放します(解放したバイト数)
+  size_t Trim(uint32_t idleMs);
+  // 保持する合計の上限と解放するまでの未使用時間
+  void SetLimits(size_t maxCachedBytes, uint32_t idleMs);
+  // 統計
+  BufferPoolStats Stats();
+
+private:
+  BufferPool(const BufferPool &);
+  BufferPool &operator=(const BufferPool &);
+
+  // 未使用の領域を解放します(ロック中)
+  size_t TrimLocked(std::chrono::steady_clock::time_point now, uint32_t idleMs);
+  // 解放用のスレッドを開始します(ロック中、保持している領域がある場合)
+  void StartTrimmer();
+  // 解放用のスレッド(保持している領域が無くなれば終了)
+  void TrimLoop();
+  static void Free(Block &block);
+
+  std::mutex m_mutex;
+  std::vector<Block> m_free[BUFFER_CLASSES];
+  size_t m_inUse[BUFFER_CLASSES];
+  size_t m_highWater[BUFFER_CLASSES];
+  size_t m_cachedBytes;
+  size_t m_inUseBytes;
+  size_t m_highWaterBytes;
+  size_t m_maxCachedBytes;
+  uint32_t m_idleMs;
+  std::chrono::steady_clock::time_point m_lastTrim;
+  // 解放用のスレッドが動いているか・設定の変更の通知
+  bool m_trimming;
+  std::condition_variable m_trimCv;
+  uint64_t m_allocated;
+  uint64_t m_reused;
+  uint64_t m_trimmed;
+};
+
+//
+// 借りた領域(破棄で返却)
+//
+class BufferLease {
+public:
+  BufferLease() { m_block.data = NULL; m_block.size = 0; }
+  explicit BufferLease(size_t bytes) { m_block.data = NULL; m_block.size = 0; Reset(bytes); }
+  ~BufferLease() { Release(); }
+
+  // bytes以上の領域に替えます(今の領域で足りて大きすぎなければそのまま)
+  char *Reset(size_t bytes)
+  {
+    if(m_block.data && bytes <= m_block.size && bytes * 2 > m_block.size) {
+      return m_block.data;
+    }
+    Release();
+    m_block = BufferPool::Shared().Acquire(bytes);
+    return m_block.data;
+  }
+  // 返却します
+  void Release()
+  {
+    if(m_block.data) {
+      BufferPool::Shared().Release(m_block);
+      m_block.data = NULL;
+      m_block.size = 0;
+    }
+  }
+
+  char *data() const { return m_block.data; }
+  size_t size() const { return m_block.size; }
+
+private:
+  BufferLease(const BufferLease &);
+  BufferLease &operator=(const BufferLease &);
+
+  BufferPool::Block m_block;
+};
+
+#endif
@@ -0,0 +1,288 @@
+﻿#include "bulkexec.h"
+
+#include <algorithm>
+
+
+/**
+* 診断レコードから行ごとのエラーを取得します
+*
+* SQL_DIAG_ROW_NUMBERが分かるレコードだけを、その行のエラーとして追加します。
+*
+* @param[in] stmt 文ハンドル
+* @param[in] offset 先頭行
+* @param[in] rows 行数
+* @param[in,out] result 行のエラーを追加します
+*/
+static void CollectRowErrors(SQLHSTMT stmt, size_t offset, size_t rows, BulkResult &result)
+{
+  SQLLEN numRecs = 0;
+  SQLGetDiagField(SQL_HANDLE_STMT, stmt, 0, SQL_DIAG_NUMBER, &numRecs, 0, 0);
+  SQLTCHAR state[32], odbcmsg[SQL_MAX_MESSAGE_LENGTH];
+  SQLSMALLINT msgLen;
+  SQLINTEGER native;
+  for(SQLSMALLINT recNo = 1; recNo <= numRecs; recNo++) {
+    SQLLEN rowNumber = SQL_NO_ROW_NUMBER;
+    if(!SQL_SUCCEEDED(SQLGetDiagField(
+        SQL_HANDLE_STMT, stmt, recNo, SQL_DIAG_ROW_NUMBER, &rowNumber, SQL_IS_INTEGER, 0))
+      || rowNumber < 1 || (size_t)rowNumber > rows) {
+      continue;
+    }
+    memset(state, 0x00, sizeof(state));
+    if(SQLGetDiagRec(SQL_HANDLE_STMT, stmt, recNo, state, &native,
+        odbcmsg, sizeof(odbcmsg), &msgLen) == SQL_NO_DATA) {
+      break;
+    }
+    BulkRowError e;
+    e.row = offset + (size_t)rowNumber - 1;
+    e.message = _O("[ODBC-ERROR]") + _S2O(odbcmsg) + _O("(API:SQLExecute, STATE:") + _S2O(state)
+      + _O(", NATIVE:") + to_ostring(native) + _O(")");
+    e.sqlState = to_jsonstr(_S2O(state));
+    result.rowErrors.push_back(e);
+  }
+}
+
+
+/**
+* コンストラクタ
+*/
+BulkStatement::BulkStatement()
+{
+  m_paramCount = 0;
+  m_attached = false;
+}
+
+
+/**
+* デストラクタ(借りた文は解放しない)
+*/
+BulkStatement::~BulkStatement()
+{
+  Free();
+}
+
+
+/**
+* SQLを準備します
+*
+* @param[in] hdbc 接続ハンドル
+* @param[in] sql SQL
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool BulkStatement::Prepare(SQLHDBC hdbc, SQLTCHAR *sql, OString &error)
+{
+  SQLRETURN ret;
+
+  Free();
+  m_stmt.reset(StmtAcc::alloc(hdbc));
+  if(!m_stmt) {
+    error = OdbcErrorMessage(_O("SQLAllocHandle"), SQL_ERROR, SQL_HANDLE_DBC, hdbc);
+    return false;
+  }
+  if(!SQL_SUCCEEDED(ret = SQLPrepare(m_stmt.get(), sql, SQL_NTS))) {
+    error = OdbcErrorMessage(_O("SQLPrepare"), ret, SQL_HANDLE_STMT, m_stmt.get());
+    return false;
+  }
+  if(!SQL_SUCCEEDED(ret = SQLNumParams(m_stmt.get(), &m_paramCount))) {
+    error = OdbcErrorMessage(_O("SQLNumParams"), ret, SQL_HANDLE_STMT, m_stmt.get());
+    return false;
+  }
+  return true;
+}
+
+
+/**
+* 準備済みの文を借りて使います
+*
+* 接続プールが接続ごとに覚えている文を使う場合に使います。Freeでは解放せず、
+* パラメータのバインドと状態の領域の指定だけを外します。
+*
+* @param[in] stmt 準備済みの文
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool BulkStatement::Attach(SQLHSTMT stmt, OString &error)
+{
+  SQLRETURN ret;
+
+  Free();
+  m_stmt.reset(stmt);
+  m_attached = true;
+  if(!SQL_SUCCEEDED(ret = SQLNumParams(stmt, &m_paramCount))) {
+    error = OdbcErrorMessage(_O("SQLNumParams"), ret, SQL_HANDLE_STMT, stmt);
+    return false;
+  }
+  return true;
+}
+
+
+/**
+* 文の解放
+*
+* 借りた文は解放せず、次に使う人のためにパラメータのバインドと
+* 状態の領域(このオブジェクトが解放する領域)の指定を外します。
+*/
+void BulkStatement::Free()
+{
+  if(m_attached) {
+    SQLHSTMT stmt = m_stmt.release();
+    SQLFreeStmt(stmt, SQL_RESET_PARAMS);
+    SQLSetStmtAttr(stmt, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)1, 0);
+    SQLSetStmtAttr(stmt, SQL_ATTR_PARAM_STATUS_PTR, NULL, 0);
+    SQLSetStmtAttr(stmt, SQL_ATTR_PARAMS_PROCESSED_PTR, NULL, 0);
+    m_attached = false;
+  }
+  m_stmt.reset();
+  m_paramCount = 0;
+}
+
+
+/**
+* パラメータの型を取得します
+*
+* @param[in] index パラメータ番号(1～)
+* @param[out] sqlType SQLの型
+* @param[out] columnSize 桁数
+* @param[out] decimalDigits 小数部桁数
+* @return bool 成否(SQLDescribeParam未対応のドライバはfalse)
+*/
+bool BulkStatement::DescribeParam(
+  SQLUSMALLINT index, SQLSMALLINT &sqlType, SQLULEN &columnSize, SQLSMALLINT &decimalDigits)
+{
+  SQLSMALLINT nullable = 0;
+  return SQL_SUCCEEDED(
+    SQLDescribeParam(m_stmt.get(), index, &sqlType, &columnSize, &decimalDigits, &nullable));
+}
+
+
+/**
+* 全パラメータの型を取得します
+*
+* @param[out] types パラメータの型(パラメータ数分)
+*/
+void BulkStatement::DescribeParams(std::vector<BulkParamType> &types)
+{
+  types.resize(m_paramCount);
+  for(SQLSMALLINT p = 0; p < m_paramCount; p++) {
+    BulkParamType &t = types[p];
+    t.sqlType = 0;
+    t.columnSize = 0;
+    t.decimalDigits = 0;
+    t.described = DescribeParam((SQLUSMALLINT)(p + 1), t.sqlType, t.columnSize, t.decimalDigits);
+  }
+}
+
+
+/**
+* offset行目からrows行を1回のSQLExecuteで実行します
+*
+* @param[in] columns 列ごとのパラメータ配列
+* @param[in] offset 先頭行
+* @param[in] rows 行数
+* @param[out] status 行ごとの状態(rows要素)
+* @param[in,out] result 実行回数・処理行数・更新行数を加算します
+* @param[out] error エラーメッセージ
+* @param[out] sqlState SQLSTATE
+* @return bool 成否
+*/
+bool BulkStatement::Execute(
+  const std::vector<BulkColumn> &columns, size_t offset, size_t rows,
+  SQLUSMALLINT *status, BulkResult &result, OString &error, std::string &sqlState)
+{
+  SQLRETURN ret;
+  SQLHSTMT stmt = m_stmt.get();
+  SQLULEN processed = 0;
+
+  if(columns.size() != (size_t)m_paramCount) {
+    error = _O("パラメータの数(") + to_ostring(m_paramCount) + _O(")と列の数(")
+      + to_ostring(columns.size()) + _O(")が一致しません");
+    return false;
+  }
+
+  // ドライバが処理しなかった行はUNUSEDのまま残る
+  std::fill(status, status + rows, (SQLUSMALLINT)SQL_PARAM_UNUSED);
+
+  SQLSetStmtAttr(stmt, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER)SQL_PARAM_BIND_BY_COLUMN, 0);
+  SQLSetStmtAttr(stmt, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)(SQLULEN)rows, 0);
+  SQLSetStmtAttr(stmt, SQL_ATTR_PARAM_STATUS_PTR, status, 0);
+  SQLSetStmtAttr(stmt, SQL_ATTR_PARAMS_PROCESSED_PTR, &processed, 0);
+
+  //
+  // 列ごとに先頭行の位置でバインド
+  // ※列によって1行の幅が異なるのでSQL_ATTR_PARAM_BIND_OFFSET_PTRは使えない
+  //
+  for(size_t c = 0; c < columns.size(); c++) {
+    const BulkColumn &col = columns[c];
+    ret = SQLBindParameter(
+      stmt, (SQLUSMALLINT)(c + 1), SQL_PARAM_INPUT, col.cType, col.sqlType,
+      col.columnSize, col.decimalDigits,
+      (SQLPOINTER)(col.data + offset * col.width), col.width,
+      col.indicators ? col.indicators + offset : NULL);
+    if(!SQL_SUCCEEDED(ret)) {
+      error = OdbcErrorMessage(_O("SQLBindParameter"), ret, SQL_HANDLE_STMT, stmt);
+      sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt);
+      return false;
+    }
+  }
+
+  ret = SQLExecute(stmt);
+  result.batches++;
+  result.processed += processed;
+
+  // 途中で失敗しても処理済みの行の更新数は返す
+  SQLLEN count = 0;
+  if(SQL_SUCCEEDED(SQLRowCount(stmt, &count)) && count > 0) {
+    result.affected += count;
+  }
+
+  // 一部の行だけ失敗した場合はSQL_SUCCESS_WITH_INFOのこともある
+  bool failed = !SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA;
+  if(failed || (ret == SQL_SUCCESS_WITH_INFO
+      && std::find(status, status + rows, (SQLUSMALLINT)SQL_PARAM_ERROR) != status + rows)) {
+    CollectRowErrors(stmt, offset, rows, result);
+  }
+  if(failed) {
+    error = OdbcErrorMessage(_O("SQLExecute"), ret, SQL_HANDLE_STMT, stmt);
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt);
+    SQLFreeStmt(stmt, SQL_CLOSE);
+    return false;
+  }
+  SQLFreeStmt(stmt, SQL_CLOSE);
+  return true;
+}
+
+
+/**
+* 全行をbatchSize行ずつ実行します
+*
+* @param[in] columns 列ごとのパラメータ配列
+* @param[in] rows 行数
+* @param[in] batchSize 1回に実行する行数
+* @param[in] stopOnError 失敗したバッチで中止するか
+* @param[out] result 結果
+* @return bool 全バッチが成功したか
+*/
+bool BulkStatement::ExecuteAll(
+  const std::vector<BulkColumn> &columns, size_t rows, size_t batchSize, bool stopOnError,
+  BulkResult &result)
+{
+  if(batchSize == 0) {
+    batchSize = 1;
+  }
+  result.rows = rows;
+  result.status.assign(rows, (SQLUSMALLINT)SQL_PARAM_UNUSED);
+
+  for(size_t offset = 0; offset < rows; offset += batchSize) {
+    size_t n = std::min(batchSize, rows - offset);
+    BulkBatchError batchError;
+    if(!Execute(columns, offset, n, &result.status[offset], result, batchError.message, batchError.sqlState)) {
+      batchError.offset = offset;
+      batchError.rows = n;
+      result.errors.push_back(batchError);
+      if(stopOnError) {
+        return false;
+      }
+    }
+  }
+  return result.errors.empty();
+}
@@ -0,0 +1,148 @@
+﻿#ifndef _BULKEXEC_H
+#define _BULKEXEC_H
+//
+// 配列パラメータによる一括実行
+//
+// パラメータを列ごとの配列でバインド(SQL_PARAM_BIND_BY_COLUMN)し、
+// SQL_ATTR_PARAMSET_SIZE行ずつまとめて実行します。napiに依存しないので
+// ワーカースレッドからも使えます。
+//
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "omnicommon.h"
+
+// 列ごとのパラメータ配列
+struct BulkColumn {
+  // Cの型(SQL_C_*)
+  SQLSMALLINT cType;
+  // SQLの型(SQL_*)
+  SQLSMALLINT sqlType;
+  // 桁数(文字列は文字数)
+  SQLULEN columnSize;
+  // 小数部桁数
+  SQLSMALLINT decimalDigits;
+  // 1行分のバイト数
+  SQLLEN width;
+  // 値配列(width * 行数)
+  char *data;
+  // 長さ・NULL配列(NULLの場合は全行が非NULLの固定長)
+  SQLLEN *indicators;
+
+  // 自前で確保した値配列・長さ配列(dataとindicatorsが指す)
+  std::vector<char> ownedData;
+  std::vector<SQLLEN> ownedIndicators;
+
+  BulkColumn()
+    : cType(SQL_C_CHAR), sqlType(SQL_VARCHAR), columnSize(0), decimalDigits(0),
+      width(0), data(NULL), indicators(NULL) {}
+};
+
+// パラメータの型(SQLDescribeParam)
+struct BulkParamType {
+  // 型が取得できたか(未対応のドライバはfalse)
+  bool described;
+  // SQLの型
+  SQLSMALLINT sqlType;
+  // 桁数
+  SQLULEN columnSize;
+  // 小数部桁数
+  SQLSMALLINT decimalDigits;
+};
+
+// 実行に失敗したバッチ
+struct BulkBatchError {
+  // 先頭行
+  size_t offset;
+  // 行数
+  size_t rows;
+  // エラーメッセージ
+  OString message;
+  // SQLSTATE
+  std::string sqlState;
+};
+
+// 失敗した行(診断レコードの行番号から)
+struct BulkRowError {
+  // 行(全体での行番号)
+  size_t row;
+  // エラーメッセージ
+  OString message;
+  // SQLSTATE
+  std::string sqlState;
+};
+
+// 一括実行の結果
+struct BulkResult {
+  // 行数
+  size_t rows;
+  // 実行回数
+  size_t batches;
+  // 処理された行数(SQL_ATTR_PARAMS_PROCESSED_PTR)
+  uint64_t processed;
+  // 更新行数の合計(SQLRowCount)
+  uint64_t affected;
+  // 行ごとの状態(SQL_PARAM_SUCCESS等)
+  std::vector<SQLUSMALLINT> status;
+  // 失敗したバッチ
+  std::vector<BulkBatchError> errors;
+  // 行番号の分かった行のエラー
+  std::vector<BulkRowError> rowErrors;
+
+  BulkResult() : rows(0), batches(0), processed(0), affected(0) {}
+
+  // 再利用のためのクリア(statusの領域は残す)
+  void Clear()
+  {
+    rows = 0;
+    batches = 0;
+    processed = 0;
+    affected = 0;
+    status.clear();
+    errors.clear();
+    rowErrors.clear();
+  }
+};
+
+class BulkStatement {
+public:
+  BulkStatement();
+  ~BulkStatement();
+
+  // SQLを準備します
+  bool Prepare(SQLHDBC hdbc, SQLTCHAR *sql, OString &error);
+  // 準備済みの文を借りて使います(Freeでは解放しない)
+  bool Attach(SQLHSTMT stmt, OString &error);
+  // パラメータ数
+  SQLSMALLINT ParamCount() const { return m_paramCount; }
+  // パラメータの型(SQLDescribeParam、未対応のドライバはfalse)
+  bool DescribeParam(SQLUSMALLINT index, SQLSMALLINT &sqlType, SQLULEN &columnSize, SQLSMALLINT &decimalDigits);
+  // 全パラメータの型
+  void DescribeParams(std::vector<BulkParamType> &types);
+
+  // offset行目からrows行を1回で実行します
+  bool Execute(
+    const std::vector<BulkColumn> &columns, size_t offset, size_t rows,
+    SQLUSMALLINT *status, BulkResult &result, OString &error, std::string &sqlState);
+  // 全行をbatchSize行ずつ実行します
+  bool ExecuteAll(
+    const std::vector<BulkColumn> &columns, size_t rows, size_t batchSize, bool stopOnError,
+    BulkResult &result);
+
+  // 文の解放(切断前に呼ぶ、借りた文はパラメータのバインドだけ外す)
+  void Free();
+
+  SQLHSTMT get() const { return m_stmt.get(); }
+
+private:
+  BulkStatement(const BulkStatement &);
+  BulkStatement &operator=(const BulkStatement &);
+
+  std::unique_ptr<SQLHSTMT, StmtAcc> m_stmt;
+  SQLSMALLINT m_paramCount;
+  // 借りた文か
+  bool m_attached;
+};
+
+#endif
@@ -0,0 +1,493 @@
+﻿#include "bulkparams.h"
+
+#include <math.h>
+#include <string.h>
+
+
+#ifdef UNICODE
+  // パラメータ文字列(UTF-16)
+  typedef std::u16string BulkString;
+  #define BULK_C_STRING SQL_C_WCHAR
+  #define BULK_SQL_STRING SQL_WVARCHAR
+  #define to_bulkstring(v) (v).Utf16Value()
+#else
+  // パラメータ文字列(UTF-8)
+  typedef std::string BulkString;
+  #define BULK_C_STRING SQL_C_CHAR
+  #define BULK_SQL_STRING SQL_VARCHAR
+  #define to_bulkstring(v) (v).Utf8Value()
+#endif
+
+// 列の変換方法
+enum BulkKind {
+  BULK_KIND_STRING,
+  BULK_KIND_DOUBLE,
+  BULK_KIND_BIGINT
+};
+
+
+/**
+* 文字列として送るSQL型か(文字・日付時刻)
+*/
+static bool IsStringSqlType(SQLSMALLINT type)
+{
+  switch(type) {
+    case SQL_CHAR:
+    case SQL_VARCHAR:
+    case SQL_LONGVARCHAR:
+    case SQL_WCHAR:
+    case SQL_WVARCHAR:
+    case SQL_WLONGVARCHAR:
+    case SQL_TYPE_DATE:
+    case SQL_TYPE_TIME:
+    case SQL_TYPE_TIMESTAMP:
+      return true;
+  }
+  return false;
+}
+
+
+/**
+* 浮動小数点のSQL型か
+*/
+static bool IsFloatSqlType(SQLSMALLINT type)
+{
+  return type == SQL_REAL || type == SQL_FLOAT || type == SQL_DOUBLE;
+}
+
+
+/**
+* 10進数のSQL型か
+*/
+static bool IsDecimalSqlType(SQLSMALLINT type)
+{
+  return type == SQL_DECIMAL || type == SQL_NUMERIC;
+}
+
+
+/**
+* 整数で正確に表せる数値か(±2^53)
+*/
+static bool IsSafeInteger(double d)
+{
+  return d == floor(d) && d >= -9007199254740992.0 && d <= 9007199254740992.0;
+}
+
+
+/**
+* 固定長バッファ形式({data: Buffer, width: 1行のバイト数})かを調べます
+*
+* @param[in] values パラメータ
+* @param[out] packed オブジェクト
+* @param[out] width 1行のバイト数
+* @return bool 固定長バッファ形式か
+*/
+static bool GetPackedColumn(Napi::Value values, Napi::Object &packed, size_t &width)
+{
+  if(!values.IsObject() || values.IsArray() || values.IsTypedArray()) {
+    return false;
+  }
+  packed = values.As<Napi::Object>();
+  if(!packed.Has("data") || !packed.Get("data").IsTypedArray()
+    || !packed.Has("width") || !packed.Get("width").IsNumber()) {
+    return false;
+  }
+  double w = packed.Get("width").As<Napi::Number>().DoubleValue();
+  if(w < 1) {
+    return false;
+  }
+  width = (size_t)w;
+  return true;
+}
+
+
+/**
+* TypedArrayの要素型に対応するCの型・SQLの型を取得します
+*
+* @param[in] type TypedArrayの要素型
+* @param[out] cType Cの型
+* @param[out] sqlType SQLの型
+* @param[out] columnSize 桁数
+* @return bool 対応している型か
+*/
+static bool TypedArrayToSqlType(napi_typedarray_type type, SQLSMALLINT &cType, SQLSMALLINT &sqlType, SQLULEN &columnSize)
+{
+  switch(type) {
+    case napi_int8_array:
+      cType = SQL_C_STINYINT; sqlType = SQL_SMALLINT; columnSize = 5;
+      return true;
+    case napi_uint8_array:
+    case napi_uint8_clamped_array:
+      cType = SQL_C_UTINYINT; sqlType = SQL_SMALLINT; columnSize = 5;
+      return true;
+    case napi_int16_array:
+      cType = SQL_C_SSHORT; sqlType = SQL_SMALLINT; columnSize = 5;
+      return true;
+    case napi_uint16_array:
+      cType = SQL_C_USHORT; sqlType = SQL_INTEGER; columnSize = 10;
+      return true;
+    case napi_int32_array:
+      cType = SQL_C_SLONG; sqlType = SQL_INTEGER; columnSize = 10;
+      return true;
+    case napi_uint32_array:
+      cType = SQL_C_ULONG; sqlType = SQL_BIGINT; columnSize = 19;
+      return true;
+    case napi_float32_array:
+      cType = SQL_C_FLOAT; sqlType = SQL_REAL; columnSize = 7;
+      return true;
+    case napi_float64_array:
+      cType = SQL_C_DOUBLE; sqlType = SQL_DOUBLE; columnSize = 15;
+      return true;
+    case napi_bigint64_array:
+      cType = SQL_C_SBIGINT; sqlType = SQL_BIGINT; columnSize = 19;
+      return true;
+    case napi_biguint64_array:
+      cType = SQL_C_UBIGINT; sqlType = SQL_BIGINT; columnSize = 20;
+      return true;
+  }
+  return false;
+}
+
+
+/**
+* TypedArrayをコピーせずにバインドします(NULLは無し)
+*/
+static bool TypedArrayToBulkColumn(
+  Napi::TypedArray array, bool described, SQLSMALLINT sqlType, SQLULEN columnSize, SQLSMALLINT decimalDigits,
+  BulkColumn &column, BulkPins &pins, OString &error)
+{
+  SQLSMALLINT defaultSqlType = 0;
+  SQLULEN defaultColumnSize = 0;
+  if(!TypedArrayToSqlType(array.TypedArrayType(), column.cType, defaultSqlType, defaultColumnSize)) {
+    error = _O("対応していないTypedArrayです");
+    return false;
+  }
+  column.sqlType = described ? sqlType : defaultSqlType;
+  column.columnSize = described ? columnSize : defaultColumnSize;
+  column.decimalDigits = described ? decimalDigits : 0;
+  column.width = (SQLLEN)array.ElementSize();
+  column.data = (char *)array.ArrayBuffer().Data() + array.ByteOffset();
+  column.indicators = NULL;
+  column.ownedData.clear();
+  column.ownedIndicators.clear();
+  pins.push_back(Napi::Persistent(array.As<Napi::Object>()));
+  return true;
+}
+
+
+/**
+* 固定長バッファ({data, width, lengths, binary})をコピーせずにバインドします
+*
+* 1行width バイトで詰めた文字列(binaryの場合はバイナリ)をそのまま送ります。
+* 各行の長さはlengths(-1はNULL)で指定し、無ければwidth内の最初のNULまでです。
+* ※文字列はドライバの文字コード(SQL_C_CHAR)で送ります
+*/
+static bool PackedToBulkColumn(
+  Napi::Object packed, size_t width, size_t rows,
+  bool described, SQLSMALLINT sqlType, SQLULEN columnSize, SQLSMALLINT decimalDigits,
+  BulkColumn &column, BulkPins &pins, OString &error)
+{
+  Napi::TypedArray data = packed.Get("data").As<Napi::TypedArray>();
+  bool binary = packed.Has("binary") && packed.Get("binary").ToBoolean();
+
+  column.cType = binary ? SQL_C_BINARY : SQL_C_CHAR;
+  column.sqlType = described ? sqlType : (binary ? SQL_VARBINARY : SQL_VARCHAR);
+  column.columnSize = (described && columnSize > 0) ? columnSize : width;
+  column.decimalDigits = described ? decimalDigits : 0;
+  column.width = (SQLLEN)width;
+  column.data = (char *)data.ArrayBuffer().Data() + data.ByteOffset();
+  column.ownedData.clear();
+  pins.push_back(Napi::Persistent(data.As<Napi::Object>()));
+
+  //
+  // 行ごとの長さ
+  //
+  Napi::Value lengths = packed.Has("lengths") ? packed.Get("lengths") : packed.Env().Undefined();
+  if(lengths.IsTypedArray()) {
+    Napi::TypedArray _lengths = lengths.As<Napi::TypedArray>();
+    if(_lengths.ElementLength() < rows) {
+      error = _O("lengths の要素数が行数より少ないです");
+      return false;
+    }
+    napi_typedarray_type type = _lengths.TypedArrayType();
+    const char *p = (const char *)_lengths.ArrayBuffer().Data() + _lengths.ByteOffset();
+    if(type == napi_bigint64_array && sizeof(SQLLEN) == sizeof(int64_t)) {
+      // 長さ配列もそのままバインド
+      column.indicators = (SQLLEN *)p;
+      column.ownedIndicators.clear();
+      pins.push_back(Napi::Persistent(_lengths.As<Napi::Object>()));
+    } else if(type == napi_int32_array) {
+      column.ownedIndicators.resize(rows);
+      column.indicators = column.ownedIndicators.data();
+      const int32_t *len = (const int32_t *)p;
+      for(size_t i = 0; i < rows; i++) {
+        column.indicators[i] = len[i] < 0 ? SQL_NULL_DATA : (SQLLEN)len[i];
+      }
+    } else {
+      error = _O("lengths はInt32ArrayまたはBigInt64Arrayで指定してください");
+      return false;
+    }
+    for(size_t i = 0; i < rows; i++) {
+      if(column.indicators[i] > (SQLLEN)width) {
+        error = _O("lengths の値がwidthを超えています(") + to_ostring(i) + _O("行目)");
+        return false;
+      }
+    }
+    return true;
+  }
+
+  column.ownedIndicators.resize(rows);
+  column.indicators = column.ownedIndicators.data();
+  for(size_t i = 0; i < rows; i++) {
+    const char *row = column.data + i * width;
+    const void *nul = binary ? NULL : memchr(row, 0, width);
+    column.indicators[i] = nul ? (SQLLEN)((const char *)nul - row) : (SQLLEN)width;
+  }
+  return true;
+}
+
+
+/**
+* パラメータ配列の要素数を取得します
+*
+* @param[in] values パラメータ配列
+* @param[out] rows 要素数
+* @return bool 配列か
+*/
+bool BulkColumnLength(Napi::Value values, size_t &rows)
+{
+  if(values.IsArray()) {
+    rows = values.As<Napi::Array>().Length();
+    return true;
+  }
+  if(values.IsTypedArray()) {
+    rows = values.As<Napi::TypedArray>().ElementLength();
+    return true;
+  }
+  // 固定長バッファ {data, width}
+  Napi::Object packed;
+  size_t width = 0;
+  if(GetPackedColumn(values, packed, width)) {
+    rows = packed.Get("data").As<Napi::TypedArray>().ByteLength() / width;
+    return true;
+  }
+  return false;
+}
+
+
+/**
+* JSの値をパラメータ配列に変換します
+*
+* TypedArray・固定長バッファ({data, width})はコピーせずに直接バインドします。
+* 配列の場合は値の型で変換方法を決めます。文字列を含む列・文字型の列は文字列、小数を含む列は
+* double(10進数型の列は桁落ちしないよう文字列)、それ以外は64bit整数で送ります。
+* null/undefinedはNULLになります。
+*
+* @param[in] values パラメータ配列
+* @param[in] rows 行数
+* @param[in] described パラメータの型が取得できたか
+* @param[in] sqlType SQLの型
+* @param[in] columnSize 桁数
+* @param[in] decimalDigits 小数部桁数
+* @param[out] column パラメータ配列
+* @param[out] pins 直接バインドしたJSオブジェクトの参照
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool ToBulkColumn(
+  Napi::Value values, size_t rows,
+  bool described, SQLSMALLINT sqlType, SQLULEN columnSize, SQLSMALLINT decimalDigits,
+  BulkColumn &column, BulkPins &pins, OString &error)
+{
+  if(values.IsTypedArray()) {
+    return TypedArrayToBulkColumn(
+      values.As<Napi::TypedArray>(), described, sqlType, columnSize, decimalDigits, column, pins, error);
+  }
+  Napi::Object packed;
+  size_t width = 0;
+  if(GetPackedColumn(values, packed, width)) {
+    return PackedToBulkColumn(
+      packed, width, rows, described, sqlType, columnSize, decimalDigits, column, pins, error);
+  }
+
+  Napi::Array array = values.As<Napi::Array>();
+
+  //
+  // 値の型を調べます
+  //
+  size_t nulls = 0;
+  size_t strings = 0;
+  size_t numbers = 0;
+  size_t fractions = 0;
+  for(size_t i = 0; i < rows; i++) {
+    Napi::Value v = array.Get((uint32_t)i);
+    if(v.IsNull() || v.IsUndefined()) {
+      nulls++;
+    } else if(v.IsString()) {
+      strings++;
+    } else if(v.IsNumber()) {
+      numbers++;
+      if(!IsSafeInteger(v.As<Napi::Number>().DoubleValue())) {
+        fractions++;
+      }
+    } else if(v.IsBoolean() || v.IsBigInt()) {
+      numbers++;
+    } else {
+      error = _O("パラメータは文字列・数値・真偽値・nullのみ指定できます(") + to_ostring(i) + _O("行目)");
+      return false;
+    }
+  }
+
+  BulkKind kind = BULK_KIND_BIGINT;
+  if(strings > 0 || numbers == 0 || (described && IsStringSqlType(sqlType))) {
+    kind = BULK_KIND_STRING;
+  } else if(described && IsFloatSqlType(sqlType)) {
+    kind = BULK_KIND_DOUBLE;
+  } else if(fractions > 0) {
+    kind = (described && IsDecimalSqlType(sqlType)) ? BULK_KIND_STRING : BULK_KIND_DOUBLE;
+  }
+
+  column.indicators = NULL;
+  column.ownedIndicators.clear();
+  if(nulls > 0 || kind == BULK_KIND_STRING) {
+    column.ownedIndicators.resize(rows);
+    column.indicators = column.ownedIndicators.data();
+  }
+
+  //
+  // 数値(固定長)
+  //
+  if(kind == BULK_KIND_DOUBLE || kind == BULK_KIND_BIGINT) {
+    column.width = 8;
+    column.ownedData.assign(rows * column.width, 0);
+    column.data = column.ownedData.data();
+    if(kind == BULK_KIND_DOUBLE) {
+      column.cType = SQL_C_DOUBLE;
+      column.sqlType = described ? sqlType : SQL_DOUBLE;
+      column.columnSize = described ? columnSize : 15;
+    } else {
+      column.cType = SQL_C_SBIGINT;
+      column.sqlType = described ? sqlType : SQL_BIGINT;
+      column.columnSize = described ? columnSize : 19;
+    }
+    column.decimalDigits = described ? decimalDigits : 0;
+
+    for(size_t i = 0; i < rows; i++) {
+      Napi::Value v = array.Get((uint32_t)i);
+      char *p = column.data + i * column.width;
+      if(v.IsNull() || v.IsUndefined()) {
+        column.indicators[i] = SQL_NULL_DATA;
+        continue;
+      }
+      if(column.indicators) {
+        column.indicators[i] = column.width;
+      }
+      if(kind == BULK_KIND_DOUBLE) {
+        double d = v.IsBoolean() ? (v.As<Napi::Boolean>().Value() ? 1 : 0) : v.ToNumber().DoubleValue();
+        memcpy(p, &d, sizeof(d));
+      } else {
+        int64_t n = 0;
+        if(v.IsBoolean()) {
+          n = v.As<Napi::Boolean>().Value() ? 1 : 0;
+        } else if(v.IsBigInt()) {
+          bool lossless = true;
+          n = v.As<Napi::BigInt>().Int64Value(&lossless);
+          if(!lossless) {
+            error = _O("BigIntの値が64bit整数の範囲を超えています(") + to_ostring(i) + _O("行目)");
+            return false;
+          }
+        } else {
+          n = (int64_t)v.As<Napi::Number>().DoubleValue();
+        }
+        memcpy(p, &n, sizeof(n));
+      }
+    }
+    return true;
+  }
+
+  //
+  // 文字列(最大長の固定幅で詰める)
+  //
+  std::vector<BulkString> texts(rows);
+  size_t maxUnits = 0;
+  for(size_t i = 0; i < rows; i++) {
+    Napi::Value v = array.Get((uint32_t)i);
+    if(v.IsNull() || v.IsUndefined()) {
+      column.indicators[i] = SQL_NULL_DATA;
+      continue;
+    }
+    if(v.IsBoolean()) {
+      texts[i] = to_bulkstring(Napi::String::New(v.Env(), v.As<Napi::Boolean>().Value() ? "1" : "0"));
+    } else {
+      texts[i] = to_bulkstring(v.ToString());
+    }
+    column.indicators[i] = (SQLLEN)(texts[i].size() * sizeof(texts[i][0]));
+    if(texts[i].size() > maxUnits) {
+      maxUnits = texts[i].size();
+    }
+  }
+
+  column.cType = BULK_C_STRING;
+  column.sqlType = described ? sqlType : BULK_SQL_STRING;
+  column.columnSize = (described && columnSize > 0) ? columnSize : (maxUnits > 0 ? maxUnits : 1);
+  column.decimalDigits = described ? decimalDigits : 0;
+  column.width = (SQLLEN)((maxUnits + 1) * sizeof(BulkString::value_type));
+  column.ownedData.assign(rows * column.width, 0);
+  column.data = column.ownedData.data();
+  for(size_t i = 0; i < rows; i++) {
+    if(column.indicators[i] > 0) {
+      memcpy(column.data + i * column.width, texts[i].data(), column.indicators[i]);
+    }
+  }
+  return true;
+}
+
+
+/**
+* 列ごとのJSの値(columns)を全パラメータ分変換します
+*
+* @param[in] values 列ごとの値の配列
+* @param[in] types パラメータの型
+* @param[out] columns パラメータ配列(再利用する場合は前回の領域を使い回します)
+* @param[out] pins 直接バインドしたJSオブジェクトの参照
+* @param[out] rows 行数
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool ToBulkColumns(
+  Napi::Value values, const std::vector<BulkParamType> &types,
+  std::vector<BulkColumn> &columns, BulkPins &pins, size_t &rows, OString &error)
+{
+  if(!values.IsArray()) {
+    error = _O("columns は配列のみ指定できます");
+    return false;
+  }
+  Napi::Array array = values.As<Napi::Array>();
+  if(array.Length() != types.size()) {
+    error = _O("columns の数(") + to_ostring(array.Length()) + _O(")がパラメータの数(")
+      + to_ostring(types.size()) + _O(")と一致しません");
+    return false;
+  }
+
+  rows = 0;
+  columns.resize(types.size());
+  for(uint32_t c = 0; c < array.Length(); c++) {
+    Napi::Value v = array.Get(c);
+    size_t length = 0;
+    if(!BulkColumnLength(v, length)) {
+      error = _O("columns の要素は値の配列・TypedArray・{data, width}で指定してください");
+      return false;
+    }
+    if(c > 0 && length != rows) {
+      error = _O("columns の各配列は同じ長さで指定してください");
+      return false;
+    }
+    rows = length;
+
+    const BulkParamType &t = types[c];
+    if(!ToBulkColumn(v, rows, t.described, t.sqlType, t.columnSize, t.decimalDigits, columns[c], pins, error)) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,32 @@
+﻿#ifndef _BULKPARAMS_H
+#define _BULKPARAMS_H
+//
+// 一括実行パラメータのJS値→列配列変換
+//
+#include <napi.h>
+
+#include <vector>
+
+#include "omnicommon.h"
+#include "bulkexec.h"
+
+// 直接バインドしたJSオブジェクトの参照(実行が終わるまでGCされないように保持)
+typedef std::vector<Napi::ObjectReference> BulkPins;
+
+// パラメータ配列の要素数を取得します(配列・TypedArray・固定長バッファ以外はfalse)
+bool BulkColumnLength(Napi::Value values, size_t &rows);
+
+// JSの値をパラメータ配列に変換します
+// ※described=trueの場合はSQLDescribeParamの型に合わせます
+// ※TypedArray・固定長バッファはコピーせずにバインドし、pinsで参照を保持します
+bool ToBulkColumn(
+  Napi::Value values, size_t rows,
+  bool described, SQLSMALLINT sqlType, SQLULEN columnSize, SQLSMALLINT decimalDigits,
+  BulkColumn &column, BulkPins &pins, OString &error);
+
+// 列ごとのJSの値(columns)を全パラメータ分変換します
+bool ToBulkColumns(
+  Napi::Value values, const std::vector<BulkParamType> &types,
+  std::vector<BulkColumn> &columns, BulkPins &pins, size_t &rows, OString &error);
+
+#endif
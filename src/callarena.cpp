@@ -0,0 +1,161 @@
+﻿#include "callarena.h"
+
+#include <string.h>
+
+
+// スレッドで使っているアリーナ
+static thread_local CallArena *g_current = NULL;
+
+
+/**
+* コンストラクタ
+*
+* @param[in] chunkBytes 最初の塊の大きさ(最初に切り出すまで借りない)
+*/
+CallArena::CallArena(size_t chunkBytes)
+  : m_chunkBytes(chunkBytes), m_count(0), m_offset(0), m_used(0), m_failed(false), m_outer(NULL)
+{
+}
+
+
+/**
+* デストラクタ(塊をまとめてプールに返却)
+*/
+CallArena::~CallArena()
+{
+  for(size_t i = 0; i < m_count; i++) {
+    BufferPool::Shared().Release(m_chunks[i]);
+  }
+}
+
+
+/**
+* 領域を切り出します
+*
+* 今の塊に収まらなければ倍の大きさ(足りなければbytes以上)の塊を借ります。
+*
+* @param[in] bytes 大きさ
+* @param[in] align 境界(2のべき乗、BUFFER_ALIGN以下)
+* @return void* 領域(塊を借りられなければNULL)
+*/
+void *CallArena::Allocate(size_t bytes, size_t align)
+{
+  if(bytes == 0) {
+    bytes = 1;
+  }
+  if(m_count > 0) {
+    BufferPool::Block &chunk = m_chunks[m_count - 1];
+    size_t offset = (m_offset + align - 1) & ~(align - 1);
+    if(offset + bytes <= chunk.size) {
+      m_offset = offset + bytes;
+      m_used += bytes;
+      return chunk.data + offset;
+    }
+  }
+  if(m_count >= CALL_ARENA_MAX_CHUNKS) {
+    m_failed = true;
+    return NULL;
+  }
+
+  size_t size = m_chunkBytes << m_count;
+  if(size < bytes) {
+    size = bytes;
+  }
+  BufferPool::Block chunk = BufferPool::Shared().Acquire(size);
+  if(!chunk.data) {
+    m_failed = true;
+    return NULL;
+  }
+  m_chunks[m_count++] = chunk;
+  m_offset = bytes;
+  m_used += bytes;
+  return chunk.data;
+}
+
+
+/**
+* 文字列を複製します
+*
+* @param[in] data 文字列
+* @param[in] bytes 文字列のバイト数(終端を含まない)
+* @param[in] terminator 終端のバイト数(0で埋める)
+* @return char* 複製(失敗はNULL)
+*/
+char *CallArena::Copy(const void *data, size_t bytes, size_t terminator)
+{
+  char *p = (char *)Allocate(bytes + terminator);
+  if(p) {
+    memcpy(p, data, bytes);
+    memset(p + bytes, 0, terminator);
+  }
+  return p;
+}
+
+
+/**
+* このアリーナの領域か
+*
+* @param[in] p 領域
+* @return bool 借りている塊のいずれかの中ならtrue
+*/
+bool CallArena::Owns(const void *p) const
+{
+  const char *c = (const char *)p;
+  for(size_t i = 0; i < m_count; i++) {
+    if(c >= m_chunks[i].data && c < m_chunks[i].data + m_chunks[i].size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+* スレッドで使っているアリーナ
+*
+* @return CallArena* アリーナ(無ければNULL)
+*/
+CallArena *CallArena::Current()
+{
+  return g_current;
+}
+
+
+/**
+* スレッドで使っているアリーナ(外側を含む)のいずれかの領域か
+*
+* @param[in] p 領域
+* @return bool アリーナの領域ならtrue(解放しない)
+*/
+bool CallArena::OwnedByActive(const void *p)
+{
+  for(CallArena *arena = g_current; arena; arena = arena->m_outer) {
+    if(arena->Owns(p)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+* コンストラクタ(スレッドで使うアリーナを切り替え)
+*
+* @param[in] arena アリーナ
+*/
+CallArenaScope::CallArenaScope(CallArena &arena)
+  : m_arena(arena)
+{
+  m_arena.m_outer = g_current;
+  g_current = &m_arena;
+}
+
+
+/**
+* デストラクタ(外側のアリーナに戻す)
+*/
+CallArenaScope::~CallArenaScope()
+{
+  g_current = m_arena.m_outer;
+  m_arena.m_outer = NULL;
+}
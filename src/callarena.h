@@ -0,0 +1,131 @@
+﻿#ifndef _CALLARENA_H
+#define _CALLARENA_H
+//
+// 呼び出し単位のアリーナ
+//
+// tables()/columns()/query()の1回の呼び出しの中で確保する小さな領域(引数の
+// 文字列の複製・JSONの節点と文字列)を、行セット領域のプールから借りた塊から
+// 順に切り出します。個別には解放せず、アリーナの破棄でまとめて返却します。
+// CallArenaScopeの間はそのスレッドのArenaAllocatorがアリーナから確保します。
+// napiに依存しません。
+//
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "bufferpool.h"
+#include "nlohmann/json.hpp"
+
+// 最初の塊の大きさ(バイト、以降は倍にしていく)
+#define CALL_ARENA_CHUNK (16 * 1024)
+// 塊の数の上限
+#define CALL_ARENA_MAX_CHUNKS 24
+
+class CallArena {
+public:
+  explicit CallArena(size_t chunkBytes = CALL_ARENA_CHUNK);
+  ~CallArena();
+
+  // bytesを切り出します(失敗はNULL)
+  void *Allocate(size_t bytes, size_t align = sizeof(void *) * 2);
+  // 文字列をNUL終端で複製します
+  char *Copy(const void *data, size_t bytes, size_t terminator = 1);
+  // pがこのアリーナの領域か
+  bool Owns(const void *p) const;
+  // 切り出したバイト数
+  size_t Used() const { return m_used; }
+  // 借りている塊の数
+  size_t Chunks() const { return m_count; }
+  // 切り出せなかったことがあるか
+  bool Failed() const { return m_failed; }
+
+  // スレッドで使っているアリーナ(無ければNULL)
+  static CallArena *Current();
+  // スレッドで使っているアリーナ(入れ子を含む)のいずれかの領域か
+  static bool OwnedByActive(const void *p);
+
+private:
+  CallArena(const CallArena &);
+  CallArena &operator=(const CallArena &);
+  friend class CallArenaScope;
+
+  size_t m_chunkBytes;
+  BufferPool::Block m_chunks[CALL_ARENA_MAX_CHUNKS];
+  size_t m_count;
+  // 今の塊で切り出した位置
+  size_t m_offset;
+  size_t m_used;
+  bool m_failed;
+  // 外側のアリーナ(CallArenaScopeが設定)
+  CallArena *m_outer;
+};
+
+//
+// スレッドで使うアリーナの範囲(破棄で外側のアリーナに戻す)
+//
+class CallArenaScope {
+public:
+  explicit CallArenaScope(CallArena &arena);
+  ~CallArenaScope();
+
+private:
+  CallArenaScope(const CallArenaScope &);
+  CallArenaScope &operator=(const CallArenaScope &);
+
+  CallArena &m_arena;
+};
+
+//
+// アリーナから確保するアロケータ
+//
+// スレッドにアリーナが無ければ(または切り出せなければ)通常のヒープから
+// 確保します。アリーナの領域は解放しません(アリーナの破棄で返却)。
+//
+template<typename T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+
+  ArenaAllocator() {}
+  template<typename U> ArenaAllocator(const ArenaAllocator<U> &) {}
+
+  T *allocate(size_t n)
+  {
+    CallArena *arena = CallArena::Current();
+    if(arena) {
+      void *p = arena->Allocate(n * sizeof(T), alignof(T));
+      if(p) {
+        return (T *)p;
+      }
+    }
+    return (T *)::operator new(n * sizeof(T));
+  }
+  void deallocate(T *p, size_t)
+  {
+    if(!CallArena::OwnedByActive(p)) {
+      ::operator delete(p);
+    }
+  }
+};
+
+template<typename T, typename U>
+inline bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return true; }
+template<typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return false; }
+
+// アリーナの文字列
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > ArenaString;
+// アリーナのJSON(破棄するまでアリーナを残すこと)
+typedef nlohmann::basic_json<
+  std::map, std::vector, ArenaString, bool, int64_t, uint64_t, double, ArenaAllocator> ArenaJson;
+
+// std::stringをアリーナの文字列に複製します
+inline ArenaString ToArenaString(const std::string &s)
+{
+  return ArenaString(s.data(), s.size());
+}
+
+#endif
@@ -0,0 +1,849 @@
+﻿#include "catalogcache.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#endif
+
+// ファイル識別子
+static const char CONTROL_MAGIC[8] = { 'O', 'M', 'N', 'I', 'C', 'A', 'T', 0 };
+static const char SEGMENT_MAGIC[8] = { 'O', 'M', 'N', 'I', 'S', 'E', 'G', 0 };
+// レイアウト番号(構造を変えたら上げる)
+#define CATALOG_LAYOUT 2
+// 制御ファイルのサイズ
+#define CONTROL_SIZE 4096
+// ロックする位置(初期化と書き込みは別の1バイトをロックする)
+#define LOCK_INIT 0
+#define LOCK_WRITER 1
+
+//
+// 制御ファイルの内容(全プロセスで共有)
+//
+struct CatalogCache::Control {
+  char magic[8];
+  uint32_t layout;
+  uint32_t reserved;
+  // 公開中のスナップショット番号
+  std::atomic<uint64_t> version;
+  // 公開日時(エポックミリ秒)
+  std::atomic<uint64_t> publishedAt;
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "atomic<uint64_t> must be plain 64bit");
+
+//
+// セグメントの先頭
+//
+typedef struct CATALOG_SEGMENT_HEADER {
+  char magic[8];
+  uint32_t layout;
+  uint32_t reserved;
+  uint64_t version;
+  uint64_t createdAt;
+  uint64_t totalSize;
+  uint64_t tableOffset;
+  uint64_t columnOffset;
+  uint64_t stringOffset;
+  uint64_t stringSize;
+  uint32_t tableCount;
+  uint32_t columnCount;
+  // 取得した範囲(catalog, schema, table, tableType。空は全件)
+  CatalogStringRef scope[4];
+} CATALOG_SEGMENT_HEADER;
+
+
+/**
+* 現在時刻(エポックミリ秒)
+*/
+static uint64_t NowMillis()
+{
+#ifndef _WIN32
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#else
+  return (uint64_t)time(NULL) * 1000;
+#endif
+}
+
+
+/**
+* errnoをエラー文字列に変換します
+*/
+static OString SystemError(const OString &api)
+{
+  OString msg = api + _O("エラー (");
+  msg += to_ostring(errno);
+  msg += _O(": ");
+#ifndef _WIN32
+  msg += _S2O(strerror(errno));
+#endif
+  msg += _O(")");
+  return msg;
+}
+
+
+//
+// セグメント作成時の文字列プール(同じ文字列は1回だけ格納)
+//
+class CatalogStringPool {
+public:
+  CatalogStringRef Add(const std::string &s)
+  {
+    std::unordered_map<std::string, uint32_t>::const_iterator it = m_index.find(s);
+    CatalogStringRef ref;
+    ref.length = (uint32_t)s.size();
+    if(it != m_index.end()) {
+      ref.offset = it->second;
+      return ref;
+    }
+    ref.offset = (uint32_t)m_chars.size();
+    m_chars.append(s);
+    // 終端を付けておく(Chars()をそのままCの文字列として使えるように)
+    m_chars.push_back('\0');
+    m_index[s] = ref.offset;
+    return ref;
+  }
+  const std::string &Chars() const { return m_chars; }
+private:
+  std::string m_chars;
+  std::unordered_map<std::string, uint32_t> m_index;
+};
+
+
+/**
+* 詰め物(0)を書き込みます
+*/
+static bool WritePadding(FILE *fp, uint64_t size)
+{
+  static const char zeros[8] = { 0 };
+  return size == 0 || fwrite(zeros, (size_t)size, 1, fp) == 1;
+}
+
+
+/**
+* 制御ファイルのロックを取得・解放します
+*
+* fcntlのレコードロックはプロセス単位のため、同じプロセスの別インスタンスを
+* 排他できず、同じファイルの別のfdを閉じただけで外れてしまいます。そのため
+* オープンファイル記述ごとのロック(OFDロック、無ければflock)を使います。
+* flockでは位置を分けられないため、初期化も書き込みの完了を待ちます。
+*
+* @param[in] fd 制御ファイル
+* @param[in] lock 取得するか(falseは解放)
+* @param[in] offset ロックする位置(LOCK_INIT, LOCK_WRITER)
+* @return int fcntl・flockの戻り値
+*/
+static int LockControlFile(int fd, bool lock, off_t offset)
+{
+#ifdef F_OFD_SETLKW
+  struct flock fl;
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = lock ? F_WRLCK : F_UNLCK;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = offset;
+  fl.l_len = 1;
+  return fcntl(fd, lock ? F_OFD_SETLKW : F_OFD_SETLK, &fl);
+#else
+  (void)offset;
+  return flock(fd, lock ? LOCK_EX : LOCK_UN);
+#endif
+}
+
+
+/**
+* 8バイト境界に切り上げ
+*/
+static uint64_t Align8(uint64_t v)
+{
+  return (v + 7) & ~(uint64_t)7;
+}
+
+
+/**
+* テーブル種別リストに含まれるか(カンマ区切り、'で括られていても可)
+*/
+static bool MatchTableType(const std::string &types, const char *type, size_t tlen)
+{
+  if(types.empty()) {
+    return true;
+  }
+  size_t pos = 0;
+  while(pos <= types.size()) {
+    size_t comma = types.find(',', pos);
+    if(comma == std::string::npos) {
+      comma = types.size();
+    }
+    // 前後の空白と引用符を除去
+    size_t b = pos, e = comma;
+    while(b < e && (types[b] == ' ' || types[b] == '\'')) b++;
+    while(e > b && (types[e - 1] == ' ' || types[e - 1] == '\'')) e--;
+    if((e - b) == tlen && types.compare(b, e - b, type, tlen) == 0) {
+      return true;
+    }
+    pos = comma + 1;
+  }
+  return false;
+}
+
+
+/**
+* デストラクタ(マップ解除)
+*/
+CatalogSnapshot::~CatalogSnapshot()
+{
+#ifndef _WIN32
+  if(m_base) {
+    munmap((void *)m_base, m_size);
+    m_base = NULL;
+  }
+#endif
+}
+
+uint64_t CatalogSnapshot::CreatedAt() const
+{
+  return ((const CATALOG_SEGMENT_HEADER *)m_base)->createdAt;
+}
+
+uint32_t CatalogSnapshot::TableCount() const
+{
+  return ((const CATALOG_SEGMENT_HEADER *)m_base)->tableCount;
+}
+
+uint32_t CatalogSnapshot::ColumnCount() const
+{
+  return ((const CATALOG_SEGMENT_HEADER *)m_base)->columnCount;
+}
+
+const CatalogTableRecord &CatalogSnapshot::TableAt(uint32_t i) const
+{
+  const CATALOG_SEGMENT_HEADER *h = (const CATALOG_SEGMENT_HEADER *)m_base;
+  return ((const CatalogTableRecord *)(m_base + h->tableOffset))[i];
+}
+
+const CatalogColumnRecord &CatalogSnapshot::ColumnAt(uint32_t i) const
+{
+  const CATALOG_SEGMENT_HEADER *h = (const CATALOG_SEGMENT_HEADER *)m_base;
+  return ((const CatalogColumnRecord *)(m_base + h->columnOffset))[i];
+}
+
+const char *CatalogSnapshot::Chars(const CatalogStringRef &ref) const
+{
+  const CATALOG_SEGMENT_HEADER *h = (const CATALOG_SEGMENT_HEADER *)m_base;
+  return m_base + h->stringOffset + ref.offset;
+}
+
+std::string CatalogSnapshot::Str(const CatalogStringRef &ref) const
+{
+  return std::string(Chars(ref), ref.length);
+}
+
+/**
+* 取得した範囲(Publishで指定した条件)
+*/
+CatalogFilter CatalogSnapshot::Scope() const
+{
+  const CATALOG_SEGMENT_HEADER *h = (const CATALOG_SEGMENT_HEADER *)m_base;
+  CatalogFilter scope;
+  scope.catalog = Str(h->scope[0]);
+  scope.schema = Str(h->scope[1]);
+  scope.table = Str(h->scope[2]);
+  scope.tableType = Str(h->scope[3]);
+  return scope;
+}
+
+
+/**
+* 範囲の条件が検索条件を含むか
+*
+* 検索条件がパターンを含む場合は、範囲と同じ条件の場合のみ含むとみなします。
+*/
+static bool ScopeCovers(const std::string &scope, const std::string &request)
+{
+  if(scope.empty() || scope == "%" || scope == request) {
+    return true;
+  }
+  if(request.empty() || request.find_first_of("%_\\") != std::string::npos) {
+    return false;
+  }
+  return CatalogCache::PatternMatch(scope.data(), scope.size(), request.data(), request.size());
+}
+
+
+/**
+* スナップショットが検索条件の全件を持っているか
+*
+* @param[in] filter 検索条件
+* @param[in] tables テーブルの検索か(テーブル種別も比べる)
+* @return bool 持っているか
+*/
+bool CatalogSnapshot::Covers(const CatalogFilter &filter, bool tables) const
+{
+  CatalogFilter scope = Scope();
+  if(!ScopeCovers(scope.catalog, filter.catalog) || !ScopeCovers(scope.schema, filter.schema) ||
+     !ScopeCovers(scope.table, filter.table)) {
+    return false;
+  }
+  if(!tables || scope.tableType.empty()) {
+    return true;
+  }
+  if(filter.tableType.empty()) {
+    return false;
+  }
+  // 検索する種別がすべて範囲の種別に含まれるか
+  size_t pos = 0;
+  while(pos <= filter.tableType.size()) {
+    size_t comma = filter.tableType.find(',', pos);
+    if(comma == std::string::npos) {
+      comma = filter.tableType.size();
+    }
+    size_t b = pos, e = comma;
+    while(b < e && (filter.tableType[b] == ' ' || filter.tableType[b] == '\'')) b++;
+    while(e > b && (filter.tableType[e - 1] == ' ' || filter.tableType[e - 1] == '\'')) e--;
+    if(e > b && !MatchTableType(scope.tableType, filter.tableType.data() + b, e - b)) {
+      return false;
+    }
+    pos = comma + 1;
+  }
+  return true;
+}
+
+bool CatalogSnapshot::Match(const std::string &pattern, const CatalogStringRef &ref) const
+{
+  if(pattern.empty()) {
+    return true;
+  }
+  return CatalogCache::PatternMatch(pattern.data(), pattern.size(), Chars(ref), ref.length);
+}
+
+
+/**
+* 条件に一致するテーブルを取得します
+*
+* @param[in] filter 検索条件
+* @param[out] out 一致したテーブル
+*/
+void CatalogSnapshot::FindTables(const CatalogFilter &filter, std::vector<CatalogTable> &out) const
+{
+  uint32_t count = TableCount();
+  for(uint32_t i = 0; i < count; i++) {
+    const CatalogTableRecord &r = TableAt(i);
+    if(!Match(filter.catalog, r.catalog) || !Match(filter.schema, r.schema) ||
+       !Match(filter.table, r.name) ||
+       !MatchTableType(filter.tableType, Chars(r.type), r.type.length)) {
+      continue;
+    }
+    CatalogTable t;
+    t.catalog = Str(r.catalog);
+    t.schema = Str(r.schema);
+    t.name = Str(r.name);
+    t.type = Str(r.type);
+    t.remarks = Str(r.remarks);
+    out.push_back(t);
+  }
+}
+
+
+/**
+* 条件に一致するカラムを取得します
+*
+* @param[in] filter 検索条件
+* @param[out] out 一致したカラム
+*/
+void CatalogSnapshot::FindColumns(const CatalogFilter &filter, std::vector<CatalogColumn> &out) const
+{
+  uint32_t count = ColumnCount();
+  for(uint32_t i = 0; i < count; i++) {
+    const CatalogColumnRecord &r = ColumnAt(i);
+    if(!Match(filter.catalog, r.catalog) || !Match(filter.schema, r.schema) ||
+       !Match(filter.table, r.table) || !Match(filter.column, r.name)) {
+      continue;
+    }
+    CatalogColumn c;
+    c.catalog = Str(r.catalog);
+    c.schema = Str(r.schema);
+    c.table = Str(r.table);
+    c.name = Str(r.name);
+    c.remarks = Str(r.remarks);
+    c.defaultValue = Str(r.defaultValue);
+    c.size = r.size;
+    c.type = r.type;
+    c.decimalDigits = r.decimalDigits;
+    c.numPrec = r.numPrec;
+    c.nullable = r.nullable != 0;
+    out.push_back(c);
+  }
+}
+
+
+/**
+* コンストラクタ
+*/
+CatalogCache::CatalogCache()
+{
+  m_fd = -1;
+  m_control = NULL;
+  m_keep = 2;
+  m_writerLocked = false;
+}
+
+
+/**
+* デストラクタ
+*/
+CatalogCache::~CatalogCache()
+{
+  Close();
+}
+
+
+/**
+* 制御ファイルを閉じます
+*/
+void CatalogCache::Close()
+{
+#ifndef _WIN32
+  if(m_writerLocked) {
+    UnlockWriter();
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_snapshotMutex);
+    m_snapshot.reset();
+  }
+  if(m_control) {
+    munmap(m_control, CONTROL_SIZE);
+    m_control = NULL;
+  }
+  if(m_fd >= 0) {
+    close(m_fd);
+    m_fd = -1;
+  }
+#endif
+}
+
+
+/**
+* 制御ファイルを開きます。無ければ作成して初期化します
+*
+* @param[in] path 制御ファイルのパス
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool CatalogCache::Open(const OString &path, OString &error)
+{
+#ifdef _WIN32
+  error = _O("カタログキャッシュはこのOSでは未対応です");
+  return false;
+#else
+  Close();
+
+  m_path = path;
+  m_nativePath = to_jsonstr(path);
+
+  int fd = open(m_nativePath.c_str(), O_RDWR | O_CREAT, 0666);
+  if(fd < 0) {
+    error = SystemError(_O("open"));
+    return false;
+  }
+
+  // 初期化は書き込みロックを取って1つだけが行う(同じプロセスの別インスタンスも排他)
+  if(LockControlFile(fd, true, LOCK_INIT) < 0) {
+    error = SystemError(_O("fcntl"));
+    close(fd);
+    return false;
+  }
+
+  struct stat st;
+  bool ok = (fstat(fd, &st) == 0);
+  if(ok && st.st_size < CONTROL_SIZE) {
+    ok = (ftruncate(fd, CONTROL_SIZE) == 0);
+  }
+  void *p = MAP_FAILED;
+  if(ok) {
+    p = mmap(NULL, CONTROL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if(!ok || p == MAP_FAILED) {
+    error = SystemError(ok ? _O("mmap") : _O("ftruncate"));
+    LockControlFile(fd, false, LOCK_INIT);
+    close(fd);
+    return false;
+  }
+
+  Control *control = (Control *)p;
+  if(memcmp(control->magic, CONTROL_MAGIC, sizeof(CONTROL_MAGIC)) != 0) {
+    // 新規作成
+    control->layout = CATALOG_LAYOUT;
+    control->reserved = 0;
+    control->version.store(0, std::memory_order_relaxed);
+    control->publishedAt.store(0, std::memory_order_relaxed);
+    memcpy(control->magic, CONTROL_MAGIC, sizeof(CONTROL_MAGIC));
+    msync(p, CONTROL_SIZE, MS_SYNC);
+  }
+  bool compatible = (control->layout == CATALOG_LAYOUT);
+
+  LockControlFile(fd, false, LOCK_INIT);
+
+  if(!compatible) {
+    munmap(p, CONTROL_SIZE);
+    close(fd);
+    error = _O("カタログキャッシュのレイアウトが異なります");
+    return false;
+  }
+
+  m_fd = fd;
+  m_control = control;
+  return true;
+#endif
+}
+
+
+/**
+* 公開中のスナップショット番号
+*/
+uint64_t CatalogCache::CurrentVersion() const
+{
+  return m_control ? m_control->version.load(std::memory_order_acquire) : 0;
+}
+
+
+/**
+* 公開日時
+*/
+uint64_t CatalogCache::PublishedAt() const
+{
+  return m_control ? m_control->publishedAt.load(std::memory_order_acquire) : 0;
+}
+
+
+/**
+* セグメントファイル名
+*/
+std::string CatalogCache::SegmentPath(uint64_t version) const
+{
+  return m_nativePath + "." + std::to_string((unsigned long long)version);
+}
+
+
+/**
+* セグメントを読み取り専用でマップします
+*/
+std::shared_ptr<const CatalogSnapshot> CatalogCache::MapSegment(uint64_t version, OString &error)
+{
+  std::shared_ptr<const CatalogSnapshot> result;
+#ifndef _WIN32
+  std::string segPath = SegmentPath(version);
+  int fd = open(segPath.c_str(), O_RDONLY);
+  if(fd < 0) {
+    error = SystemError(_O("open"));
+    return result;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CATALOG_SEGMENT_HEADER)) {
+    error = _O("カタログキャッシュのセグメントが不正です");
+    close(fd);
+    return result;
+  }
+  void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // マップ後はfdは不要(セグメントが削除されてもマップは有効)
+  close(fd);
+  if(p == MAP_FAILED) {
+    error = SystemError(_O("mmap"));
+    return result;
+  }
+
+  const CATALOG_SEGMENT_HEADER *h = (const CATALOG_SEGMENT_HEADER *)p;
+  if(memcmp(h->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 ||
+     h->layout != CATALOG_LAYOUT || h->version != version ||
+     h->totalSize != (uint64_t)st.st_size) {
+    munmap(p, (size_t)st.st_size);
+    error = _O("カタログキャッシュのセグメントが不正です");
+    return result;
+  }
+
+  CatalogSnapshot *snapshot = new CatalogSnapshot();
+  snapshot->m_version = version;
+  snapshot->m_base = (const char *)p;
+  snapshot->m_size = (size_t)st.st_size;
+  result.reset(snapshot);
+#endif
+  return result;
+}
+
+
+/**
+* 公開中のスナップショットを取得します
+*
+* プロセス間のロックは取りません。公開番号が変わっていれば新しいセグメントを
+* マップし直します。取得したスナップショットは保持している間は有効です。
+*
+* @param[out] error エラーメッセージ
+* @return スナップショット(未公開、エラーの場合はnullptr)
+*/
+std::shared_ptr<const CatalogSnapshot> CatalogCache::Acquire(OString &error)
+{
+  std::shared_ptr<const CatalogSnapshot> result;
+  if(!m_control) {
+    error = _O("カタログキャッシュが開かれていません");
+    return result;
+  }
+
+  // 書き込み側が旧セグメントを削除した直後に読んだ場合は番号を読み直す
+  for(int retry = 0; retry < 3; retry++) {
+    uint64_t version = CurrentVersion();
+    if(version == 0) {
+      return result;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_snapshotMutex);
+      if(m_snapshot && m_snapshot->Version() == version) {
+        return m_snapshot;
+      }
+    }
+    result = MapSegment(version, error);
+    if(result) {
+      std::lock_guard<std::mutex> lock(m_snapshotMutex);
+      m_snapshot = result;
+      return result;
+    }
+  }
+  return result;
+}
+
+
+/**
+* 書き込み側の排他を取得します(他プロセスの公開が終わるまで待ちます)
+*/
+bool CatalogCache::LockWriter(OString &error)
+{
+#ifdef _WIN32
+  error = _O("カタログキャッシュはこのOSでは未対応です");
+  return false;
+#else
+  if(!m_control) {
+    error = _O("カタログキャッシュが開かれていません");
+    return false;
+  }
+  // 同じインスタンスのスレッド間はOFDロックでは排他されないのでmutexで排他する
+  m_writerMutex.lock();
+  if(LockControlFile(m_fd, true, LOCK_WRITER) < 0) {
+    error = SystemError(_O("fcntl"));
+    m_writerMutex.unlock();
+    return false;
+  }
+  m_writerLocked = true;
+  return true;
+#endif
+}
+
+
+/**
+* 書き込み側の排他を解放します
+*/
+void CatalogCache::UnlockWriter()
+{
+#ifndef _WIN32
+  if(!m_writerLocked) {
+    return;
+  }
+  LockControlFile(m_fd, false, LOCK_WRITER);
+  m_writerLocked = false;
+  m_writerMutex.unlock();
+#endif
+}
+
+
+/**
+* 新しいスナップショットを作成して公開します
+*
+* @param[in] tables テーブル情報
+* @param[in] columns カラム情報
+* @param[in] scope 取得した範囲(検索条件)
+* @param[out] version 公開したスナップショット番号
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool CatalogCache::Publish(
+  const std::vector<CatalogTable> &tables,
+  const std::vector<CatalogColumn> &columns,
+  const CatalogFilter &scope,
+  uint64_t &version, OString &error)
+{
+#ifdef _WIN32
+  error = _O("カタログキャッシュはこのOSでは未対応です");
+  return false;
+#else
+  if(!m_writerLocked) {
+    error = _O("カタログキャッシュの書き込みロックがありません");
+    return false;
+  }
+
+  //
+  // セグメント内容の作成
+  //
+  CatalogStringPool pool;
+  CatalogStringRef scopeRefs[4];
+  scopeRefs[0] = pool.Add(scope.catalog);
+  scopeRefs[1] = pool.Add(scope.schema);
+  scopeRefs[2] = pool.Add(scope.table);
+  scopeRefs[3] = pool.Add(scope.tableType);
+  std::vector<CatalogTableRecord> tableRecords(tables.size());
+  for(size_t i = 0; i < tables.size(); i++) {
+    const CatalogTable &t = tables[i];
+    CatalogTableRecord &r = tableRecords[i];
+    r.catalog = pool.Add(t.catalog);
+    r.schema = pool.Add(t.schema);
+    r.name = pool.Add(t.name);
+    r.type = pool.Add(t.type);
+    r.remarks = pool.Add(t.remarks);
+  }
+  std::vector<CatalogColumnRecord> columnRecords(columns.size());
+  for(size_t i = 0; i < columns.size(); i++) {
+    const CatalogColumn &c = columns[i];
+    CatalogColumnRecord &r = columnRecords[i];
+    r.catalog = pool.Add(c.catalog);
+    r.schema = pool.Add(c.schema);
+    r.table = pool.Add(c.table);
+    r.name = pool.Add(c.name);
+    r.remarks = pool.Add(c.remarks);
+    r.defaultValue = pool.Add(c.defaultValue);
+    r.size = c.size;
+    r.type = c.type;
+    r.decimalDigits = c.decimalDigits;
+    r.numPrec = c.numPrec;
+    r.nullable = c.nullable ? 1 : 0;
+    r.reserved = 0;
+  }
+
+  version = CurrentVersion() + 1;
+
+  CATALOG_SEGMENT_HEADER header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+  header.layout = CATALOG_LAYOUT;
+  header.version = version;
+  header.createdAt = NowMillis();
+  header.tableCount = (uint32_t)tableRecords.size();
+  header.columnCount = (uint32_t)columnRecords.size();
+  memcpy(header.scope, scopeRefs, sizeof(header.scope));
+  header.tableOffset = Align8(sizeof(header));
+  header.columnOffset = Align8(header.tableOffset + tableRecords.size() * sizeof(CatalogTableRecord));
+  header.stringOffset = Align8(header.columnOffset + columnRecords.size() * sizeof(CatalogColumnRecord));
+  header.stringSize = pool.Chars().size();
+  header.totalSize = header.stringOffset + header.stringSize;
+
+  //
+  // 一時ファイルに書いてからrenameで差し替え
+  //
+  std::string segPath = SegmentPath(version);
+  std::string tmpPath = segPath + ".tmp" + std::to_string((long long)getpid());
+  FILE *fp = fopen(tmpPath.c_str(), "wb");
+  if(!fp) {
+    error = SystemError(_O("fopen"));
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  ok = ok && WritePadding(fp, header.tableOffset - sizeof(header));
+  if(ok && !tableRecords.empty()) {
+    ok = fwrite(&tableRecords[0], sizeof(CatalogTableRecord), tableRecords.size(), fp) == tableRecords.size();
+  }
+  uint64_t pos = header.tableOffset + tableRecords.size() * sizeof(CatalogTableRecord);
+  ok = ok && WritePadding(fp, header.columnOffset - pos);
+  if(ok && !columnRecords.empty()) {
+    ok = fwrite(&columnRecords[0], sizeof(CatalogColumnRecord), columnRecords.size(), fp) == columnRecords.size();
+  }
+  pos = header.columnOffset + columnRecords.size() * sizeof(CatalogColumnRecord);
+  ok = ok && WritePadding(fp, header.stringOffset - pos);
+  if(ok && header.stringSize > 0) {
+    ok = fwrite(pool.Chars().data(), header.stringSize, 1, fp) == 1;
+  }
+  ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+  if(fclose(fp) != 0) {
+    ok = false;
+  }
+  if(!ok) {
+    error = SystemError(_O("write"));
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  if(rename(tmpPath.c_str(), segPath.c_str()) != 0) {
+    error = SystemError(_O("rename"));
+    unlink(tmpPath.c_str());
+    return false;
+  }
+
+  //
+  // 公開(番号をアトミックに更新)
+  //
+  m_control->publishedAt.store(header.createdAt, std::memory_order_release);
+  m_control->version.store(version, std::memory_order_release);
+  msync(m_control, CONTROL_SIZE, MS_ASYNC);
+
+  // 古いセグメントを削除(マップ中のプロセスはそのまま読める)
+  for(uint64_t old = version > m_keep ? version - m_keep : 0; old > 0; old--) {
+    if(unlink(SegmentPath(old).c_str()) != 0 && errno == ENOENT) {
+      break;
+    }
+  }
+  return true;
+#endif
+}
+
+
+/**
+* ODBC検索パターンと一致するか判定します
+*
+* % は任意の文字列、_ は任意の1文字(utf-8の1文字)、\ はエスケープ
+*/
+bool CatalogCache::PatternMatch(const char *pattern, size_t plen, const char *str, size_t slen)
+{
+  size_t p = 0, s = 0;
+  // 直近の%の位置(バックトラック用)
+  size_t starP = (size_t)-1, starS = 0;
+
+  while(s < slen) {
+    if(p < plen && pattern[p] == '%') {
+      starP = ++p;
+      starS = s;
+      continue;
+    }
+    if(p < plen && pattern[p] == '_') {
+      // utf-8の1文字分進める
+      p++;
+      s++;
+      while(s < slen && (str[s] & 0xC0) == 0x80) s++;
+      continue;
+    }
+    if(p < plen) {
+      size_t q = p;
+      if(pattern[q] == '\\' && q + 1 < plen) {
+        q++;
+      }
+      if(pattern[q] == str[s]) {
+        p = q + 1;
+        s++;
+        continue;
+      }
+    }
+    if(starP != (size_t)-1) {
+      // %の一致範囲を1文字延ばしてやり直し
+      p = starP;
+      s = ++starS;
+      continue;
+    }
+    return false;
+  }
+  while(p < plen && pattern[p] == '%') {
+    p++;
+  }
+  return p == plen;
+}
@@ -0,0 +1,215 @@
+﻿#ifndef _CATALOGCACHE_H
+#define _CATALOGCACHE_H
+//
+// カタログキャッシュ(共有メモリマップドファイル)
+//
+// 同一ホストの複数プロセスでtables()/columns()の結果を共有します。
+//
+//   <path>           : 制御ファイル。公開中のスナップショット番号を保持
+//   <path>.<version> : スナップショット本体(セグメント)。作成後は不変
+//
+// 書き込み側はセグメントを一時ファイルに作成してrenameし、制御ファイルの
+// 番号をアトミックに更新して公開します。読み込み側は番号を読んで該当
+// セグメントをmmapするだけなのでロックを取りません。
+//
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "omnicommon.h"
+
+// テーブル情報(文字列はすべてutf-8)
+struct CatalogTable {
+  std::string catalog;
+  std::string schema;
+  std::string name;
+  std::string type;
+  std::string remarks;
+};
+
+// カラム情報(文字列はすべてutf-8)
+struct CatalogColumn {
+  std::string catalog;
+  std::string schema;
+  std::string table;
+  std::string name;
+  std::string remarks;
+  std::string defaultValue;
+  int32_t size;
+  int16_t type;
+  int16_t decimalDigits;
+  int16_t numPrec;
+  bool nullable;
+};
+
+// 検索条件(ODBCの検索パターン。空の場合は全件)
+struct CatalogFilter {
+  std::string catalog;
+  std::string schema;
+  std::string table;
+  std::string column;
+  // テーブル種別(カンマ区切り。例: "TABLE,VIEW")
+  std::string tableType;
+};
+
+// セグメント内の文字列参照
+struct CatalogStringRef {
+  uint32_t offset;
+  uint32_t length;
+};
+
+// セグメント内のテーブルレコード
+struct CatalogTableRecord {
+  CatalogStringRef catalog;
+  CatalogStringRef schema;
+  CatalogStringRef name;
+  CatalogStringRef type;
+  CatalogStringRef remarks;
+};
+
+// セグメント内のカラムレコード
+struct CatalogColumnRecord {
+  CatalogStringRef catalog;
+  CatalogStringRef schema;
+  CatalogStringRef table;
+  CatalogStringRef name;
+  CatalogStringRef remarks;
+  CatalogStringRef defaultValue;
+  int32_t size;
+  int16_t type;
+  int16_t decimalDigits;
+  int16_t numPrec;
+  uint8_t nullable;
+  uint8_t reserved;
+};
+
+//
+// 公開済みスナップショット(読み取り専用のmmap領域)
+//
+class CatalogSnapshot {
+public:
+  ~CatalogSnapshot();
+
+  // スナップショット番号
+  uint64_t Version() const { return m_version; }
+  // 作成日時(エポックミリ秒)
+  uint64_t CreatedAt() const;
+  // セグメントサイズ
+  size_t Bytes() const { return m_size; }
+
+  // テーブル数
+  uint32_t TableCount() const;
+  // カラム数
+  uint32_t ColumnCount() const;
+  // テーブルレコード取得
+  const CatalogTableRecord &TableAt(uint32_t i) const;
+  // カラムレコード取得
+  const CatalogColumnRecord &ColumnAt(uint32_t i) const;
+  // セグメント内文字列の先頭
+  const char *Chars(const CatalogStringRef &ref) const;
+  // セグメント内文字列取得
+  std::string Str(const CatalogStringRef &ref) const;
+
+  // 取得した範囲(Publishで指定した条件)
+  CatalogFilter Scope() const;
+  // 検索条件の全件を持っているか(tablesはテーブル種別も比べる)
+  bool Covers(const CatalogFilter &filter, bool tables) const;
+
+  // 条件に一致するテーブル取得
+  void FindTables(const CatalogFilter &filter, std::vector<CatalogTable> &out) const;
+  // 条件に一致するカラム取得
+  void FindColumns(const CatalogFilter &filter, std::vector<CatalogColumn> &out) const;
+
+private:
+  friend class CatalogCache;
+  CatalogSnapshot() : m_version(0), m_base(NULL), m_size(0) {}
+
+  // 文字列参照とパターンの比較
+  bool Match(const std::string &pattern, const CatalogStringRef &ref) const;
+
+  uint64_t m_version;
+  const char *m_base;
+  size_t m_size;
+};
+
+//
+// カタログキャッシュ
+//
+class CatalogCache {
+public:
+  CatalogCache();
+  ~CatalogCache();
+
+  // 制御ファイルを開きます(無ければ作成)
+  bool Open(const OString &path, OString &error);
+  // 開いているか
+  bool IsOpen() const { return m_control != NULL; }
+  // 制御ファイルのパス
+  const OString &Path() const { return m_path; }
+
+  // 公開中のスナップショット番号(0は未公開)
+  uint64_t CurrentVersion() const;
+  // 公開日時(エポックミリ秒)
+  uint64_t PublishedAt() const;
+
+  // 公開中のスナップショットを取得します(無ければnullptr)
+  std::shared_ptr<const CatalogSnapshot> Acquire(OString &error);
+
+  // 書き込み側のプロセス間排他
+  bool LockWriter(OString &error);
+  void UnlockWriter();
+
+  // 新しいスナップショットを公開します ※LockWriter()済みであること
+  // scopeは取得した範囲(検索条件)で、スナップショットに記録します
+  bool Publish(
+    const std::vector<CatalogTable> &tables,
+    const std::vector<CatalogColumn> &columns,
+    const CatalogFilter &scope,
+    uint64_t &version, OString &error);
+
+  // 保持する旧セグメント数
+  void SetKeepSegments(uint32_t keep) { m_keep = keep; }
+
+  // ODBC検索パターン(% _ \)との一致判定
+  static bool PatternMatch(const char *pattern, size_t plen, const char *str, size_t slen);
+
+private:
+  struct Control;
+
+  // セグメントファイル名
+  std::string SegmentPath(uint64_t version) const;
+  // セグメントをマップ
+  std::shared_ptr<const CatalogSnapshot> MapSegment(uint64_t version, OString &error);
+  void Close();
+
+  OString m_path;
+  std::string m_nativePath;
+  int m_fd;
+  Control *m_control;
+  uint32_t m_keep;
+  bool m_writerLocked;
+
+  // 同一インスタンスのスレッド間の書き込み排他(OFDロックはファイル記述単位のため)
+  std::mutex m_writerMutex;
+  // マップ済みスナップショットの差し替え用
+  std::mutex m_snapshotMutex;
+  std::shared_ptr<const CatalogSnapshot> m_snapshot;
+};
+
+//
+// 書き込みロックの自動解放
+//
+class CatalogWriterGuard {
+public:
+  explicit CatalogWriterGuard(CatalogCache &cache) : m_cache(cache) {}
+  ~CatalogWriterGuard() { m_cache.UnlockWriter(); }
+private:
+  CatalogWriterGuard(const CatalogWriterGuard &);
+  CatalogWriterGuard &operator=(const CatalogWriterGuard &);
+  CatalogCache &m_cache;
+};
+
+#endif
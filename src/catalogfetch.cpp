@@ -0,0 +1,444 @@
+﻿#include "catalogfetch.h"
+
+#include <memory>
+#include <utility>
+
+#include "bufferpool.h"
+
+
+// SQLの型名
+typedef struct SQLTYPENAME {
+  SQLSMALLINT type;
+  const SQLTCHAR *name;
+  const SQLTCHAR *className;
+} SQLTYPENAME;
+
+// SQLのタイプ名
+// https://www.ibm.com/docs/ja/i/7.3?topic=wdica-data-types-data-conversion-in-db2-i-cli-functions#rzadphddtdcn__tbcsql
+// https://docs.microsoft.com/ja-jp/sql/odbc/reference/appendixes/sql-data-types?view=sql-server-ver15
+static const SQLTYPENAME SQLTYPENAMES[] = {
+  // CHAR (n) : 固定長文字列の文字列。
+  { SQL_CHAR, (SQLTCHAR *)_O("SQL_CHAR"), (SQLTCHAR *)_O("String")},
+  // VARCHAR (n) : 最大文字列長 n の可変長文字列。
+  { SQL_VARCHAR, (SQLTCHAR *)_O("SQL_VARCHAR"), (SQLTCHAR *)_O("String") },
+  // LONG VARCHAR : 可変長文字データ。 最大長は、データソースに依存します。
+  { SQL_LONGVARCHAR, (SQLTCHAR *)_O("SQL_LONGVARCHAR"), (SQLTCHAR *)_O("String") },
+  // WCHAR (n) : 固定長文字列の Unicode 文字列の長さ n
+  { SQL_WCHAR, (SQLTCHAR *)_O("SQL_WCHAR"), (SQLTCHAR *)_O("String") },
+  // VARWCHAR (n) : 最大文字列長を持つ Unicode 可変長文字列 n
+  { SQL_WVARCHAR, (SQLTCHAR *)_O("SQL_WVARCHAR"), (SQLTCHAR *)_O("String") },
+  // LONGWVARCHAR : Unicode 可変長文字データ。 最大長はデータソースに依存します
+  { SQL_WLONGVARCHAR, (SQLTCHAR *)_O("SQL_WLONGVARCHAR"), (SQLTCHAR *)_O("String") },
+  // DECIMAL (p,s) : 少なくとも p と scale s の有効桁数を持つ符号付きの正確な数値 。
+  // (最大有効桁数はドライバーで定義されています)。
+  // (1 <= p <= 15;s <= p)。4/4
+  { SQL_DECIMAL, (SQLTCHAR *)_O("SQL_DECIMAL"), (SQLTCHAR *)_O("Number") },
+  // NUMERIC (p,s) : 精度が p で小数点以下桁数が s の符号付きの正確な数値
+  // (1 <= p <= 15;s <= p)。4/4
+  { SQL_NUMERIC, (SQLTCHAR *)_O("SQL_NUMERIC"), (SQLTCHAR *)_O("Number") },
+  // SMALLINT : 精度が5および小数点以下桁数が0の numeric 値
+  // (符号付き:-32768 <= n <= 32767、unsigned: 0 <= n <= 65535) [3]。
+  { SQL_SMALLINT, (SQLTCHAR *)_O("SQL_SMALLINT"), (SQLTCHAR *)_O("Number") },
+  // INTEGER : 有効桁数が10および小数点以下桁数が0の正確な数値
+  // (符号付き:-2 [31] <= n <= 2 [31]-1、符号なし: 0 <= n <= 2 [32]-1) [3]。
+  { SQL_INTEGER, (SQLTCHAR *)_O("SQL_INTEGER"), (SQLTCHAR *)_O("Number") },
+  // real : バイナリ精度 24 (0 または絶対値が 10 [-38] ~ 10 [38]) の符号付き概数値。
+  { SQL_REAL, (SQLTCHAR *)_O("SQL_REAL"), (SQLTCHAR *)_O("Number") },
+  // FLOAT (p) : 少なくとも p のバイナリ有効桁数を持つ、符号付きの概数型の数値。
+  // (最大有効桁数はドライバーで定義されています)。5/5
+  { SQL_FLOAT, (SQLTCHAR *)_O("SQL_FLOAT"), (SQLTCHAR *)_O("Number") },
+  // DOUBLE PRECISION : バイナリ精度 53 (0 または絶対値が 10 [-308] ~ 10 [308])
+  // の符号付き概数。数値。
+  { SQL_DOUBLE, (SQLTCHAR *)_O("SQL_DOUBLE"), (SQLTCHAR *)_O("Number") },
+  // BIT : 1ビットのバイナリデータ。8
+  { SQL_BIT, (SQLTCHAR *)_O("SQL_BIT"), (SQLTCHAR *)_O("Number") },
+  // TINYINT : 精度3および小数点以下桁数が0の正確な数値 
+  // (符号付き:-128 <= n <= 127、符号なし: 0 <= n <= 255) [3]。
+  { SQL_TINYINT, (SQLTCHAR *)_O("SQL_TINYINT"), (SQLTCHAR *)_O("Number") },
+  // bigint : 精度が 19 (符号付きの場合) または 20 (符号なしの場合) 
+  // および小数点以下桁数 0 (符号付きの場合) およびスケール 0 
+  // (符号付き:-2 [63] <= n <= 2 [63]-1、符号なし: 0 <= n <= 2 [64]-1) [3]、[9]
+  { SQL_BIGINT, (SQLTCHAR *)_O("SQL_BIGINT"), (SQLTCHAR *)_O("Number") },
+  // バイナリ (n) : 固定長 n のバイナリデータ。ませ
+  { SQL_BINARY, (SQLTCHAR *)_O("SQL_BINARY"), (SQLTCHAR *)_O("Binary") },
+  // VARBINARY (n) : 最大長 n の可変長バイナリデータ。 最大値は、ユーザーによって
+  // 設定されます。
+  { SQL_VARBINARY, (SQLTCHAR *)_O("SQL_VARBINARY"), (SQLTCHAR *)_O("Binary") },
+  // LONG VARBINARY : 可変長バイナリ データ。 最大長は、データソースに依存します。
+  { SQL_LONGVARBINARY, (SQLTCHAR *)_O("SQL_LONGVARBINARY"), (SQLTCHAR *)_O("Binary") },
+  // DATE : グレゴリオ暦の規則に準拠した年、月、日の各フィールド。 
+  // (この付録の後半の「 グレゴリオ暦の制約」を参照してください)。
+  { SQL_TYPE_DATE, (SQLTCHAR *)_O("SQL_TYPE_DATE"), (SQLTCHAR *)_O("Date") },
+  // 時間 (p) : 時間、分、および秒のフィールド。有効な値は 00 ~ 23 の時間、00 ~ 59
+  // の有効な値、および 00 ~ 61 の秒の有効な値です。 有効桁数 p 秒の有効桁数を示します。
+  { SQL_TYPE_TIME, (SQLTCHAR *)_O("SQL_TYPE_TIME"), (SQLTCHAR *)_O("Time") },
+  // タイムスタンプ (p) : 日付と時刻のデータ型に対して定義されている有効な値を持つ
+  // 年、月、日、時、分、および秒の各フィールド。
+  { SQL_TYPE_TIMESTAMP, (SQLTCHAR *)_O("SQL_TYPE_TIMESTAMP"), (SQLTCHAR *)_O("DateTime") },
+/* unix-odbcで未定義だった
+  // UTCDATETIME : Year、month、day、hour、minute、second、utchour、utcminute
+  // の各フィールド。 Utchour フィールドと utcminute フィールドの精度は1/10 マイクロ秒です。
+  { SQL_TYPE_UTCDATETIME, (SQLTCHAR *)_O("SQL_TYPE_UTCDATETIME" },
+  // UTCTIME : Hour、minute、second、utchour、utcminute の各フィールド。 Utchour
+  // フィールドと utcminute フィールドの精度は1/10 マイクロ秒です。
+  { SQL_TYPE_UTCTIME, (SQLTCHAR *)_O("SQL_TYPE_UTCTIME" },
+*/
+  // 間隔月 (p) : 2つの日付の間の月数。 p は、間隔の有効桁数です。
+  { SQL_INTERVAL_MONTH, (SQLTCHAR *)_O("SQL_INTERVAL_MONTH"), (SQLTCHAR *)_O("Number") },
+  // 間隔の年 (p) : 2つの日付間の年数 p は、間隔の有効桁数です。
+  { SQL_INTERVAL_YEAR, (SQLTCHAR *)_O("SQL_INTERVAL_YEAR"), (SQLTCHAR *)_O("Number") },
+  // 間隔の年 (p) から月 : 2つの日付間の年と月の数。 p は、間隔の有効桁数です。
+  { SQL_INTERVAL_YEAR_TO_MONTH, (SQLTCHAR *)_O("SQL_INTERVAL_YEAR_TO_MONTH"), (SQLTCHAR *)_O("Number") },
+  // 間隔の日 (p) : 2つの日付の間の日数 p は、間隔の有効桁数です。
+  { SQL_INTERVAL_DAY, (SQLTCHAR *)_O("SQL_INTERVAL_DAY"), (SQLTCHAR *)_O("Number") },
+  // 間隔 (時間) (p) : 2つの日付/時刻の間の時間数。 p は、間隔の有効桁数です。
+  { SQL_INTERVAL_HOUR, (SQLTCHAR *)_O("SQL_INTERVAL_HOUR"), (SQLTCHAR *)_O("Number") },
+  // 間隔 (分) (p) : 2つの日付/時刻の間の分数 p は、間隔の有効桁数です。
+  { SQL_INTERVAL_MINUTE, (SQLTCHAR *)_O("SQL_INTERVAL_MINUTE"), (SQLTCHAR *)_O("Number") },
+  // INTERVAL 秒 (p,q) : 2つの日付/時刻の間の秒数。 p は間隔の先頭の有効桁数
+  // で、 q は間隔の秒の有効桁数です。
+  { SQL_INTERVAL_SECOND, (SQLTCHAR *)_O("SQL_INTERVAL_SECOND"), (SQLTCHAR *)_O("Number") },
+  // 間隔の日 (p) から時間 : 2つの日付/時刻の間の日数/時間。 p は、間隔の
+  // 有効桁数です。
+  { SQL_INTERVAL_DAY_TO_HOUR, (SQLTCHAR *)_O("SQL_INTERVAL_DAY_TO_HOUR"), (SQLTCHAR *)_O("Number") },
+  // 間隔の日 (p) から分 : 2つの日付/時刻の間の日数/時間/分 p は、間隔の
+  // 有効桁数です。
+  { SQL_INTERVAL_DAY_TO_MINUTE, (SQLTCHAR *)_O("SQL_INTERVAL_DAY_TO_MINUTE"), (SQLTCHAR *)_O("Number") },
+  // 間隔の日 (p) から秒 (q) : 2つの日付/時刻の間の日数/時間/分/秒 p は間隔
+  // の先頭の有効桁数で、 q は間隔の秒の有効桁数です。
+  { SQL_INTERVAL_DAY_TO_SECOND, (SQLTCHAR *)_O("SQL_INTERVAL_DAY_TO_SECOND"), (SQLTCHAR *)_O("Number") },
+  // INTERVAL 時間 (p) から分 : 2つの日付/時刻の間の時間数/分 p は、間隔の
+  // 有効桁数です。
+  { SQL_INTERVAL_HOUR_TO_MINUTE, (SQLTCHAR *)_O("SQL_INTERVAL_HOUR_TO_MINUTE"), (SQLTCHAR *)_O("Number") },
+  // INTERVAL 時間 (p) から秒 (q) : 2つの日付/時刻の間の時間数/分/秒。
+  // p は間隔の先頭の有効桁数で、 q は間隔の秒の有効桁数です。
+  { SQL_INTERVAL_HOUR_TO_SECOND, (SQLTCHAR *)_O("SQL_INTERVAL_HOUR_TO_SECOND"), (SQLTCHAR *)_O("Number") },
+  // 間隔 (分) (p) から秒 (q) : 2つの日付/時刻の間の分数 (秒単位)。
+  // p は間隔の先頭の有効桁数で、 q は間隔の秒の有効桁数です。
+  { SQL_INTERVAL_MINUTE_TO_SECOND, (SQLTCHAR *)_O("SQL_INTERVAL_MINUTE_TO_SECOND"), (SQLTCHAR *)_O("Number") },
+  // GUID : 固定長 GUID。
+  { SQL_GUID, (SQLTCHAR *)_O("SQL_GUID"), (SQLTCHAR *)_O("Guid") }
+};
+
+
+/**
+* SQL ODBC型名を取得します
+*
+* @param[in] type ODBCの型
+* @return const SQLTCHAR* 型名(未知の型は空文字列)
+*/
+const SQLTCHAR *SqlTypeName(SQLSMALLINT type)
+{
+  int numType = sizeof(SQLTYPENAMES) / sizeof(SQLTYPENAME);
+  for(int i = 0; i < numType; i++) {
+    if(SQLTYPENAMES[i].type == type) {
+      return SQLTYPENAMES[i].name;
+    }
+  }
+  return (const SQLTCHAR *)_O("");
+}
+
+
+/**
+* SQL ODBC型名に対するクラス名を取得します
+*
+* @param[in] type ODBCの型
+* @return const SQLTCHAR* クラス名(未知の型は空文字列)
+*/
+const SQLTCHAR *SqlTypeClassName(SQLSMALLINT type)
+{
+  int numType = sizeof(SQLTYPENAMES) / sizeof(SQLTYPENAME);
+  for(int i = 0; i < numType; i++) {
+    if(SQLTYPENAMES[i].type == type) {
+      return SQLTYPENAMES[i].className;
+    }
+  }
+  return (const SQLTCHAR *)_O("");
+}
+
+
+/**
+* ODBCの文字列をアリーナの文字列に変換します
+*
+* @param[in] text 文字列(NUL終端)
+* @return ArenaString utf-8の文字列
+*/
+ArenaString ToArenaText(const SQLTCHAR *text)
+{
+  #ifdef UNICODE
+  return ToArenaString(to_jsonstr(_S2O(text)));
+  #else
+  return ArenaString((const char *)text);
+  #endif
+}
+
+
+/**
+* カタログの列の値を文字列に変換します
+*
+* 前後の空白はバインドした領域の上で削除し、一時的な文字列を作りません。
+*
+* @param[in] text 値(NUL終端)
+* @param[in] length 長さ(SQL_NULL_DATAは空文字列)
+* @param[in] trim 前後の空白を削除するか
+* @return std::string utf-8の文字列
+*/
+static std::string CatalogText(const SQLTCHAR *text, SQLLEN length, bool trim)
+{
+  if(length == SQL_NULL_DATA) {
+    return std::string();
+  }
+  const SQLTCHAR *begin = text;
+  const SQLTCHAR *end = text;
+  while(*end) {
+    end++;
+  }
+  if(trim) {
+    while(begin < end && *begin == ' ') {
+      begin++;
+    }
+    while(end > begin && *(end - 1) == ' ') {
+      end--;
+    }
+  }
+  #ifdef UNICODE
+  return to_jsonstr(OString((const wchar_t *)begin, end - begin));
+  #else
+  return std::string((const char *)begin, (const char *)end);
+  #endif
+}
+
+
+/**
+* テーブル情報をODBCから取得します
+*
+* @param[in] hOdbc 接続ハンドル
+* @param[in] catalog カタログ条件(nullptrは条件なし)
+* @param[in] schema スキーマ条件
+* @param[in] table テーブル条件
+* @param[in] tableType テーブル種別
+* @param[out] tables テーブル情報
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool FetchCatalogTables(
+  SQLHDBC hOdbc, SQLTCHAR *catalog, SQLTCHAR *schema, SQLTCHAR *table, SQLTCHAR *tableType,
+  std::vector<CatalogTable> &tables, OString &error)
+{
+  SQLRETURN ret;
+
+  // テーブル情報取得
+  // https://www.ibm.com/docs/ja/i/7.3?topic=functions-sqlcolumns-get-column-information-table
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(hOdbc));
+  if(!SQL_SUCCEEDED(ret = 
+    SQLTables(
+      stmt.get(),
+      catalog, catalog == nullptr ? 0 : SQL_NTS,
+      schema, schema == nullptr ? 0 : SQL_NTS,
+      table, table == nullptr ? 0 : SQL_NTS,
+      tableType, tableType == nullptr ? 0 : SQL_NTS))) {
+    error = OdbcErrorMessage(_O("SQLTables"), ret, SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }  
+
+  //
+  // テーブル情報を出力
+  //
+  // 列の領域はまとめてプールから借りる
+  BufferLease buffers((4 * CATALOG_DATA_LENGTH + CATALOG_REMARK_LENGTH) * sizeof(SQLTCHAR));
+  if(!buffers.data()) {
+    error = _O("列の領域を確保できません");
+    return false;
+  }
+  SQLTCHAR *colCatalog = (SQLTCHAR *)buffers.data();
+  SQLTCHAR *colSchema = colCatalog + CATALOG_DATA_LENGTH;
+  SQLTCHAR *colTable = colSchema + CATALOG_DATA_LENGTH;
+  SQLTCHAR *colTableType = colTable + CATALOG_DATA_LENGTH;
+  SQLTCHAR *colRemarks = colTableType + CATALOG_DATA_LENGTH;
+  SQLLEN sizCatalog; 
+  SQLLEN sizSchema;  
+  SQLLEN sizTable;  
+  SQLLEN sizTableType;  
+  SQLLEN sizRemarks;  
+  #ifdef UNICODE
+  SQLSMALLINT ctype = SQL_C_WCHAR;
+  #else
+  SQLSMALLINT ctype = SQL_C_CHAR;
+  #endif
+
+  SQLBindCol(stmt.get(), 1, ctype, colCatalog, CATALOG_DATA_LENGTH * sizeof(SQLTCHAR), &sizCatalog);  
+  SQLBindCol(stmt.get(), 2, ctype, colSchema, CATALOG_DATA_LENGTH * sizeof(SQLTCHAR), &sizSchema);  
+  SQLBindCol(stmt.get(), 3, ctype, colTable, CATALOG_DATA_LENGTH * sizeof(SQLTCHAR), &sizTable);  
+  SQLBindCol(stmt.get(), 4, ctype, colTableType, CATALOG_DATA_LENGTH * sizeof(SQLTCHAR), &sizTableType);  
+  SQLBindCol(stmt.get(), 5, ctype, colRemarks, CATALOG_REMARK_LENGTH * sizeof(SQLTCHAR), &sizRemarks);  
+
+  // 全ての列情報を出力
+  while ((ret = SQLFetch(stmt.get())) == SQL_SUCCESS) {
+    CatalogTable t;
+    t.catalog = CatalogText(colCatalog, sizCatalog, false);
+    t.schema = CatalogText(colSchema, sizSchema, false);
+    t.name = CatalogText(colTable, sizTable, false);
+    t.type = CatalogText(colTableType, sizTableType, false);
+    t.remarks = CatalogText(colRemarks, sizRemarks, true);
+    tables.push_back(std::move(t));
+  }
+  return true;
+}
+
+
+/**
+* カラム情報をODBCから取得します
+*
+* @param[in] hOdbc 接続ハンドル
+* @param[in] catalog カタログ条件(nullptrは条件なし)
+* @param[in] schema スキーマ条件
+* @param[in] table テーブル条件
+* @param[in] column カラム条件
+* @param[out] columns カラム情報
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool FetchCatalogColumns(
+  SQLHDBC hOdbc, SQLTCHAR *catalog, SQLTCHAR *schema, SQLTCHAR *table, SQLTCHAR *column,
+  std::vector<CatalogColumn> &columns, OString &error)
+{
+  SQLRETURN ret;
+
+  // テーブルのカラム情報取得
+  // https://www.ibm.com/docs/ja/i/7.3?topic=functions-sqlcolumns-get-column-information-table
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(hOdbc));
+
+  if(!SQL_SUCCEEDED(ret = 
+    SQLColumns(
+      stmt.get(),
+      catalog, catalog == nullptr ? 0 : SQL_NTS,
+      schema, schema == nullptr ? 0 : SQL_NTS,
+      table, table == nullptr ? 0 : SQL_NTS,
+      column, column == nullptr ? 0 : SQL_NTS))) {
+    error = OdbcErrorMessage(_O("SQLColumns"), ret, SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }  
+
+  //
+  // カラム情報を出力
+  //
+  // 列の領域はまとめてプールから借りる
+  BufferLease buffers((5 * CATALOG_DATA_LENGTH + CATALOG_REMARK_LENGTH) * sizeof(SQLTCHAR));
+  if(!buffers.data()) {
+    error = _O("列の領域を確保できません");
+    return false;
+  }
+  SQLTCHAR *colCatalog = (SQLTCHAR *)buffers.data();
+  SQLTCHAR *colSchema = colCatalog + CATALOG_DATA_LENGTH;
+  SQLTCHAR *colTable = colSchema + CATALOG_DATA_LENGTH;
+  SQLTCHAR *colColumn = colTable + CATALOG_DATA_LENGTH;
+  SQLTCHAR *colDefault = colColumn + CATALOG_DATA_LENGTH;
+  SQLTCHAR *colRemarks = colDefault + CATALOG_DATA_LENGTH;
+  SQLINTEGER colSize;
+  SQLSMALLINT colType;
+  SQLSMALLINT colDecimalDigits;
+  SQLSMALLINT colNumPrec; 
+  SQLSMALLINT colNullable;
+  SQLLEN sizCatalog;  
+  SQLLEN sizSchema;  
+  SQLLEN sizTable;  
+  SQLLEN sizColumn;  
+  SQLLEN sizType;
+  SQLLEN sizSize;  
+  SQLLEN sizDecimalDigits;  
+  SQLLEN sizNumPrec;  
+  SQLLEN sizNullable;  
+  SQLLEN sizRemarks;  
+  SQLLEN sizDefault;  
+  #ifdef UNICODE
+  SQLSMALLINT ctype = SQL_C_WCHAR;
+  #else
+  SQLSMALLINT ctype = SQL_C_CHAR;
+  #endif
+
+  SQLBindCol(stmt.get(),  1, ctype, colCatalog, CATALOG_DATA_LENGTH * sizeof(SQLTCHAR), &sizCatalog);  
+  SQLBindCol(stmt.get(),  2, ctype, colSchema, CATALOG_DATA_LENGTH * sizeof(SQLTCHAR), &sizSchema);  
+  SQLBindCol(stmt.get(),  3, ctype, colTable, CATALOG_DATA_LENGTH * sizeof(SQLTCHAR), &sizTable);  
+  SQLBindCol(stmt.get(),  4, ctype, colColumn, CATALOG_DATA_LENGTH * sizeof(SQLTCHAR), &sizColumn);  
+  SQLBindCol(stmt.get(),  5, SQL_C_SLONG, &colType, 0, &sizType);  
+  SQLBindCol(stmt.get(),  7, SQL_C_SLONG, &colSize, 0, &sizSize);  
+  SQLBindCol(stmt.get(),  9, SQL_C_SSHORT, &colDecimalDigits, 0, &sizDecimalDigits);  
+  SQLBindCol(stmt.get(), 10, SQL_C_SSHORT, &colNumPrec, 0, &sizNumPrec);  
+  SQLBindCol(stmt.get(), 11, SQL_C_SSHORT, &colNullable, 0, &sizNullable);
+  SQLBindCol(stmt.get(), 12, ctype, colRemarks, CATALOG_REMARK_LENGTH * sizeof(SQLTCHAR), &sizRemarks);  
+  SQLBindCol(stmt.get(), 13, ctype, colDefault, CATALOG_DATA_LENGTH * sizeof(SQLTCHAR), &sizDefault);  
+
+  while ((ret = SQLFetch(stmt.get())) == SQL_SUCCESS) {
+    CatalogColumn col;
+    col.catalog = CatalogText(colCatalog, sizCatalog, false);
+    col.schema = CatalogText(colSchema, sizSchema, false);
+    col.table = CatalogText(colTable, sizTable, false);
+    col.name = CatalogText(colColumn, sizColumn, false);
+    col.type = colType;
+    col.size = colSize;
+    col.decimalDigits = colDecimalDigits;
+    col.numPrec = colNumPrec;
+    col.remarks = CatalogText(colRemarks, sizRemarks, true);
+    col.defaultValue = CatalogText(colDefault, sizDefault, false);
+    col.nullable = (colNullable == SQL_NULLABLE) ? true : false;
+    columns.push_back(std::move(col));
+  }
+  return true;
+}
+
+
+/**
+* テーブル情報をJSONに変換します
+*
+* 節点・文字列はスレッドのアリーナ(無ければヒープ)から確保します。
+*
+* @param[in] tables テーブル情報
+* @return ArenaString tables()の返却形式のJSON文字列
+*/
+ArenaString CatalogTablesToJson(const std::vector<CatalogTable> &tables)
+{
+  ArenaJson result = ArenaJson::array();
+  for(size_t i = 0; i < tables.size(); i++) {
+    const CatalogTable &t = tables[i];
+    ArenaJson table = ArenaJson::object();
+    table["catalog"] = ToArenaString(t.catalog);
+    table["schema"] = ToArenaString(t.schema);
+    table["name"] = ToArenaString(t.name);
+    table["type"] = ToArenaString(t.type);
+    table["remarks"] = ToArenaString(t.remarks);
+    result.push_back(std::move(table));
+  }
+  return result.dump(-1, ' ', true, ArenaJson::error_handler_t::replace);
+}
+
+
+/**
+* カラム情報をJSONに変換します
+*
+* 節点・文字列はスレッドのアリーナ(無ければヒープ)から確保します。
+*
+* @param[in] columns カラム情報
+* @return ArenaString columns()の返却形式のJSON文字列
+*/
+ArenaString CatalogColumnsToJson(const std::vector<CatalogColumn> &columns)
+{
+  ArenaJson result = ArenaJson::array();
+  for(size_t i = 0; i < columns.size(); i++) {
+    const CatalogColumn &c = columns[i];
+    ArenaJson col = ArenaJson::object();
+    col["catalog"] = ToArenaString(c.catalog);
+    col["schema"] = ToArenaString(c.schema);
+    col["table"] = ToArenaString(c.table);
+    col["name"] = ToArenaString(c.name);
+    col["type"] = ToArenaText(SqlTypeName(c.type));
+    col["typeClass"] = ToArenaText(SqlTypeClassName(c.type));
+    col["size"] = c.size;
+    col["decimalDigits"] = c.decimalDigits;
+    col["numPrec"] = c.numPrec;
+    col["remarks"] = ToArenaString(c.remarks);
+    col["defualt"] = ToArenaString(c.defaultValue);
+    col["nullable"] = c.nullable;
+    result.push_back(std::move(col));
+  }
+  return result.dump(-1, ' ', true, ArenaJson::error_handler_t::replace);
+}
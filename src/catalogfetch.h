@@ -0,0 +1,42 @@
+﻿#ifndef _CATALOGFETCH_H
+#define _CATALOGFETCH_H
+//
+// カタログ(tables()/columns())の取得とJSON化
+//
+// SQLTables・SQLColumnsの行をCatalogTable・CatalogColumnに読み込み、
+// tables()/columns()の返却形式のJSON文字列に出力します。napiに依存しないので
+// ワーカースレッドやベンチマークからもそのまま使えます。
+//
+#include <vector>
+
+#include "omnicommon.h"
+#include "catalogcache.h"
+#include "callarena.h"
+
+// 文字列列の長さ(文字数)
+#define CATALOG_DATA_LENGTH 256
+// 備考列の長さ(文字数)
+#define CATALOG_REMARK_LENGTH 1024
+
+// SQL型名取得(未知の型は空文字列)
+const SQLTCHAR *SqlTypeName(SQLSMALLINT type);
+// SQL型属性取得(未知の型は空文字列)
+const SQLTCHAR *SqlTypeClassName(SQLSMALLINT type);
+// ODBCの文字列→アリーナの文字列(utf-8)変換
+ArenaString ToArenaText(const SQLTCHAR *text);
+
+// テーブル情報取得(条件はnullptrで指定なし)
+bool FetchCatalogTables(
+  SQLHDBC hOdbc, SQLTCHAR *catalog, SQLTCHAR *schema, SQLTCHAR *table, SQLTCHAR *tableType,
+  std::vector<CatalogTable> &tables, OString &error);
+// カラム情報取得(条件はnullptrで指定なし)
+bool FetchCatalogColumns(
+  SQLHDBC hOdbc, SQLTCHAR *catalog, SQLTCHAR *schema, SQLTCHAR *table, SQLTCHAR *column,
+  std::vector<CatalogColumn> &columns, OString &error);
+
+// テーブル情報→JSON文字列変換(tables()の返却形式、スレッドのアリーナから確保)
+ArenaString CatalogTablesToJson(const std::vector<CatalogTable> &tables);
+// カラム情報→JSON文字列変換(columns()の返却形式、スレッドのアリーナから確保)
+ArenaString CatalogColumnsToJson(const std::vector<CatalogColumn> &columns);
+
+#endif
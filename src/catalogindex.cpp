@@ -0,0 +1,490 @@
+﻿#include "catalogindex.h"
+
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+// トライグラムの1文字分のビット数(Unicodeは21ビットに収まる)
+#define GRAM_BITS 21
+
+
+/**
+* 3文字からトライグラムのキーを作成します
+*/
+static inline uint64_t GramKey(uint32_t c0, uint32_t c1, uint32_t c2)
+{
+  return ((uint64_t)c0 << (GRAM_BITS * 2)) | ((uint64_t)c1 << GRAM_BITS) | (uint64_t)c2;
+}
+
+
+/**
+* コードポイントをutf-8で追加します
+*/
+static void AppendUtf8(std::string &out, uint32_t c)
+{
+  if(c < 0x80) {
+    out.push_back((char)c);
+  } else if(c < 0x800) {
+    out.push_back((char)(0xC0 | (c >> 6)));
+    out.push_back((char)(0x80 | (c & 0x3F)));
+  } else if(c < 0x10000) {
+    out.push_back((char)(0xE0 | (c >> 12)));
+    out.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+    out.push_back((char)(0x80 | (c & 0x3F)));
+  } else {
+    out.push_back((char)(0xF0 | (c >> 18)));
+    out.push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+    out.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+    out.push_back((char)(0x80 | (c & 0x3F)));
+  }
+}
+
+
+/**
+* 文字列のトライグラムを列挙します
+*
+* 末尾に終端文字(0)を2つ補うので、1～2文字の部分文字列も必ずいずれかの
+* トライグラムの先頭に現れます(前方一致検索用)。
+*/
+template<typename Fn>
+static void ForEachGram(const std::vector<uint32_t> &cps, Fn fn)
+{
+  size_t n = cps.size();
+  for(size_t i = 0; i < n; i++) {
+    uint32_t c1 = (i + 1 < n) ? cps[i + 1] : 0;
+    uint32_t c2 = (i + 2 < n) ? cps[i + 2] : 0;
+    fn(GramKey(cps[i], c1, c2));
+  }
+}
+
+
+/**
+* 文字列の1文字・2文字の部分文字列を列挙します(1～2文字の検索用)
+*/
+template<typename Fn>
+static void ForEachShortGram(const std::vector<uint32_t> &cps, Fn fn)
+{
+  size_t n = cps.size();
+  for(size_t i = 0; i < n; i++) {
+    fn(GramKey(cps[i], 0, 0));
+    if(i + 1 < n) {
+      fn(GramKey(cps[i], cps[i + 1], 0));
+    }
+  }
+}
+
+
+/**
+* 検索用に正規化したコードポイント列を作成します
+*
+* @param[in] text utf-8文字列
+* @param[in] length バイト数
+* @param[out] codepoints 正規化済みコードポイント
+*/
+void CatalogIndex::Normalize(const char *text, size_t length, std::vector<uint32_t> &codepoints)
+{
+  codepoints.clear();
+  const unsigned char *p = (const unsigned char *)text;
+  size_t i = 0;
+  while(i < length) {
+    uint32_t c = p[i];
+    size_t n = 1;
+    if(c >= 0x80) {
+      // 先頭バイトから長さを決め、続きのバイトを確かめる(途中で切れていれば不正)
+      size_t expect = 0;
+      if(c >= 0xF0 && c <= 0xF4) {
+        expect = 4;
+      } else if(c >= 0xE0 && c < 0xF0) {
+        expect = 3;
+      } else if(c >= 0xC2 && c < 0xE0) {
+        expect = 2;
+      }
+      bool valid = expect > 0 && expect <= length - i;
+      for(size_t k = 1; valid && k < expect; k++) {
+        valid = (p[i + k] & 0xC0) == 0x80;
+      }
+      if(!valid) {
+        // 不正なバイト
+        c = 0xFFFD;
+      } else if(expect == 4) {
+        c = ((c & 0x07) << 18) | ((p[i + 1] & 0x3F) << 12) | ((p[i + 2] & 0x3F) << 6) | (p[i + 3] & 0x3F);
+        n = 4;
+      } else if(expect == 3) {
+        c = ((c & 0x0F) << 12) | ((p[i + 1] & 0x3F) << 6) | (p[i + 2] & 0x3F);
+        n = 3;
+      } else {
+        c = ((c & 0x1F) << 6) | (p[i + 1] & 0x3F);
+        n = 2;
+      }
+    }
+    i += n;
+
+    if(c >= 0xFF01 && c <= 0xFF5E) {
+      // 全角英数記号→半角
+      c -= 0xFEE0;
+    } else if(c == 0x3000) {
+      // 全角空白
+      c = ' ';
+    } else if(c >= 0x3041 && c <= 0x3096) {
+      // ひらがな→カタカナ
+      c += 0x60;
+    }
+    if(c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    }
+    if(c == 0) {
+      continue;
+    }
+    codepoints.push_back(c);
+  }
+}
+
+
+/**
+* コンストラクタ
+*/
+CatalogIndex::CatalogIndex()
+{
+  m_tableCount = 0;
+}
+
+
+/**
+* 索引のメモリ使用量(概算)
+*/
+size_t CatalogIndex::Bytes() const
+{
+  return m_text.capacity() +
+    (m_fieldOffsets.capacity() + m_fieldLengths.capacity()) * sizeof(uint32_t) +
+    (m_gramKeys.capacity() + m_shortKeys.capacity()) * sizeof(uint64_t) +
+    (m_gramOffsets.capacity() + m_postings.capacity()) * sizeof(uint32_t) +
+    (m_shortOffsets.capacity() + m_shortPostings.capacity()) * sizeof(uint32_t);
+}
+
+
+/**
+* 文書の正規化済みフィールドを取得します
+*/
+void CatalogIndex::Field(uint32_t doc, int field, const char *&text, size_t &length) const
+{
+  text = m_text.data() + m_fieldOffsets[doc * 2 + field];
+  length = m_fieldLengths[doc * 2 + field];
+}
+
+
+/**
+* キーの位置を二分探索します
+*/
+static int64_t FindKey(const std::vector<uint64_t> &keys, uint64_t key)
+{
+  std::vector<uint64_t>::const_iterator it = std::lower_bound(keys.begin(), keys.end(), key);
+  if(it == keys.end() || *it != key) {
+    return -1;
+  }
+  return it - keys.begin();
+}
+
+
+/**
+* トライグラムの位置を二分探索します
+*/
+int64_t CatalogIndex::FindGram(uint64_t key) const
+{
+  return FindKey(m_gramKeys, key);
+}
+
+
+/**
+* キーごとの文書番号リストを作成します
+*
+* 1回目でキーごとの文書数を数えて格納位置を決め、2回目で文書番号を格納します
+* (文書順に処理するのでリストは昇順になる)。
+*
+* @param[in] docCount 文書数
+* @param[in] forEach 文書のキーを列挙する関数(doc, fn)
+* @param[out] keys キー(昇順)
+* @param[out] offsets キーごとのリストの位置(キー数+1)
+* @param[out] postings 文書番号リスト
+*/
+template<typename ForEach>
+static void BuildPostings(uint32_t docCount, ForEach forEach,
+  std::vector<uint64_t> &keys, std::vector<uint32_t> &offsets, std::vector<uint32_t> &postings)
+{
+  //
+  // 1回目: キーごとの文書数を数える
+  //
+  std::unordered_map<uint64_t, uint32_t> ids;
+  std::vector<uint32_t> counts;
+  std::vector<uint32_t> lastDoc;
+  for(uint32_t doc = 0; doc < docCount; doc++) {
+    forEach(doc, [&](uint64_t key) {
+      std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> r =
+        ids.insert(std::make_pair(key, (uint32_t)counts.size()));
+      if(r.second) {
+        counts.push_back(0);
+        lastDoc.push_back(0);
+      }
+      uint32_t id = r.first->second;
+      // 同じ文書は1回だけ数える
+      if(lastDoc[id] != doc + 1) {
+        lastDoc[id] = doc + 1;
+        counts[id]++;
+      }
+    });
+  }
+
+  //
+  // キー順に並べて格納位置を決める
+  //
+  std::vector<std::pair<uint64_t, uint32_t> > order;
+  order.reserve(ids.size());
+  for(std::unordered_map<uint64_t, uint32_t>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+    order.push_back(*it);
+  }
+  std::sort(order.begin(), order.end());
+
+  std::vector<uint32_t> cursor(order.size());
+  keys.resize(order.size());
+  offsets.resize(order.size() + 1);
+  uint32_t total = 0;
+  for(size_t i = 0; i < order.size(); i++) {
+    keys[i] = order[i].first;
+    offsets[i] = total;
+    cursor[order[i].second] = total;
+    total += counts[order[i].second];
+  }
+  offsets[order.size()] = total;
+
+  //
+  // 2回目: 文書番号を格納
+  //
+  postings.resize(total);
+  std::fill(lastDoc.begin(), lastDoc.end(), 0);
+  for(uint32_t doc = 0; doc < docCount; doc++) {
+    forEach(doc, [&](uint64_t key) {
+      uint32_t id = ids[key];
+      if(lastDoc[id] != doc + 1) {
+        lastDoc[id] = doc + 1;
+        postings[cursor[id]++] = doc;
+      }
+    });
+  }
+}
+
+
+/**
+* スナップショットから索引を作成します
+*
+* @param[in] snapshot カタログキャッシュのスナップショット
+*/
+void CatalogIndex::Build(const std::shared_ptr<const CatalogSnapshot> &snapshot)
+{
+  m_snapshot = snapshot;
+  m_text.clear();
+  m_fieldOffsets.clear();
+  m_fieldLengths.clear();
+  m_gramKeys.clear();
+  m_gramOffsets.clear();
+  m_postings.clear();
+  m_shortKeys.clear();
+  m_shortOffsets.clear();
+  m_shortPostings.clear();
+  m_tableCount = 0;
+  if(!snapshot) {
+    return;
+  }
+
+  //
+  // 文書ごとのフィールド(名前・備考)を正規化して保持
+  //
+  m_tableCount = snapshot->TableCount();
+  uint32_t columnCount = snapshot->ColumnCount();
+  uint32_t docCount = m_tableCount + columnCount;
+  m_fieldOffsets.reserve(docCount * 2);
+  m_fieldLengths.reserve(docCount * 2);
+
+  std::vector<uint32_t> cps;
+  for(uint32_t doc = 0; doc < docCount; doc++) {
+    const CatalogStringRef *fields[2];
+    if(doc < m_tableCount) {
+      const CatalogTableRecord &r = snapshot->TableAt(doc);
+      fields[CATALOG_FIELD_NAME] = &r.name;
+      fields[CATALOG_FIELD_REMARKS] = &r.remarks;
+    } else {
+      const CatalogColumnRecord &r = snapshot->ColumnAt(doc - m_tableCount);
+      fields[CATALOG_FIELD_NAME] = &r.name;
+      fields[CATALOG_FIELD_REMARKS] = &r.remarks;
+    }
+    for(int f = 0; f < 2; f++) {
+      Normalize(snapshot->Chars(*fields[f]), fields[f]->length, cps);
+      m_fieldOffsets.push_back((uint32_t)m_text.size());
+      for(size_t i = 0; i < cps.size(); i++) {
+        AppendUtf8(m_text, cps[i]);
+      }
+      m_fieldLengths.push_back((uint32_t)(m_text.size() - m_fieldOffsets.back()));
+    }
+  }
+
+  //
+  // トライグラムと1～2文字の索引
+  //
+  BuildPostings(docCount, [&](uint32_t doc, const std::function<void(uint64_t)> &fn) {
+    for(int f = 0; f < 2; f++) {
+      const char *text;
+      size_t length;
+      Field(doc, f, text, length);
+      Normalize(text, length, cps);
+      ForEachGram(cps, fn);
+    }
+  }, m_gramKeys, m_gramOffsets, m_postings);
+  BuildPostings(docCount, [&](uint32_t doc, const std::function<void(uint64_t)> &fn) {
+    for(int f = 0; f < 2; f++) {
+      const char *text;
+      size_t length;
+      Field(doc, f, text, length);
+      Normalize(text, length, cps);
+      ForEachShortGram(cps, fn);
+    }
+  }, m_shortKeys, m_shortOffsets, m_shortPostings);
+}
+
+
+/**
+* 文書のスコアを計算します
+*
+* 名前での一致を備考より、完全一致・前方一致・単語の先頭での一致を
+* 途中での一致より上位にします。同じ条件なら短い名前を上位にします。
+*
+* @return double スコア(一致しなければ0)
+*/
+double CatalogIndex::Score(uint32_t doc, const std::string &needle,
+  const CatalogSearchOptions &options, uint8_t &field) const
+{
+  double best = 0;
+  for(int f = 0; f < 2; f++) {
+    if(f == CATALOG_FIELD_REMARKS && !options.remarks) {
+      continue;
+    }
+    const char *text;
+    size_t length;
+    Field(doc, f, text, length);
+    if(length < needle.size()) {
+      continue;
+    }
+    const char *hit = std::search(text, text + length, needle.begin(), needle.end());
+    if(hit == text + length) {
+      continue;
+    }
+    size_t pos = hit - text;
+
+    double weight = (f == CATALOG_FIELD_NAME) ? 4.0 : 1.0;
+    double match;
+    if(pos == 0 && length == needle.size()) {
+      match = 4.0;
+    } else if(pos == 0) {
+      match = 2.5;
+    } else if(text[pos - 1] == '_' || text[pos - 1] == ' ' || text[pos - 1] == '.') {
+      match = 1.5;
+    } else {
+      match = 1.0;
+    }
+    double score = weight * match + 1.0 / (1.0 + (double)(length - needle.size()));
+    if(doc < m_tableCount) {
+      score += 0.25;
+    }
+    if(score > best) {
+      best = score;
+      field = (uint8_t)f;
+    }
+  }
+  return best;
+}
+
+
+/**
+* 上位K件を検索します
+*
+* @param[in] query 検索文字列(utf-8)
+* @param[in] options 検索オプション
+* @param[out] hits 検索結果(スコア順)
+*/
+void CatalogIndex::Search(const std::string &query, const CatalogSearchOptions &options,
+  std::vector<CatalogSearchHit> &hits) const
+{
+  hits.clear();
+
+  std::vector<uint32_t> q;
+  Normalize(query.data(), query.size(), q);
+  if(q.empty() || m_gramKeys.empty() || options.limit == 0) {
+    return;
+  }
+  std::string needle;
+  for(size_t i = 0; i < q.size(); i++) {
+    AppendUtf8(needle, q[i]);
+  }
+
+  //
+  // 候補の文書を集める
+  //
+  const uint32_t *candidates = NULL;
+  size_t candidateCount = 0;
+  if(q.size() >= 3) {
+    // 最も文書数の少ないトライグラムのリストを候補にする(残りは照合で確認)
+    for(size_t i = 0; i + 2 < q.size(); i++) {
+      int64_t g = FindGram(GramKey(q[i], q[i + 1], q[i + 2]));
+      if(g < 0) {
+        return;
+      }
+      size_t n = m_gramOffsets[g + 1] - m_gramOffsets[g];
+      if(candidates == NULL || n < candidateCount) {
+        candidates = &m_postings[m_gramOffsets[g]];
+        candidateCount = n;
+      }
+    }
+  } else {
+    // 1～2文字は作成時にまとめた文書番号リスト
+    int64_t g = FindKey(m_shortKeys, GramKey(q[0], q.size() > 1 ? q[1] : 0, 0));
+    if(g < 0) {
+      return;
+    }
+    candidates = &m_shortPostings[m_shortOffsets[g]];
+    candidateCount = m_shortOffsets[g + 1] - m_shortOffsets[g];
+  }
+
+  //
+  // 照合してスコアを付ける
+  //
+  for(size_t i = 0; i < candidateCount; i++) {
+    uint32_t doc = candidates[i];
+    bool isTable = doc < m_tableCount;
+    if((isTable && !options.tables) || (!isTable && !options.columns)) {
+      continue;
+    }
+    CatalogSearchHit hit;
+    hit.field = CATALOG_FIELD_NAME;
+    hit.score = Score(doc, needle, options, hit.field);
+    if(hit.score <= 0) {
+      continue;
+    }
+    hit.kind = isTable ? CATALOG_KIND_TABLE : CATALOG_KIND_COLUMN;
+    hit.record = isTable ? doc : doc - m_tableCount;
+    hits.push_back(hit);
+  }
+
+  //
+  // 上位K件
+  //
+  struct ByScore {
+    bool operator()(const CatalogSearchHit &a, const CatalogSearchHit &b) const {
+      if(a.score != b.score) return a.score > b.score;
+      if(a.kind != b.kind) return a.kind < b.kind;
+      return a.record < b.record;
+    }
+  };
+  if(hits.size() > options.limit) {
+    std::partial_sort(hits.begin(), hits.begin() + options.limit, hits.end(), ByScore());
+    hits.resize(options.limit);
+  } else {
+    std::sort(hits.begin(), hits.end(), ByScore());
+  }
+}
@@ -0,0 +1,102 @@
+﻿#ifndef _CATALOGINDEX_H
+#define _CATALOGINDEX_H
+//
+// カタログ検索インデックス
+//
+// カタログキャッシュのスナップショットから作成する、テーブル名・カラム名・
+// 備考(remarks)のトライグラム索引です。文字単位(コードポイント)で分割する
+// ため日本語もそのまま検索できます。1～2文字の検索は作成時にまとめた1文字・
+// 2文字の索引から候補を取り出します。
+//
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "catalogcache.h"
+
+// 検索対象の種類
+#define CATALOG_KIND_TABLE  0
+#define CATALOG_KIND_COLUMN 1
+
+// 一致したフィールド
+#define CATALOG_FIELD_NAME    0
+#define CATALOG_FIELD_REMARKS 1
+
+// 検索結果
+struct CatalogSearchHit {
+  // CATALOG_KIND_TABLE / CATALOG_KIND_COLUMN
+  uint8_t kind;
+  // 一致したフィールド
+  uint8_t field;
+  // スナップショット内のレコード番号
+  uint32_t record;
+  // スコア(大きいほど上位)
+  double score;
+};
+
+// 検索オプション
+struct CatalogSearchOptions {
+  // 最大件数
+  size_t limit;
+  // テーブルを対象にするか
+  bool tables;
+  // カラムを対象にするか
+  bool columns;
+  // 備考も対象にするか
+  bool remarks;
+
+  CatalogSearchOptions() : limit(20), tables(true), columns(true), remarks(true) {}
+};
+
+class CatalogIndex {
+public:
+  CatalogIndex();
+
+  // スナップショットから索引を作成します
+  void Build(const std::shared_ptr<const CatalogSnapshot> &snapshot);
+
+  // 作成元のスナップショット
+  const std::shared_ptr<const CatalogSnapshot> &Snapshot() const { return m_snapshot; }
+  // 作成元のスナップショット番号
+  uint64_t Version() const { return m_snapshot ? m_snapshot->Version() : 0; }
+  // 索引のメモリ使用量(概算)
+  size_t Bytes() const;
+
+  // 上位K件を検索します
+  void Search(const std::string &query, const CatalogSearchOptions &options,
+    std::vector<CatalogSearchHit> &hits) const;
+
+  // 検索用の正規化(英字小文字化・全角英数→半角・ひらがな→カタカナ)
+  static void Normalize(const char *text, size_t length, std::vector<uint32_t> &codepoints);
+
+private:
+  // 文書の正規化済みフィールド
+  void Field(uint32_t doc, int field, const char *&text, size_t &length) const;
+  // 文書のスコア計算(一致しなければ0)
+  double Score(uint32_t doc, const std::string &needle,
+    const CatalogSearchOptions &options, uint8_t &field) const;
+  // トライグラムの位置(無ければ-1)
+  int64_t FindGram(uint64_t key) const;
+
+  std::shared_ptr<const CatalogSnapshot> m_snapshot;
+  // テーブル数(これより後ろの文書はカラム)
+  uint32_t m_tableCount;
+
+  // 正規化済みテキスト(utf-8) と 文書ごとのフィールド位置
+  std::string m_text;
+  std::vector<uint32_t> m_fieldOffsets;
+  std::vector<uint32_t> m_fieldLengths;
+
+  // トライグラム(昇順) → 文書番号リスト
+  std::vector<uint64_t> m_gramKeys;
+  std::vector<uint32_t> m_gramOffsets;
+  std::vector<uint32_t> m_postings;
+
+  // 1文字・2文字(昇順) → 文書番号リスト
+  std::vector<uint64_t> m_shortKeys;
+  std::vector<uint32_t> m_shortOffsets;
+  std::vector<uint32_t> m_shortPostings;
+};
+
+#endif
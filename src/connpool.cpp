@@ -0,0 +1,660 @@
+﻿#include "connpool.h"
+
+
+/**
+* セッション(キーは初期化SQLを連結したもの)
+*
+* @param[in] s 初期化SQL
+*/
+PoolSession::PoolSession(const std::vector<OString> &s) : statements(s)
+{
+  for(size_t i = 0; i < statements.size(); i++) {
+    key += statements[i];
+    key += _O(";\n");
+  }
+}
+
+
+/**
+* 準備済みの文を取得します
+*
+* 接続を借りている間だけ使えます。文の数が上限を超えたら全て解放します。
+*
+* @param[in] sql SQL
+* @param[out] error エラーメッセージ
+* @return SQLHSTMT 準備済みの文(失敗時はNULL)
+*/
+SQLHSTMT PooledConnection::Prepare(const OString &sql, OString &error)
+{
+  std::map<OString, SQLHSTMT>::const_iterator it = statements.find(sql);
+  if(it != statements.end()) {
+    return it->second;
+  }
+  if(statements.size() >= POOL_STATEMENT_CACHE) {
+    FreeStatements();
+  }
+
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(hdbc));
+  if(!stmt) {
+    error = OdbcErrorMessage(_O("SQLAllocHandle"), SQL_ERROR, SQL_HANDLE_DBC, hdbc);
+    return NULL;
+  }
+  SQLRETURN ret = SQLPrepare(stmt.get(), (SQLTCHAR *)sql.c_str(), SQL_NTS);
+  if(!SQL_SUCCEEDED(ret)) {
+    error = OdbcErrorMessage(_O("SQLPrepare"), ret, SQL_HANDLE_STMT, stmt.get());
+    return NULL;
+  }
+  statements[sql] = stmt.get();
+  return stmt.release();
+}
+
+
+/**
+* 準備済みの文を全て解放します
+*/
+void PooledConnection::FreeStatements()
+{
+  for(std::map<OString, SQLHSTMT>::const_iterator it = statements.begin(); it != statements.end(); ++it) {
+    SQLFreeHandle(SQL_HANDLE_STMT, it->second);
+  }
+  statements.clear();
+}
+
+
+/**
+* コンストラクタ
+*/
+ConnectionPool::ConnectionPool()
+{
+  m_hEnv = NULL;
+  m_maxSize = 0;
+  m_minSize = 0;
+  m_loginTimeout = 0;
+  m_total = 0;
+  m_waiting = 0;
+  m_closed = false;
+  m_nextId = 1;
+  m_created = 0;
+  m_destroyed = 0;
+  m_acquired = 0;
+  m_timeouts = 0;
+  m_sessionHits = 0;
+  m_sessionInits = 0;
+  m_sessionEvictions = 0;
+  m_fetches = 0;
+  m_fetchRows = 0;
+  m_fetchBytes = 0;
+  m_fetchMicros = 0;
+  m_health.intervalMs = 0;
+  m_health.idleMs = 0;
+  m_health.timeoutSec = 0;
+  m_probes = 0;
+  m_probeFailures = 0;
+  m_replacements = 0;
+  m_deadOnAcquire = 0;
+}
+
+
+/**
+* デストラクタ
+*/
+ConnectionPool::~ConnectionPool()
+{
+  Close();
+  if(m_hEnv) {
+    SQLFreeHandle(SQL_HANDLE_ENV, m_hEnv);
+    m_hEnv = NULL;
+  }
+}
+
+
+/**
+* 初期化(ODBC環境の作成)
+*
+* @param[in] connectionString ODBC接続文字列
+* @param[in] maxSize 最大接続数
+* @param[in] init 全接続で接続直後に実行する初期化SQL
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool ConnectionPool::Init(
+  const OString &connectionString, size_t maxSize, const std::vector<OString> &init, OString &error)
+{
+  SQLRETURN ret = SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &m_hEnv);
+  if(!SQL_SUCCEEDED(ret)) {
+    error = OdbcErrorMessage(_O("SQLAllocHandle"), ret, SQL_HANDLE_ENV, m_hEnv);
+    m_hEnv = NULL;
+    return false;
+  }
+  // ODBC 3.0
+  SQLSetEnvAttr(m_hEnv, SQL_ATTR_ODBC_VERSION, (SQLPOINTER)SQL_OV_ODBC3, SQL_IS_UINTEGER);
+
+  m_connectionString = connectionString;
+  m_maxSize = maxSize > 0 ? maxSize : 1;
+  m_init = init;
+  return true;
+}
+
+
+/**
+* 全接続を閉じます
+*/
+void ConnectionPool::Close()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+  }
+  // 死活確認中の接続は死活確認のスレッドが破棄する
+  m_healthCv.notify_all();
+  if(m_healthThread.joinable() && m_healthThread.get_id() != std::this_thread::get_id()) {
+    m_healthThread.join();
+  }
+
+  std::vector<PooledConnection *> idle;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    idle.swap(m_idle);
+    m_total -= idle.size();
+  }
+  m_cv.notify_all();
+  for(size_t i = 0; i < idle.size(); i++) {
+    Destroy(idle[i]);
+  }
+}
+
+
+/**
+* 新しい接続を作成します
+*
+* 接続直後にプール既定の初期化SQLとsessionの初期化SQLを実行します。
+*
+* @param[in] session セッション(NULLは既定のみ)
+* @param[out] error エラーメッセージ
+* @param[out] sqlState 接続できなかった場合のSQLSTATE
+* @return PooledConnection* 接続(失敗時はNULL)
+*/
+PooledConnection *ConnectionPool::Connect(const PoolSession *session, OString &error, std::string &sqlState)
+{
+  // https://www.ibm.com/docs/ja/i/7.3?topic=details-connection-string-keywords
+  SQLHDBC hOdbc = NULL;
+  SQLRETURN ret = SQLAllocHandle(SQL_HANDLE_DBC, m_hEnv, &hOdbc);
+  if(!SQL_SUCCEEDED(ret)) {
+    error = OdbcErrorMessage(_O("SQLAllocHandle"), ret, SQL_HANDLE_ENV, m_hEnv);
+    return NULL;
+  }
+  if(m_loginTimeout > 0) {
+    SQLSetConnectAttr(hOdbc, SQL_ATTR_LOGIN_TIMEOUT, (SQLPOINTER)(SQLULEN)m_loginTimeout, SQL_IS_UINTEGER);
+  }
+  ret = SQLDriverConnect(
+    hOdbc, NULL, (SQLTCHAR *)m_connectionString.c_str(), SQL_NTS,
+    NULL, 0, NULL, SQL_DRIVER_NOPROMPT);
+  if(!SQL_SUCCEEDED(ret)) {
+    error = OdbcErrorMessage(_O("SQLDriverConnect"), ret, SQL_HANDLE_DBC, hOdbc);
+    sqlState = OdbcSqlState(SQL_HANDLE_DBC, hOdbc);
+    SQLFreeHandle(SQL_HANDLE_DBC, hOdbc);
+    return NULL;
+  }
+
+  if(!RunSessionScript(hOdbc, m_init, error)) {
+    SQLDisconnect(hOdbc);
+    SQLFreeHandle(SQL_HANDLE_DBC, hOdbc);
+    return NULL;
+  }
+
+  PooledConnection *conn = new PooledConnection();
+  conn->hdbc = hOdbc;
+  conn->lastUsed = std::chrono::steady_clock::now();
+  conn->lastChecked = conn->lastUsed;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    conn->id = m_nextId++;
+    m_created++;
+    if(!m_init.empty()) {
+      m_sessionInits++;
+    }
+  }
+  if(session && !session->statements.empty() && !ApplySession(conn, session, error)) {
+    return NULL;
+  }
+  return conn;
+}
+
+
+/**
+* 接続にセッションを初期化します
+*
+* 既定のセッションの接続にだけ使います(別のセッションの状態は戻せないため)。
+* 失敗した接続は状態が分からないので破棄します。
+*
+* @param[in] conn 接続(既定のセッション)
+* @param[in] session セッション
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool ConnectionPool::ApplySession(PooledConnection *conn, const PoolSession *session, OString &error)
+{
+  if(!RunSessionScript(conn->hdbc, session->statements, error)) {
+    Destroy(conn);
+    return false;
+  }
+  conn->session = session->key;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_sessionInits++;
+  return true;
+}
+
+
+/**
+* 接続を破棄します
+*/
+void ConnectionPool::Destroy(PooledConnection *conn)
+{
+  conn->FreeStatements();
+  SQLDisconnect(conn->hdbc);
+  SQLFreeHandle(SQL_HANDLE_DBC, conn->hdbc);
+  delete conn;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_destroyed++;
+}
+
+
+/**
+* 接続を借ります
+*
+* 同じセッションの空き接続があればそれを、無ければ既定のセッションの空き接続に
+* 初期化SQLを実行して、それも無ければ上限まで新しく接続します。上限に達していて
+* 別のセッションの空き接続しか無い場合は、最も長く使われていない接続を破棄して
+* 接続し直します。空きが無い場合は返却されるまで待ちます。
+*
+* @param[in] timeoutMs 待ち時間の上限(ミリ秒)
+* @param[in] session セッション(NULLは既定のセッション)
+* @param[out] error エラーメッセージ
+* @param[out] sqlState 新しく接続できなかった場合のSQLSTATE
+* @return PooledConnection* 接続(失敗時はNULL)
+*/
+PooledConnection *ConnectionPool::Acquire(
+  uint32_t timeoutMs, const PoolSession *session, OString &error, std::string &sqlState)
+{
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  OString key = session ? session->key : OString();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for(;;) {
+    if(m_closed) {
+      error = _O("接続プールは閉じられています");
+      return NULL;
+    }
+
+    // 同じセッションの空き接続(最近返却されたものから)
+    // ※切れていた接続は破棄して探し直す
+    bool retry = false;
+    for(size_t i = m_idle.size(); i > 0; i--) {
+      if(m_idle[i - 1]->session == key) {
+        PooledConnection *conn = TakeIdle(i - 1, lock);
+        if(!conn) {
+          retry = true;
+          break;
+        }
+        m_acquired++;
+        if(!key.empty()) {
+          m_sessionHits++;
+        }
+        return conn;
+      }
+    }
+    if(retry) {
+      continue;
+    }
+
+    // 既定のセッションの空き接続にセッションを初期化
+    if(!key.empty()) {
+      for(size_t i = m_idle.size(); i > 0; i--) {
+        if(m_idle[i - 1]->session.empty()) {
+          PooledConnection *conn = TakeIdle(i - 1, lock);
+          if(!conn) {
+            retry = true;
+            break;
+          }
+          lock.unlock();
+          bool ok = ApplySession(conn, session, error);
+          lock.lock();
+          if(!ok) {
+            m_total--;
+            m_cv.notify_one();
+            return NULL;
+          }
+          m_acquired++;
+          return conn;
+        }
+      }
+      if(retry) {
+        continue;
+      }
+    }
+
+    // 上限に達していれば別のセッションの空き接続を破棄して接続し直す
+    PooledConnection *evict = NULL;
+    if(m_total >= m_maxSize && !m_idle.empty()) {
+      size_t oldest = 0;
+      for(size_t i = 1; i < m_idle.size(); i++) {
+        if(m_idle[i]->lastUsed < m_idle[oldest]->lastUsed) {
+          oldest = i;
+        }
+      }
+      evict = m_idle[oldest];
+      m_idle.erase(m_idle.begin() + oldest);
+      m_total--;
+      m_sessionEvictions++;
+    }
+
+    if(m_total < m_maxSize) {
+      // 接続中の分も数に含めておく(上限を超えて接続しないように)
+      m_total++;
+      lock.unlock();
+      if(evict) {
+        Destroy(evict);
+      }
+      PooledConnection *conn = Connect(session, error, sqlState);
+      lock.lock();
+      if(!conn) {
+        m_total--;
+        m_cv.notify_one();
+        return NULL;
+      }
+      m_acquired++;
+      return conn;
+    }
+
+    m_waiting++;
+    std::cv_status status = m_cv.wait_until(lock, deadline);
+    m_waiting--;
+    if(status == std::cv_status::timeout && m_idle.empty() && m_total >= m_maxSize) {
+      m_timeouts++;
+      error = _O("接続プールの待ち時間を超えました");
+      return NULL;
+    }
+  }
+}
+
+
+/**
+* 空き接続を取り出します
+*
+* ドライバが切断を検知済みの接続は貸し出さずに破棄します(一時的にロックを外します)。
+*
+* @param[in] index 空き接続の位置
+* @param[in,out] lock m_mutexのロック
+* @return PooledConnection* 接続(切れていた場合はNULL)
+*/
+PooledConnection *ConnectionPool::TakeIdle(size_t index, std::unique_lock<std::mutex> &lock)
+{
+  PooledConnection *conn = m_idle[index];
+  m_idle.erase(m_idle.begin() + index);
+  if(!IsDead(conn)) {
+    return conn;
+  }
+  m_total--;
+  m_deadOnAcquire++;
+  lock.unlock();
+  Destroy(conn);
+  lock.lock();
+  return NULL;
+}
+
+
+/**
+* 接続が切れているか判定します
+*
+* SQL_ATTR_CONNECTION_DEADは通信せずにドライバが検知済みの状態を返すだけなので、
+* 黙って切られた接続は確認SQL(Probe)でないと分かりません。
+*
+* @param[in] conn 接続
+* @return bool 切れているか
+*/
+bool ConnectionPool::IsDead(PooledConnection *conn)
+{
+  SQLUINTEGER dead = SQL_CD_FALSE;
+  SQLRETURN ret = SQLGetConnectAttr(conn->hdbc, SQL_ATTR_CONNECTION_DEAD, &dead, SQL_IS_UINTEGER, NULL);
+  return SQL_SUCCEEDED(ret) && dead == SQL_CD_TRUE;
+}
+
+
+/**
+* 死活確認
+*
+* 確認SQLを実行して結果を読み捨てます。通信が発生するのでファイアウォールの
+* 無通信タイムアウトを防ぐ効果もあります。
+* 黙って切られたTCPセッションでは通信断のSQLSTATEではなくタイムアウト
+* (HYT00/HYT01)になるため、タイムアウトを含めて失敗した接続は使えないとみなします。
+*
+* @param[in] conn 接続(貸し出し中・空き接続でないもの)
+* @return bool 使えるか
+*/
+bool ConnectionPool::Probe(PooledConnection *conn)
+{
+  if(IsDead(conn)) {
+    return false;
+  }
+  if(m_health.probe.empty()) {
+    return true;
+  }
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(conn->hdbc));
+  if(!stmt) {
+    return false;
+  }
+  if(m_health.timeoutSec > 0) {
+    SQLSetStmtAttr(stmt.get(), SQL_ATTR_QUERY_TIMEOUT, (SQLPOINTER)(SQLULEN)m_health.timeoutSec, 0);
+  }
+  SQLRETURN ret = SQLExecDirect(stmt.get(), (SQLTCHAR *)m_health.probe.c_str(), SQL_NTS);
+  if(!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+    return false;
+  }
+  SQLSMALLINT columns = 0;
+  SQLNumResultCols(stmt.get(), &columns);
+  if(columns == 0) {
+    return true;
+  }
+  while(SQL_SUCCEEDED(ret = SQLFetch(stmt.get()))) {
+  }
+  // 結果の読み込み中の失敗も同じ
+  return ret == SQL_NO_DATA;
+}
+
+
+/**
+* 空き接続の死活確認を開始します
+*
+* @param[in] options 確認間隔・対象・確認SQL
+*/
+void ConnectionPool::StartHealthCheck(const PoolHealthOptions &options)
+{
+  if(options.intervalMs == 0 || m_healthThread.joinable()) {
+    return;
+  }
+  m_health = options;
+  m_healthThread = std::thread(&ConnectionPool::HealthLoop, this);
+}
+
+
+/**
+* 死活確認のスレッド
+*
+* 一定時間使われていない空き接続を空きから外して確認し、生きていれば空きに戻し、
+* 切れていれば破棄して代わりに接続し直します。確認中の接続は貸し出されません。
+*/
+void ConnectionPool::HealthLoop()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while(!m_closed) {
+    m_healthCv.wait_for(lock, std::chrono::milliseconds(m_health.intervalMs));
+    if(m_closed) {
+      break;
+    }
+
+    //
+    // 確認する接続を空きから外す
+    //
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::milliseconds idle(m_health.idleMs);
+    std::vector<PooledConnection *> targets;
+    for(size_t i = m_idle.size(); i > 0; i--) {
+      PooledConnection *conn = m_idle[i - 1];
+      if(now - std::max(conn->lastUsed, conn->lastChecked) >= idle) {
+        targets.push_back(conn);
+        m_idle.erase(m_idle.begin() + (i - 1));
+      }
+    }
+    if(targets.empty()) {
+      continue;
+    }
+
+    //
+    // 確認(ロック外)
+    //
+    lock.unlock();
+    std::vector<bool> alive(targets.size());
+    for(size_t i = 0; i < targets.size(); i++) {
+      alive[i] = Probe(targets[i]);
+      targets[i]->lastChecked = std::chrono::steady_clock::now();
+    }
+    lock.lock();
+
+    size_t dead = 0;
+    std::vector<PooledConnection *> discard;
+    for(size_t i = 0; i < targets.size(); i++) {
+      m_probes++;
+      if(!alive[i]) {
+        m_probeFailures++;
+        dead++;
+      }
+      if(alive[i] && !m_closed) {
+        m_idle.push_back(targets[i]);
+        m_cv.notify_one();
+      } else {
+        m_total--;
+        discard.push_back(targets[i]);
+      }
+    }
+
+    //
+    // 切れていた接続を破棄して接続し直す
+    //
+    lock.unlock();
+    for(size_t i = 0; i < discard.size(); i++) {
+      Destroy(discard[i]);
+    }
+    m_cv.notify_all();
+    for(size_t i = 0; i < dead; i++) {
+      {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if(m_closed || m_total >= m_maxSize) {
+          break;
+        }
+        m_total++;
+      }
+      OString error;
+      std::string sqlState;
+      PooledConnection *conn = Connect(NULL, error, sqlState);
+      bool closed = false;
+      {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if(!conn) {
+          // 接続できない場合は次の確認で
+          m_total--;
+          m_cv.notify_one();
+          break;
+        }
+        m_replacements++;
+        closed = m_closed;
+        if(closed) {
+          m_total--;
+        } else {
+          m_idle.push_back(conn);
+          m_cv.notify_one();
+        }
+      }
+      if(closed) {
+        Destroy(conn);
+        break;
+      }
+    }
+    lock.lock();
+  }
+}
+
+
+/**
+* 接続を返します
+*
+* @param[in] conn 接続
+* @param[in] broken 使えなくなった接続か(破棄します)
+*/
+void ConnectionPool::Release(PooledConnection *conn, bool broken)
+{
+  if(!conn) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(!broken && !m_closed) {
+      conn->lastUsed = std::chrono::steady_clock::now();
+      m_idle.push_back(conn);
+      m_cv.notify_one();
+      return;
+    }
+    m_total--;
+  }
+  m_cv.notify_one();
+  Destroy(conn);
+}
+
+
+/**
+* 統計
+*/
+ConnectionPoolStats ConnectionPool::Stats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ConnectionPoolStats stats;
+  stats.total = m_total;
+  stats.idle = m_idle.size();
+  stats.waiting = m_waiting;
+  stats.created = m_created;
+  stats.destroyed = m_destroyed;
+  stats.acquired = m_acquired;
+  stats.timeouts = m_timeouts;
+  stats.min = m_minSize;
+  stats.probes = m_probes;
+  stats.probeFailures = m_probeFailures;
+  stats.replacements = m_replacements;
+  stats.deadOnAcquire = m_deadOnAcquire;
+  stats.sessionHits = m_sessionHits;
+  stats.sessionInits = m_sessionInits;
+  stats.sessionEvictions = m_sessionEvictions;
+  stats.fetches = m_fetches;
+  stats.fetchRows = m_fetchRows;
+  stats.fetchBytes = m_fetchBytes;
+  stats.fetchMicros = m_fetchMicros;
+  return stats;
+}
+
+
+/**
+* ストリームの取得の統計を加えます
+*
+* @param[in] fetches 取得回数
+* @param[in] rows 行数
+* @param[in] bytes 値のバイト数
+* @param[in] micros 取得の時間(マイクロ秒)
+*/
+void ConnectionPool::RecordFetch(uint64_t fetches, uint64_t rows, uint64_t bytes, uint64_t micros)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_fetches += fetches;
+  m_fetchRows += rows;
+  m_fetchBytes += bytes;
+  m_fetchMicros += micros;
+}
@@ -0,0 +1,250 @@
+﻿#ifndef _CONNPOOL_H
+#define _CONNPOOL_H
+//
+// ODBC接続プール
+//
+// 同じ接続文字列の接続(HDBC)を使い回します。napiに依存しないので
+// ワーカースレッドから直接使えます。
+//
+// 接続ごとに実行済みのセッション初期化SQL(セッションキー)を覚えておき、
+// 同じセッションを求める貸し出しには初期化済みの接続を優先して返します。
+//
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "omnicommon.h"
+
+// 接続ごとに覚えておく準備済みの文の数(超えたら全て解放)
+#define POOL_STATEMENT_CACHE 64
+
+// 既定の死活確認SQL
+#define POOL_DEFAULT_PROBE _O("SELECT 1 FROM SYSIBM.SYSDUMMY1")
+
+// 空き接続の死活確認
+struct PoolHealthOptions {
+  // 確認間隔(ミリ秒、0は確認しない)
+  uint32_t intervalMs;
+  // この時間以上使われていない(確認されていない)接続を確認(ミリ秒)
+  uint32_t idleMs;
+  // 確認SQLのタイムアウト(秒、0はドライバの既定)
+  uint32_t timeoutSec;
+  // 確認SQL(空はSQL_ATTR_CONNECTION_DEADのみ)
+  OString probe;
+};
+
+// セッション(接続直後に実行する初期化SQL)
+struct PoolSession {
+  // セッションキー(初期化SQLを連結したもの、空はプール既定の初期化のみ)
+  OString key;
+  // 初期化SQL(プール既定の初期化の後に実行)
+  std::vector<OString> statements;
+
+  PoolSession() {}
+  PoolSession(const std::vector<OString> &s);
+};
+
+// プールの接続
+struct PooledConnection {
+  // 接続ハンドル
+  SQLHDBC hdbc;
+  // 接続番号(プール内で一意)
+  uint64_t id;
+  // 実行済みのセッションのキー
+  OString session;
+  // 最後に返却された時刻
+  std::chrono::steady_clock::time_point lastUsed;
+  // 最後に死活を確認した時刻
+  std::chrono::steady_clock::time_point lastChecked;
+  // 準備済みの文(SQL→文、借りている間だけ使える)
+  std::map<OString, SQLHSTMT> statements;
+
+  // 準備済みの文を取得します(無ければ準備して覚えておく)
+  SQLHSTMT Prepare(const OString &sql, OString &error);
+  // 準備済みの文を全て解放します
+  void FreeStatements();
+};
+
+// プールの統計
+struct ConnectionPoolStats {
+  // 接続数(使用中+空き+接続中)
+  size_t total;
+  // 空き接続数
+  size_t idle;
+  // 接続待ちのスレッド数
+  size_t waiting;
+  // 作成した接続数(累計)
+  uint64_t created;
+  // 破棄した接続数(累計)
+  uint64_t destroyed;
+  // 貸し出し回数(累計)
+  uint64_t acquired;
+  // 貸し出しのタイムアウト回数(累計)
+  uint64_t timeouts;
+  // 最小接続数
+  size_t min;
+  // 死活確認の回数(累計)
+  uint64_t probes;
+  // 死活確認で切れていた接続数(累計)
+  uint64_t probeFailures;
+  // 切れていた接続の代わりに接続した数(累計)
+  uint64_t replacements;
+  // 貸し出し時に切れていた接続数(累計、貸し出さずに破棄)
+  uint64_t deadOnAcquire;
+  // 同じセッションの接続を返した回数(累計)
+  uint64_t sessionHits;
+  // セッション初期化SQLを実行した回数(累計)
+  uint64_t sessionInits;
+  // セッションを切り替えるために破棄した接続数(累計)
+  uint64_t sessionEvictions;
+  // ストリームの取得回数・行数・値のバイト数・時間(マイクロ秒、累計)
+  uint64_t fetches;
+  uint64_t fetchRows;
+  uint64_t fetchBytes;
+  uint64_t fetchMicros;
+};
+
+class ConnectionPool {
+public:
+  ConnectionPool();
+  ~ConnectionPool();
+
+  // 初期化(ODBC環境の作成、initは全接続で接続直後に実行するSQL)
+  bool Init(
+    const OString &connectionString, size_t maxSize, const std::vector<OString> &init, OString &error);
+  // 最小接続数(ウォームアップで接続しておく数)
+  void SetMinSize(size_t minSize) { m_minSize = minSize < m_maxSize ? minSize : m_maxSize; }
+  // ログインタイムアウト(秒、0はドライバの既定)
+  void SetLoginTimeout(uint32_t seconds) { m_loginTimeout = seconds; }
+  // 空き接続の死活確認を開始します(バックグラウンドのスレッド、Closeで停止)
+  void StartHealthCheck(const PoolHealthOptions &options);
+  // 全接続を閉じます(使用中の接続は返却時に閉じます)
+  void Close();
+
+  // 接続を借ります(空きが無く上限に達している場合はtimeoutMsまで待ちます)
+  // ※sessionを指定した場合はそのセッションを初期化済みの接続を返します(NULLは既定)
+  // ※sqlStateは新しく接続できなかった場合のSQLSTATE(待ち時間超過等は空)
+  PooledConnection *Acquire(uint32_t timeoutMs, const PoolSession *session, OString &error, std::string &sqlState);
+  // 接続を返します(brokenの場合は破棄します)
+  void Release(PooledConnection *conn, bool broken);
+
+  // 最大接続数
+  size_t MaxSize() const { return m_maxSize; }
+  // 最小接続数
+  size_t MinSize() const { return m_minSize; }
+  // 統計
+  ConnectionPoolStats Stats();
+  // ストリームの取得の統計を加えます
+  void RecordFetch(uint64_t fetches, uint64_t rows, uint64_t bytes, uint64_t micros);
+
+private:
+  ConnectionPool(const ConnectionPool &);
+  ConnectionPool &operator=(const ConnectionPool &);
+
+  // 新しい接続を作成します(ロック外で呼ぶ)
+  PooledConnection *Connect(const PoolSession *session, OString &error, std::string &sqlState);
+  // 接続にセッションを初期化します(ロック外で呼ぶ、失敗した接続は破棄)
+  bool ApplySession(PooledConnection *conn, const PoolSession *session, OString &error);
+  // 接続を破棄します(ロック外で呼ぶ)
+  void Destroy(PooledConnection *conn);
+  // 空き接続を取り出します(切れていた場合は破棄してNULL、ロック中に呼ぶ)
+  PooledConnection *TakeIdle(size_t index, std::unique_lock<std::mutex> &lock);
+  // 接続が切れているか(ドライバが切断を検知済みか)
+  static bool IsDead(PooledConnection *conn);
+  // 死活確認(確認SQLを実行、ロック外で呼ぶ)
+  bool Probe(PooledConnection *conn);
+  // 死活確認のスレッド
+  void HealthLoop();
+
+  SQLHENV m_hEnv;
+  OString m_connectionString;
+  size_t m_maxSize;
+  size_t m_minSize;
+  uint32_t m_loginTimeout;
+  std::vector<OString> m_init;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::vector<PooledConnection *> m_idle;
+  size_t m_total;
+  size_t m_waiting;
+  bool m_closed;
+  uint64_t m_nextId;
+  uint64_t m_created;
+  uint64_t m_destroyed;
+  uint64_t m_acquired;
+  uint64_t m_timeouts;
+  uint64_t m_sessionHits;
+  uint64_t m_sessionInits;
+  uint64_t m_sessionEvictions;
+  uint64_t m_fetches;
+  uint64_t m_fetchRows;
+  uint64_t m_fetchBytes;
+  uint64_t m_fetchMicros;
+
+  // 死活確認
+  PoolHealthOptions m_health;
+  std::thread m_healthThread;
+  std::condition_variable m_healthCv;
+  uint64_t m_probes;
+  uint64_t m_probeFailures;
+  uint64_t m_replacements;
+  uint64_t m_deadOnAcquire;
+};
+
+//
+// 借りた接続の自動返却
+//
+class PoolLease {
+public:
+  PoolLease(ConnectionPool &pool) : m_pool(&pool), m_conn(NULL), m_broken(false) {}
+  ~PoolLease() { Reset(); }
+
+  // 借りる先のプールを替えます(借りている接続は返す)
+  void Bind(ConnectionPool &pool)
+  {
+    Reset();
+    m_pool = &pool;
+  }
+  // 接続を借ります(sessionはNULLで既定のセッション)
+  bool Acquire(uint32_t timeoutMs, OString &error, const PoolSession *session = NULL)
+  {
+    Reset();
+    m_sqlState.clear();
+    m_conn = m_pool->Acquire(timeoutMs, session, error, m_sqlState);
+    return m_conn != NULL;
+  }
+  // 借りられなかった理由のSQLSTATE(接続できなかった場合のみ、待ち時間超過等は空)
+  const std::string &SqlState() const { return m_sqlState; }
+  // 接続を返します
+  void Reset()
+  {
+    if(m_conn) {
+      m_pool->Release(m_conn, m_broken);
+      m_conn = NULL;
+    }
+    m_broken = false;
+  }
+  // 接続が使えなくなったことを記録(返却時に破棄)
+  void MarkBroken() { m_broken = true; }
+
+  PooledConnection *get() const { return m_conn; }
+  SQLHDBC hdbc() const { return m_conn ? m_conn->hdbc : NULL; }
+  ConnectionPool *pool() const { return m_pool; }
+
+private:
+  PoolLease(const PoolLease &);
+  PoolLease &operator=(const PoolLease &);
+
+  ConnectionPool *m_pool;
+  PooledConnection *m_conn;
+  bool m_broken;
+  std::string m_sqlState;
+};
+
+#endif
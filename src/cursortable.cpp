@@ -0,0 +1,251 @@
+﻿#include "cursortable.h"
+#include "omnidb.h"
+
+using json = nlohmann::json;
+
+
+/**
+* 取得を取り消します
+*/
+void StreamCursor::Cancel()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if(stream) {
+    stream->Cancel();
+  }
+  for(size_t i = 0; i < sources.size(); i++) {
+    sources[i]->Cancel();
+  }
+}
+
+
+/**
+* コンストラクタ
+*/
+CursorTable::CursorTable() : m_executor(NULL), m_bridge(NULL), m_next(1), m_rows(0)
+{
+}
+
+
+/**
+* 初期化
+*
+* @param[in] executor fetchとカーソルの解放を行うワーカースレッド
+* @param[in] bridge 完了通知
+*/
+void CursorTable::Init(Executor *executor, AsyncBridge *bridge)
+{
+  m_executor = executor;
+  m_bridge = bridge;
+}
+
+
+/**
+* カーソルを登録します
+*
+* @param[in] cursor カーソル
+* @return uint32_t カーソル番号
+*/
+uint32_t CursorTable::Add(std::shared_ptr<StreamCursor> cursor)
+{
+  uint32_t id = m_next++;
+  m_cursors[id] = cursor;
+  return id;
+}
+
+
+/**
+* 読むストリームを作ります(ワーカースレッド)
+*
+* @param[in,out] cursor カーソル
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool CursorTable::Open(StreamCursor &cursor, OString &error)
+{
+  if(cursor.stream) {
+    return cursor.stream->Columns(cursor.columns, error);
+  }
+  if(cursor.sources.empty()) {
+    error = _O("カーソルにストリームがありません");
+    return false;
+  }
+  if(!cursor.sources[0]->Columns(cursor.columns, error)) {
+    return false;
+  }
+  // 取り消しと競合しないようにストリームの入れ替えは排他
+  std::lock_guard<std::mutex> lock(cursor.mutex);
+  ResultStream *stream = cursor.merge
+    ? cursor.merge(cursor.sources, cursor.columns, error)
+    : new ConcatStream(cursor.sources);
+  if(!stream) {
+    return false;
+  }
+  cursor.stream.reset(stream);
+  return true;
+}
+
+
+/**
+* カーソルから行を取得します
+*
+* @param[in] info Node.jsパラメータ(cursor, rows)
+* @return Napi::Value {columns, rows, done}(JSON形式の文字列)を返すPromise
+*/
+Napi::Value CursorTable::Fetch(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() < 1 || !info[0].IsNumber()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("fetch(cursor, rows) cursorはカーソル番号を指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  // fetchの要求
+  struct FetchTask {
+    std::shared_ptr<StreamCursor> cursor;
+    size_t rows;
+    size_t fetched;
+    bool ok;
+    std::string result;
+    OString error;
+    Napi::Promise::Deferred deferred;
+    FetchTask(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {}
+  };
+  std::shared_ptr<FetchTask> task(new FetchTask(env));
+  task->rows = CURSOR_DEFAULT_FETCH_ROWS;
+  task->fetched = 0;
+  task->ok = false;
+  if(info.Length() >= 2 && info[1].IsNumber() && info[1].As<Napi::Number>().Uint32Value() > 0) {
+    task->rows = info[1].As<Napi::Number>().Uint32Value();
+  }
+  std::map<uint32_t, std::shared_ptr<StreamCursor> >::iterator it =
+    m_cursors.find(info[0].As<Napi::Number>().Uint32Value());
+  if(it == m_cursors.end()) {
+    task->deferred.Reject(OmniDb::CreateError(env, OString(_O("カーソルは閉じられています"))).Value());
+    return task->deferred.Promise();
+  }
+  if(it->second->busy) {
+    task->deferred.Reject(OmniDb::CreateError(env, OString(_O("前のfetchが終わっていません"))).Value());
+    return task->deferred.Promise();
+  }
+  task->cursor = it->second;
+  task->cursor->busy = true;
+
+  m_bridge->BeginWork(env);
+  CursorTable *self = this;
+  m_executor->Submit([self, task]() {
+    StreamCursor &cursor = *task->cursor;
+    json rows = json::array();
+    task->ok = (cursor.stream && !cursor.columns.empty()) || Open(cursor, task->error);
+    if(task->ok && !cursor.done) {
+      task->ok = cursor.stream->Read(task->rows, rows, cursor.done, task->error);
+    }
+    if(task->ok) {
+      json result = json::object();
+      result["columns"] = cursor.columns;
+      result["rows"] = rows;
+      result["done"] = cursor.done;
+      task->result = result.dump(-1, ' ', true, json::error_handler_t::replace);
+    }
+    task->fetched = rows.size();
+    self->m_bridge->Post([self, task](Napi::Env env) {
+      Napi::HandleScope scope(env);
+      task->cursor->busy = false;
+      self->m_rows += task->fetched;
+      if(task->cursor->closed) {
+        // fetch中に閉じられた
+        self->Discard(task->cursor);
+        task->deferred.Reject(OmniDb::CreateError(env, OString(_O("カーソルは閉じられています"))).Value());
+      } else if(task->ok) {
+        task->deferred.Resolve(Napi::String::New(env, task->result));
+      } else {
+        task->deferred.Reject(OmniDb::CreateError(env, task->error).Value());
+      }
+      self->m_bridge->EndWork(env);
+    });
+  });
+
+  return task->deferred.Promise();
+}
+
+
+/**
+* カーソルを閉じます(読み残した結果は取得を取り消す)
+*
+* @param[in] info Node.jsパラメータ(cursor)
+* @return Napi::Value 閉じたか
+*/
+Napi::Value CursorTable::Close(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() < 1 || !info[0].IsNumber()) {
+    return Napi::Boolean::New(env, false);
+  }
+  std::map<uint32_t, std::shared_ptr<StreamCursor> >::iterator it =
+    m_cursors.find(info[0].As<Napi::Number>().Uint32Value());
+  if(it == m_cursors.end()) {
+    return Napi::Boolean::New(env, false);
+  }
+  std::shared_ptr<StreamCursor> cursor = it->second;
+  m_cursors.erase(it);
+  Close(cursor);
+  return Napi::Boolean::New(env, true);
+}
+
+
+/**
+* 全カーソルを閉じます
+*/
+void CursorTable::CloseAll()
+{
+  std::map<uint32_t, std::shared_ptr<StreamCursor> > cursors;
+  cursors.swap(m_cursors);
+  for(std::map<uint32_t, std::shared_ptr<StreamCursor> >::iterator it = cursors.begin(); it != cursors.end(); it++) {
+    Close(it->second);
+  }
+}
+
+
+/**
+* 全カーソルの取得を取り消します
+*/
+void CursorTable::CancelAll()
+{
+  for(std::map<uint32_t, std::shared_ptr<StreamCursor> >::iterator it = m_cursors.begin(); it != m_cursors.end(); it++) {
+    it->second->Cancel();
+  }
+}
+
+
+/**
+* カーソルを閉じます
+*
+* @param[in] cursor カーソル
+*/
+void CursorTable::Close(std::shared_ptr<StreamCursor> cursor)
+{
+  cursor->closed = true;
+  if(cursor->busy) {
+    // fetch中のストリームは取り消しだけして、fetchの完了で解放
+    cursor->Cancel();
+  } else {
+    Discard(cursor);
+  }
+}
+
+
+/**
+* カーソルを捨てます(取得スレッドの終了はワーカースレッドで待つ)
+*
+* @param[in] cursor カーソル
+*/
+void CursorTable::Discard(std::shared_ptr<StreamCursor> cursor)
+{
+  cursor->Cancel();
+  std::shared_ptr<StreamCursor> discarded = cursor;
+  m_executor->Submit([discarded]() mutable { discarded.reset(); });
+}
@@ -0,0 +1,99 @@
+﻿#ifndef _CURSORTABLE_H
+#define _CURSORTABLE_H
+//
+// 結果ストリームのカーソル表
+//
+// OmniFederation・OmniPoolのquery/scanで開いたストリームをカーソル番号で
+// 管理し、fetch(ワーカースレッドで読んでPromiseを解決)・closeCursorを
+// 共通で提供します。カーソルの解放(取得スレッドの終了待ち)もワーカー
+// スレッドで行います。
+//
+#include <napi.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "omnicommon.h"
+#include "connpool.h"
+#include "executor.h"
+#include "asyncbridge.h"
+#include "resultstream.h"
+
+// 既定のfetchの行数
+#define CURSOR_DEFAULT_FETCH_ROWS 1000
+
+// カーソル
+struct StreamCursor {
+  // マージの処理(列名が分かってから呼ぶ、sourcesの所有権を移す)
+  typedef std::function<ResultStream *(
+    std::vector<std::unique_ptr<ResultStream> > &sources, const nlohmann::json &columns, OString &error)> Merge;
+
+  // ストリームが使うセッション(ストリームより後に解放)
+  std::shared_ptr<PoolSession> session;
+  // マージ前のストリーム
+  std::vector<std::unique_ptr<ResultStream> > sources;
+  // マージの処理(nullptrは連結)
+  Merge merge;
+  // 読むストリーム(最初のfetchで作る、始めから指定してもよい)
+  std::unique_ptr<ResultStream> stream;
+  nlohmann::json columns;
+  // sources・streamの入れ替えと取り消し
+  std::mutex mutex;
+  // fetch中か(JSスレッドのみ)
+  bool busy;
+  // 閉じられたか(JSスレッドのみ)
+  bool closed;
+  // 終わりまで読んだか
+  bool done;
+
+  StreamCursor() : columns(nlohmann::json::array()), busy(false), closed(false), done(false) {}
+  // 取得を取り消します(別スレッドでfetch中でもよい)
+  void Cancel();
+};
+
+class CursorTable {
+public:
+  CursorTable();
+
+  // 初期化(ワーカースレッドと完了通知は所有者のもの)
+  void Init(Executor *executor, AsyncBridge *bridge);
+
+  // カーソルを登録します
+  uint32_t Add(std::shared_ptr<StreamCursor> cursor);
+  // fetch(cursor, rows) {columns, rows, done}(JSON形式の文字列)を返すPromise
+  Napi::Value Fetch(const Napi::CallbackInfo& info);
+  // closeCursor(cursor)
+  Napi::Value Close(const Napi::CallbackInfo& info);
+  // 全カーソルを閉じます
+  void CloseAll();
+  // 全カーソルの取得を取り消します(ワーカースレッドの停止前)
+  void CancelAll();
+  // 全カーソルを解放します(ワーカースレッドの停止後、取得スレッドの終了を待つ)
+  void Clear() { m_cursors.clear(); }
+
+  // 開いているカーソル数・取得した行数(JSスレッドのみ)
+  size_t Size() const { return m_cursors.size(); }
+  uint64_t Rows() const { return m_rows; }
+
+private:
+  CursorTable(const CursorTable &);
+  CursorTable &operator=(const CursorTable &);
+
+  // 読むストリームを作ります(ワーカースレッド)
+  static bool Open(StreamCursor &cursor, OString &error);
+  // カーソルを閉じます(fetch中なら取り消しだけ)
+  void Close(std::shared_ptr<StreamCursor> cursor);
+  // カーソルを捨てます(取り消してワーカースレッドで解放)
+  void Discard(std::shared_ptr<StreamCursor> cursor);
+
+  Executor *m_executor;
+  AsyncBridge *m_bridge;
+  std::map<uint32_t, std::shared_ptr<StreamCursor> > m_cursors;
+  uint32_t m_next;
+  uint64_t m_rows;
+};
+
+#endif
@@ -0,0 +1,217 @@
+﻿#include "executor.h"
+
+
+/**
+* コンストラクタ(スレッド起動)
+*
+* @param[in] threads スレッド数
+*/
+Executor::Executor(size_t threads)
+{
+  m_stop = false;
+  for(int i = 0; i < LANE_COUNT; i++) {
+    m_running[i] = 0;
+    m_reserved[i] = 0;
+  }
+  if(threads == 0) {
+    threads = 1;
+  }
+  m_size = threads;
+  for(size_t i = 0; i < threads; i++) {
+    m_threads.push_back(std::thread(&Executor::Run, this));
+  }
+}
+
+
+/**
+* デストラクタ
+*/
+Executor::~Executor()
+{
+  Shutdown();
+}
+
+
+/**
+* レーンのために予約するスレッド数を設定します
+*
+* 全レーンの予約の合計がスレッド数を超えないように切り詰めます。
+* (少なくとも1本はどのレーンでも使えるように残す)
+*
+* @param[in] lane レーン
+* @param[in] threads 予約するスレッド数
+*/
+void Executor::SetReserved(ExecutorLane lane, size_t threads)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t others = 0;
+    for(int i = 0; i < LANE_COUNT; i++) {
+      if(i != lane) {
+        others += m_reserved[i];
+      }
+    }
+    size_t limit = m_size > others + 1 ? m_size - others - 1 : 0;
+    m_reserved[lane] = threads < limit ? threads : limit;
+  }
+  m_cv.notify_all();
+}
+
+
+/**
+* タスクを登録します
+*
+* @param[in] task タスク
+* @param[in] lane レーン(優先度)
+*/
+void Executor::Submit(const Task &task, ExecutorLane lane)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_stop) {
+      return;
+    }
+    m_queue[lane].push_back(task);
+  }
+  // 予約の条件で取り出せないスレッドもあるので全て起こす
+  m_cv.notify_all();
+}
+
+
+/**
+* 待ち状態のタスク数
+*/
+size_t Executor::Pending()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t pending = 0;
+  for(int i = 0; i < LANE_COUNT; i++) {
+    pending += m_queue[i].size();
+  }
+  return pending;
+}
+
+
+/**
+* レーンの待ち状態のタスク数
+*/
+size_t Executor::Pending(ExecutorLane lane)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_queue[lane].size();
+}
+
+
+/**
+* レーンの実行中のタスク数
+*/
+size_t Executor::Running(ExecutorLane lane)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_running[lane];
+}
+
+
+/**
+* レーンの予約スレッド数
+*/
+size_t Executor::Reserved(ExecutorLane lane)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_reserved[lane];
+}
+
+
+/**
+* 登録済みのタスクを実行し終えてからスレッドを終了します
+*/
+void Executor::Shutdown()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_stop && m_threads.empty()) {
+      return;
+    }
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for(size_t i = 0; i < m_threads.size(); i++) {
+    if(m_threads[i].joinable()) {
+      m_threads[i].join();
+    }
+  }
+  m_threads.clear();
+}
+
+
+/**
+* 次に実行するレーンを選びます
+*
+* 優先度の高いレーンから順に、取り出しても他のレーンの予約(まだ使われて
+* いない分)が残るレーンを選びます。
+*
+* @return int レーン(実行できるタスクが無ければLANE_COUNT)
+*/
+int Executor::NextLane()
+{
+  size_t running = 0;
+  for(int i = 0; i < LANE_COUNT; i++) {
+    running += m_running[i];
+  }
+  size_t idle = m_size > running ? m_size - running : 0;
+  for(int lane = 0; lane < LANE_COUNT; lane++) {
+    if(m_queue[lane].empty()) {
+      continue;
+    }
+    size_t keep = 0;
+    for(int i = 0; i < LANE_COUNT; i++) {
+      if(i != lane && m_reserved[i] > m_running[i]) {
+        keep += m_reserved[i] - m_running[i];
+      }
+    }
+    if(idle > keep) {
+      return lane;
+    }
+  }
+  return LANE_COUNT;
+}
+
+
+/**
+* ワーカースレッド本体
+*/
+void Executor::Run()
+{
+  for(;;) {
+    Task task;
+    int lane;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this, &lane]() {
+        lane = NextLane();
+        if(lane != LANE_COUNT) {
+          return true;
+        }
+        // 停止要求かつタスク無し(予約で取り出せないだけのタスクは待つ)
+        bool empty = true;
+        for(int i = 0; i < LANE_COUNT; i++) {
+          empty = empty && m_queue[i].empty();
+        }
+        return m_stop && empty;
+      });
+      if(lane == LANE_COUNT) {
+        return;
+      }
+      task = m_queue[lane].front();
+      m_queue[lane].pop_front();
+      m_running[lane]++;
+    }
+    task();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_running[lane]--;
+    }
+    // 予約の空きが変わったので待っているスレッドを起こす
+    m_cv.notify_all();
+  }
+}
@@ -0,0 +1,75 @@
+﻿#ifndef _EXECUTOR_H
+#define _EXECUTOR_H
+//
+// ODBC実行用のワーカースレッドプール
+//
+// ODBCの呼び出しはブロックするため、libuvのスレッドプール(既定4本)ではなく
+// 専用のスレッドで実行します。
+//
+// タスクは優先度(レーン)ごとの待ち行列に入り、空いたスレッドは優先度の高い
+// レーンから取り出します。レーンごとにスレッドを予約でき、予約分は他のレーンの
+// タスクが使い切らないように残しておきます(長いバッチ処理の後ろで対話的な
+// 処理が待たされないように)。
+//
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 優先度(値が小さいほど優先)
+enum ExecutorLane {
+  // 対話的な短い処理(メタデータ取得・SQL解析)
+  LANE_INTERACTIVE = 0,
+  // バッチ処理(一括実行・大量の解析・エクスポート)
+  LANE_BATCH,
+  LANE_COUNT
+};
+
+class Executor {
+public:
+  typedef std::function<void()> Task;
+
+  explicit Executor(size_t threads);
+  ~Executor();
+
+  // レーンのために予約するスレッド数(合計はスレッド数-1まで)
+  void SetReserved(ExecutorLane lane, size_t threads);
+  // タスクを登録します(Shutdown後は無視)
+  void Submit(const Task &task, ExecutorLane lane = LANE_INTERACTIVE);
+  // 登録済みのタスクを実行し終えてからスレッドを終了します
+  void Shutdown();
+
+  // スレッド数
+  size_t Threads() const { return m_threads.size(); }
+  // 待ち状態のタスク数
+  size_t Pending();
+  // レーンの待ち状態のタスク数
+  size_t Pending(ExecutorLane lane);
+  // レーンの実行中のタスク数
+  size_t Running(ExecutorLane lane);
+  // レーンの予約スレッド数
+  size_t Reserved(ExecutorLane lane);
+
+private:
+  Executor(const Executor &);
+  Executor &operator=(const Executor &);
+
+  // ワーカースレッド本体
+  void Run();
+  // 次に実行するレーン(無ければLANE_COUNT、ロック中に呼ぶ)
+  int NextLane();
+
+  std::vector<std::thread> m_threads;
+  // スレッド数(起動中のスレッドからも参照するため別に持つ)
+  size_t m_size;
+  std::deque<Task> m_queue[LANE_COUNT];
+  size_t m_running[LANE_COUNT];
+  size_t m_reserved[LANE_COUNT];
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stop;
+};
+
+#endif
@@ -0,0 +1,785 @@
+﻿#include "fetcher.h"
+#include "spillbuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+using json = nlohmann::json;
+
+
+/**
+* 8バイト境界に切り上げ
+*/
+static size_t Align8(size_t n)
+{
+  return (n + 7) & ~(size_t)7;
+}
+
+
+/**
+* SQLの型からバインドするCの型と1行分のバイト数を決めます
+*
+* 整数はSQL_C_SBIGINT、浮動小数点はSQL_C_DOUBLE、バイナリはSQL_C_BINARY、
+* それ以外(10進数・日付時刻を含む)は文字列で取得します。
+*
+* @param[in,out] col sqlType・columnSizeからcType・widthを設定します
+*/
+void ChooseFetchBinding(FetchColumn &col)
+{
+  SQLULEN size = col.columnSize;
+  switch(col.sqlType) {
+    case SQL_TINYINT:
+    case SQL_SMALLINT:
+    case SQL_INTEGER:
+    case SQL_BIGINT:
+      col.cType = SQL_C_SBIGINT;
+      col.width = sizeof(int64_t);
+      return;
+    case SQL_REAL:
+    case SQL_FLOAT:
+    case SQL_DOUBLE:
+      col.cType = SQL_C_DOUBLE;
+      col.width = sizeof(double);
+      return;
+    case SQL_BIT:
+      col.cType = SQL_C_BIT;
+      col.width = 1;
+      return;
+    case SQL_BINARY:
+    case SQL_VARBINARY:
+    case SQL_LONGVARBINARY:
+      col.cType = SQL_C_BINARY;
+      col.width = (SQLLEN)((size == 0 || size > FETCH_MAX_WIDTH) ? FETCH_MAX_WIDTH : size);
+      return;
+    case SQL_DECIMAL:
+    case SQL_NUMERIC:
+      // 符号・小数点・終端
+      size += 3;
+      break;
+    case SQL_TYPE_DATE:
+    case SQL_TYPE_TIME:
+    case SQL_TYPE_TIMESTAMP:
+      size = 64;
+      break;
+  }
+
+#ifdef UNICODE
+  col.cType = SQL_C_WCHAR;
+  size = (size + 1) * sizeof(SQLWCHAR);
+#else
+  col.cType = SQL_C_CHAR;
+  // utf-8は1文字最大4バイト
+  size = size * 4 + 1;
+#endif
+  if(col.columnSize == 0 || size > FETCH_MAX_WIDTH) {
+    size = FETCH_MAX_WIDTH;
+  }
+  col.width = (SQLLEN)size;
+}
+
+
+/**
+* コンストラクタ
+*/
+RowsetFetcher::RowsetFetcher()
+{
+  m_stmt = NULL;
+  m_rowArraySize = 0;
+  m_capacity = 0;
+  m_maxCapacity = 0;
+  m_nextRows = 0;
+  m_byteMicros = 0;
+  m_rowBytes = 0;
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_fetched = 0;
+  m_slots = 1;
+  m_slotBytes = 0;
+  m_bindOffset = 0;
+  m_view = 0;
+  m_viewRows = 0;
+}
+
+
+/**
+* 結果セットの列を調べてバインドします
+*
+* @param[in] stmt 実行済みの文
+* @param[in] rowArraySize 1回に取得する行数(領域の上限を超える場合は減らします、自動調整では無視)
+* @param[out] error エラーメッセージ
+* @param[in] slots 行セット領域の数(2以上はRowsetPipeline用)
+* @return bool 成否
+*/
+bool RowsetFetcher::Bind(SQLHSTMT stmt, size_t rowArraySize, OString &error, size_t slots)
+{
+  SQLRETURN ret;
+  SQLSMALLINT count = 0;
+
+  m_stmt = stmt;
+  m_columns.clear();
+  m_fetched = 0;
+  m_slots = slots > 0 ? slots : 1;
+  m_bindOffset = 0;
+  m_view = 0;
+  m_viewRows = 0;
+  m_byteMicros = 0;
+  m_rowBytes = 0;
+  memset(&m_stats, 0, sizeof(m_stats));
+  // 前の結果セットのバインドを外す
+  SQLFreeStmt(stmt, SQL_UNBIND);
+  if(!SQL_SUCCEEDED(ret = SQLNumResultCols(stmt, &count))) {
+    error = OdbcErrorMessage(_O("SQLNumResultCols"), ret, SQL_HANDLE_STMT, stmt);
+    return false;
+  }
+
+  //
+  // 列情報
+  //
+  size_t rowBytes = 0;
+  m_columns.resize(count);
+  for(SQLSMALLINT c = 0; c < count; c++) {
+    FetchColumn &col = m_columns[c];
+    SQLTCHAR name[256];
+    SQLSMALLINT nameLength = 0;
+    ret = SQLDescribeCol(
+      stmt, (SQLUSMALLINT)(c + 1), name, (SQLSMALLINT)(sizeof(name) / sizeof(SQLTCHAR)), &nameLength,
+      &col.sqlType, &col.columnSize, &col.decimalDigits, &col.nullable);
+    if(!SQL_SUCCEEDED(ret)) {
+      error = OdbcErrorMessage(_O("SQLDescribeCol"), ret, SQL_HANDLE_STMT, stmt);
+      return false;
+    }
+    col.name = _S2O(name);
+    ChooseFetchBinding(col);
+    rowBytes += col.width + sizeof(SQLLEN);
+  }
+
+  //
+  // 行セットの行数(自動調整は列の大きさから目安のバイト数に収まる行数で始め、
+  // 領域は行数が増えた時に上限の行数まで広げる)
+  //
+  size_t maxCapacity;
+  if(m_tuning.adaptive) {
+    maxCapacity = FETCH_ADAPTIVE_MAX_ROWS;
+    rowArraySize = rowBytes > 0 ? FETCH_ADAPTIVE_START_BYTES / rowBytes : FETCH_DEFAULT_ROWS;
+  } else {
+    if(rowArraySize == 0) {
+      rowArraySize = FETCH_DEFAULT_ROWS;
+    }
+    maxCapacity = rowArraySize;
+  }
+  size_t maxBlock = m_tuning.maxBytes > 0 ? m_tuning.maxBytes : FETCH_MAX_BLOCK;
+  if(rowBytes > 0 && rowBytes * maxCapacity * m_slots > maxBlock) {
+    maxCapacity = std::max((size_t)1, maxBlock / (rowBytes * m_slots));
+  }
+  m_maxCapacity = maxCapacity;
+  m_rowArraySize = std::max((size_t)1, std::min(rowArraySize, maxCapacity));
+  m_nextRows = m_rowArraySize;
+
+  SQLSetStmtAttr(stmt, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)SQL_BIND_BY_COLUMN, 0);
+  SQLSetStmtAttr(stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)(SQLULEN)m_rowArraySize, 0);
+  SQLSetStmtAttr(stmt, SQL_ATTR_ROWS_FETCHED_PTR, &m_fetched, 0);
+  // スロット0にバインドし、取得先はオフセットで切り替える(前の結果セットの設定も戻す)
+  SQLSetStmtAttr(stmt, SQL_ATTR_ROW_BIND_OFFSET_PTR, m_slots > 1 ? &m_bindOffset : NULL, 0);
+  return Layout(m_rowArraySize, error);
+}
+
+
+/**
+* capacity行の行セット領域を配置してバインドします
+*
+* 列ごとに値配列・長さ配列を並べた領域をスロット数分確保します。
+* 領域の内容は引き継ぎません。
+*
+* @param[in] capacity 領域に入る行数
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool RowsetFetcher::Layout(size_t capacity, OString &error)
+{
+  m_capacity = capacity;
+  size_t offset = 0;
+  for(size_t c = 0; c < m_columns.size(); c++) {
+    FetchColumn &col = m_columns[c];
+    col.dataOffset = offset;
+    offset = Align8(offset + col.width * m_capacity);
+    col.indicatorOffset = offset;
+    offset = Align8(offset + sizeof(SQLLEN) * m_capacity);
+  }
+  m_slotBytes = offset;
+  // 領域は共有プールから借りる(前の結果セットで借りた領域で足りればそのまま)
+  if(!m_block.Reset(offset * m_slots)) {
+    error = _O("行セットの領域を確保できません");
+    return false;
+  }
+  memset(m_block.data(), 0, offset * m_slots);
+
+  for(size_t c = 0; c < m_columns.size(); c++) {
+    FetchColumn &col = m_columns[c];
+    SQLRETURN ret = SQLBindCol(
+      m_stmt, (SQLUSMALLINT)(c + 1), col.cType, m_block.data() + col.dataOffset, col.width,
+      (SQLLEN *)(m_block.data() + col.indicatorOffset));
+    if(!SQL_SUCCEEDED(ret)) {
+      error = OdbcErrorMessage(_O("SQLBindCol"), ret, SQL_HANDLE_STMT, m_stmt);
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/**
+* 領域を広げてバインドし直します
+*
+* 自動調整の行数が領域に入らない場合に、倍(上限の行数まで)に広げます。
+* 結果セットの途中でもバインドし直せます。
+*
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool RowsetFetcher::Grow(OString &error)
+{
+  if(!NeedsGrow()) {
+    return true;
+  }
+  return Layout(std::min(m_maxCapacity, std::max(m_nextRows, m_capacity * 2)), error);
+}
+
+
+/**
+* 次の行セットを取得します
+*
+* @param[out] error エラーメッセージ
+* @return bool 取得できたか(終わりの場合はerrorが空)
+*/
+bool RowsetFetcher::Fetch(OString &error)
+{
+  // 前の行セットは読み終わっているので、ここで領域を広げてよい
+  if(!Grow(error)) {
+    return false;
+  }
+  size_t rows = 0;
+  bool ok = FetchInto(0, rows, error);
+  Select(0, rows);
+  return ok;
+}
+
+
+/**
+* 次の行セットをスロットに取得します
+*
+* @param[in] slot 取得先のスロット
+* @param[out] rows 取得した行数
+* @param[out] error エラーメッセージ
+* @return bool 取得できたか(終わりの場合はerrorが空)
+*/
+bool RowsetFetcher::FetchInto(size_t slot, size_t &rows, OString &error)
+{
+  // 領域を広げる前は領域に入る行数まで
+  size_t nextRows = std::min(m_nextRows, m_capacity);
+  if(nextRows != m_rowArraySize) {
+    if(SQL_SUCCEEDED(SQLSetStmtAttr(m_stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)(SQLULEN)nextRows, 0))) {
+      m_rowArraySize = nextRows;
+    } else {
+      // 結果セットの途中で変えられないドライバは今の行数のまま
+      m_tuning.adaptive = false;
+      m_nextRows = m_rowArraySize;
+    }
+  }
+
+  m_bindOffset = (SQLULEN)(slot * m_slotBytes);
+  m_fetched = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  SQLRETURN ret = SQLFetch(m_stmt);
+  uint64_t micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  rows = (size_t)m_fetched;
+  if(ret == SQL_NO_DATA) {
+    return false;
+  }
+  if(!SQL_SUCCEEDED(ret)) {
+    error = OdbcErrorMessage(_O("SQLFetch"), ret, SQL_HANDLE_STMT, m_stmt);
+    return false;
+  }
+
+  size_t bytes = MeasureBytes(slot, rows);
+  m_stats.fetches++;
+  m_stats.rows += rows;
+  m_stats.bytes += bytes;
+  m_stats.micros += micros;
+  if(m_tuning.adaptive) {
+    Adapt(rows, bytes, micros);
+  }
+  return true;
+}
+
+
+/**
+* 取得した行セットの値のバイト数
+*
+* 長さ配列から数えます(NULLは0、長さ不明・切り捨ては列の幅)。
+*
+* @param[in] slot スロット
+* @param[in] rows 行数
+* @return size_t バイト数
+*/
+size_t RowsetFetcher::MeasureBytes(size_t slot, size_t rows) const
+{
+  size_t bytes = 0;
+  for(size_t c = 0; c < m_columns.size(); c++) {
+    const FetchColumn &col = m_columns[c];
+    const SQLLEN *indicators = (const SQLLEN *)(m_block.data() + slot * m_slotBytes + col.indicatorOffset);
+    for(size_t r = 0; r < rows; r++) {
+      SQLLEN length = indicators[r];
+      if(length == SQL_NULL_DATA) {
+        continue;
+      }
+      bytes += (length == SQL_NO_TOTAL || length > col.width) ? (size_t)col.width : (size_t)length;
+    }
+  }
+  return bytes;
+}
+
+
+/**
+* 取得のバイト数と時間から次の行数を決めます
+*
+* 実際に返った値のバイト数で、1バイトあたりの時間(往復の時間を含む)と
+* 1行あたりのバイト数を平滑して、目標の時間で取得できる行数に近づけます。
+* 1回の変化は半分〜倍まで、領域を広げられる上限の行数までで、取得した値を
+* JSONにした目安(値のバイト数+1値あたりFETCH_JSON_VALUE_BYTES)が全スロットで
+* 上限のバイト数に収まる行数までです。行数が足りない(最後の)行セットは測りません。
+*
+* @param[in] rows 取得した行数
+* @param[in] bytes 値のバイト数
+* @param[in] micros 取得の時間(マイクロ秒)
+*/
+void RowsetFetcher::Adapt(size_t rows, size_t bytes, uint64_t micros)
+{
+  if(rows == 0 || rows < m_rowArraySize) {
+    return;
+  }
+  // 値が全てNULL・空の行セットも測れるように1行1バイト以上として数える
+  double perByte = (double)micros / std::max(bytes, rows);
+  double perRow = (double)bytes / rows;
+  m_byteMicros = m_byteMicros > 0 ? m_byteMicros * 0.7 + perByte * 0.3 : perByte;
+  m_rowBytes = m_rowBytes > 0 ? m_rowBytes * 0.7 + perRow * 0.3 : perRow;
+
+  double rowMicros = m_byteMicros * std::max(m_rowBytes, 1.0);
+  double target = m_tuning.targetMillis * 1000.0 / std::max(rowMicros, 0.01);
+  double lower = std::max(1.0, m_rowArraySize / 2.0);
+  double upper = std::min((double)m_maxCapacity, m_rowArraySize * 2.0);
+  size_t maxBytes = m_tuning.maxBytes > 0 ? m_tuning.maxBytes : FETCH_MAX_BLOCK;
+  double converted = m_rowBytes + (double)FETCH_JSON_VALUE_BYTES * m_columns.size();
+  double memory = std::max(1.0, (double)maxBytes / (m_slots * std::max(converted, 1.0)));
+  size_t next = (size_t)std::min(memory, std::max(lower, std::min(upper, target)));
+  // 1割以内の変化では変えない(属性の設定を減らす)
+  if(next * 10 < m_rowArraySize * 9 || next * 10 > m_rowArraySize * 11) {
+    m_nextRows = next;
+  }
+}
+
+
+/**
+* 取得の統計
+*
+* @return FetchStats 統計
+*/
+FetchStats RowsetFetcher::Stats() const
+{
+  FetchStats stats = m_stats;
+  stats.rowArraySize = m_rowArraySize;
+  stats.capacity = m_capacity;
+  return stats;
+}
+
+
+/**
+* 参照するスロットと行数を切り替えます
+*
+* @param[in] slot スロット
+* @param[in] rows 行数
+*/
+void RowsetFetcher::Select(size_t slot, size_t rows)
+{
+  m_view = slot * m_slotBytes;
+  m_viewRows = rows;
+}
+
+
+//
+// RowsetPipeline
+//
+
+/**
+* コンストラクタ
+*
+* @param[in] fetcher バインド済みの取得(2スロット以上)
+*/
+RowsetPipeline::RowsetPipeline(RowsetFetcher &fetcher)
+  : m_fetcher(fetcher), m_current(0), m_holding(false), m_finished(false), m_stop(false)
+{
+  for(size_t i = 0; i < m_fetcher.Slots(); i++) {
+    m_free.push_back(i);
+  }
+}
+
+
+/**
+* デストラクタ(取得スレッドの終了を待つ)
+*/
+RowsetPipeline::~RowsetPipeline()
+{
+  Stop();
+}
+
+
+/**
+* 取得スレッドを開始します
+*/
+void RowsetPipeline::Start()
+{
+  m_thread = std::thread(&RowsetPipeline::Run, this);
+}
+
+
+/**
+* 取得スレッドを止めて終了を待ちます
+*
+* 取得中のSQLFetchは完了を待ちます(中断はCancelTokenで)。
+*/
+void RowsetPipeline::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if(m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+
+/**
+* 取得スレッド
+*
+* 自動調整の行数が領域に入らなくなった場合は、他のスロットが全て空くのを
+* 待って領域を広げます。
+*/
+void RowsetPipeline::Run()
+{
+  for(;;) {
+    size_t slot;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this]() { return m_stop || !m_free.empty(); });
+      if(m_stop) {
+        break;
+      }
+      slot = m_free.front();
+      m_free.pop_front();
+      if(m_fetcher.NeedsGrow()) {
+        // 領域を広げるのは他のスロットが全て空いてから(取得済み・変換中の行セットを壊さない)
+        m_cv.wait(lock, [this]() { return m_stop || m_free.size() + 1 == m_fetcher.Slots(); });
+        if(m_stop) {
+          m_free.push_back(slot);
+          break;
+        }
+      }
+    }
+    size_t rows = 0;
+    OString error;
+    bool ok = m_fetcher.Grow(error) && m_fetcher.FetchInto(slot, rows, error);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(ok) {
+        m_filled.push_back(std::make_pair(slot, rows));
+      } else {
+        m_free.push_back(slot);
+        m_error = error;
+      }
+    }
+    m_cv.notify_all();
+    if(!ok) {
+      break;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_finished = true;
+  }
+  m_cv.notify_all();
+}
+
+
+/**
+* 次の行セットを参照します
+*
+* @param[out] error エラーメッセージ
+* @return bool 行セットがあるか(終わりの場合はerrorが空)
+*/
+bool RowsetPipeline::Next(OString &error)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if(m_holding) {
+    // 変換が終わった行セットのスロットを返却して取得を再開させる
+    m_free.push_back(m_current);
+    m_holding = false;
+    m_cv.notify_all();
+  }
+  m_cv.wait(lock, [this]() { return m_finished || !m_filled.empty(); });
+  if(m_filled.empty()) {
+    error = m_error;
+    return false;
+  }
+  m_current = m_filled.front().first;
+  size_t rows = m_filled.front().second;
+  m_filled.pop_front();
+  m_holding = true;
+  lock.unlock();
+  m_fetcher.Select(m_current, rows);
+  return true;
+}
+
+
+/**
+* バインドした領域の値をJSONにします
+*
+* @param[in] col 列(cType・widthを使用)
+* @param[in] p 値の先頭
+* @param[in] length 長さ(SQL_NULL_DATAはnull)
+* @return json 値
+*/
+json FetchValue(const FetchColumn &col, const char *p, SQLLEN length)
+{
+  if(length == SQL_NULL_DATA) {
+    return json();
+  }
+
+  switch(col.cType) {
+    case SQL_C_SBIGINT: {
+      int64_t n;
+      memcpy(&n, p, sizeof(n));
+      // JSの数値で正確に表せない値は文字列
+      if(n > 9007199254740991LL || n < -9007199254740991LL) {
+        return json(std::to_string(n));
+      }
+      return json(n);
+    }
+    case SQL_C_DOUBLE: {
+      double d;
+      memcpy(&d, p, sizeof(d));
+      return json(d);
+    }
+    case SQL_C_BIT:
+      return json(*p != 0);
+    case SQL_C_BINARY: {
+      // 16進数の文字列
+      static const char hex[] = "0123456789ABCDEF";
+      size_t n = (length == SQL_NO_TOTAL || length > col.width) ? (size_t)col.width : (size_t)length;
+      std::string s(n * 2, '0');
+      for(size_t i = 0; i < n; i++) {
+        s[i * 2] = hex[((unsigned char)p[i]) >> 4];
+        s[i * 2 + 1] = hex[((unsigned char)p[i]) & 0x0f];
+      }
+      return json(s);
+    }
+  }
+
+  // 文字列(切り捨てられた場合は終端の手前まで)
+  size_t unit = col.cType == SQL_C_WCHAR ? sizeof(SQLWCHAR) : 1;
+  size_t bytes = (length == SQL_NO_TOTAL || length > col.width - (SQLLEN)unit)
+    ? (size_t)col.width - unit : (size_t)length;
+#ifdef UNICODE
+  return json(to_jsonstr(OString((const wchar_t *)p, bytes / unit)));
+#else
+  return json(std::string(p, bytes));
+#endif
+}
+
+
+/**
+* 値をJSONにします
+*
+* @param[in] c 列番号
+* @param[in] r 行セット内の行番号
+* @return json 値(NULLはnull)
+*/
+json RowsetFetcher::Value(size_t c, size_t r) const
+{
+  return FetchValue(m_columns[c], Data(c, r), Indicator(c, r));
+}
+
+
+/**
+* バインドした領域の値(1行分)と長さを写します
+*
+* 写した値はそのままパラメータとしてバインドできます(Cの型は列のcType)。
+*
+* @param[in] c 列番号
+* @param[in] r 行セット内の行番号
+* @param[out] data 値
+* @param[out] indicator 長さ(NULLはSQL_NULL_DATA)
+*/
+void RowsetFetcher::CopyValue(size_t c, size_t r, std::vector<char> &data, SQLLEN &indicator) const
+{
+  const char *p = Data(c, r);
+  data.assign(p, p + m_columns[c].width);
+  indicator = Indicator(c, r);
+}
+
+
+/**
+* 列名の一覧
+*
+* @return json 列名の配列
+*/
+json RowsetFetcher::ColumnsJson() const
+{
+  json columns = json::array();
+  for(size_t c = 0; c < m_columns.size(); c++) {
+    columns.push_back(to_jsonstr(m_columns[c].name));
+  }
+  return columns;
+}
+
+
+/**
+* 行をJSONにした場合の目安のバイト数
+*
+* 列ごとに列名・値の長さ(長さ配列から、バイナリは16進数で倍)と
+* オブジェクトの節点の分を数えます。
+*
+* @param[in] r 行セット内の行番号
+* @return size_t バイト数
+*/
+size_t RowsetFetcher::EstimateJsonBytes(size_t r) const
+{
+  size_t bytes = 0;
+  for(size_t c = 0; c < m_columns.size(); c++) {
+    const FetchColumn &col = m_columns[c];
+    bytes += FETCH_JSON_VALUE_BYTES + col.name.size();
+    SQLLEN length = Indicator(c, r);
+    if(length == SQL_NULL_DATA) {
+      continue;
+    }
+    size_t value = (length == SQL_NO_TOTAL || length > col.width) ? (size_t)col.width : (size_t)length;
+    bytes += col.cType == SQL_C_BINARY ? value * 2 : value;
+  }
+  return bytes;
+}
+
+
+/**
+* 残りの行を全て取得します
+*
+* 最大行数に達したら取得を止めます(残りは呼び出し元がSQLMoreResultsで破棄する)。
+* 最大行数ちょうどで行セットが終わった場合は、続きがあるかを次の行セットで確かめます。
+* 行のJSONの目安のバイト数を行セットごとにプロセス全体のメモリ予算(MemoryBudget)
+* から確保し、超える場合は失敗します(確保は戻る時に返す)。
+*
+* @param[out] rows 行(列名→値のオブジェクト)の配列
+* @param[in] maxRows 最大行数(0は無制限)
+* @param[out] truncated 最大行数を超えたか
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool RowsetFetcher::FetchAll(json &rows, size_t maxRows, bool &truncated, OString &error)
+{
+  std::vector<std::string> names;
+  for(size_t c = 0; c < m_columns.size(); c++) {
+    names.push_back(to_jsonstr(m_columns[c].name));
+  }
+
+  truncated = false;
+  rows = json::array();
+  MemoryBudget &budget = MemoryBudget::Shared();
+  size_t reserved = 0;
+  while(!truncated && Fetch(error)) {
+    // 取り込む行の分をメモリ予算から確保する
+    size_t bytes = 0;
+    for(size_t r = 0; r < RowCount() && (maxRows == 0 || rows.size() + r < maxRows); r++) {
+      bytes += EstimateJsonBytes(r);
+    }
+    if(!budget.TryReserve(bytes)) {
+      error = _O("結果がメモリ予算(setMemoryBudget)を超えました。maxRowsで行数を制限するか、pool.materializeで読んでください");
+      break;
+    }
+    reserved += bytes;
+    for(size_t r = 0; r < RowCount(); r++) {
+      if(maxRows > 0 && rows.size() >= maxRows) {
+        // 残りは読まない(SQLCloseCursorは後続の結果セットも破棄するので使わない)
+        truncated = true;
+        break;
+      }
+      json row = json::object();
+      for(size_t c = 0; c < m_columns.size(); c++) {
+        row[names[c]] = Value(c, r);
+      }
+      rows.push_back(row);
+    }
+  }
+  budget.Release(reserved);
+  return error.empty();
+}
+
+
+/**
+* 実行済みの文の全ての結果をSQLMoreResultsで読み切ります
+*
+* 結果を返さない場合は結果セットを取得せず、SQLMoreResultsで破棄します。
+*
+* @param[in] stmt 実行済みの文
+* @param[in] keep 結果を返すか
+* @param[in] maxRows 1つの結果セットから返す最大行数(0は無制限)
+* @param[out] results 結果の配列([{columns, rows, truncated} | {rowCount}])
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool FetchResults(SQLHSTMT stmt, bool keep, size_t maxRows, json &results, OString &error)
+{
+  SQLRETURN ret;
+  RowsetFetcher fetcher;
+
+  results = json::array();
+  for(;;) {
+    SQLSMALLINT columnCount = 0;
+    SQLNumResultCols(stmt, &columnCount);
+    if(columnCount > 0) {
+      // 結果セット(返さない場合は取得しない)
+      if(keep) {
+        json rows;
+        bool truncated = false;
+        if(!fetcher.Bind(stmt, FETCH_DEFAULT_ROWS, error)
+          || !fetcher.FetchAll(rows, maxRows, truncated, error)) {
+          SQLFreeStmt(stmt, SQL_UNBIND);
+          return false;
+        }
+        json result = json::object();
+        result["columns"] = fetcher.ColumnsJson();
+        result["rows"] = rows;
+        result["truncated"] = truncated;
+        results.push_back(result);
+      }
+    } else {
+      SQLLEN rowCount = -1;
+      SQLRowCount(stmt, &rowCount);
+      json result = json::object();
+      result["rowCount"] = rowCount;
+      results.push_back(result);
+    }
+
+    ret = SQLMoreResults(stmt);
+    if(ret == SQL_NO_DATA) {
+      break;
+    }
+    if(!SQL_SUCCEEDED(ret)) {
+      error = OdbcErrorMessage(_O("SQLMoreResults"), ret, SQL_HANDLE_STMT, stmt);
+      SQLFreeStmt(stmt, SQL_UNBIND);
+      return false;
+    }
+  }
+  // 結果セットのバインドを外す(fetcherの領域はここで解放される)
+  SQLFreeStmt(stmt, SQL_UNBIND);
+  return true;
+}
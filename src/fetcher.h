@@ -0,0 +1,234 @@
+﻿#ifndef _FETCHER_H
+#define _FETCHER_H
+//
+// 結果セットの行セット取得
+//
+// 列ごとの配列にバインド(SQL_BIND_BY_COLUMN)し、SQL_ATTR_ROW_ARRAY_SIZE行
+// ずつまとめて取得します。全列の配列は1つの連続した領域に置きます。
+// napiに依存しないのでワーカースレッドからも使えます。
+//
+// 自動調整(FetchTuning)では領域を上限の行数で確保し、取得ごとの時間と
+// バイト数を測ってSQL_ATTR_ROW_ARRAY_SIZEを目標の時間に近づけます。
+//
+// 領域を複数の行セット分(スロット)確保した場合は、SQL_ATTR_ROW_BIND_OFFSET_PTR
+// で取得先のスロットを切り替えます。RowsetPipelineは取得スレッドで次の
+// 行セットを取得している間に、前の行セットを呼び出し側のスレッドで変換します。
+//
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "omnicommon.h"
+#include "bufferpool.h"
+#include "nlohmann/json.hpp"
+
+// 既定の1回に取得する行数
+#define FETCH_DEFAULT_ROWS 256
+// 1列の最大バイト数(超える分は切り捨て)
+#define FETCH_MAX_WIDTH 32768
+// 行セット領域の上限(全スロットの合計、超える場合は行数を減らす)
+#define FETCH_MAX_BLOCK (8 * 1024 * 1024)
+// RowsetPipelineで使うスロット数(変換中・取得済み・取得中)
+#define FETCH_PIPELINE_SLOTS 3
+// 自動調整の既定の1回の取得の目標時間(ミリ秒)
+#define FETCH_ADAPTIVE_TARGET 50
+// 自動調整の最初の取得の目安(バイト、列の大きさから行数を決める)
+#define FETCH_ADAPTIVE_START_BYTES (64 * 1024)
+// 自動調整の行数の上限
+#define FETCH_ADAPTIVE_MAX_ROWS 32768
+// 全行取得のJSONの1値あたりの目安のバイト数(値の文字列を除く)
+#define FETCH_JSON_VALUE_BYTES 64
+
+// 1回に取得する行数の自動調整
+struct FetchTuning {
+  FetchTuning() : adaptive(false), targetMillis(FETCH_ADAPTIVE_TARGET), maxBytes(FETCH_MAX_BLOCK) {}
+  // 自動調整するか(falseは指定の行数で固定)
+  bool adaptive;
+  // 1回の取得の目標時間(ミリ秒)
+  uint32_t targetMillis;
+  // 行セットの上限(全スロットの合計、バイト。領域と、取得した値をJSONにした目安の両方)
+  size_t maxBytes;
+};
+
+// 取得の統計
+struct FetchStats {
+  // 取得回数・行数・値のバイト数(長さから)・時間(マイクロ秒)
+  uint64_t fetches;
+  uint64_t rows;
+  uint64_t bytes;
+  uint64_t micros;
+  // 今の1回に取得する行数と領域に入る行数
+  size_t rowArraySize;
+  size_t capacity;
+};
+
+// 結果セットの列
+struct FetchColumn {
+  // 列名
+  OString name;
+  // SQLの型
+  SQLSMALLINT sqlType;
+  // 桁数
+  SQLULEN columnSize;
+  // 小数部桁数
+  SQLSMALLINT decimalDigits;
+  // NULL可
+  SQLSMALLINT nullable;
+  // バインドするCの型
+  SQLSMALLINT cType;
+  // 1行分のバイト数
+  SQLLEN width;
+  // 行セット領域内の値配列の位置
+  size_t dataOffset;
+  // 行セット領域内の長さ配列の位置
+  size_t indicatorOffset;
+};
+
+// SQLの型からバインドするCの型と1行分のバイト数を決めます
+void ChooseFetchBinding(FetchColumn &col);
+// バインドした領域の値をJSONにします
+nlohmann::json FetchValue(const FetchColumn &col, const char *p, SQLLEN length);
+
+class RowsetFetcher {
+public:
+  RowsetFetcher();
+
+  // 行数の自動調整を設定します(Bindの前に呼ぶ)
+  void SetTuning(const FetchTuning &tuning) { m_tuning = tuning; }
+  // 結果セットの列を調べてバインドします(rowArraySize行ずつ取得、slotsは行セット領域の数)
+  bool Bind(SQLHSTMT stmt, size_t rowArraySize, OString &error, size_t slots = 1);
+  // 次の行セットを取得します(終わり・失敗はfalse、終わりの場合errorは空)
+  bool Fetch(OString &error);
+  // 次の行セットをスロットに取得します(参照するスロットは変えない)
+  bool FetchInto(size_t slot, size_t &rows, OString &error);
+  // 自動調整の行数が領域に入らず、領域を広げる必要があるか
+  bool NeedsGrow() const { return m_nextRows > m_capacity; }
+  // 領域を広げてバインドし直します(どのスロットも参照・取得していない時に呼ぶ)
+  bool Grow(OString &error);
+  // 参照するスロットと行数を切り替えます(Value等はこのスロットを読む)
+  void Select(size_t slot, size_t rows);
+
+  // 列数
+  size_t ColumnCount() const { return m_columns.size(); }
+  // 列
+  const FetchColumn &Column(size_t c) const { return m_columns[c]; }
+  // 1回に取得する行数
+  size_t RowArraySize() const { return m_rowArraySize; }
+  // 取得の統計(取得する側のスレッド、またはRowsetPipelineの停止後)
+  FetchStats Stats() const;
+  // スロット数
+  size_t Slots() const { return m_slots; }
+  // 参照している行セットの行数
+  size_t RowCount() const { return m_viewRows; }
+
+  // NULLか
+  bool IsNull(size_t c, size_t r) const { return Indicator(c, r) == SQL_NULL_DATA; }
+  // 値をJSONにします
+  nlohmann::json Value(size_t c, size_t r) const;
+  // バインドした領域の値(1行分)と長さを写します
+  void CopyValue(size_t c, size_t r, std::vector<char> &data, SQLLEN &indicator) const;
+  // 列名の一覧
+  nlohmann::json ColumnsJson() const;
+
+  // 残りの行を全て取得します(maxRowsに達したら止めてtruncatedを設定、0は無制限、
+  // JSONの大きさがプロセス全体のメモリ予算を超える場合は失敗)
+  bool FetchAll(nlohmann::json &rows, size_t maxRows, bool &truncated, OString &error);
+
+private:
+  RowsetFetcher(const RowsetFetcher &);
+  RowsetFetcher &operator=(const RowsetFetcher &);
+
+  // 値の先頭
+  const char *Data(size_t c, size_t r) const
+  {
+    return m_block.data() + m_view + m_columns[c].dataOffset + r * m_columns[c].width;
+  }
+  // 長さ
+  SQLLEN Indicator(size_t c, size_t r) const
+  {
+    return ((const SQLLEN *)(m_block.data() + m_view + m_columns[c].indicatorOffset))[r];
+  }
+  // 行をJSONにした場合の目安のバイト数
+  size_t EstimateJsonBytes(size_t r) const;
+  // capacity行の行セット領域を配置してバインドします
+  bool Layout(size_t capacity, OString &error);
+  // 取得した行セットの値のバイト数
+  size_t MeasureBytes(size_t slot, size_t rows) const;
+  // 取得のバイト数と時間から次の行数を決めます
+  void Adapt(size_t rows, size_t bytes, uint64_t micros);
+
+  SQLHSTMT m_stmt;
+  std::vector<FetchColumn> m_columns;
+  BufferLease m_block;
+  size_t m_rowArraySize;
+  // 領域に入る行数・広げられる上限の行数と次の取得の行数(自動調整)
+  size_t m_capacity;
+  size_t m_maxCapacity;
+  size_t m_nextRows;
+  FetchTuning m_tuning;
+  // 1バイトあたりの取得時間(マイクロ秒)と1行あたりの値のバイト数の平滑値
+  double m_byteMicros;
+  double m_rowBytes;
+  FetchStats m_stats;
+  // SQL_ATTR_ROWS_FETCHED_PTR(取得する側のスレッドのみ)
+  SQLULEN m_fetched;
+  // スロット数と1スロットのバイト数
+  size_t m_slots;
+  size_t m_slotBytes;
+  // SQL_ATTR_ROW_BIND_OFFSET_PTR(取得先のスロットの位置)
+  SQLULEN m_bindOffset;
+  // 参照しているスロットの位置と行数(変換する側のスレッドのみ)
+  size_t m_view;
+  size_t m_viewRows;
+};
+
+//
+// 取得と変換のパイプライン
+//
+// 取得スレッドが空きスロットに次の行セットを取得して取得済みの待ち行列に
+// 入れ、呼び出し側のスレッドがNextで順に受け取って変換します。スロットは
+// 使い回すので、待ち行列の長さはスロット数で制限されます。
+//
+class RowsetPipeline {
+public:
+  // fetcherは2スロット以上でバインドしたもの
+  explicit RowsetPipeline(RowsetFetcher &fetcher);
+  ~RowsetPipeline();
+
+  // 取得スレッドを開始します
+  void Start();
+  // 次の行セットを参照します(前の行セットのスロットは返却、終わり・失敗はfalse)
+  bool Next(OString &error);
+  // 取得スレッドを止めて終了を待ちます(以降は文を操作してよい)
+  void Stop();
+
+private:
+  RowsetPipeline(const RowsetPipeline &);
+  RowsetPipeline &operator=(const RowsetPipeline &);
+
+  // 取得スレッド
+  void Run();
+
+  RowsetFetcher &m_fetcher;
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  // 空きスロット
+  std::deque<size_t> m_free;
+  // 取得済みのスロットと行数
+  std::deque<std::pair<size_t, size_t> > m_filled;
+  // 変換中のスロット
+  size_t m_current;
+  bool m_holding;
+  bool m_finished;
+  bool m_stop;
+  OString m_error;
+};
+
+// 実行済みの文の全ての結果をSQLMoreResultsで順に処理します(返さない結果セットは取得しない)
+bool FetchResults(SQLHSTMT stmt, bool keep, size_t maxRows, nlohmann::json &results, OString &error);
+
+#endif
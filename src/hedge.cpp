@@ -0,0 +1,228 @@
+﻿#include "hedge.h"
+
+#include <algorithm>
+
+
+/**
+* コンストラクタ(タイマースレッド起動)
+*
+* @param[in] options 設定
+*/
+HedgeController::HedgeController(const HedgeOptions &options)
+  : m_options(options)
+{
+  m_options.percentile = std::max(1.0, std::min(99.0, m_options.percentile));
+  m_options.maxDelayMs = std::max(m_options.minDelayMs, m_options.maxDelayMs);
+  m_next = 0;
+  m_tokens = m_options.burst;
+  m_requests = 0;
+  m_hedged = 0;
+  m_hedgeWins = 0;
+  m_budgetDenied = 0;
+  m_cancelled = 0;
+  m_closed = false;
+  m_timerThread = std::thread(&HedgeController::TimerLoop, this);
+}
+
+
+/**
+* デストラクタ
+*/
+HedgeController::~HedgeController()
+{
+  Close();
+}
+
+
+/**
+* 既定の設定
+*
+* @return HedgeOptions 設定(p95、10ms～1秒、予算10%)
+*/
+HedgeOptions HedgeController::DefaultOptions()
+{
+  HedgeOptions options;
+  options.percentile = 95;
+  options.minDelayMs = 10;
+  options.maxDelayMs = 1000;
+  options.budgetPercent = 10;
+  options.burst = 5;
+  return options;
+}
+
+
+/**
+* 要求の開始
+*
+* 要求ごとに予算(budgetPercent/100回分のヘッジ)を貯めます。
+*/
+void HedgeController::Begin()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_requests++;
+  m_tokens = std::min(m_options.burst, m_tokens + m_options.budgetPercent / 100);
+}
+
+
+/**
+* ヘッジまでの待ち時間
+*
+* @return uint32_t 待ち時間(ミリ秒)
+*/
+uint32_t HedgeController::Delay()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return (uint32_t)ComputeDelay();
+}
+
+
+/**
+* 待ち時間の計算
+*
+* 直近の処理時間のパーセンタイルをminDelayMs～maxDelayMsに収めます。
+* 処理時間が少ないうちはmaxDelayMsを使います。
+*/
+double HedgeController::ComputeDelay()
+{
+  if(m_samples.size() < HEDGE_MIN_SAMPLES) {
+    return m_options.maxDelayMs;
+  }
+  std::vector<double> sorted(m_samples);
+  size_t k = (size_t)((sorted.size() - 1) * m_options.percentile / 100);
+  std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+  return std::max((double)m_options.minDelayMs, std::min((double)m_options.maxDelayMs, sorted[k]));
+}
+
+
+/**
+* ヘッジしてよいか判定します
+*
+* @return bool 予算が残っていればtrue(予算を1回分使う)
+*/
+bool HedgeController::TryHedge()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(m_tokens < 1) {
+    m_budgetDenied++;
+    return false;
+  }
+  m_tokens -= 1;
+  m_hedged++;
+  return true;
+}
+
+
+/**
+* 要求の完了
+*
+* @param[in] latencyMs 勝った試行の処理時間(ミリ秒、負の値は記録しない)
+* @param[in] hedgeWon ヘッジした側が勝ったか
+*/
+void HedgeController::Complete(double latencyMs, bool hedgeWon)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(hedgeWon) {
+    m_hedgeWins++;
+  }
+  if(latencyMs < 0) {
+    return;
+  }
+  if(m_samples.size() < HEDGE_SAMPLES) {
+    m_samples.push_back(latencyMs);
+  } else {
+    m_samples[m_next] = latencyMs;
+  }
+  m_next = (m_next + 1) % HEDGE_SAMPLES;
+}
+
+
+/**
+* 負けた試行を取り消した
+*/
+void HedgeController::Cancelled()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_cancelled++;
+}
+
+
+/**
+* delayMs後にfnを呼びます
+*
+* @param[in] delayMs 待ち時間(ミリ秒)
+* @param[in] fn タイマースレッドで呼ぶ関数(短く終わること)
+*/
+void HedgeController::Schedule(uint32_t delayMs, const std::function<void()> &fn)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    if(m_closed) {
+      return;
+    }
+    m_timers.insert(std::make_pair(std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs), fn));
+  }
+  m_timerCv.notify_one();
+}
+
+
+/**
+* タイマーを止めます
+*/
+void HedgeController::Close()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    if(m_closed) {
+      return;
+    }
+    m_closed = true;
+    m_timers.clear();
+  }
+  m_timerCv.notify_all();
+  if(m_timerThread.joinable()) {
+    m_timerThread.join();
+  }
+}
+
+
+/**
+* タイマースレッド
+*/
+void HedgeController::TimerLoop()
+{
+  std::unique_lock<std::mutex> lock(m_timerMutex);
+  while(!m_closed) {
+    if(m_timers.empty()) {
+      m_timerCv.wait(lock);
+      continue;
+    }
+    std::chrono::steady_clock::time_point due = m_timers.begin()->first;
+    if(std::chrono::steady_clock::now() < due) {
+      m_timerCv.wait_until(lock, due);
+      continue;
+    }
+    std::function<void()> fn = m_timers.begin()->second;
+    m_timers.erase(m_timers.begin());
+    // 予定の登録を止めないようにロック外で呼ぶ
+    lock.unlock();
+    fn();
+    lock.lock();
+  }
+}
+
+
+/**
+* 統計
+*/
+HedgeStats HedgeController::Stats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  HedgeStats stats;
+  stats.delayMs = ComputeDelay();
+  stats.requests = m_requests;
+  stats.hedged = m_hedged;
+  stats.hedgeWins = m_hedgeWins;
+  stats.budgetDenied = m_budgetDenied;
+  stats.cancelled = m_cancelled;
+  return stats;
+}
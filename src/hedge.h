@@ -0,0 +1,109 @@
+﻿#ifndef _HEDGE_H
+#define _HEDGE_H
+//
+// ヘッジ実行(遅い要求を別の接続でも実行して先に返った方を使う)
+//
+// 直近の処理時間の分布からヘッジまでの待ち時間(パーセンタイル)を求め、
+// その時間を過ぎても終わらない要求を別の接続でも実行します。ヘッジの数は
+// 要求数に対する割合(予算)で制限し、負荷が倍にならないようにします。
+// 待ち時間はタイマースレッドで計ります。napiに依存しません。
+//
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 処理時間を覚えておく数
+#define HEDGE_SAMPLES 256
+// パーセンタイルを使い始めるまでの処理時間の数
+#define HEDGE_MIN_SAMPLES 20
+
+// 設定
+struct HedgeOptions {
+  // 待ち時間に使う処理時間のパーセンタイル(1-99)
+  double percentile;
+  // 待ち時間の最小・最大(ミリ秒、処理時間が少ないうちは最大を使う)
+  uint32_t minDelayMs;
+  uint32_t maxDelayMs;
+  // 予算(要求数に対するヘッジの割合、%)
+  double budgetPercent;
+  // 予算の貯めておける上限(ヘッジの回数)
+  double burst;
+};
+
+// 統計
+struct HedgeStats {
+  // 現在の待ち時間(ミリ秒)
+  double delayMs;
+  // ヘッジ対象の要求数
+  uint64_t requests;
+  // ヘッジした数
+  uint64_t hedged;
+  // ヘッジした側が先に返った数
+  uint64_t hedgeWins;
+  // 予算切れでヘッジしなかった数
+  uint64_t budgetDenied;
+  // 取り消した数
+  uint64_t cancelled;
+};
+
+class HedgeController {
+public:
+  explicit HedgeController(const HedgeOptions &options);
+  ~HedgeController();
+
+  // 既定の設定
+  static HedgeOptions DefaultOptions();
+
+  // 要求の開始(予算を貯める)
+  void Begin();
+  // ヘッジまでの待ち時間(ミリ秒)
+  uint32_t Delay();
+  // ヘッジしてよいか(予算を使う)
+  bool TryHedge();
+  // 要求の完了(成功した試行の処理時間を記録、hedgeWonはヘッジ側が勝ったか)
+  void Complete(double latencyMs, bool hedgeWon);
+  // 負けた試行を取り消した
+  void Cancelled();
+
+  // delayMs後にfnを呼びます(タイマースレッド、Close後は呼ばない)
+  void Schedule(uint32_t delayMs, const std::function<void()> &fn);
+  // タイマーを止めます(未実行の予定は捨てる)
+  void Close();
+
+  HedgeStats Stats();
+
+private:
+  HedgeController(const HedgeController &);
+  HedgeController &operator=(const HedgeController &);
+
+  // 待ち時間の計算(ロック中に呼ぶ)
+  double ComputeDelay();
+  // タイマースレッド
+  void TimerLoop();
+
+  HedgeOptions m_options;
+  std::mutex m_mutex;
+  // 処理時間(リングバッファ)
+  std::vector<double> m_samples;
+  size_t m_next;
+  double m_tokens;
+  uint64_t m_requests;
+  uint64_t m_hedged;
+  uint64_t m_hedgeWins;
+  uint64_t m_budgetDenied;
+  uint64_t m_cancelled;
+
+  // タイマー
+  std::mutex m_timerMutex;
+  std::condition_variable m_timerCv;
+  std::multimap<std::chrono::steady_clock::time_point, std::function<void()> > m_timers;
+  std::thread m_timerThread;
+  bool m_closed;
+};
+
+#endif
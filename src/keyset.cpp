@@ -0,0 +1,178 @@
+﻿#include "keyset.h"
+
+using json = nlohmann::json;
+
+
+/**
+* 列名が同じか(英字の大文字・小文字は区別しない)
+*/
+static bool SameColumnName(const OString &a, const OString &b)
+{
+  if(a.size() != b.size()) {
+    return false;
+  }
+  for(size_t i = 0; i < a.size(); i++) {
+    OString::value_type x = a[i];
+    OString::value_type y = b[i];
+    if(x >= 'a' && x <= 'z') x = x - 'a' + 'A';
+    if(y >= 'a' && y <= 'z') y = y - 'a' + 'A';
+    if(x != y) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/**
+* コンストラクタ
+*
+* 複合キー(k1, k2, ...)のシーク条件は
+*   k1 > ? OR (k1 = ? AND k2 > ?) OR ...(降順のキーは<)
+* で、最後のページか判定するためにページの行数+1行を読みます。
+*
+* @param[in] sql ORDER BYを含まないSELECT
+* @param[in] keys 一意になる列の組(NULLを含まないこと)
+* @param[in] pageSize ページの行数
+*/
+KeysetQuery::KeysetQuery(const OString &sql, const std::vector<KeysetKey> &keys, size_t pageSize)
+  : m_keys(keys), m_pageSize(pageSize > 0 ? pageSize : 1)
+{
+  OString select = _O("SELECT * FROM (") + sql + _O(") AS ") + KEYSET_ALIAS;
+  OString order = _O(" ORDER BY ");
+  for(size_t k = 0; k < m_keys.size(); k++) {
+    order += (k > 0 ? _O(", ") : _O("")) + m_keys[k].column + (m_keys[k].desc ? _O(" DESC") : _O(""));
+  }
+  order += _O(" FETCH FIRST ") + to_ostring(m_pageSize + 1) + _O(" ROWS ONLY");
+
+  OString seek;
+  for(size_t k = 0; k < m_keys.size(); k++) {
+    seek += k > 0 ? _O(" OR (") : _O("(");
+    for(size_t e = 0; e < k; e++) {
+      seek += m_keys[e].column + _O(" = ? AND ");
+    }
+    seek += m_keys[k].column + (m_keys[k].desc ? _O(" < ?)") : _O(" > ?)"));
+  }
+  m_first = select + order;
+  m_seek = select + _O(" WHERE ") + seek + order;
+}
+
+
+/**
+* afterのキーより後の1ページを取得します
+*
+* @param[in] hdbc 接続ハンドル
+* @param[in] after 前のページの最後の行のキー(空なら最初のページ)
+* @param[out] page 取得結果
+* @param[out] error エラーメッセージ
+* @param[out] sqlState SQLSTATE
+* @return bool 成否
+*/
+bool KeysetQuery::Fetch(
+  SQLHDBC hdbc, const std::vector<KeysetValue> &after, KeysetPage &page, OString &error, std::string &sqlState) const
+{
+  SQLRETURN ret;
+
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(hdbc));
+  if(!stmt) {
+    error = OdbcErrorMessage(_O("SQLAllocHandle"), SQL_ERROR, SQL_HANDLE_DBC, hdbc);
+    return false;
+  }
+
+  // シーク条件のパラメータ(k番目の項はk1..kkを使う)
+  std::vector<SQLLEN> indicators;
+  if(!after.empty()) {
+    for(size_t k = 0; k < m_keys.size(); k++) {
+      for(size_t e = 0; e <= k; e++) {
+        indicators.push_back(after[e].indicator);
+      }
+    }
+    SQLUSMALLINT number = 0;
+    for(size_t k = 0; k < m_keys.size(); k++) {
+      for(size_t e = 0; e <= k; e++) {
+        const KeysetValue &v = after[e];
+        ret = SQLBindParameter(
+          stmt.get(), (SQLUSMALLINT)(number + 1), SQL_PARAM_INPUT, v.column.cType, v.column.sqlType,
+          v.column.columnSize, v.column.decimalDigits,
+          (SQLPOINTER)&v.data[0], v.column.width, &indicators[number]);
+        if(!SQL_SUCCEEDED(ret)) {
+          error = OdbcErrorMessage(_O("SQLBindParameter"), ret, SQL_HANDLE_STMT, stmt.get());
+          sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+          return false;
+        }
+        number++;
+      }
+    }
+  }
+
+  const OString &sql = after.empty() ? m_first : m_seek;
+  ret = SQLExecDirect(stmt.get(), (SQLTCHAR *)sql.c_str(), SQL_NTS);
+  if(!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+    error = OdbcErrorMessage(_O("SQLExecDirect"), ret, SQL_HANDLE_STMT, stmt.get());
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
+
+  RowsetFetcher fetcher;
+  if(!fetcher.Bind(stmt.get(), m_pageSize + 1, error)) {
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
+  // キーの列
+  std::vector<size_t> keyColumns;
+  for(size_t k = 0; k < m_keys.size(); k++) {
+    size_t c = 0;
+    while(c < fetcher.ColumnCount() && !SameColumnName(fetcher.Column(c).name, m_keys[k].column)) {
+      c++;
+    }
+    if(c == fetcher.ColumnCount()) {
+      error = _O("キーの列が結果にありません: ") + m_keys[k].column;
+      return false;
+    }
+    keyColumns.push_back(c);
+  }
+  std::vector<std::string> names;
+  for(size_t c = 0; c < fetcher.ColumnCount(); c++) {
+    names.push_back(to_jsonstr(fetcher.Column(c).name));
+  }
+
+  json rows = json::array();
+  size_t count = 0;
+  page.last.resize(m_keys.size());
+  while(fetcher.Fetch(error)) {
+    for(size_t r = 0; r < fetcher.RowCount(); r++, count++) {
+      if(count >= m_pageSize) {
+        // 次のページがあるかの確認用の1行
+        continue;
+      }
+      json row = json::object();
+      for(size_t c = 0; c < fetcher.ColumnCount(); c++) {
+        row[names[c]] = fetcher.Value(c, r);
+      }
+      rows.push_back(row);
+      for(size_t k = 0; k < keyColumns.size(); k++) {
+        page.last[k].column = fetcher.Column(keyColumns[k]);
+        fetcher.CopyValue(keyColumns[k], r, page.last[k].data, page.last[k].indicator);
+      }
+    }
+  }
+  if(!error.empty()) {
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
+  for(size_t k = 0; k < page.last.size(); k++) {
+    if(rows.size() > 0 && page.last[k].indicator == SQL_NULL_DATA) {
+      error = _O("キーの列にNULLがあります: ") + m_keys[k].column;
+      return false;
+    }
+  }
+
+  page.rows = rows.size();
+  page.done = count <= m_pageSize;
+  json result = json::object();
+  result["columns"] = fetcher.ColumnsJson();
+  result["rows"] = rows;
+  result["done"] = page.done;
+  page.json = result.dump(-1, ' ', true, json::error_handler_t::replace);
+  return true;
+}
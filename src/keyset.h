@@ -0,0 +1,70 @@
+﻿#ifndef _KEYSET_H
+#define _KEYSET_H
+//
+// キーセットページング
+//
+// OFFSETの代わりに前のページの最後の行のキーより後(シーク条件)を読みます。
+// 最後のキーはバインドした領域の値のまま保持し、次のページのパラメータと
+// してそのままバインドします(JSONを経由しないので型・文字コードが変わらない)。
+// napiに依存しません。
+//
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "omnicommon.h"
+#include "fetcher.h"
+
+// 元のSQLを囲む相関名
+#define KEYSET_ALIAS _O("OMNI_KEYSET")
+
+// ページのキー
+struct KeysetKey {
+  // 結果の列名(ORDER BY・シーク条件にそのまま使う)
+  OString column;
+  // 降順か
+  bool desc;
+};
+
+// キーの値(最後の行の値をバインドした領域のまま保持)
+struct KeysetValue {
+  FetchColumn column;
+  std::vector<char> data;
+  SQLLEN indicator;
+};
+
+// 1ページの取得結果
+struct KeysetPage {
+  // {columns, rows}(JSON形式の文字列)
+  std::string json;
+  // 行数
+  size_t rows;
+  // 最後のページか
+  bool done;
+  // ページの最後の行のキー
+  std::vector<KeysetValue> last;
+};
+
+class KeysetQuery {
+public:
+  // sqlはORDER BYを含まないSELECT、keysは一意になる列の組
+  KeysetQuery(const OString &sql, const std::vector<KeysetKey> &keys, size_t pageSize);
+
+  // afterのキーより後の1ページを取得します(afterが空なら最初のページ)
+  bool Fetch(
+    SQLHDBC hdbc, const std::vector<KeysetValue> &after, KeysetPage &page, OString &error, std::string &sqlState) const;
+
+  // ページの行数
+  size_t PageSize() const { return m_pageSize; }
+
+private:
+  // 最初のページのSQL
+  OString m_first;
+  // 2ページ目以降のSQL(シーク条件付き)
+  OString m_seek;
+  std::vector<KeysetKey> m_keys;
+  size_t m_pageSize;
+};
+
+#endif
@@ -0,0 +1,220 @@
+﻿#include "limiter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+// 短期・長期の処理時間の平滑化係数
+#define LIMITER_SHORT_ALPHA 0.2
+#define LIMITER_LONG_ALPHA 0.01
+// 上限の変化の平滑化係数(GRADIENT)
+#define LIMITER_SMOOTHING 0.2
+
+
+/**
+* コンストラクタ
+*
+* @param[in] options 設定
+*/
+ConcurrencyLimiter::ConcurrencyLimiter(const LimiterOptions &options)
+  : m_options(options)
+{
+  m_options.minLimit = std::max(1.0, m_options.minLimit);
+  m_options.maxLimit = std::max(m_options.minLimit, m_options.maxLimit);
+  m_limit = std::min(m_options.maxLimit, std::max(m_options.minLimit, m_options.initialLimit));
+  m_inFlight = 0;
+  m_pending = 0;
+  m_waiting = 0;
+  m_interactiveWaiting = 0;
+  m_completed = 0;
+  m_rejected = 0;
+  m_timeouts = 0;
+  m_overloads = 0;
+  m_minLatency = 0;
+  m_shortLatency = 0;
+  m_longLatency = 0;
+}
+
+
+/**
+* 既定の設定
+*
+* @param[in] maxLimit 上限の最大値(最大接続数)
+* @return LimiterOptions 設定
+*/
+LimiterOptions ConcurrencyLimiter::DefaultOptions(size_t maxLimit)
+{
+  LimiterOptions options;
+  options.algorithm = LIMITER_GRADIENT;
+  options.maxLimit = (double)std::max((size_t)1, maxLimit);
+  options.minLimit = 1;
+  options.initialLimit = std::max(1.0, options.maxLimit / 2);
+  options.maxQueue = maxLimit * 16;
+  options.queueTimeoutMs = 30000;
+  options.latencyThresholdMs = 1000;
+  options.backoff = 0.9;
+  options.tolerance = 1.5;
+  return options;
+}
+
+
+/**
+* 受け付け
+*
+* 実行待ち(受け付け済みで未実行の数)がmaxQueueに達している場合は断ります。
+*
+* @param[out] error エラーメッセージ
+* @return bool 受け付けたか
+*/
+bool ConcurrencyLimiter::Enqueue(OString &error)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(m_pending >= m_options.maxQueue) {
+    m_rejected++;
+    error = _O("処理待ちが上限(") + to_ostring(m_options.maxQueue) + _O(")に達したため受け付けられません");
+    return false;
+  }
+  m_pending++;
+  return true;
+}
+
+
+/**
+* 受け付けた要求を実行せずに取り消します
+*/
+void ConcurrencyLimiter::Cancel()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(m_pending > 0) {
+    m_pending--;
+  }
+}
+
+
+/**
+* 実行の許可を待ちます
+*
+* @param[in] enqueued Enqueueで受け付け済みか
+* @param[in] interactive 対話的な要求か(待っている間はバッチ処理より先に許可)
+* @param[out] error エラーメッセージ
+* @return bool 許可されたか(待ち時間の上限を超えた場合はfalse)
+*/
+bool ConcurrencyLimiter::Acquire(bool enqueued, bool interactive, OString &error)
+{
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(m_options.queueTimeoutMs);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_waiting++;
+  if(interactive) {
+    m_interactiveWaiting++;
+  }
+  bool ok = m_cv.wait_until(lock, deadline, [this, interactive]() {
+    return (double)m_inFlight < floor(m_limit) && (interactive || m_interactiveWaiting == 0);
+  });
+  m_waiting--;
+  if(interactive) {
+    m_interactiveWaiting--;
+    // 待たせていたバッチ処理に許可を出せるか確認させる
+    m_cv.notify_all();
+  }
+  if(enqueued && m_pending > 0) {
+    m_pending--;
+  }
+  if(!ok) {
+    m_timeouts++;
+    error = _O("同時実行数の制限の待ち時間を超えました");
+    return false;
+  }
+  m_inFlight++;
+  return true;
+}
+
+
+/**
+* 実行の終了
+*
+* @param[in] latencyMs 処理時間(ミリ秒)
+* @param[in] overload 過負荷(タイムアウト等)による失敗か
+*/
+void ConcurrencyLimiter::Release(double latencyMs, bool overload)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t inFlight = m_inFlight;
+    m_inFlight--;
+    m_completed++;
+    if(overload) {
+      m_overloads++;
+    }
+    Adjust(latencyMs, overload, inFlight);
+  }
+  m_cv.notify_all();
+}
+
+
+/**
+* 上限の調整
+*
+* 上限まで使っていない(アプリ側が律速の)ときは処理時間が速くても増やしません。
+*
+* @param[in] latencyMs 処理時間(ミリ秒)
+* @param[in] overload 過負荷による失敗か
+* @param[in] inFlight 終了した処理を含む実行中の数
+*/
+void ConcurrencyLimiter::Adjust(double latencyMs, bool overload, size_t inFlight)
+{
+  // 処理時間の平滑化
+  if(m_completed == 1) {
+    m_shortLatency = latencyMs;
+    m_longLatency = latencyMs;
+    m_minLatency = latencyMs;
+  } else {
+    m_shortLatency += (latencyMs - m_shortLatency) * LIMITER_SHORT_ALPHA;
+    m_longLatency += (latencyMs - m_longLatency) * LIMITER_LONG_ALPHA;
+    m_minLatency = std::min(m_minLatency, latencyMs);
+  }
+  bool saturated = (double)inFlight * 2 >= m_limit;
+
+  double limit = m_limit;
+  if(m_options.algorithm == LIMITER_AIMD) {
+    if(overload || latencyMs > m_options.latencyThresholdMs) {
+      limit = m_limit * m_options.backoff;
+    } else if(saturated) {
+      limit = m_limit + 1.0 / m_limit;
+    }
+  } else {
+    if(overload) {
+      limit = m_limit * m_options.backoff;
+    } else {
+      // 短期の処理時間が長期平均の許容倍率を超えて遅くなるほど減らす
+      double gradient = std::max(0.5, std::min(1.0, m_options.tolerance * m_longLatency / std::max(m_shortLatency, 0.001)));
+      // 余裕分(待ちに使える数)
+      double headroom = saturated ? sqrt(m_limit) : 0;
+      double target = m_limit * gradient + headroom;
+      limit = m_limit * (1 - LIMITER_SMOOTHING) + target * LIMITER_SMOOTHING;
+    }
+  }
+  m_limit = std::min(m_options.maxLimit, std::max(m_options.minLimit, limit));
+}
+
+
+/**
+* 統計
+*/
+LimiterStats ConcurrencyLimiter::Stats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  LimiterStats stats;
+  stats.limit = m_limit;
+  stats.inFlight = m_inFlight;
+  stats.waiting = m_pending > m_waiting ? m_pending : m_waiting;
+  stats.completed = m_completed;
+  stats.rejected = m_rejected;
+  stats.timeouts = m_timeouts;
+  stats.overloads = m_overloads;
+  stats.minLatencyMs = m_minLatency;
+  stats.shortLatencyMs = m_shortLatency;
+  stats.longLatencyMs = m_longLatency;
+  return stats;
+}
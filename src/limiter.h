@@ -0,0 +1,147 @@
+﻿#ifndef _LIMITER_H
+#define _LIMITER_H
+//
+// 適応型の同時実行数制限
+//
+// 処理時間を計測して同時に実行する数(上限)を調整します。上限を超える要求は
+// 待たせ、待ちがmaxQueueを超える要求はすぐに断ります(バックエンドが遅く
+// なったときに待ちが際限なく増えないように)。napiに依存しません。
+//
+//   AIMD     処理時間がしきい値以下なら上限を1/上限ずつ増やし、超えたか
+//            過負荷の失敗があれば上限にbackoffを掛けて減らします
+//   GRADIENT 長期の平均処理時間と短期の処理時間の比(勾配)で上限を増減します
+//
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "omnicommon.h"
+
+// 上限の調整方法
+enum LimiterAlgorithm {
+  LIMITER_AIMD,
+  LIMITER_GRADIENT
+};
+
+// 設定
+struct LimiterOptions {
+  // 調整方法
+  LimiterAlgorithm algorithm;
+  // 上限の初期値・最小値・最大値
+  double initialLimit;
+  double minLimit;
+  double maxLimit;
+  // 待ちの上限(超えた要求は断る)
+  size_t maxQueue;
+  // 待ち時間の上限(ミリ秒)
+  uint32_t queueTimeoutMs;
+  // AIMD: 遅いと判断する処理時間(ミリ秒)
+  double latencyThresholdMs;
+  // AIMD: 減らすときに掛ける値
+  double backoff;
+  // GRADIENT: 短期の処理時間の許容倍率(長期平均のこの倍までは減らさない)
+  double tolerance;
+};
+
+// 統計
+struct LimiterStats {
+  double limit;
+  size_t inFlight;
+  size_t waiting;
+  uint64_t completed;
+  uint64_t rejected;
+  uint64_t timeouts;
+  uint64_t overloads;
+  double minLatencyMs;
+  double shortLatencyMs;
+  double longLatencyMs;
+};
+
+class ConcurrencyLimiter {
+public:
+  explicit ConcurrencyLimiter(const LimiterOptions &options);
+
+  // 既定の設定(maxLimitは最大接続数)
+  static LimiterOptions DefaultOptions(size_t maxLimit);
+
+  // 受け付け(JSスレッド、待ちが上限を超える場合はfalse)
+  bool Enqueue(OString &error);
+  // 受け付けた要求を実行せずに取り消します
+  void Cancel();
+  // 実行の許可を待ちます(ワーカースレッド、enqueuedはEnqueue済みか)
+  // ※interactiveの要求が待っている間はそれ以外の要求に許可を出しません
+  bool Acquire(bool enqueued, bool interactive, OString &error);
+  // 実行の終了(latencyMsは処理時間、overloadはタイムアウト等の過負荷による失敗)
+  void Release(double latencyMs, bool overload);
+
+  LimiterStats Stats();
+
+private:
+  ConcurrencyLimiter(const ConcurrencyLimiter &);
+  ConcurrencyLimiter &operator=(const ConcurrencyLimiter &);
+
+  // 上限の調整(ロック中に呼ぶ)
+  void Adjust(double latencyMs, bool overload, size_t inFlight);
+
+  LimiterOptions m_options;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  double m_limit;
+  size_t m_inFlight;
+  // 受け付け済みで実行待ちの数
+  size_t m_pending;
+  // 実行の許可待ちの数(うち対話的な要求の数)
+  size_t m_waiting;
+  size_t m_interactiveWaiting;
+  uint64_t m_completed;
+  uint64_t m_rejected;
+  uint64_t m_timeouts;
+  uint64_t m_overloads;
+  double m_minLatency;
+  double m_shortLatency;
+  double m_longLatency;
+};
+
+//
+// 実行の許可の自動返却
+//
+class LimiterPermit {
+public:
+  LimiterPermit(ConcurrencyLimiter *limiter)
+    : m_limiter(limiter), m_acquired(false), m_overload(false) {}
+  ~LimiterPermit() { Release(); }
+
+  // 実行の許可を待ちます(制限なしの場合はすぐに許可)
+  bool Acquire(bool enqueued, bool interactive, OString &error)
+  {
+    if(!m_limiter) {
+      return true;
+    }
+    m_acquired = m_limiter->Acquire(enqueued, interactive, error);
+    m_start = std::chrono::steady_clock::now();
+    return m_acquired;
+  }
+  // 過負荷による失敗を記録
+  void MarkOverload() { m_overload = true; }
+  // 実行の終了
+  void Release()
+  {
+    if(m_acquired) {
+      double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+      m_limiter->Release(ms, m_overload);
+      m_acquired = false;
+    }
+  }
+
+private:
+  LimiterPermit(const LimiterPermit &);
+  LimiterPermit &operator=(const LimiterPermit &);
+
+  ConcurrencyLimiter *m_limiter;
+  bool m_acquired;
+  bool m_overload;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+#endif
@@ -0,0 +1,237 @@
+﻿#include "omnicommon.h"
+
+#include <memory>
+
+
+/**
+* ODBCエラー文字列取得
+*
+* @param[in] api エラーになったAPI名
+* @param[in] retcode APIの戻り値
+* @param[in] handleType ハンドル種別
+* @param[in] hError ハンドル
+* @return OString エラーメッセージ
+*/
+OString OdbcErrorMessage(const OString &api, SQLRETURN retcode, SQLSMALLINT handleType, SQLHANDLE hError)
+{
+  OString sqlmsg;
+
+  //
+  // SQLメッセージが取得できるやつだけ取得
+  //
+  if(retcode == SQL_ERROR) {
+    // メッセージ数取得
+    SQLLEN numRecs = 0;
+    SQLGetDiagField(handleType, hError, 0, SQL_DIAG_NUMBER, &numRecs, 0, 0);
+
+    // 全メッセージ取得
+    SQLTCHAR state[32], odbcmsg[SQL_MAX_MESSAGE_LENGTH];
+    SQLSMALLINT msgLen;
+    SQLINTEGER  native;
+    SQLSMALLINT recNo = 1;
+    while(
+      recNo <= numRecs &&
+      (SQLGetDiagRec(
+        handleType, hError, recNo, state, &native,  
+        odbcmsg, sizeof(odbcmsg), &msgLen) != SQL_NO_DATA)) {
+      if (sqlmsg.length() > 0) {
+        sqlmsg += _O(", ");
+      }
+
+      OString p = _O("[ODBC-ERROR]");
+      p += _S2O(odbcmsg);
+      p += _O("(API:");
+      p += api;
+      p += _O(", STATE:");
+      p += _S2O(state);
+      p += _O(", NATIVE:");
+      p += to_ostring(native);
+      p += _O(")");
+      sqlmsg += p;
+      recNo++;
+    }
+  }
+  
+  OString res;
+  if(sqlmsg.length() > 0) {
+    res += sqlmsg;
+  } else {
+    res += api + _O("エラー (CODE:") + to_ostring(retcode) + _O(")");
+  }
+  return res;
+}
+
+
+/**
+* 先頭の診断レコードのSQLSTATEを取得します
+*
+* @param[in] handleType ハンドル種別
+* @param[in] hError ハンドル
+* @return std::string SQLSTATE(無ければ空文字列)
+*/
+std::string OdbcSqlState(SQLSMALLINT handleType, SQLHANDLE hError)
+{
+  SQLTCHAR state[32], odbcmsg[SQL_MAX_MESSAGE_LENGTH];
+  SQLSMALLINT msgLen;
+  SQLINTEGER native;
+  memset(state, 0x00, sizeof(state));
+  if(!SQL_SUCCEEDED(SQLGetDiagRec(
+      handleType, hError, 1, state, &native,
+      odbcmsg, sizeof(odbcmsg), &msgLen))) {
+    return std::string();
+  }
+  return to_jsonstr(_S2O(state));
+}
+
+
+/**
+* 再試行で回復が見込めるSQLSTATEか判定します
+*
+* 通信断(08xxx)・デッドロック/シリアライズ失敗(40001)・ロック待ちタイムアウト
+* (57033)・タイムアウト(HYT00/HYT01)を一時的な失敗とみなします。
+*/
+bool IsTransientSqlState(const std::string &state)
+{
+  static const char *TRANSIENT_STATES[] = {
+    "40001", "40003", "57033", "HYT00", "HYT01"
+  };
+  if(IsConnectionSqlState(state)) {
+    return true;
+  }
+  for(size_t i = 0; i < sizeof(TRANSIENT_STATES) / sizeof(TRANSIENT_STATES[0]); i++) {
+    if(state == TRANSIENT_STATES[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+* 接続が使えなくなったSQLSTATEか判定します(08xxx)
+*/
+bool IsConnectionSqlState(const std::string &state)
+{
+  return state.size() == 5 && state[0] == '0' && state[1] == '8';
+}
+
+
+/**
+* SQLスクリプトを文に分割します
+*
+* ;で区切ります。'～'・"～"の中の;は区切りにしません。空の文は除きます。
+*
+* @param[in] script SQLスクリプト
+* @return std::vector<OString> 文
+*/
+std::vector<OString> SplitSqlScript(const OString &script)
+{
+  std::vector<OString> statements;
+  OString current;
+  OString::value_type quote = 0;
+  for(size_t i = 0; i <= script.size(); i++) {
+    OString::value_type ch = i < script.size() ? script[i] : (OString::value_type)';';
+    if(quote) {
+      // 引用符の中(''・""は引用符自体)
+      if(ch == quote) {
+        quote = 0;
+      }
+      current += ch;
+      continue;
+    }
+    if(ch == '\'' || ch == '"') {
+      quote = ch;
+      current += ch;
+      continue;
+    }
+    if(ch != ';') {
+      current += ch;
+      continue;
+    }
+    size_t first = current.find_first_not_of(_O(" \t\r\n"));
+    if(first != OString::npos) {
+      size_t last = current.find_last_not_of(_O(" \t\r\n"));
+      statements.push_back(current.substr(first, last - first + 1));
+    }
+    current.clear();
+  }
+  return statements;
+}
+
+
+/**
+* 接続直後のセッション初期化SQL(SET CURRENT SCHEMA・SET PATH・ライブラリリスト等)を
+* 順に実行します
+*
+* @param[in] hdbc 接続ハンドル
+* @param[in] statements 初期化SQL
+* @param[out] error エラーメッセージ
+* @return bool 成否(最初に失敗したSQLで中止)
+*/
+bool RunSessionScript(SQLHDBC hdbc, const std::vector<OString> &statements, OString &error)
+{
+  for(size_t i = 0; i < statements.size(); i++) {
+    std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(hdbc));
+    if(!stmt) {
+      error = OdbcErrorMessage(_O("SQLAllocHandle"), SQL_ERROR, SQL_HANDLE_DBC, hdbc);
+      return false;
+    }
+    SQLRETURN ret = SQLExecDirect(stmt.get(), (SQLTCHAR *)statements[i].c_str(), SQL_NTS);
+    if(!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+      error = OdbcErrorMessage(_O("SQLExecDirect"), ret, SQL_HANDLE_STMT, stmt.get())
+        + _O(" (") + statements[i] + _O(")");
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/**
+* 実行する文を登録します
+*
+* @param[in] stmt 文
+* @return bool 登録できたか(取り消し済みの場合はfalse)
+*/
+bool CancelToken::Attach(SQLHSTMT stmt)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(m_cancelled) {
+    return false;
+  }
+  m_stmt = stmt;
+  return true;
+}
+
+
+/**
+* 文の登録を外します(以降のCancelは文に触れない)
+*/
+void CancelToken::Detach()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_stmt = 0;
+}
+
+
+/**
+* 取り消します(実行中の文はSQLCancelで中断)
+*/
+void CancelToken::Cancel()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_cancelled = true;
+  if(m_stmt) {
+    SQLCancel(m_stmt);
+  }
+}
+
+
+/**
+* 取り消されたか
+*/
+bool CancelToken::Cancelled()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_cancelled;
+}
@@ -0,0 +1,135 @@
+﻿#ifndef _OMNICOMMON_H
+#define _OMNICOMMON_H
+//
+// OmniDb共通定義(文字列型・ODBCヘッダ)
+// ※napiに依存しないソースからも参照するためomnidb.hから分離
+//
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <mutex>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sql.h>
+#include <sqlext.h>
+#include <locale.h>
+
+// Convert a wide Unicode string to an UTF8 string
+
+#ifdef UNICODE
+  //
+  // Windows用(WideChar対応)
+  //
+
+  // OmniDb文字列型
+  typedef std::wstring OString;
+  // OmniDb文字列ストリーム
+  typedef std::wstringstream OStringStream;
+  // 標準出力
+  #define ocout std::wcout
+  // locale設定
+  #define osetlocale(c, l) _wsetlocale((c), (const wchar_t *)l)
+  // 文字列コピー
+  #define ostrcpy(s1,s2) wcscpy((wchar_t *)(s1), (const wchar_t *)(s2))
+  // 数値文字列変換
+  #define to_ostring(s) std::to_wstring((s))
+  // 文字列リテラル
+  #define _O(s) L##s
+  #define _S2O(s) OString((const wchar_t *)(s))
+  // ネイティブ文字列
+  
+  // JSON文字列変換(utf-8に変換)
+  inline std::string to_jsonstr(const std::wstring &wstr)
+  {
+    // utf-8専用。windowsだと切り替えないと駄目
+    if( wstr.empty() ) return std::string();
+    int size_needed = WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), NULL, 0, NULL, NULL);
+    std::string strTo( size_needed, 0 );
+    WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), &strTo[0], size_needed, NULL, NULL);
+    return strTo;
+  }
+#else
+  //
+  // UNIX用(utf-8ベース)
+  //
+  typedef std::string OString;
+  // OmniDb文字列ストリーム
+  typedef std::stringstream OStringStream;
+  // 標準出力
+  #define ocout std::cout
+  // locale設定
+  #define osetlocale(c, l) setlocale((c), (const char *)l)
+  // 文字列コピー
+  #define ostrcpy(s1,s2) strcpy((char *)(s1), (const char *)(s2))
+  // O数値文字列変換
+  #define to_ostring(s) std::to_string((s))
+  // 文字列リテラル
+  #define _O(s) s
+  #define _S2O(s) OString((const char *)(s))
+  // JSON文字列変換(utf-8に変換) ※何もしない
+  #define to_jsonstr(s) s
+#endif
+
+
+//
+// SQLHSTMTをunique_ptrの解放で使うための型
+// 
+struct StmtAcc {
+  typedef SQLHSTMT pointer;
+  // 開放時
+  inline void operator()(SQLHSTMT stmt) const { if(stmt) { SQLFreeHandle(SQL_HANDLE_STMT, stmt); } }
+  // アロケータ
+  static SQLHSTMT alloc(SQLHANDLE odbc) {
+    SQLHSTMT stmt = 0;  
+    SQLAllocHandle(SQL_HANDLE_STMT, odbc, &stmt);
+    return stmt;
+  };
+};
+
+// ODBCエラーメッセージ取得
+OString OdbcErrorMessage(const OString &api, SQLRETURN retcode, SQLSMALLINT handleType, SQLHANDLE hError);
+// 先頭の診断レコードのSQLSTATE取得(無ければ空)
+std::string OdbcSqlState(SQLSMALLINT handleType, SQLHANDLE hError);
+// 再試行で回復が見込めるSQLSTATEか(通信断・デッドロック・タイムアウト)
+bool IsTransientSqlState(const std::string &state);
+// 接続が使えなくなったSQLSTATEか(08xxx)
+bool IsConnectionSqlState(const std::string &state);
+
+//
+// 実行中の文の取り消し(別スレッドからSQLCancelする)
+//
+// 実行する側は文を割り当てたらAttach、解放する前にDetachします。Cancelは
+// Attach前なら以降のAttachを失敗させ、実行中ならSQLCancelを呼びます。
+//
+class CancelToken {
+public:
+  CancelToken() : m_stmt(0), m_cancelled(false) {}
+
+  // 実行する文を登録します(取り消し済みならfalse)
+  bool Attach(SQLHSTMT stmt);
+  // 文の登録を外します(文を解放する前に呼ぶ)
+  void Detach();
+  // 取り消します
+  void Cancel();
+  // 取り消されたか
+  bool Cancelled();
+
+private:
+  CancelToken(const CancelToken &);
+  CancelToken &operator=(const CancelToken &);
+
+  std::mutex m_mutex;
+  SQLHSTMT m_stmt;
+  bool m_cancelled;
+};
+
+// SQLスクリプトを文に分割します(文字列・区切り識別子の中の;は区切りにしない)
+std::vector<OString> SplitSqlScript(const OString &script);
+// 接続直後のセッション初期化SQLを順に実行します
+bool RunSessionScript(SQLHDBC hdbc, const std::vector<OString> &statements, OString &error);
+
+#endif
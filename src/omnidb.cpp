@@ -2,8 +2,18 @@
 #include <time.h>
 #include <stdlib.h>
 #include <iostream>
+#include <chrono>
 
 #include "omnidb.h"
+#include "omnipool.h"
+#include "omniloader.h"
+#include "omnifederation.h"
+#include "bufferpool.h"
+#include "bulkparams.h"
+#include "catalogfetch.h"
+#include "fetcher.h"
+#include "procedure.h"
+#include "spillbuffer.h"
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
@@ -20,121 +30,6 @@ using namespace Napi;
 #define ODATA_LENGTH 256
 #define OREMARK_LENGTH 1024
 
-// SQLの型名
-typedef struct SQLTYPENAME {
-  SQLSMALLINT type;
-  const SQLTCHAR *name;
-  const SQLTCHAR *className;
-} SQLTYPENAME;
-
-// SQLのタイプ名
-// https://www.ibm.com/docs/ja/i/7.3?topic=wdica-data-types-data-conversion-in-db2-i-cli-functions#rzadphddtdcn__tbcsql
-// https://docs.microsoft.com/ja-jp/sql/odbc/reference/appendixes/sql-data-types?view=sql-server-ver15
-const SQLTYPENAME SQLTYPENAMES[] = {
-  // CHAR (n) : 固定長文字列の文字列。
-  { SQL_CHAR, (SQLTCHAR *)_O("SQL_CHAR"), (SQLTCHAR *)_O("String")},
-  // VARCHAR (n) : 最大文字列長 n の可変長文字列。
-  { SQL_VARCHAR, (SQLTCHAR *)_O("SQL_VARCHAR"), (SQLTCHAR *)_O("String") },
-  // LONG VARCHAR : 可変長文字データ。 最大長は、データソースに依存します。
-  { SQL_LONGVARCHAR, (SQLTCHAR *)_O("SQL_LONGVARCHAR"), (SQLTCHAR *)_O("String") },
-  // WCHAR (n) : 固定長文字列の Unicode 文字列の長さ n
-  { SQL_WCHAR, (SQLTCHAR *)_O("SQL_WCHAR"), (SQLTCHAR *)_O("String") },
-  // VARWCHAR (n) : 最大文字列長を持つ Unicode 可変長文字列 n
-  { SQL_WVARCHAR, (SQLTCHAR *)_O("SQL_WVARCHAR"), (SQLTCHAR *)_O("String") },
-  // LONGWVARCHAR : Unicode 可変長文字データ。 最大長はデータソースに依存します
-  { SQL_WLONGVARCHAR, (SQLTCHAR *)_O("SQL_WLONGVARCHAR"), (SQLTCHAR *)_O("String") },
-  // DECIMAL (p,s) : 少なくとも p と scale s の有効桁数を持つ符号付きの正確な数値 。
-  // (最大有効桁数はドライバーで定義されています)。
-  // (1 <= p <= 15;s <= p)。4/4
-  { SQL_DECIMAL, (SQLTCHAR *)_O("SQL_DECIMAL"), (SQLTCHAR *)_O("Number") },
-  // NUMERIC (p,s) : 精度が p で小数点以下桁数が s の符号付きの正確な数値
-  // (1 <= p <= 15;s <= p)。4/4
-  { SQL_NUMERIC, (SQLTCHAR *)_O("SQL_NUMERIC"), (SQLTCHAR *)_O("Number") },
-  // SMALLINT : 精度が5および小数点以下桁数が0の numeric 値
-  // (符号付き:-32768 <= n <= 32767、unsigned: 0 <= n <= 65535) [3]。
-  { SQL_SMALLINT, (SQLTCHAR *)_O("SQL_SMALLINT"), (SQLTCHAR *)_O("Number") },
-  // INTEGER : 有効桁数が10および小数点以下桁数が0の正確な数値
-  // (符号付き:-2 [31] <= n <= 2 [31]-1、符号なし: 0 <= n <= 2 [32]-1) [3]。
-  { SQL_INTEGER, (SQLTCHAR *)_O("SQL_INTEGER"), (SQLTCHAR *)_O("Number") },
-  // real : バイナリ精度 24 (0 または絶対値が 10 [-38] ~ 10 [38]) の符号付き概数値。
-  { SQL_REAL, (SQLTCHAR *)_O("SQL_REAL"), (SQLTCHAR *)_O("Number") },
-  // FLOAT (p) : 少なくとも p のバイナリ有効桁数を持つ、符号付きの概数型の数値。
-  // (最大有効桁数はドライバーで定義されています)。5/5
-  { SQL_FLOAT, (SQLTCHAR *)_O("SQL_FLOAT"), (SQLTCHAR *)_O("Number") },
-  // DOUBLE PRECISION : バイナリ精度 53 (0 または絶対値が 10 [-308] ~ 10 [308])
-  // の符号付き概数。数値。
-  { SQL_DOUBLE, (SQLTCHAR *)_O("SQL_DOUBLE"), (SQLTCHAR *)_O("Number") },
-  // BIT : 1ビットのバイナリデータ。8
-  { SQL_BIT, (SQLTCHAR *)_O("SQL_BIT"), (SQLTCHAR *)_O("Number") },
-  // TINYINT : 精度3および小数点以下桁数が0の正確な数値 
-  // (符号付き:-128 <= n <= 127、符号なし: 0 <= n <= 255) [3]。
-  { SQL_TINYINT, (SQLTCHAR *)_O("SQL_TINYINT"), (SQLTCHAR *)_O("Number") },
-  // bigint : 精度が 19 (符号付きの場合) または 20 (符号なしの場合) 
-  // および小数点以下桁数 0 (符号付きの場合) およびスケール 0 
-  // (符号付き:-2 [63] <= n <= 2 [63]-1、符号なし: 0 <= n <= 2 [64]-1) [3]、[9]
-  { SQL_BIGINT, (SQLTCHAR *)_O("SQL_BIGINT"), (SQLTCHAR *)_O("Number") },
-  // バイナリ (n) : 固定長 n のバイナリデータ。ませ
-  { SQL_BINARY, (SQLTCHAR *)_O("SQL_BINARY"), (SQLTCHAR *)_O("Binary") },
-  // VARBINARY (n) : 最大長 n の可変長バイナリデータ。 最大値は、ユーザーによって
-  // 設定されます。
-  { SQL_VARBINARY, (SQLTCHAR *)_O("SQL_VARBINARY"), (SQLTCHAR *)_O("Binary") },
-  // LONG VARBINARY : 可変長バイナリ データ。 最大長は、データソースに依存します。
-  { SQL_LONGVARBINARY, (SQLTCHAR *)_O("SQL_LONGVARBINARY"), (SQLTCHAR *)_O("Binary") },
-  // DATE : グレゴリオ暦の規則に準拠した年、月、日の各フィールド。 
-  // (この付録の後半の「 グレゴリオ暦の制約」を参照してください)。
-  { SQL_TYPE_DATE, (SQLTCHAR *)_O("SQL_TYPE_DATE"), (SQLTCHAR *)_O("Date") },
-  // 時間 (p) : 時間、分、および秒のフィールド。有効な値は 00 ~ 23 の時間、00 ~ 59
-  // の有効な値、および 00 ~ 61 の秒の有効な値です。 有効桁数 p 秒の有効桁数を示します。
-  { SQL_TYPE_TIME, (SQLTCHAR *)_O("SQL_TYPE_TIME"), (SQLTCHAR *)_O("Time") },
-  // タイムスタンプ (p) : 日付と時刻のデータ型に対して定義されている有効な値を持つ
-  // 年、月、日、時、分、および秒の各フィールド。
-  { SQL_TYPE_TIMESTAMP, (SQLTCHAR *)_O("SQL_TYPE_TIMESTAMP"), (SQLTCHAR *)_O("DateTime") },
-/* unix-odbcで未定義だった
-  // UTCDATETIME : Year、month、day、hour、minute、second、utchour、utcminute
-  // の各フィールド。 Utchour フィールドと utcminute フィールドの精度は1/10 マイクロ秒です。
-  { SQL_TYPE_UTCDATETIME, (SQLTCHAR *)_O("SQL_TYPE_UTCDATETIME" },
-  // UTCTIME : Hour、minute、second、utchour、utcminute の各フィールド。 Utchour
-  // フィールドと utcminute フィールドの精度は1/10 マイクロ秒です。
-  { SQL_TYPE_UTCTIME, (SQLTCHAR *)_O("SQL_TYPE_UTCTIME" },
-*/
-  // 間隔月 (p) : 2つの日付の間の月数。 p は、間隔の有効桁数です。
-  { SQL_INTERVAL_MONTH, (SQLTCHAR *)_O("SQL_INTERVAL_MONTH"), (SQLTCHAR *)_O("Number") },
-  // 間隔の年 (p) : 2つの日付間の年数 p は、間隔の有効桁数です。
-  { SQL_INTERVAL_YEAR, (SQLTCHAR *)_O("SQL_INTERVAL_YEAR"), (SQLTCHAR *)_O("Number") },
-  // 間隔の年 (p) から月 : 2つの日付間の年と月の数。 p は、間隔の有効桁数です。
-  { SQL_INTERVAL_YEAR_TO_MONTH, (SQLTCHAR *)_O("SQL_INTERVAL_YEAR_TO_MONTH"), (SQLTCHAR *)_O("Number") },
-  // 間隔の日 (p) : 2つの日付の間の日数 p は、間隔の有効桁数です。
-  { SQL_INTERVAL_DAY, (SQLTCHAR *)_O("SQL_INTERVAL_DAY"), (SQLTCHAR *)_O("Number") },
-  // 間隔 (時間) (p) : 2つの日付/時刻の間の時間数。 p は、間隔の有効桁数です。
-  { SQL_INTERVAL_HOUR, (SQLTCHAR *)_O("SQL_INTERVAL_HOUR"), (SQLTCHAR *)_O("Number") },
-  // 間隔 (分) (p) : 2つの日付/時刻の間の分数 p は、間隔の有効桁数です。
-  { SQL_INTERVAL_MINUTE, (SQLTCHAR *)_O("SQL_INTERVAL_MINUTE"), (SQLTCHAR *)_O("Number") },
-  // INTERVAL 秒 (p,q) : 2つの日付/時刻の間の秒数。 p は間隔の先頭の有効桁数
-  // で、 q は間隔の秒の有効桁数です。
-  { SQL_INTERVAL_SECOND, (SQLTCHAR *)_O("SQL_INTERVAL_SECOND"), (SQLTCHAR *)_O("Number") },
-  // 間隔の日 (p) から時間 : 2つの日付/時刻の間の日数/時間。 p は、間隔の
-  // 有効桁数です。
-  { SQL_INTERVAL_DAY_TO_HOUR, (SQLTCHAR *)_O("SQL_INTERVAL_DAY_TO_HOUR"), (SQLTCHAR *)_O("Number") },
-  // 間隔の日 (p) から分 : 2つの日付/時刻の間の日数/時間/分 p は、間隔の
-  // 有効桁数です。
-  { SQL_INTERVAL_DAY_TO_MINUTE, (SQLTCHAR *)_O("SQL_INTERVAL_DAY_TO_MINUTE"), (SQLTCHAR *)_O("Number") },
-  // 間隔の日 (p) から秒 (q) : 2つの日付/時刻の間の日数/時間/分/秒 p は間隔
-  // の先頭の有効桁数で、 q は間隔の秒の有効桁数です。
-  { SQL_INTERVAL_DAY_TO_SECOND, (SQLTCHAR *)_O("SQL_INTERVAL_DAY_TO_SECOND"), (SQLTCHAR *)_O("Number") },
-  // INTERVAL 時間 (p) から分 : 2つの日付/時刻の間の時間数/分 p は、間隔の
-  // 有効桁数です。
-  { SQL_INTERVAL_HOUR_TO_MINUTE, (SQLTCHAR *)_O("SQL_INTERVAL_HOUR_TO_MINUTE"), (SQLTCHAR *)_O("Number") },
-  // INTERVAL 時間 (p) から秒 (q) : 2つの日付/時刻の間の時間数/分/秒。
-  // p は間隔の先頭の有効桁数で、 q は間隔の秒の有効桁数です。
-  { SQL_INTERVAL_HOUR_TO_SECOND, (SQLTCHAR *)_O("SQL_INTERVAL_HOUR_TO_SECOND"), (SQLTCHAR *)_O("Number") },
-  // 間隔 (分) (p) から秒 (q) : 2つの日付/時刻の間の分数 (秒単位)。
-  // p は間隔の先頭の有効桁数で、 q は間隔の秒の有効桁数です。
-  { SQL_INTERVAL_MINUTE_TO_SECOND, (SQLTCHAR *)_O("SQL_INTERVAL_MINUTE_TO_SECOND"), (SQLTCHAR *)_O("Number") },
-  // GUID : 固定長 GUID。
-  { SQL_GUID, (SQLTCHAR *)_O("SQL_GUID"), (SQLTCHAR *)_O("Guid") }
-};
-
-
 // ロケールのカテゴリ名
 typedef struct LOCALE_NAME {
   int category;
@@ -151,22 +46,6 @@ const LOCALE_NAME LOCALE_NAMES[] = {
 };
 
 
-//
-// SQLHSTMTをunique_ptrの解放で使うための型
-// 
-struct StmtAcc {
-  typedef SQLHSTMT pointer;
-  // 開放時
-  inline void operator()(SQLHSTMT stmt) const { if(stmt) { SQLFreeHandle(SQL_HANDLE_STMT, stmt); } }
-  // アロケータ
-  static SQLHSTMT alloc(SQLHANDLE odbc) {
-    SQLHSTMT stmt = 0;  
-    SQLAllocHandle(SQL_HANDLE_STMT, odbc, &stmt);
-    return stmt;
-  };
-};
-
-
 /**
 * omnidbインスタンスの生成(newの時)
 *
@@ -211,6 +90,18 @@ Napi::Object OmniDb::Init(Napi::Env env, Napi::Object exports)
       InstanceMethod("columns", &OmniDb::Columns),
       InstanceMethod("setLocale", &OmniDb::SetLocale),
       InstanceMethod("execute", &OmniDb::Execute),
+      InstanceMethod("executeBulk", &OmniDb::ExecuteBulk),
+      InstanceMethod("call", &OmniDb::Call),
+      InstanceMethod("callBulk", &OmniDb::CallBulk),
+      InstanceMethod("begin", &OmniDb::Begin),
+      InstanceMethod("commit", &OmniDb::Commit),
+      InstanceMethod("rollback", &OmniDb::Rollback),
+      InstanceMethod("openCatalogCache", &OmniDb::OpenCatalogCache),
+      InstanceMethod("refreshCatalogCache", &OmniDb::RefreshCatalogCache),
+      InstanceMethod("cachedTables", &OmniDb::CachedTables),
+      InstanceMethod("cachedColumns", &OmniDb::CachedColumns),
+      InstanceMethod("catalogCacheInfo", &OmniDb::CatalogCacheInfo),
+      InstanceMethod("searchCatalog", &OmniDb::SearchCatalog),
   });
 
   Napi::FunctionReference *constructor = new Napi::FunctionReference();
@@ -228,6 +119,7 @@ OmniDb::OmniDb(const Napi::CallbackInfo &info) : Napi::ObjectWrap<OmniDb>(info)
 {
   m_hEnv = NULL;
   m_hOdbc = NULL;
+  m_inTransaction = false;
 
   //
   // ライブラリ初期化
@@ -265,10 +157,10 @@ Napi::Value OmniDb::Connect(const Napi::CallbackInfo &info)
   Napi::Env env = info.Env();
 
   //
-  // connect(connectionString)
-  // のパラメータチェック
+  // connect(connectionString, options)
+  // のパラメータチェック ※optionsは任意
   //
-  if(info.Length() != 1) {
+  if(info.Length() < 1) {
     CreateTypeError(
       env,
       OString(_O("connect(connectionString) connectionStringは必須です"))
@@ -282,17 +174,43 @@ Napi::Value OmniDb::Connect(const Napi::CallbackInfo &info)
     ).ThrowAsJavaScriptException();
     return env.Null();
   }
+  if(info.Length() >= 2 && !info[1].IsUndefined() && !info[1].IsNull() && !info[1].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("options はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // 接続直後に実行するセッション初期化SQL・ログインタイムアウト(秒)
+  std::vector<OString> init;
+  SQLUINTEGER loginTimeout = 0;
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    if(options.Has("loginTimeout") && options.Get("loginTimeout").IsNumber()) {
+      double n = options.Get("loginTimeout").As<Napi::Number>().DoubleValue();
+      loginTimeout = n > 0 ? (SQLUINTEGER)n : 0;
+    }
+    OString error;
+    if(options.Has("init") && !ToSessionScript(options.Get("init"), init, error)) {
+      CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
 
   // 接続している状態で呼ばれた場合は一旦切断
   _Disconnect();
 
   Napi::String _connectionString = info[0].As<Napi::String>();
-  std::unique_ptr<SQLTCHAR> connectString(OmniDb::NapiStringToSQLTCHAR(_connectionString));
+  std::unique_ptr<SQLTCHAR[]> connectString(OmniDb::NapiStringToSQLTCHAR(_connectionString));
 
   // DB接続
   // https://www.ibm.com/docs/ja/i/7.3?topic=details-connection-string-keywords
   SQLHDBC hOdbc;
   SQLAllocHandle(SQL_HANDLE_DBC, m_hEnv, &hOdbc);
+  if(loginTimeout > 0) {
+    SQLSetConnectAttr(hOdbc, SQL_ATTR_LOGIN_TIMEOUT, (SQLPOINTER)(SQLULEN)loginTimeout, SQL_IS_UINTEGER);
+  }
   SQLRETURN ret = SQLDriverConnect(hOdbc, NULL, connectString.get(), SQL_NTS, NULL, 0, NULL, SQL_DRIVER_COMPLETE);
   if(!SQL_SUCCEEDED(ret)) {
     OString e = ErrorMessage(_O("SQLDriverConnect"), ret, SQL_HANDLE_DBC, hOdbc);
@@ -300,6 +218,13 @@ Napi::Value OmniDb::Connect(const Napi::CallbackInfo &info)
     CreateError(env, e).ThrowAsJavaScriptException();
     return env.Null();
   }
+  OString e;
+  if(!RunSessionScript(hOdbc, init, e)) {
+    SQLDisconnect(hOdbc);
+    SQLFreeHandle(SQL_HANDLE_DBC, hOdbc);
+    CreateError(env, e).ThrowAsJavaScriptException();
+    return env.Null();
+  }
   m_hOdbc = hOdbc;
 
   return Napi::Boolean::New(env, true);
@@ -328,10 +253,17 @@ Napi::Value OmniDb::Disconnect(const Napi::CallbackInfo &info)
 void OmniDb::_Disconnect()
 {
   if(m_hOdbc) {
+    // 未確定のトランザクションは破棄(残っているとSQLDisconnectが失敗する)
+    if(m_inTransaction) {
+      SQLEndTran(SQL_HANDLE_DBC, m_hOdbc, SQL_ROLLBACK);
+      m_inTransaction = false;
+    }
     SQLDisconnect(m_hOdbc);
     SQLFreeHandle(SQL_HANDLE_DBC, m_hOdbc);
     m_hOdbc = NULL;
   }
+  // 接続先が変わるのでパラメータ定義も破棄
+  m_procedures.clear();
 }
 
 
@@ -383,16 +315,21 @@ Napi::Value OmniDb::Drivers(const Napi::CallbackInfo &info)
 */
 Napi::Value OmniDb::Tables(const Napi::CallbackInfo& info)
 {
-  SQLRETURN ret;
   Napi::Env env = info.Env();
 
-  std::unique_ptr<SQLTCHAR> catalog = nullptr;
-  std::unique_ptr<SQLTCHAR> schema = nullptr;
-  std::unique_ptr<SQLTCHAR> table = nullptr;
-  std::unique_ptr<SQLTCHAR> tableType(new SQLTCHAR[256]);
+  // 呼び出しの中の確保はアリーナから(返却時にまとめて解放)
+  CallArena arena;
+  CallArenaScope scope(arena);
+
+  SQLTCHAR *catalog = NULL;
+  SQLTCHAR *schema = NULL;
+  SQLTCHAR *table = NULL;
+  SQLTCHAR *tableType = (SQLTCHAR *)arena.Allocate(sizeof(SQLTCHAR) * 256);
 
   // デフォルトはテーブルのみ出力
-  ostrcpy(tableType.get(), _O("TABLE"));
+  if(tableType) {
+    ostrcpy(tableType, _O("TABLE"));
+  }
 
   //
   // tables(condition)
@@ -415,88 +352,47 @@ Napi::Value OmniDb::Tables(const Napi::CallbackInfo& info)
     if(condition.Has("catalog")) {
       Napi::String _catalog = condition.Get("catalog").ToString();
       if(!IsBlank(_catalog))
-        catalog.reset(OmniDb::NapiStringToSQLTCHAR(_catalog));
+        catalog = OmniDb::NapiStringToSQLTCHAR(_catalog, arena);
     }
     // スキーマー
     if(condition.Has("schema")) {
       Napi::String _schema = condition.Get("schema").ToString();
       if(!IsBlank(_schema))
-        schema.reset(OmniDb::NapiStringToSQLTCHAR(_schema));
+        schema = OmniDb::NapiStringToSQLTCHAR(_schema, arena);
     }
     // テーブル
     if(condition.Has("table")) {
       Napi::String _table = condition.Get("table").ToString();
       if(!IsBlank(_table))
-        table.reset(OmniDb::NapiStringToSQLTCHAR(_table));
+        table = OmniDb::NapiStringToSQLTCHAR(_table, arena);
     }
     // カラム
     if(condition.Has("tableType")) {
       Napi::String _tableType = condition.Get("tableType").ToString();
       if(!IsBlank(_tableType))
-        tableType.reset(OmniDb::NapiStringToSQLTCHAR(_tableType));
+        tableType = OmniDb::NapiStringToSQLTCHAR(_tableType, arena);
     }
   }
 
   
-  // テーブル情報取得
-  // https://www.ibm.com/docs/ja/i/7.3?topic=functions-sqlcolumns-get-column-information-table
-  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(m_hOdbc));
-  if(!SQL_SUCCEEDED(ret = 
-    SQLTables(
-      stmt.get(),
-      catalog.get(), catalog.get() == nullptr ? 0 : SQL_NTS,
-      schema.get(), schema.get() == nullptr ? 0 : SQL_NTS,
-      table.get(), table.get() == nullptr ? 0 : SQL_NTS,
-      tableType.get(), tableType.get() == nullptr ? 0 : SQL_NTS))) {
-    CreateError(
-      env,
-      ErrorMessage(_O("SQLTables"), ret, SQL_HANDLE_STMT, stmt.get())
-    ).ThrowAsJavaScriptException();
+  if(arena.Failed()) {
+    CreateError(env, OString(_O("メモリを確保できません"))).ThrowAsJavaScriptException();
     return env.Null();
-  }  
-
-  //
-  // テーブル情報を出力
-  //
-  std::unique_ptr<SQLTCHAR> colCatalog(new SQLTCHAR[ODATA_LENGTH]);
-  std::unique_ptr<SQLTCHAR> colSchema(new SQLTCHAR[ODATA_LENGTH]);
-  std::unique_ptr<SQLTCHAR> colTable(new SQLTCHAR[ODATA_LENGTH]);
-  std::unique_ptr<SQLTCHAR> colTableType(new SQLTCHAR[ODATA_LENGTH]);
-  std::unique_ptr<SQLTCHAR> colRemarks(new SQLTCHAR[OREMARK_LENGTH]);
-  SQLLEN sizCatalog; 
-  SQLLEN sizSchema;  
-  SQLLEN sizTable;  
-  SQLLEN sizTableType;  
-  SQLLEN sizRemarks;  
-  #ifdef UNICODE
-  SQLSMALLINT ctype = SQL_C_WCHAR;
-  #else
-  SQLSMALLINT ctype = SQL_C_CHAR;
-  #endif
-
-  SQLBindCol(stmt.get(), 1, ctype, colCatalog.get(), ODATA_LENGTH * sizeof(SQLTCHAR), &sizCatalog);  
-  SQLBindCol(stmt.get(), 2, ctype, colSchema.get(), ODATA_LENGTH * sizeof(SQLTCHAR), &sizSchema);  
-  SQLBindCol(stmt.get(), 3, ctype, colTable.get(), ODATA_LENGTH * sizeof(SQLTCHAR), &sizTable);  
-  SQLBindCol(stmt.get(), 4, ctype, colTableType.get(), ODATA_LENGTH * sizeof(SQLTCHAR), &sizTableType);  
-  SQLBindCol(stmt.get(), 5, ctype, colRemarks.get(), OREMARK_LENGTH * sizeof(SQLTCHAR), &sizRemarks);  
+  }
 
-  // 全ての列情報を出力
-  json tables = json::array();
-  while ((ret = SQLFetch(stmt.get())) == SQL_SUCCESS) {
-    json table = json::object();
-    table["catalog"] = to_jsonstr(_S2O(colCatalog.get()));
-    table["schema"] = to_jsonstr(_S2O(colSchema.get()));
-    table["name"] = to_jsonstr(_S2O(colTable.get()));
-    table["type"] = to_jsonstr(_S2O(colTableType.get()));
-    table["type"] = to_jsonstr(_S2O(colTableType.get()));
-    table["remarks"] = to_jsonstr(trimString(_S2O(colRemarks.get())));
-    tables.push_back(table);
+  // テーブル情報取得
+  std::vector<CatalogTable> tables;
+  OString error;
+  if(!FetchCatalogTables(m_hOdbc, catalog, schema, table, tableType, tables, error)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
   }
 
   //
   // JSON文字列として返却
   //
-  return Napi::String::New(env, tables.dump(-1, ' ', true, json::error_handler_t::replace));
+  ArenaString result = CatalogTablesToJson(tables);
+  return Napi::String::New(env, result.data(), result.size());
 }
 
 
@@ -508,13 +404,16 @@ Napi::Value OmniDb::Tables(const Napi::CallbackInfo& info)
 */
 Napi::Value OmniDb::Columns(const Napi::CallbackInfo &info)
 {
-  SQLRETURN ret;
   Napi::Env env = info.Env();
 
-  std::unique_ptr<SQLTCHAR> catalog = nullptr;
-  std::unique_ptr<SQLTCHAR> schema = nullptr;
-  std::unique_ptr<SQLTCHAR> table = nullptr;
-  std::unique_ptr<SQLTCHAR> column = nullptr;
+  // 呼び出しの中の確保はアリーナから(返却時にまとめて解放)
+  CallArena arena;
+  CallArenaScope scope(arena);
+
+  SQLTCHAR *catalog = NULL;
+  SQLTCHAR *schema = NULL;
+  SQLTCHAR *table = NULL;
+  SQLTCHAR *column = NULL;
 
   //
   // columns(condition)
@@ -537,111 +436,46 @@ Napi::Value OmniDb::Columns(const Napi::CallbackInfo &info)
     if(condition.Has("catalog")) {
       Napi::String _catalog = condition.Get("catalog").ToString();
       if(!IsBlank(_catalog))
-        catalog.reset(OmniDb::NapiStringToSQLTCHAR(_catalog));
+        catalog = OmniDb::NapiStringToSQLTCHAR(_catalog, arena);
     }
     // スキーマー
     if(condition.Has("schema")) {
       Napi::String _schema = condition.Get("schema").ToString();
       if(!IsBlank(_schema))
-        schema.reset(OmniDb::NapiStringToSQLTCHAR(_schema));
+        schema = OmniDb::NapiStringToSQLTCHAR(_schema, arena);
     }
     // テーブル
     if(condition.Has("table")) {
       Napi::String _table = condition.Get("table").ToString();
       if(!IsBlank(_table))
-        table.reset(OmniDb::NapiStringToSQLTCHAR(_table));
+        table = OmniDb::NapiStringToSQLTCHAR(_table, arena);
     }
     // カラム
     if(condition.Has("column")) {
       Napi::String _column = condition.Get("column").ToString();
       if(!IsBlank(_column))
-        column.reset(OmniDb::NapiStringToSQLTCHAR(_column));
+        column = OmniDb::NapiStringToSQLTCHAR(_column, arena);
     }
   }
 
-  // テーブルのカラム情報取得
-  // https://www.ibm.com/docs/ja/i/7.3?topic=functions-sqlcolumns-get-column-information-table
-  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(m_hOdbc));
-
-  if(!SQL_SUCCEEDED(ret = 
-    SQLColumns(
-      stmt.get(),
-      catalog.get(), catalog.get() == nullptr ? 0 : SQL_NTS,
-      schema.get(), schema.get() == nullptr ? 0 : SQL_NTS,
-      table.get(), table.get() == nullptr ? 0 : SQL_NTS,
-      column.get(), column.get() == nullptr ? 0 : SQL_NTS))) {
-    CreateError(
-      env,
-      ErrorMessage(_O("SQLColumns"), ret, SQL_HANDLE_STMT, stmt.get())
-    ).ThrowAsJavaScriptException();
+  if(arena.Failed()) {
+    CreateError(env, OString(_O("メモリを確保できません"))).ThrowAsJavaScriptException();
     return env.Null();
-  }  
-
-  //
-  // カラム情報を出力
-  //
-  std::unique_ptr<SQLTCHAR> colCatalog(new SQLTCHAR[ODATA_LENGTH]);
-  std::unique_ptr<SQLTCHAR> colSchema(new SQLTCHAR[ODATA_LENGTH]);
-  std::unique_ptr<SQLTCHAR> colTable(new SQLTCHAR[ODATA_LENGTH]);
-  std::unique_ptr<SQLTCHAR> colColumn(new SQLTCHAR[ODATA_LENGTH]);
-  std::unique_ptr<SQLTCHAR> colRemarks(new SQLTCHAR[OREMARK_LENGTH]);
-  std::unique_ptr<SQLTCHAR> colDefault(new SQLTCHAR[ODATA_LENGTH]);
-  SQLINTEGER colSize;
-  SQLSMALLINT colType;
-  SQLSMALLINT colDecimalDigits;
-  SQLSMALLINT colNumPrec; 
-  SQLSMALLINT colNullable;
-  SQLLEN sizCatalog;  
-  SQLLEN sizSchema;  
-  SQLLEN sizTable;  
-  SQLLEN sizColumn;  
-  SQLLEN sizType;
-  SQLLEN sizSize;  
-  SQLLEN sizDecimalDigits;  
-  SQLLEN sizNumPrec;  
-  SQLLEN sizNullable;  
-  SQLLEN sizRemarks;  
-  SQLLEN sizDefault;  
-  #ifdef UNICODE
-  SQLSMALLINT ctype = SQL_C_WCHAR;
-  #else
-  SQLSMALLINT ctype = SQL_C_CHAR;
-  #endif
+  }
 
-  SQLBindCol(stmt.get(),  1, ctype, colCatalog.get(), ODATA_LENGTH * sizeof(SQLTCHAR), &sizCatalog);  
-  SQLBindCol(stmt.get(),  2, ctype, colSchema.get(), ODATA_LENGTH * sizeof(SQLTCHAR), &sizSchema);  
-  SQLBindCol(stmt.get(),  3, ctype, colTable.get(), ODATA_LENGTH * sizeof(SQLTCHAR), &sizTable);  
-  SQLBindCol(stmt.get(),  4, ctype, colColumn.get(), ODATA_LENGTH * sizeof(SQLTCHAR), &sizColumn);  
-  SQLBindCol(stmt.get(),  5, SQL_C_SLONG, &colType, 0, &sizType);  
-  SQLBindCol(stmt.get(),  7, SQL_C_SLONG, &colSize, 0, &sizSize);  
-  SQLBindCol(stmt.get(),  9, SQL_C_SSHORT, &colDecimalDigits, 0, &sizDecimalDigits);  
-  SQLBindCol(stmt.get(), 10, SQL_C_SSHORT, &colNumPrec, 0, &sizNumPrec);  
-  SQLBindCol(stmt.get(), 11, SQL_C_SSHORT, &colNullable, 0, &sizNullable);
-  SQLBindCol(stmt.get(), 12, ctype, colRemarks.get(), OREMARK_LENGTH * sizeof(SQLTCHAR), &sizRemarks);  
-  SQLBindCol(stmt.get(), 13, ctype, colDefault.get(), ODATA_LENGTH * sizeof(SQLTCHAR), &sizDefault);  
-
-  json cols = json::array();
-  while ((ret = SQLFetch(stmt.get())) == SQL_SUCCESS) {
-    json col = json::object();
-    col["catalog"] = to_jsonstr(_S2O(colCatalog.get()));
-    col["schema"] = to_jsonstr(_S2O(colSchema.get()));
-    col["table"] = to_jsonstr(_S2O(colTable.get()));
-    col["name"] = to_jsonstr(_S2O(colColumn.get()));
-    col["type"] = to_jsonstr(GetTypeName(colType));
-    col["typeClass"] = to_jsonstr(GetTypeClassName(colType));
-    col["size"] = colSize;
-    col["decimalDigits"] = colDecimalDigits;
-    col["numPrec"] = colNumPrec;
-    col["remarks"] = to_jsonstr(trimString(_S2O(colRemarks.get())));
-    col["defualt"] = to_jsonstr(_S2O(colDefault.get()));
-    col["nullable"] = (colNullable == SQL_NULLABLE) ? true : false;
-    cols.push_back(col);
+  // テーブルのカラム情報取得
+  std::vector<CatalogColumn> columns;
+  OString error;
+  if(!FetchCatalogColumns(m_hOdbc, catalog, schema, table, column, columns, error)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
   }
 
   //
   // カラム情報をJSON文字列として返却
   //
-  return Napi::String::New(env, cols.dump(-1, ' ', true, json::error_handler_t::replace));
+  ArenaString result = CatalogColumnsToJson(columns);
+  return Napi::String::New(env, result.data(), result.size());
 
 }
 
@@ -654,43 +488,6 @@ Napi::Value OmniDb::Columns(const Napi::CallbackInfo &info)
 */
 Napi::Value OmniDb::Query(const Napi::CallbackInfo& info)
 {
-  // 出力タイプ
-  #define NUM_ATTR    0   // 数値属性
-  #define CHAR_ATTR   1   // キャラ属性
-
-  typedef struct  {
-    SQLSMALLINT type;
-    const char *name;
-    SQLSMALLINT attr;
-  } QUERY_COLTYPE;
-
-  // QUERY情報で出力するタイプ
-  static const QUERY_COLTYPE QUERY_COLTYPES[] = {
-    // 列名
-    { SQL_DESC_NAME, "name", CHAR_ATTR },
-    // ラベル名
-    { SQL_DESC_LABEL, "label", CHAR_ATTR },
-    // データタイプ
-    { SQL_DESC_TYPE, "type", NUM_ATTR },
-    // NULL
-    { SQL_DESC_NULLABLE, "nullable", NUM_ATTR },
-    // オートインクリメント
-    { SQL_DESC_AUTO_UNIQUE_VALUE, "autoIncliment", NUM_ATTR },
-    // サイズ
-    { SQL_DESC_LENGTH, "size", NUM_ATTR },
-    // 10進数精度
-    { SQL_DESC_SCALE, "decimalDigits", NUM_ATTR },
-    // カタログ名（物理的な割当がある場合）
-    { SQL_DESC_CATALOG_NAME, "catalog", CHAR_ATTR },
-    // スキーマ名（物理的な割当がある場合）
-    { SQL_DESC_SCHEMA_NAME, "schema", CHAR_ATTR },
-    // テーブル名（物理的な割当がある場合）
-    { SQL_DESC_BASE_TABLE_NAME, "table", CHAR_ATTR },
-    // カラム名（物理的な割当がある場合）
-    { SQL_DESC_BASE_COLUMN_NAME, "column", CHAR_ATTR },
-  };
-
-  SQLRETURN ret;
   Napi::Env env = info.Env();
 
   // query(queryString, options)
@@ -744,36 +541,105 @@ Napi::Value OmniDb::Query(const Napi::CallbackInfo& info)
   //
   // パラメータ付きSQLの解析
   //
-  json query = json::object();
-
+  CallArena arena;
+  CallArenaScope scope(arena);
   Napi::String _queryString = info[0].As<Napi::String>();
-  std::unique_ptr<SQLTCHAR> queryString(OmniDb::NapiStringToSQLTCHAR(_queryString));
+  SQLTCHAR *queryString = OmniDb::NapiStringToSQLTCHAR(_queryString, arena);
+  if(!queryString) {
+    CreateError(env, OString(_O("メモリを確保できません"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
 
-  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(m_hOdbc));
-  if(!SQL_SUCCEEDED(ret = SQLPrepare(stmt.get(), queryString.get(), SQL_NTS))) {
-    CreateError(
-      env,
-      ErrorMessage(_O("SQLPrepare"), ret, SQL_HANDLE_STMT, stmt.get())
-    ).ThrowAsJavaScriptException();
+  std::string result;
+  OString error;
+  std::string sqlState;
+  if(!DescribeQuery(m_hOdbc, queryString, supportLabel, result, error, sqlState)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
     return env.Null();
   }
+  return Napi::String::New(env, result);
+}
+
+
+/**
+* パラメータ付きSQLを解析してカラム・パラメータ情報を作成します
+*
+* napiを使わないのでワーカースレッドからも呼び出せます。
+*
+* @param[in] hOdbc 接続ハンドル
+* @param[in] queryString SQL
+* @param[in] supportLabel ラベルを出力するか
+* @param[out] result SQLの情報(JSON形式の文字列)
+* @param[out] error エラーメッセージ
+* @param[out] sqlState 失敗時のSQLSTATE
+* @return bool 成否
+*/
+bool OmniDb::DescribeQuery(
+  SQLHDBC hOdbc, SQLTCHAR *queryString, bool supportLabel,
+  std::string &result, OString &error, std::string &sqlState)
+{
+  // 出力タイプ
+  #define NUM_ATTR    0   // 数値属性
+  #define CHAR_ATTR   1   // キャラ属性
+
+  typedef struct  {
+    SQLSMALLINT type;
+    const char *name;
+    SQLSMALLINT attr;
+  } QUERY_COLTYPE;
+
+  // QUERY情報で出力するタイプ
+  static const QUERY_COLTYPE QUERY_COLTYPES[] = {
+    // 列名
+    { SQL_DESC_NAME, "name", CHAR_ATTR },
+    // ラベル名
+    { SQL_DESC_LABEL, "label", CHAR_ATTR },
+    // データタイプ
+    { SQL_DESC_TYPE, "type", NUM_ATTR },
+    // NULL
+    { SQL_DESC_NULLABLE, "nullable", NUM_ATTR },
+    // オートインクリメント
+    { SQL_DESC_AUTO_UNIQUE_VALUE, "autoIncliment", NUM_ATTR },
+    // サイズ
+    { SQL_DESC_LENGTH, "size", NUM_ATTR },
+    // 10進数精度
+    { SQL_DESC_SCALE, "decimalDigits", NUM_ATTR },
+    // カタログ名（物理的な割当がある場合）
+    { SQL_DESC_CATALOG_NAME, "catalog", CHAR_ATTR },
+    // スキーマ名（物理的な割当がある場合）
+    { SQL_DESC_SCHEMA_NAME, "schema", CHAR_ATTR },
+    // テーブル名（物理的な割当がある場合）
+    { SQL_DESC_BASE_TABLE_NAME, "table", CHAR_ATTR },
+    // カラム名（物理的な割当がある場合）
+    { SQL_DESC_BASE_COLUMN_NAME, "column", CHAR_ATTR },
+  };
+
+  SQLRETURN ret;
+
+  //
+  // パラメータ付きSQLの解析
+  //
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(hOdbc));
+  if(!SQL_SUCCEEDED(ret = SQLPrepare(stmt.get(), queryString, SQL_NTS))) {
+    error = ErrorMessage(_O("SQLPrepare"), ret, SQL_HANDLE_STMT, stmt.get());
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
 
   //
   // カラム情報の取得
   //
-  json cols = json::array();
+  ArenaJson cols = ArenaJson::array();
   
   SQLSMALLINT numCol;
   if(!SQL_SUCCEEDED(ret = SQLNumResultCols(stmt.get(), &numCol))) {
-    CreateError(
-      env,
-      ErrorMessage(_O("SQLNumResultCols"), ret, SQL_HANDLE_STMT, stmt.get())
-    ).ThrowAsJavaScriptException();
-    return env.Null();
+    error = ErrorMessage(_O("SQLNumResultCols"), ret, SQL_HANDLE_STMT, stmt.get());
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
   }
 
   for(int col = 0; col < numCol; col++) {
-    json column = json::object();
+    ArenaJson column = ArenaJson::object();
 
     SQLSMALLINT numType = sizeof(QUERY_COLTYPES) / sizeof(QUERY_COLTYPE);
     for(int t = 0; t < numType; t++) {
@@ -811,9 +677,9 @@ Napi::Value OmniDb::Query(const Napi::CallbackInfo& info)
             break;
           case SQL_DESC_TYPE:
             // データ型
-            column[prop] = to_jsonstr(GetTypeName(attr));
+            column[prop] = ToArenaString(to_jsonstr(GetTypeName(attr)));
             // 型は特別に型クラスも出力
-            column["typeClass"] = to_jsonstr(GetTypeClassName(attr));
+            column["typeClass"] = ToArenaString(to_jsonstr(GetTypeClassName(attr)));
             break;
           default:
             // 上記以外の数値型の場合はそのまま転送
@@ -822,32 +688,30 @@ Napi::Value OmniDb::Query(const Napi::CallbackInfo& info)
         }
       } else {
         // 文字列データの場合は加工無しで設定
-        column[prop] = to_jsonstr(_S2O(data));
+        column[prop] = ToArenaText(data);
       }
     }
 
-    cols.push_back(column);
+    cols.push_back(std::move(column));
   }
 
   //
   // パラメータ情報の取得
   //
-  json params = json::array();
+  ArenaJson params = ArenaJson::array();
 
   // パラメータ数取得
   SQLSMALLINT numParam;
   if(!SQL_SUCCEEDED(ret = SQLNumParams(stmt.get(), &numParam))) {
-    CreateError(
-      env,
-      ErrorMessage(_O("SQLNumParams"), ret, SQL_HANDLE_STMT, stmt.get())
-    ).ThrowAsJavaScriptException();
-    return env.Null();
+    error = ErrorMessage(_O("SQLNumParams"), ret, SQL_HANDLE_STMT, stmt.get());
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
   }
 
   for (int p = 0; p < numParam; p++) {
     // パラメータの情報を取得する
     // https://www.ibm.com/docs/ja/i/7.3?topic=functions-sqldescribeparam-return-description-parameter-marker
-    json param = json::object();
+    ArenaJson param = ArenaJson::object();
 
     SQLSMALLINT dataType = 0;
     SQLULEN paramSize = 0;
@@ -856,17 +720,15 @@ Napi::Value OmniDb::Query(const Napi::CallbackInfo& info)
     if(!SQL_SUCCEEDED(ret =
       SQLDescribeParam(
         stmt.get(), p + 1, &dataType, &paramSize, &decimalDigits, &nullable))) {
-      CreateError(
-        env,
-        ErrorMessage(_O("SQLDescribeParam"), ret, SQL_HANDLE_STMT, stmt.get())
-      ).ThrowAsJavaScriptException();
-      return env.Null();
+      error = ErrorMessage(_O("SQLDescribeParam"), ret, SQL_HANDLE_STMT, stmt.get());
+      sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+      return false;
     }
 
     // データ型
-    param["type"] = to_jsonstr(GetTypeName(dataType));
+    param["type"] = ToArenaString(to_jsonstr(GetTypeName(dataType)));
     // 型分類
-    param["typeClass"] = to_jsonstr(GetTypeClassName(dataType));
+    param["typeClass"] = ToArenaString(to_jsonstr(GetTypeClassName(dataType)));
     // サイズ
     param["size"] = paramSize;
     // 10進数
@@ -874,34 +736,41 @@ Napi::Value OmniDb::Query(const Napi::CallbackInfo& info)
     // nullを許可するか
     param["nullable"]= (nullable == SQL_NULLABLE) ? true : false;
 
-    params.push_back(param);
+    params.push_back(std::move(param));
   }
 
   //
   // SQL情報返却
   //
-  json result = json::object();
-  result["columns"] = cols;
-  result["params"] = params;
-  return Napi::String::New(env, result.dump(-1, ' ', true, json::error_handler_t::replace));
+  ArenaJson query = ArenaJson::object();
+  query["columns"] = std::move(cols);
+  query["params"] = std::move(params);
+  ArenaString text = query.dump(-1, ' ', true, ArenaJson::error_handler_t::replace);
+  result.assign(text.data(), text.size());
+  return true;
 }
 
 
 /**
 * SQLを直接実行します。結果は成否のみ返します
 *
+* execute(sql, options)
+*   sql                  SQL、またはSQLの配列(1回の呼び出しで順に実行)
+*   options.results      結果(結果セット・更新行数)を返すか ※配列の場合は常に返す
+*   options.maxRows      1つの結果セットから返す最大行数(0は無制限)
+*   options.stopOnError  配列の場合、失敗したSQLで中止するか(既定はtrue)
+*
 * @param[in] info Node.jsパラメータ
-* @return Napi::Value SQLの情報をJSON形式の文字列で返します
+* @return Napi::Value 成否、または結果をJSON形式の文字列で返します
 */
 Napi::Value OmniDb::Execute(const Napi::CallbackInfo& info)
 {
-  SQLRETURN ret;
   Napi::Env env = info.Env();
 
   //
-  // execute(sql)
+  // execute(sql, options)
   //
-  // のパラメータチェック
+  // のパラメータチェック ※optionsは任意
   //
   if(info.Length() < 1) {
     CreateTypeError(
@@ -910,78 +779,1219 @@ Napi::Value OmniDb::Execute(const Napi::CallbackInfo& info)
     ).ThrowAsJavaScriptException();
     return env.Null();
   }
-  if(!info[0].IsString()) {
+  if(!info[0].IsString() && !info[0].IsArray()) {
     CreateTypeError(
       env, 
-      OString(_O("sql は文字列のみ指定できます"))
+      OString(_O("sql は文字列または文字列の配列のみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(info.Length() >= 2 && !info[1].IsUndefined() && !info[1].IsNull() && !info[1].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("options はオブジェクトのみ指定できます"))
     ).ThrowAsJavaScriptException();
     return env.Null();
   }
 
+  //
+  // オプション取得
+  //
+  bool results = false;
+  size_t maxRows = 0;
+  bool stopOnError = true;
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    if(options.Has("results")) {
+      results = options.Get("results").ToBoolean();
+    }
+    if(options.Has("maxRows") && options.Get("maxRows").IsNumber()) {
+      double n = options.Get("maxRows").As<Napi::Number>().DoubleValue();
+      maxRows = n > 0 ? (size_t)n : 0;
+    }
+    if(options.Has("stopOnError")) {
+      stopOnError = options.Get("stopOnError").ToBoolean();
+    }
+  }
+
   //
   // 指定されたSQLを実行するだけ。例外がでなければ成功
   //
   // omnidbのSQL実行はテンポラリテーブルやライブラリリスト等の前準備として必要なもの
-  // を用意するものなので、レコードとかは返却しません。実行するだけです
+  // を用意するものなので、optionsで指定しない限りレコードとかは返却しません。実行するだけです
   //
-  Napi::String _sql = info[0].As<Napi::String>();
-  std::unique_ptr<SQLTCHAR> sql(OmniDb::NapiStringToSQLTCHAR(_sql));
+  if(info[0].IsString()) {
+    Napi::String _sql = info[0].As<Napi::String>();
+    std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(_sql));
+
+    json outcome;
+    OString error;
+    std::string sqlState;
+    if(!ExecuteBatch(m_hOdbc, sql.get(), results, maxRows, outcome, error, sqlState)) {
+      CreateError(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    if(!results) {
+      return Napi::Boolean::New(env, true);
+    }
+    return Napi::String::New(env, outcome.dump(-1, ' ', true, json::error_handler_t::replace));
+  }
 
-  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(m_hOdbc));
-  if(!SQL_SUCCEEDED(ret = SQLExecDirect(stmt.get(), sql.get(), SQL_NTS))) {
-    CreateError(
-      env,
-      ErrorMessage(_O("SQLExecDirect"), ret, SQL_HANDLE_STMT, stmt.get())
-    ).ThrowAsJavaScriptException();
-    return env.Null();
+  //
+  // SQLの配列は1回の呼び出しで順に実行し、SQLごとの結果を返します
+  //
+  Napi::Array statements = info[0].As<Napi::Array>();
+  for(uint32_t i = 0; i < statements.Length(); i++) {
+    if(!statements.Get(i).IsString()) {
+      CreateTypeError(
+        env,
+        OString(_O("sql の配列は文字列のみ指定できます"))
+      ).ThrowAsJavaScriptException();
+      return env.Null();
+    }
   }
 
-  return Napi::Boolean::New(env, true);
+  json outcomes = json::array();
+  bool stopped = false;
+  for(uint32_t i = 0; i < statements.Length(); i++) {
+    json outcome = json::object();
+    if(stopped) {
+      outcome["ok"] = false;
+      outcome["skipped"] = true;
+      outcomes.push_back(outcome);
+      continue;
+    }
+
+    Napi::String _sql = statements.Get(i).As<Napi::String>();
+    std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(_sql));
+    OString error;
+    std::string sqlState;
+    if(ExecuteBatch(m_hOdbc, sql.get(), true, maxRows, outcome, error, sqlState)) {
+      outcome["ok"] = true;
+    } else {
+      outcome["ok"] = false;
+      outcome["error"] = to_jsonstr(error);
+      outcome["sqlState"] = sqlState;
+      stopped = stopOnError;
+    }
+    outcomes.push_back(outcome);
+  }
+
+  return Napi::String::New(env, outcomes.dump(-1, ' ', true, json::error_handler_t::replace));
 }
 
 
 /**
-* ロケール設定
+* SQLを直接実行し、全ての結果をSQLMoreResultsで読み切ります(ワーカースレッドからも使用)
 *
-* @param[in] info Node.jsパラメータ
-* @return Napi::Value カラム情報をJSON形式の文字列で返します
+* 複数の結果セットを返すSQL(ストアドプロシージャのカーソル等)は結果セットごと、
+* 更新系のSQLは更新行数を results に追加します。
+*
+* @param[in] hOdbc 接続ハンドル
+* @param[in] sql SQL
+* @param[in] results 結果を返すか(falseの場合も結果は読み切ります)
+* @param[in] maxRows 1つの結果セットから返す最大行数(0は無制限)
+* @param[out] outcome 結果({results: [{columns, rows, truncated} | {rowCount}]})
+* @param[out] error エラーメッセージ
+* @param[out] sqlState SQLSTATE
+* @param[in] cancel 取り消し(別スレッドからSQLCancelする場合、NULLは取り消さない)
+* @return bool 成否
 */
+bool OmniDb::ExecuteBatch(
+  SQLHDBC hOdbc, SQLTCHAR *sql, bool results, size_t maxRows,
+  json &outcome, OString &error, std::string &sqlState, CancelToken *cancel)
+{
+  SQLRETURN ret;
 
-Napi::Value OmniDb::SetLocale(const Napi::CallbackInfo &info)
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(hOdbc));
+  if(cancel && !cancel->Attach(stmt.get())) {
+    error = _O("実行は取り消されました");
+    sqlState = "HY008";
+    return false;
+  }
+  // 文を解放する前に取り消しの登録を外す
+  struct Detacher {
+    CancelToken *cancel;
+    ~Detacher() { if(cancel) { cancel->Detach(); } }
+  } detacher = { cancel };
+
+  ret = SQLExecDirect(stmt.get(), sql, SQL_NTS);
+  if(!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+    error = ErrorMessage(_O("SQLExecDirect"), ret, SQL_HANDLE_STMT, stmt.get());
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
+
+  json list;
+  if(!FetchResults(stmt.get(), results, maxRows, list, error)) {
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
+
+  outcome["results"] = list;
+  return true;
+}
+
+
+/**
+* 配列パラメータでSQLを一括実行します
+*
+* executeBulk(sql, columns, options)
+*   columns              パラメータごとの値の配列([[列1の値...], [列2の値...]])
+*                        TypedArray・固定長バッファ{data, width, lengths, binary}はコピーせずにバインド
+*   options.batchSize    1回に実行する行数(SQL_ATTR_PARAMSET_SIZE)
+*   options.stopOnError  失敗したバッチで中止するか(既定はtrue)
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 行ごとの状態・更新行数をJSON形式の文字列で返します
+*/
+Napi::Value OmniDb::ExecuteBulk(const Napi::CallbackInfo& info)
 {
   Napi::Env env = info.Env();
 
-  // setLocale(category, locale)
-  // のパラメータチェック
-  if(info.Length() != 2) {
+  //
+  // executeBulk(sql, columns, options)
+  // のパラメータチェック ※optionsは任意
+  //
+  if(info.Length() < 2) {
     CreateTypeError(
-      env, 
-      OString(_O("setLocale(category, locale) category, localeパラメータは必須です"))
+      env,
+      OString(_O("executeBulk(sql, columns) sql, columnsパラメータは必須です"))
     ).ThrowAsJavaScriptException();
     return env.Null();
   }
-
   if(!info[0].IsString()) {
     CreateTypeError(
-      env, 
-      OString(_O("category は文字列のみ指定できます"))
+      env,
+      OString(_O("sql は文字列のみ指定できます"))
     ).ThrowAsJavaScriptException();
     return env.Null();
   }
-
-  if(!info[1].IsString()) {
+  if(!info[1].IsArray()) {
     CreateTypeError(
-      env, 
-      OString(_O("locale は文字列のみ指定できます"))
+      env,
+      OString(_O("columns は配列のみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(info.Length() >= 3 && !info[2].IsUndefined() && !info[2].IsNull() && !info[2].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("options はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!m_hOdbc) {
+    CreateError(env, OString(_O("DBに接続されていません"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  //
+  // オプション取得
+  //
+  size_t batchSize = BULK_DEFAULT_BATCH_SIZE;
+  bool stopOnError = true;
+  if(info.Length() >= 3 && info[2].IsObject()) {
+    Napi::Object options = info[2].As<Napi::Object>();
+    if(options.Has("batchSize") && options.Get("batchSize").IsNumber()) {
+      double n = options.Get("batchSize").As<Napi::Number>().DoubleValue();
+      batchSize = n >= 1 ? (size_t)n : 1;
+    }
+    if(options.Has("stopOnError")) {
+      stopOnError = options.Get("stopOnError").ToBoolean();
+    }
+  }
+
+  //
+  // SQL準備
+  //
+  Napi::String _sql = info[0].As<Napi::String>();
+  std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(_sql));
+
+  BulkStatement stmt;
+  OString error;
+  if(!stmt.Prepare(m_hOdbc, sql.get(), error)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  //
+  // パラメータ配列の変換(型はSQLDescribeParamに合わせる)
+  //
+  std::vector<BulkParamType> types;
+  stmt.DescribeParams(types);
+
+  size_t rows = 0;
+  std::vector<BulkColumn> columns;
+  // 直接バインドしたTypedArray・Bufferは実行が終わるまで保持
+  BulkPins pins;
+  if(!ToBulkColumns(info[1], types, columns, pins, rows, error)) {
+    CreateTypeError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  //
+  // 一括実行
+  //
+  BulkResult bulk;
+  stmt.ExecuteAll(columns, rows, batchSize, stopOnError, bulk);
+
+  return Napi::String::New(env, BulkResultToJson(bulk));
+}
+
+
+/**
+* ストアドプロシージャを呼び出します
+*
+* call(procedure, params, options)
+*   procedure        プロシージャ名(スキーマ.名前、または名前)
+*   params           IN・INOUTパラメータの値(呼び出し順の配列、またはパラメータ名→値)
+*   options.results  結果セットを返すか(既定はtrue)
+*   options.maxRows  1つの結果セットから返す最大行数(0は無制限)
+*   options.refresh  パラメータ定義を取得し直すか
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value {returnValue, outputs, results}をJSON形式の文字列で返します
+*/
+Napi::Value OmniDb::Call(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+
+  //
+  // call(procedure, params, options)
+  // のパラメータチェック ※params, optionsは任意
+  //
+  if(info.Length() < 1) {
+    CreateTypeError(
+      env,
+      OString(_O("call(procedure) procedureパラメータは必須です"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!info[0].IsString()) {
+    CreateTypeError(
+      env,
+      OString(_O("procedure は文字列のみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(info.Length() >= 2 && !info[1].IsUndefined() && !info[1].IsNull() && !info[1].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("params は配列またはオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(info.Length() >= 3 && !info[2].IsUndefined() && !info[2].IsNull() && !info[2].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("options はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!m_hOdbc) {
+    CreateError(env, OString(_O("DBに接続されていません"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  //
+  // オプション取得
+  //
+  bool results = true;
+  size_t maxRows = 0;
+  bool refresh = false;
+  if(info.Length() >= 3 && info[2].IsObject()) {
+    Napi::Object options = info[2].As<Napi::Object>();
+    if(options.Has("results")) {
+      results = options.Get("results").ToBoolean();
+    }
+    if(options.Has("maxRows") && options.Get("maxRows").IsNumber()) {
+      double n = options.Get("maxRows").As<Napi::Number>().DoubleValue();
+      maxRows = n > 0 ? (size_t)n : 0;
+    }
+    if(options.Has("refresh")) {
+      refresh = options.Get("refresh").ToBoolean();
+    }
+  }
+
+  OString error;
+  const ProcDefinition *definition = GetProcedure(info[0].As<Napi::String>(), refresh, error);
+  if(!definition) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  //
+  // IN・INOUTパラメータの値を設定(指定のないパラメータはNULL)
+  //
+  ProcCall call(*definition);
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object params = info[1].As<Napi::Object>();
+    bool positional = info[1].IsArray();
+    uint32_t position = 0;
+    for(size_t i = 0; i < definition->params.size(); i++) {
+      const ProcParam &param = definition->params[i];
+      if(param.ioType == SQL_RETURN_VALUE) {
+        continue;
+      }
+      Napi::Value value = env.Undefined();
+      if(positional) {
+        if(position < params.As<Napi::Array>().Length()) {
+          value = params.Get(position);
+        }
+        position++;
+      } else {
+        // パラメータ名は大文字・小文字どちらでも指定できる
+        std::string name = to_jsonstr(param.column.name);
+        std::string lower = name;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if(params.Has(name)) {
+          value = params.Get(name);
+        } else if(params.Has(lower)) {
+          value = params.Get(lower);
+        }
+      }
+      if(param.ioType == SQL_PARAM_OUTPUT) {
+        continue;
+      }
+      SetProcValue(call, i, value);
+    }
+  }
+
+  //
+  // 呼び出し
+  //
+  json outcome = json::object();
+  std::string sqlState;
+  if(!call.Execute(m_hOdbc, results, maxRows, outcome, error, sqlState)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return Napi::String::New(env, outcome.dump(-1, ' ', true, json::error_handler_t::replace));
+}
+
+
+/**
+* ストアドプロシージャを配列パラメータで一括呼び出しします
+*
+* callBulk(procedure, columns, options)
+*   procedure            プロシージャ名(スキーマ.名前、または名前)
+*   columns              パラメータごとの値の配列(executeBulkと同じ形式)
+*   options.batchSize    1回に実行する行数
+*   options.stopOnError  失敗したバッチで中止するか(既定はtrue)
+*   options.refresh      パラメータ定義を取得し直すか
+*
+* パラメータの型はSQLProcedureColumnsの定義に合わせます。
+* 出力パラメータ・戻り値のあるプロシージャ、結果セットは扱えません。
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 一括実行の結果をJSON形式の文字列で返します
+*/
+Napi::Value OmniDb::CallBulk(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+
+  //
+  // callBulk(procedure, columns, options)
+  // のパラメータチェック ※optionsは任意
+  //
+  if(info.Length() < 2) {
+    CreateTypeError(
+      env,
+      OString(_O("callBulk(procedure, columns) procedure, columnsパラメータは必須です"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!info[0].IsString()) {
+    CreateTypeError(
+      env,
+      OString(_O("procedure は文字列のみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!info[1].IsArray()) {
+    CreateTypeError(
+      env,
+      OString(_O("columns は配列のみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(info.Length() >= 3 && !info[2].IsUndefined() && !info[2].IsNull() && !info[2].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("options はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!m_hOdbc) {
+    CreateError(env, OString(_O("DBに接続されていません"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  //
+  // オプション取得
+  //
+  size_t batchSize = BULK_DEFAULT_BATCH_SIZE;
+  bool stopOnError = true;
+  bool refresh = false;
+  if(info.Length() >= 3 && info[2].IsObject()) {
+    Napi::Object options = info[2].As<Napi::Object>();
+    if(options.Has("batchSize") && options.Get("batchSize").IsNumber()) {
+      double n = options.Get("batchSize").As<Napi::Number>().DoubleValue();
+      batchSize = n >= 1 ? (size_t)n : 1;
+    }
+    if(options.Has("stopOnError")) {
+      stopOnError = options.Get("stopOnError").ToBoolean();
+    }
+    if(options.Has("refresh")) {
+      refresh = options.Get("refresh").ToBoolean();
+    }
+  }
+
+  OString error;
+  const ProcDefinition *definition = GetProcedure(info[0].As<Napi::String>(), refresh, error);
+  if(!definition) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(definition->hasOutput) {
+    CreateError(
+      env,
+      OString(_O("出力パラメータ・戻り値のあるプロシージャは一括呼び出しできません"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  //
+  // CALL文の準備(型はプロシージャの定義に合わせる)
+  //
+  BulkStatement stmt;
+  if(!stmt.Prepare(m_hOdbc, (SQLTCHAR *)definition->callSql.c_str(), error)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  std::vector<BulkParamType> types(definition->params.size());
+  for(size_t i = 0; i < types.size(); i++) {
+    types[i].described = true;
+    types[i].sqlType = definition->params[i].column.sqlType;
+    types[i].columnSize = definition->params[i].column.columnSize;
+    types[i].decimalDigits = definition->params[i].column.decimalDigits;
+  }
+
+  size_t rows = 0;
+  std::vector<BulkColumn> columns;
+  BulkPins pins;
+  if(!ToBulkColumns(info[1], types, columns, pins, rows, error)) {
+    CreateTypeError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  BulkResult bulk;
+  stmt.ExecuteAll(columns, rows, batchSize, stopOnError, bulk);
+
+  return Napi::String::New(env, BulkResultToJson(bulk));
+}
+
+
+/**
+* プロシージャのパラメータ定義を取得します(接続ごとにキャッシュ)
+*
+* @param[in] procedure プロシージャ名(スキーマ.名前、または名前)
+* @param[in] refresh キャッシュを使わずに取得し直すか
+* @param[out] error エラーメッセージ
+* @return const ProcDefinition* パラメータ定義(失敗はnullptr)
+*/
+const ProcDefinition *OmniDb::GetProcedure(Napi::String procedure, bool refresh, OString &error)
+{
+  std::unique_ptr<SQLTCHAR[]> _procedure(OmniDb::NapiStringToSQLTCHAR(procedure));
+  OString qualified = _S2O(_procedure.get());
+
+  if(!refresh) {
+    std::map<OString, ProcDefinition>::const_iterator it = m_procedures.find(qualified);
+    if(it != m_procedures.end()) {
+      return &it->second;
+    }
+  }
+
+  OString schema;
+  OString name = qualified;
+  size_t dot = qualified.find(_O('.'));
+  if(dot != OString::npos) {
+    schema = qualified.substr(0, dot);
+    name = qualified.substr(dot + 1);
+  }
+
+  ProcDefinition definition;
+  if(!DescribeProcedure(m_hOdbc, schema, name, definition, error)) {
+    return nullptr;
+  }
+  if(m_procedures.size() >= PROC_CACHE_SIZE) {
+    m_procedures.clear();
+  }
+  ProcDefinition &cached = m_procedures[qualified];
+  cached = definition;
+  return &cached;
+}
+
+
+/**
+* JSの値をプロシージャのパラメータに設定します
+*
+* @param[in,out] call 呼び出し
+* @param[in] index パラメータの位置
+* @param[in] value 値(undefined・nullはNULL、Bufferはバイナリ)
+*/
+void OmniDb::SetProcValue(ProcCall &call, size_t index, Napi::Value value)
+{
+  if(value.IsUndefined() || value.IsNull()) {
+    call.SetNull(index);
+  } else if(value.IsNumber()) {
+    call.SetNumber(index, value.As<Napi::Number>().DoubleValue());
+  } else if(value.IsBoolean()) {
+    call.SetNumber(index, value.As<Napi::Boolean>().Value() ? 1 : 0);
+  } else if(value.IsBuffer()) {
+    Napi::Buffer<char> buffer = value.As<Napi::Buffer<char> >();
+    call.SetBinary(index, buffer.Data(), buffer.Length());
+  } else {
+    // 文字列・BigInt・日付等は文字列で渡す
+    std::unique_ptr<SQLTCHAR[]> text(OmniDb::NapiStringToSQLTCHAR(value.ToString()));
+    call.SetText(index, _S2O(text.get()));
+  }
+}
+
+
+/**
+* 一括実行の結果をJSONに変換します
+*
+* @param[in] bulk 一括実行の結果
+* @return std::string JSON形式の文字列
+*/
+std::string OmniDb::BulkResultToJson(const BulkResult &bulk)
+{
+  size_t failed = 0;
+  json status = json::array();
+  for(size_t i = 0; i < bulk.status.size(); i++) {
+    status.push_back(bulk.status[i]);
+    if(bulk.status[i] == SQL_PARAM_ERROR) {
+      failed++;
+    }
+  }
+  json errors = json::array();
+  for(size_t i = 0; i < bulk.errors.size(); i++) {
+    json e = json::object();
+    e["offset"] = bulk.errors[i].offset;
+    e["rows"] = bulk.errors[i].rows;
+    e["message"] = to_jsonstr(bulk.errors[i].message);
+    e["sqlState"] = bulk.errors[i].sqlState;
+    errors.push_back(e);
+  }
+  json rowErrors = json::array();
+  for(size_t i = 0; i < bulk.rowErrors.size(); i++) {
+    json e = json::object();
+    e["row"] = bulk.rowErrors[i].row;
+    e["message"] = to_jsonstr(bulk.rowErrors[i].message);
+    e["sqlState"] = bulk.rowErrors[i].sqlState;
+    rowErrors.push_back(e);
+  }
+
+  json result = json::object();
+  result["rows"] = bulk.rows;
+  result["batches"] = bulk.batches;
+  result["processed"] = bulk.processed;
+  result["affected"] = bulk.affected;
+  result["failed"] = failed;
+  result["status"] = status;
+  result["errors"] = errors;
+  result["rowErrors"] = rowErrors;
+  return result.dump(-1, ' ', true, json::error_handler_t::replace);
+}
+
+
+/**
+* トランザクションを開始します(自動コミットを止める)
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 成否
+*/
+Napi::Value OmniDb::Begin(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+
+  if(!m_hOdbc) {
+    CreateError(env, OString(_O("DBに接続されていません"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_inTransaction) {
+    CreateError(env, OString(_O("既にトランザクションを開始しています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  SQLRETURN ret = SQLSetConnectAttr(m_hOdbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_OFF, SQL_IS_UINTEGER);
+  if(!SQL_SUCCEEDED(ret)) {
+    CreateError(
+      env,
+      ErrorMessage(_O("SQLSetConnectAttr"), ret, SQL_HANDLE_DBC, m_hOdbc)
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  m_inTransaction = true;
+
+  return Napi::Boolean::New(env, true);
+}
+
+
+/**
+* トランザクションをコミットします(自動コミットに戻す)
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 成否
+*/
+Napi::Value OmniDb::Commit(const Napi::CallbackInfo& info)
+{
+  return EndTransaction(info, SQL_COMMIT);
+}
+
+
+/**
+* トランザクションをロールバックします(自動コミットに戻す)
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 成否
+*/
+Napi::Value OmniDb::Rollback(const Napi::CallbackInfo& info)
+{
+  return EndTransaction(info, SQL_ROLLBACK);
+}
+
+
+/**
+* トランザクションを終了します
+*
+* @param[in] info Node.jsパラメータ
+* @param[in] completionType SQL_COMMIT / SQL_ROLLBACK
+* @return Napi::Value 成否
+*/
+Napi::Value OmniDb::EndTransaction(const Napi::CallbackInfo& info, SQLSMALLINT completionType)
+{
+  Napi::Env env = info.Env();
+
+  if(!m_hOdbc) {
+    CreateError(env, OString(_O("DBに接続されていません"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!m_inTransaction) {
+    CreateError(env, OString(_O("トランザクションを開始していません"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  SQLRETURN ret = SQLEndTran(SQL_HANDLE_DBC, m_hOdbc, completionType);
+  if(!SQL_SUCCEEDED(ret)) {
+    // 失敗した場合はトランザクション中のまま(ロールバックできるように)
+    CreateError(
+      env,
+      ErrorMessage(_O("SQLEndTran"), ret, SQL_HANDLE_DBC, m_hOdbc)
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  m_inTransaction = false;
+  SQLSetConnectAttr(m_hOdbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, SQL_IS_UINTEGER);
+
+  return Napi::Boolean::New(env, true);
+}
+
+
+/**
+* カタログキャッシュ(共有メモリマップドファイル)を開きます
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 成否
+*/
+Napi::Value OmniDb::OpenCatalogCache(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+
+  //
+  // openCatalogCache(path)
+  // のパラメータチェック
+  //
+  if(info.Length() < 1 || !info[0].IsString()) {
+    CreateTypeError(
+      env,
+      OString(_O("openCatalogCache(path) pathは文字列で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::String _path = info[0].As<Napi::String>();
+  std::unique_ptr<SQLTCHAR[]> path(OmniDb::NapiStringToSQLTCHAR(_path));
+
+  std::unique_ptr<CatalogCache> cache(new CatalogCache());
+  OString error;
+  if(!cache->Open(_S2O(path.get()), error)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  m_catalogCache.reset(cache.release());
+  m_catalogIndex.reset();
+
+  return Napi::Boolean::New(env, true);
+}
+
+
+/**
+* カタログキャッシュの範囲の文字列(未指定は空)
+*/
+static std::string CatalogScopeText(const SQLTCHAR *text)
+{
+  return text ? std::string(to_jsonstr(_S2O(text))) : std::string();
+}
+
+
+/**
+* カタログキャッシュの範囲が同じか
+*/
+static bool SameCatalogScope(const CatalogFilter &a, const CatalogFilter &b)
+{
+  return a.catalog == b.catalog && a.schema == b.schema && a.table == b.table && a.tableType == b.tableType;
+}
+
+
+/**
+* カタログキャッシュの範囲をJSONにします
+*/
+static json CatalogScopeJson(const CatalogFilter &scope)
+{
+  json result = json::object();
+  result["catalog"] = scope.catalog;
+  result["schema"] = scope.schema;
+  result["table"] = scope.table;
+  result["tableType"] = scope.tableType;
+  return result;
+}
+
+
+/**
+* カタログキャッシュを更新します
+*
+* ホスト内で1プロセスだけがODBCから取得して公開します。他のプロセスが
+* 同じ条件で公開中の場合は完了を待ち、その結果をそのまま使います。
+* 条件はスナップショットに範囲として記録し、cachedTables()・cachedColumns()は
+* 範囲に含まれない検索をエラーにします。
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 公開したスナップショットの情報をJSON形式の文字列で返します
+*/
+Napi::Value OmniDb::RefreshCatalogCache(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+
+  //
+  // refreshCatalogCache(condition, options)
+  // のパラメータチェック ※condition, optionsは任意
+  //
+  if(!m_catalogCache) {
+    CreateError(env, OString(_O("カタログキャッシュが開かれていません"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!m_hOdbc) {
+    CreateError(env, OString(_O("DBに接続されていません"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(info.Length() >= 1 && !info[0].IsUndefined() && !info[0].IsNull() && !info[0].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("condition はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(info.Length() >= 2 && !info[1].IsUndefined() && !info[1].IsNull() && !info[1].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("options はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::unique_ptr<SQLTCHAR[]> catalog = nullptr;
+  std::unique_ptr<SQLTCHAR[]> schema = nullptr;
+  std::unique_ptr<SQLTCHAR[]> table = nullptr;
+  std::unique_ptr<SQLTCHAR[]> tableType = nullptr;
+  if(info.Length() >= 1 && info[0].IsObject()) {
+    Napi::Object condition = info[0].As<Napi::Object>();
+    if(condition.Has("catalog")) {
+      Napi::String _catalog = condition.Get("catalog").ToString();
+      if(!IsBlank(_catalog))
+        catalog.reset(OmniDb::NapiStringToSQLTCHAR(_catalog));
+    }
+    if(condition.Has("schema")) {
+      Napi::String _schema = condition.Get("schema").ToString();
+      if(!IsBlank(_schema))
+        schema.reset(OmniDb::NapiStringToSQLTCHAR(_schema));
+    }
+    if(condition.Has("table")) {
+      Napi::String _table = condition.Get("table").ToString();
+      if(!IsBlank(_table))
+        table.reset(OmniDb::NapiStringToSQLTCHAR(_table));
+    }
+    // キャッシュは既定で全種別を保持(cachedTables側でTABLEに絞る)
+    if(condition.Has("tableType")) {
+      Napi::String _tableType = condition.Get("tableType").ToString();
+      if(!IsBlank(_tableType))
+        tableType.reset(OmniDb::NapiStringToSQLTCHAR(_tableType));
+    }
+  }
+
+  CatalogFilter scope;
+  scope.catalog = CatalogScopeText(catalog.get());
+  scope.schema = CatalogScopeText(schema.get());
+  scope.table = CatalogScopeText(table.get());
+  scope.tableType = CatalogScopeText(tableType.get());
+
+  // 有効期間(秒) ※省略時は常に作り直す
+  double maxAge = -1;
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    if(options.Has("maxAge") && options.Get("maxAge").IsNumber()) {
+      maxAge = options.Get("maxAge").As<Napi::Number>().DoubleValue();
+    }
+  }
+
+  CatalogCache &cache = *m_catalogCache;
+  json result = json::object();
+  result["built"] = false;
+
+  result["scope"] = CatalogScopeJson(scope);
+
+  // 同じ範囲で有効期間内なら何もしない
+  OString error;
+  uint64_t now = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  uint64_t seen = cache.CurrentVersion();
+  if(maxAge >= 0 && seen > 0 && now - cache.PublishedAt() <= (uint64_t)(maxAge * 1000)) {
+    std::shared_ptr<const CatalogSnapshot> current = cache.Acquire(error);
+    if(current && SameCatalogScope(current->Scope(), scope)) {
+      result["version"] = current->Version();
+      return Napi::String::New(env, result.dump());
+    }
+    error.clear();
+  }
+
+  if(!cache.LockWriter(error)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  CatalogWriterGuard guard(cache);
+
+  // ロック待ちの間に他のプロセスが同じ範囲で公開した場合はそれを使う
+  if(cache.CurrentVersion() != seen) {
+    std::shared_ptr<const CatalogSnapshot> current = cache.Acquire(error);
+    if(current && SameCatalogScope(current->Scope(), scope)) {
+      result["version"] = current->Version();
+      return Napi::String::New(env, result.dump());
+    }
+    error.clear();
+  }
+
+  std::vector<CatalogTable> tables;
+  std::vector<CatalogColumn> columns;
+  if(!FetchCatalogTables(m_hOdbc, catalog.get(), schema.get(), table.get(), tableType.get(), tables, error) ||
+     !FetchCatalogColumns(m_hOdbc, catalog.get(), schema.get(), table.get(), nullptr, columns, error)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  uint64_t version = 0;
+  if(!cache.Publish(tables, columns, scope, version, error)) {
+    CreateError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  result["built"] = true;
+  result["version"] = version;
+  result["tables"] = tables.size();
+  result["columns"] = columns.size();
+  return Napi::String::New(env, result.dump());
+}
+
+
+/**
+* キャッシュからテーブル情報を取得します
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value テーブル情報をJSON形式の文字列で返します(tables()と同じ形式)
+*/
+Napi::Value OmniDb::CachedTables(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  CallArena arena;
+  CallArenaScope scope(arena);
+
+  CatalogFilter filter;
+  if(!ToCatalogFilter(env, info, filter)) {
+    return env.Null();
+  }
+  // tables()と同じくデフォルトはテーブルのみ
+  if(filter.tableType.empty()) {
+    filter.tableType = "TABLE";
+  }
+
+  OString error;
+  std::shared_ptr<const CatalogSnapshot> snapshot;
+  if(m_catalogCache) {
+    snapshot = m_catalogCache->Acquire(error);
+  }
+  if(!snapshot) {
+    CreateError(
+      env,
+      error.empty() ? OString(_O("カタログキャッシュが作成されていません")) : error
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if(!snapshot->Covers(filter, true)) {
+    CreateError(
+      env,
+      OString(_O("検索条件がカタログキャッシュの範囲(refreshCatalogCacheの条件)に含まれていません"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::vector<CatalogTable> tables;
+  snapshot->FindTables(filter, tables);
+  ArenaString result = CatalogTablesToJson(tables);
+  return Napi::String::New(env, result.data(), result.size());
+}
+
+
+/**
+* キャッシュからカラム情報を取得します
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value カラム情報をJSON形式の文字列で返します(columns()と同じ形式)
+*/
+Napi::Value OmniDb::CachedColumns(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  CallArena arena;
+  CallArenaScope scope(arena);
+
+  CatalogFilter filter;
+  if(!ToCatalogFilter(env, info, filter)) {
+    return env.Null();
+  }
+
+  OString error;
+  std::shared_ptr<const CatalogSnapshot> snapshot;
+  if(m_catalogCache) {
+    snapshot = m_catalogCache->Acquire(error);
+  }
+  if(!snapshot) {
+    CreateError(
+      env,
+      error.empty() ? OString(_O("カタログキャッシュが作成されていません")) : error
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if(!snapshot->Covers(filter, false)) {
+    CreateError(
+      env,
+      OString(_O("検索条件がカタログキャッシュの範囲(refreshCatalogCacheの条件)に含まれていません"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::vector<CatalogColumn> columns;
+  snapshot->FindColumns(filter, columns);
+  ArenaString result = CatalogColumnsToJson(columns);
+  return Napi::String::New(env, result.data(), result.size());
+}
+
+
+/**
+* カタログキャッシュの状態を取得します
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value キャッシュ情報をJSON形式の文字列で返します
+*/
+Napi::Value OmniDb::CatalogCacheInfo(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+
+  json result = json::object();
+  result["open"] = (m_catalogCache != nullptr);
+  if(m_catalogCache) {
+    result["path"] = to_jsonstr(m_catalogCache->Path());
+    result["version"] = m_catalogCache->CurrentVersion();
+    result["publishedAt"] = m_catalogCache->PublishedAt();
+
+    OString error;
+    std::shared_ptr<const CatalogSnapshot> snapshot = m_catalogCache->Acquire(error);
+    if(snapshot) {
+      result["tables"] = snapshot->TableCount();
+      result["columns"] = snapshot->ColumnCount();
+      result["bytes"] = snapshot->Bytes();
+      result["scope"] = CatalogScopeJson(snapshot->Scope());
+    }
+    if(m_catalogIndex) {
+      result["indexVersion"] = m_catalogIndex->Version();
+      result["indexBytes"] = m_catalogIndex->Bytes();
+    }
+  }
+  return Napi::String::New(env, result.dump(-1, ' ', true, json::error_handler_t::replace));
+}
+
+
+/**
+* カタログキャッシュのテーブル名・カラム名・備考を検索します
+*
+* 検索インデックスはキャッシュのスナップショットから作成し、スナップショットが
+* 更新されていれば作り直します。
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 検索結果(スコア順)をJSON形式の文字列で返します
+*/
+Napi::Value OmniDb::SearchCatalog(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+
+  //
+  // searchCatalog(query, options)
+  // のパラメータチェック ※optionsは任意
+  //
+  if(info.Length() < 1 || !info[0].IsString()) {
+    CreateTypeError(
+      env,
+      OString(_O("searchCatalog(query) queryは文字列で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  bool option = (info.Length() >= 2 && !info[1].IsUndefined() && !info[1].IsNull());
+  if(option && !info[1].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("options はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  CatalogSearchOptions searchOptions;
+  if(option) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    // 最大件数
+    if(options.Has("limit") && options.Get("limit").IsNumber()) {
+      int32_t limit = options.Get("limit").As<Napi::Number>().Int32Value();
+      searchOptions.limit = limit > 0 ? (size_t)limit : 0;
+    }
+    // 対象(テーブル・カラム・備考)
+    if(options.Has("tables")) {
+      searchOptions.tables = options.Get("tables").ToBoolean();
+    }
+    if(options.Has("columns")) {
+      searchOptions.columns = options.Get("columns").ToBoolean();
+    }
+    if(options.Has("remarks")) {
+      searchOptions.remarks = options.Get("remarks").ToBoolean();
+    }
+  }
+
+  OString error;
+  std::shared_ptr<const CatalogSnapshot> snapshot;
+  if(m_catalogCache) {
+    snapshot = m_catalogCache->Acquire(error);
+  }
+  if(!snapshot) {
+    CreateError(
+      env,
+      error.empty() ? OString(_O("カタログキャッシュが作成されていません")) : error
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // スナップショットが変わっていれば索引を作り直す
+  if(!m_catalogIndex || m_catalogIndex->Version() != snapshot->Version()) {
+    std::unique_ptr<CatalogIndex> index(new CatalogIndex());
+    index->Build(snapshot);
+    m_catalogIndex.reset(index.release());
+  }
+
+  std::vector<CatalogSearchHit> hits;
+  m_catalogIndex->Search(info[0].As<Napi::String>().Utf8Value(), searchOptions, hits);
+
+  //
+  // 検索結果
+  //
+  json result = json::array();
+  for(size_t i = 0; i < hits.size(); i++) {
+    const CatalogSearchHit &hit = hits[i];
+    json item = json::object();
+    if(hit.kind == CATALOG_KIND_TABLE) {
+      const CatalogTableRecord &r = snapshot->TableAt(hit.record);
+      item["kind"] = "table";
+      item["catalog"] = snapshot->Str(r.catalog);
+      item["schema"] = snapshot->Str(r.schema);
+      item["table"] = snapshot->Str(r.name);
+      item["name"] = snapshot->Str(r.name);
+      item["remarks"] = snapshot->Str(r.remarks);
+    } else {
+      const CatalogColumnRecord &r = snapshot->ColumnAt(hit.record);
+      item["kind"] = "column";
+      item["catalog"] = snapshot->Str(r.catalog);
+      item["schema"] = snapshot->Str(r.schema);
+      item["table"] = snapshot->Str(r.table);
+      item["name"] = snapshot->Str(r.name);
+      item["remarks"] = snapshot->Str(r.remarks);
+    }
+    item["match"] = (hit.field == CATALOG_FIELD_NAME) ? "name" : "remarks";
+    item["score"] = hit.score;
+    result.push_back(item);
+  }
+  return Napi::String::New(env, result.dump(-1, ' ', true, json::error_handler_t::replace));
+}
+
+
+/**
+* ロケール設定
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value カラム情報をJSON形式の文字列で返します
+*/
+
+Napi::Value OmniDb::SetLocale(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  // setLocale(category, locale)
+  // のパラメータチェック
+  if(info.Length() != 2) {
+    CreateTypeError(
+      env, 
+      OString(_O("setLocale(category, locale) category, localeパラメータは必須です"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if(!info[0].IsString()) {
+    CreateTypeError(
+      env, 
+      OString(_O("category は文字列のみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if(!info[1].IsString()) {
+    CreateTypeError(
+      env, 
+      OString(_O("locale は文字列のみ指定できます"))
     ).ThrowAsJavaScriptException();
     return env.Null();
   }
 
   Napi::String _category = info[0].As<Napi::String>();
-  std::unique_ptr<SQLTCHAR> category(OmniDb::NapiStringToSQLTCHAR(_category));
+  std::unique_ptr<SQLTCHAR[]> category(OmniDb::NapiStringToSQLTCHAR(_category));
 
   Napi::String _locale = info[1].As<Napi::String>();
-  std::unique_ptr<SQLTCHAR> locale(OmniDb::NapiStringToSQLTCHAR(_locale));
+  std::unique_ptr<SQLTCHAR[]> locale(OmniDb::NapiStringToSQLTCHAR(_locale));
 
 
   // カテゴリ名が一致した場合はロケール設定
@@ -999,55 +2009,44 @@ Napi::Value OmniDb::SetLocale(const Napi::CallbackInfo &info)
 
 
 /**
-* ODBCエラー文字列取得
+* セッション初期化SQLを取得します
+*
+* @param[in] value ;区切りのSQL文字列、またはSQLの配列
+* @param[out] statements 初期化SQL
+* @param[out] error エラーメッセージ
+* @return bool 成否
 */
-OString OmniDb::ErrorMessage(const OString &api, SQLRETURN retcode, SQLSMALLINT handleType, SQLHANDLE hError)
+bool OmniDb::ToSessionScript(Napi::Value value, std::vector<OString> &statements, OString &error)
 {
-  OString sqlmsg;
-
-  //
-  // SQLメッセージが取得できるやつだけ取得
-  //
-  if(retcode == SQL_ERROR) {
-    // メッセージ数取得
-    SQLLEN numRecs = 0;
-    SQLGetDiagField(handleType, hError, 0, SQL_DIAG_NUMBER, &numRecs, 0, 0);
-
-    // 全メッセージ取得
-    SQLTCHAR state[32], odbcmsg[SQL_MAX_MESSAGE_LENGTH];
-    SQLSMALLINT msgLen;
-    SQLINTEGER  native;
-    SQLSMALLINT recNo = 1;
-    while(
-      recNo <= numRecs &&
-      (SQLGetDiagRec(
-        handleType, hError, recNo, state, &native,  
-        odbcmsg, sizeof(odbcmsg), &msgLen) != SQL_NO_DATA)) {
-      if (sqlmsg.length() > 0) {
-        sqlmsg += _O(", ");
+  statements.clear();
+  if(value.IsString()) {
+    std::unique_ptr<SQLTCHAR[]> script(OmniDb::NapiStringToSQLTCHAR(value.As<Napi::String>()));
+    statements = SplitSqlScript(_S2O(script.get()));
+    return true;
+  }
+  if(value.IsArray()) {
+    Napi::Array array = value.As<Napi::Array>();
+    for(uint32_t i = 0; i < array.Length(); i++) {
+      if(!array.Get(i).IsString()) {
+        error = _O("初期化SQLは文字列の配列で指定してください");
+        return false;
       }
-
-      OString p = _O("[ODBC-ERROR]");
-      p += _S2O(odbcmsg);
-      p += _O("(API:");
-      p += api;
-      p += _O(", STATE:");
-      p += _S2O(state);
-      p += _O(", NATIVE:");
-      p += to_ostring(native);
-      p += _O(")");
-      sqlmsg += p;
-      recNo++;
+      std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(array.Get(i).As<Napi::String>()));
+      statements.push_back(_S2O(sql.get()));
     }
+    return true;
   }
-  
-  OString res;
-  if(sqlmsg.length() > 0) {
-    res += sqlmsg;
-  } else {
-    res += api + _O("エラー (CODE:") + to_ostring(retcode) + _O(")");
-  }
-  return res;
+  error = _O("初期化SQLは文字列または文字列の配列で指定してください");
+  return false;
+}
+
+
+/**
+* ODBCエラー文字列取得
+*/
+OString OmniDb::ErrorMessage(const OString &api, SQLRETURN retcode, SQLSMALLINT handleType, SQLHANDLE hError)
+{
+  return OdbcErrorMessage(api, retcode, handleType, hError);
 }
 
 
@@ -1077,16 +2076,7 @@ Napi::Error OmniDb::CreateError(napi_env env, const OString &msg)
 */
 OString OmniDb::GetTypeName(SQLSMALLINT type)
 {
-  OString result = OString(_O(""));
-
-  int numType = sizeof(SQLTYPENAMES) / sizeof(SQLTYPENAME);
-  for(int i = 0; i < numType; i++) {
-    if(SQLTYPENAMES[i].type == type) {
-        result = _S2O(SQLTYPENAMES[i].name);
-        break;
-    }
-  }
-  return result;
+  return _S2O(SqlTypeName(type));
 }
 
 
@@ -1098,16 +2088,7 @@ OString OmniDb::GetTypeName(SQLSMALLINT type)
 */
 OString OmniDb::GetTypeClassName(SQLSMALLINT type)
 {
-  OString result = OString(_O(""));
-
-  int numType = sizeof(SQLTYPENAMES) / sizeof(SQLTYPENAME);
-  for(int i = 0; i < numType; i++) {
-    if(SQLTYPENAMES[i].type == type) {
-        result = _S2O(SQLTYPENAMES[i].className);
-        break;
-    }
-  }
-  return result;
+  return _S2O(SqlTypeClassName(type));
 }
 
 
@@ -1135,6 +2116,116 @@ SQLTCHAR* OmniDb::NapiStringToSQLTCHAR(Napi::String string)
 }
 
 
+/**
+* 行セットの取得のオプションを取得します
+*
+*   options.batchRows    1回に取得する行数、または'auto'(時間とバイト数を測って自動調整)
+*   options.fetchLatency 自動調整の1回の取得の目標時間(ミリ秒)
+*   options.fetchMemory  行セットの上限(バイト、領域と取得した値をJSONにした目安)
+*
+* @param[in] options オプション
+* @param[in,out] batchRows 1回に取得する行数(指定が無ければそのまま)
+* @param[out] tuning 自動調整の設定
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool OmniDb::ToFetchTuning(Napi::Object options, size_t &batchRows, FetchTuning &tuning, OString &error)
+{
+  if(options.Has("batchRows")) {
+    Napi::Value v = options.Get("batchRows");
+    if(v.IsString() && v.As<Napi::String>().Utf8Value() == "auto") {
+      tuning.adaptive = true;
+    } else if(v.IsNumber()) {
+      double d = v.As<Napi::Number>().DoubleValue();
+      batchRows = d < 1 ? 1 : (size_t)d;
+    } else if(!v.IsUndefined() && !v.IsNull()) {
+      error = _O("batchRowsは行数または'auto'で指定してください");
+      return false;
+    }
+  }
+  if(options.Has("fetchLatency") && options.Get("fetchLatency").IsNumber()) {
+    double d = options.Get("fetchLatency").As<Napi::Number>().DoubleValue();
+    tuning.targetMillis = d < 1 ? 1 : (uint32_t)d;
+  }
+  if(options.Has("fetchMemory") && options.Get("fetchMemory").IsNumber()) {
+    double d = options.Get("fetchMemory").As<Napi::Number>().DoubleValue();
+    tuning.maxBytes = d < 0 ? 0 : (size_t)d;
+  }
+  return true;
+}
+
+
+/**
+* NAPIの文字列をアリーナのSQLTCHAR文字列に変換します
+*
+* 一時的な文字列を作らずにアリーナへ直接取り出します。
+*
+* @param[in] string NAPI文字列
+* @param[in] arena アリーナ(文字列は破棄まで有効)
+* @return SQLTCHAR* 文字列(確保できなければNULL)
+*/
+SQLTCHAR* OmniDb::NapiStringToSQLTCHAR(Napi::String string, CallArena &arena)
+{
+  size_t length = 0;
+
+  #ifdef UNICODE
+  napi_get_value_string_utf16(string.Env(), string, NULL, 0, &length);
+  char16_t *sqlString = (char16_t *)arena.Allocate((length + 1) * sizeof(char16_t), sizeof(char16_t));
+  if(sqlString) {
+    napi_get_value_string_utf16(string.Env(), string, sqlString, length + 1, &length);
+  }
+  #else
+  napi_get_value_string_utf8(string.Env(), string, NULL, 0, &length);
+  char *sqlString = (char *)arena.Allocate(length + 1, 1);
+  if(sqlString) {
+    napi_get_value_string_utf8(string.Env(), string, sqlString, length + 1, &length);
+  }
+  #endif
+  return (SQLTCHAR *)sqlString;
+}
+
+
+/**
+* tables()/columns()の取得条件をキャッシュの検索条件に変換します
+*
+* @param[in] env Node.js環境
+* @param[in] info Node.jsパラメータ(info[0]が取得条件)
+* @param[out] filter 検索条件
+* @return bool 成否(失敗時は例外設定済み)
+*/
+bool OmniDb::ToCatalogFilter(Napi::Env env, const Napi::CallbackInfo& info, CatalogFilter &filter)
+{
+  if(info.Length() < 1 || info[0].IsUndefined() || info[0].IsNull()) {
+    return true;
+  }
+  if(!info[0].IsObject()) {
+    CreateTypeError(
+      env,
+      OString(_O("condition はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return false;
+  }
+
+  Napi::Object condition = info[0].As<Napi::Object>();
+  if(condition.Has("catalog")) {
+    filter.catalog = condition.Get("catalog").ToString().Utf8Value();
+  }
+  if(condition.Has("schema")) {
+    filter.schema = condition.Get("schema").ToString().Utf8Value();
+  }
+  if(condition.Has("table")) {
+    filter.table = condition.Get("table").ToString().Utf8Value();
+  }
+  if(condition.Has("column")) {
+    filter.column = condition.Get("column").ToString().Utf8Value();
+  }
+  if(condition.Has("tableType")) {
+    filter.tableType = condition.Get("tableType").ToString().Utf8Value();
+  }
+  return true;
+}
+
+
 /**
 * NAPIの文字列がブランクかを調査します
 *
@@ -1147,6 +2238,122 @@ bool OmniDb::IsBlank(Napi::String v)
 }
 
 
+/**
+* 行セット領域のプールの統計を取得します
+*
+* @param[in] info NAPIの引数
+* @return Napi::Value 統計(JSON文字列)
+*/
+static Napi::Value BufferStats(const Napi::CallbackInfo& info) {
+  BufferPoolStats stats = BufferPool::Shared().Stats();
+  json result = json::object();
+  result["cachedBytes"] = stats.cachedBytes;
+  result["inUseBytes"] = stats.inUseBytes;
+  result["highWaterBytes"] = stats.highWaterBytes;
+  result["allocated"] = stats.allocated;
+  result["reused"] = stats.reused;
+  result["trimmed"] = stats.trimmed;
+  result["maxCachedBytes"] = stats.maxCachedBytes;
+  result["idle"] = stats.idleMs;
+  json classes = json::array();
+  for(size_t i = 0; i < stats.classes.size(); i++) {
+    json c = json::object();
+    c["size"] = stats.classes[i].size;
+    c["cached"] = stats.classes[i].cached;
+    c["inUse"] = stats.classes[i].inUse;
+    c["highWater"] = stats.classes[i].highWater;
+    classes.push_back(c);
+  }
+  result["classes"] = classes;
+  return Napi::String::New(info.Env(), result.dump());
+}
+
+
+/**
+* 行セット領域のプールから使われていない領域を解放します
+*
+* @param[in] info NAPIの引数(未使用時間(ミリ秒)、省略時は全て)
+* @return Napi::Value 解放したバイト数
+*/
+static Napi::Value TrimBuffers(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  uint32_t idleMs = 0;
+  if(info.Length() > 0 && !info[0].IsUndefined() && !info[0].IsNull()) {
+    if(!info[0].IsNumber()) {
+      OmniDb::CreateTypeError(env, _O("idleは数値で指定してください")).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    double d = info[0].As<Napi::Number>().DoubleValue();
+    idleMs = d < 0 ? 0 : (uint32_t)d;
+  }
+  return Napi::Number::New(env, (double)BufferPool::Shared().Trim(idleMs));
+}
+
+
+/**
+* 行セット領域のプールの上限を設定します
+*
+* @param[in] info NAPIの引数({maxCachedBytes, idle})
+* @return Napi::Value undefined
+*/
+static Napi::Value SetBufferLimits(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if(info.Length() < 1 || !info[0].IsObject()) {
+    OmniDb::CreateTypeError(env, _O("オプションはオブジェクトで指定してください")).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Object o = info[0].As<Napi::Object>();
+  BufferPoolStats stats = BufferPool::Shared().Stats();
+  size_t maxCachedBytes = stats.maxCachedBytes;
+  uint32_t idleMs = stats.idleMs;
+  if(o.Has("maxCachedBytes") && o.Get("maxCachedBytes").IsNumber()) {
+    double d = o.Get("maxCachedBytes").As<Napi::Number>().DoubleValue();
+    maxCachedBytes = d < 0 ? 0 : (size_t)d;
+  }
+  if(o.Has("idle") && o.Get("idle").IsNumber()) {
+    double d = o.Get("idle").As<Napi::Number>().DoubleValue();
+    idleMs = d < 0 ? 0 : (uint32_t)d;
+  }
+  BufferPool::Shared().SetLimits(maxCachedBytes, idleMs);
+  return env.Undefined();
+}
+
+
+/**
+* 全行の保管(materialize)のメモリ予算と書き出しの統計を取得します
+*
+* @param[in] info NAPIの引数
+* @return Napi::Value 統計(JSON文字列)
+*/
+static Napi::Value SpillStatsJson(const Napi::CallbackInfo& info) {
+  SpillStats stats = MemoryBudget::Shared().Stats();
+  json result = json::object();
+  result["memoryBytes"] = stats.memoryBytes;
+  result["memoryBudget"] = stats.limit;
+  result["spills"] = stats.spills;
+  result["spilledBytes"] = stats.spilledBytes;
+  result["files"] = stats.files;
+  return Napi::String::New(info.Env(), result.dump());
+}
+
+
+/**
+* 全行の保管(materialize)と結果の全行取得のプロセス全体のメモリ予算を設定します
+*
+* @param[in] info NAPIの引数(バイト数)
+* @return Napi::Value undefined
+*/
+static Napi::Value SetMemoryBudget(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if(info.Length() < 1 || !info[0].IsNumber() || info[0].As<Napi::Number>().DoubleValue() < 0) {
+    OmniDb::CreateTypeError(env, _O("メモリ予算は0以上のバイト数で指定してください")).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  MemoryBudget::Shared().SetLimit((size_t)info[0].As<Napi::Number>().DoubleValue());
+  return env.Undefined();
+}
+
+
 /**
 * OmniDbオブジェクトを生成します
 *
@@ -1167,6 +2374,14 @@ Napi::Object CreateObject(const Napi::CallbackInfo& info) {
 */
 Napi::Object InitAll(Napi::Env env, Napi::Object exports) {
   Napi::Object new_exports = Napi::Function::New(env, CreateObject);
+  OmniPool::Init(env, new_exports);
+  OmniLoader::Init(env, new_exports);
+  OmniFederation::Init(env, new_exports);
+  new_exports.Set("bufferStats", Napi::Function::New(env, BufferStats));
+  new_exports.Set("trimBuffers", Napi::Function::New(env, TrimBuffers));
+  new_exports.Set("setBufferLimits", Napi::Function::New(env, SetBufferLimits));
+  new_exports.Set("spillStats", Napi::Function::New(env, SpillStatsJson));
+  new_exports.Set("setMemoryBudget", Napi::Function::New(env, SetMemoryBudget));
   return OmniDb::Init(env, new_exports);
 }
 
@@ -5,67 +5,27 @@
 #include <wchar.h>
 
 #include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
 
 #include <stdlib.h>
 #include <sql.h>
 #include <sqlext.h>
 #include <locale.h>
 
-// Convert a wide Unicode string to an UTF8 string
-
-#ifdef UNICODE
-  //
-  // Windows用(WideChar対応)
-  //
-
-  // OmniDb文字列型
-  typedef std::wstring OString;
-  // OmniDb文字列ストリーム
-  typedef std::wstringstream OStringStream;
-  // 標準出力
-  #define ocout std::wcout
-  // locale設定
-  #define osetlocale(c, l) _wsetlocale((c), (const wchar_t *)l)
-  // 文字列コピー
-  #define ostrcpy(s1,s2) wcscpy((wchar_t *)(s1), (const wchar_t *)(s2))
-  // 数値文字列変換
-  #define to_ostring(s) std::to_wstring((s))
-  // 文字列リテラル
-  #define _O(s) L##s
-  #define _S2O(s) OString((const wchar_t *)(s))
-  // ネイティブ文字列
-  
-  // JSON文字列変換(utf-8に変換)
-  std::string to_jsonstr(const std::wstring &wstr)
-  {
-    // utf-8専用。windowsだと切り替えないと駄目
-    if( wstr.empty() ) return std::string();
-    int size_needed = WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), NULL, 0, NULL, NULL);
-    std::string strTo( size_needed, 0 );
-    WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), &strTo[0], size_needed, NULL, NULL);
-    return strTo;
-  }
-#else
-  //
-  // UNIX用(utf-8ベース)
-  //
-  typedef std::string OString;
-  // OmniDb文字列ストリーム
-  typedef std::stringstream OStringStream;
-  // 標準出力
-  #define ocout std::cout
-  // locale設定
-  #define osetlocale(c, l) setlocale((c), (const char *)l)
-  // 文字列コピー
-  #define ostrcpy(s1,s2) strcpy((char *)(s1), (const char *)(s2))
-  // O数値文字列変換
-  #define to_ostring(s) std::to_string((s))
-  // 文字列リテラル
-  #define _O(s) s
-  #define _S2O(s) OString((const char *)(s))
-  // JSON文字列変換(utf-8に変換) ※何もしない
-  #define to_jsonstr(s) s
-#endif
+#include "omnicommon.h"
+#include "catalogcache.h"
+#include "catalogfetch.h"
+#include "catalogindex.h"
+#include "bulkexec.h"
+#include "procedure.h"
+#include "callarena.h"
+#include "fetcher.h"
+#include "nlohmann/json.hpp"
+
+// 一括実行の既定のバッチ行数
+#define BULK_DEFAULT_BATCH_SIZE 1000
 
 class OmniDb : public Napi::ObjectWrap<OmniDb> {
 public:
@@ -90,39 +50,98 @@ public:
   Napi::Value Columns(const Napi::CallbackInfo& info);
   // SQL情報取得
   Napi::Value Query(const Napi::CallbackInfo& info);
-  // SQL直接実行 ※成否のみ返却
+  // SQL直接実行 ※成否のみ返却(optionsで結果を返す・配列で複数実行)
   Napi::Value Execute(const Napi::CallbackInfo& info);
+  // 配列パラメータで一括実行
+  Napi::Value ExecuteBulk(const Napi::CallbackInfo& info);
+  // ストアドプロシージャ呼び出し
+  Napi::Value Call(const Napi::CallbackInfo& info);
+  // ストアドプロシージャを配列パラメータで一括呼び出し
+  Napi::Value CallBulk(const Napi::CallbackInfo& info);
+  // トランザクション開始
+  Napi::Value Begin(const Napi::CallbackInfo& info);
+  // コミット
+  Napi::Value Commit(const Napi::CallbackInfo& info);
+  // ロールバック
+  Napi::Value Rollback(const Napi::CallbackInfo& info);
+
+  // カタログキャッシュを開く
+  Napi::Value OpenCatalogCache(const Napi::CallbackInfo& info);
+  // カタログキャッシュ更新
+  Napi::Value RefreshCatalogCache(const Napi::CallbackInfo& info);
+  // キャッシュからテーブル情報取得
+  Napi::Value CachedTables(const Napi::CallbackInfo& info);
+  // キャッシュからカラム情報取得
+  Napi::Value CachedColumns(const Napi::CallbackInfo& info);
+  // カタログキャッシュ情報
+  Napi::Value CatalogCacheInfo(const Napi::CallbackInfo& info);
+  // カタログ検索
+  Napi::Value SearchCatalog(const Napi::CallbackInfo& info);
 
   // ロケール設定
   Napi::Value SetLocale(const Napi::CallbackInfo& info);
-private:
-  // 接続ハンドル
-  SQLHDBC m_hOdbc;
-  // ODBC環境
-  SQLHENV m_hEnv;
-
-  // DB切断
-  void _Disconnect();
-
-  // ODBCエラーメッセージ取得
-  OString ErrorMessage(const OString &api, SQLRETURN retcode, SQLSMALLINT handleType, SQLHANDLE hError);
 
   // SQL型名取得
   static OString GetTypeName(SQLSMALLINT type);
   // SQL型属性
   static OString GetTypeClassName(SQLSMALLINT type);
 
+  // パラメータ付きSQLの解析(ワーカースレッドからも使用)
+  static bool DescribeQuery(
+    SQLHDBC hOdbc, SQLTCHAR *queryString, bool supportLabel,
+    std::string &result, OString &error, std::string &sqlState);
+
+  // SQL直接実行(全ての結果をSQLMoreResultsで読み切る、ワーカースレッドからも使用)
+  static bool ExecuteBatch(
+    SQLHDBC hOdbc, SQLTCHAR *sql, bool results, size_t maxRows,
+    nlohmann::json &outcome, OString &error, std::string &sqlState, CancelToken *cancel = NULL);
+
+  // 一括実行の結果→JSON変換
+  static std::string BulkResultToJson(const BulkResult &bulk);
+
+  // ODBCエラーメッセージ取得
+  static OString ErrorMessage(const OString &api, SQLRETURN retcode, SQLSMALLINT handleType, SQLHANDLE hError);
   // 型エラー作成(NAPI)
   static Napi::TypeError CreateTypeError(napi_env env, const OString &msg);
   // エラー作成(NAPI)
   static Napi::Error CreateError(napi_env env, const OString &msg);
+  // NAPI文字列→SQLCHAR変換(new[]で確保、unique_ptr<SQLTCHAR[]>で持つ)
+  static SQLTCHAR* NapiStringToSQLTCHAR(Napi::String string);
+  static SQLTCHAR* NapiStringToSQLTCHAR(Napi::String string, CallArena &arena);
+  // セッション初期化SQL取得(;区切りの文字列または配列)
+  static bool ToSessionScript(Napi::Value value, std::vector<OString> &statements, OString &error);
+  // 行セットの取得のオプション(batchRows・fetchLatency・fetchMemory)
+  static bool ToFetchTuning(Napi::Object options, size_t &batchRows, FetchTuning &tuning, OString &error);
+private:
+  // 接続ハンドル
+  SQLHDBC m_hOdbc;
+  // ODBC環境
+  SQLHENV m_hEnv;
+  // トランザクション中か(自動コミット停止中)
+  bool m_inTransaction;
+  // カタログキャッシュ
+  std::unique_ptr<CatalogCache> m_catalogCache;
+  // カタログ検索インデックス(キャッシュのスナップショットから作成)
+  std::unique_ptr<CatalogIndex> m_catalogIndex;
+  // プロシージャのパラメータ定義(プロシージャ名→定義)
+  std::map<OString, ProcDefinition> m_procedures;
+
+  // DB切断
+  void _Disconnect();
+  // トランザクション終了
+  Napi::Value EndTransaction(const Napi::CallbackInfo& info, SQLSMALLINT completionType);
+
+  // プロシージャのパラメータ定義取得(キャッシュ)
+  const ProcDefinition *GetProcedure(Napi::String procedure, bool refresh, OString &error);
+  // JSの値→プロシージャのパラメータ設定
+  static void SetProcValue(ProcCall &call, size_t index, Napi::Value value);
+
+  // 取得条件→キャッシュ検索条件変換
+  static bool ToCatalogFilter(Napi::Env env, const Napi::CallbackInfo& info, CatalogFilter &filter);
 
   // 空文字列判定
   static bool IsBlank(Napi::String v);
 
-  // NAPI文字列→SQLCHAR変換
-  static SQLTCHAR* NapiStringToSQLTCHAR(Napi::String string);
-
   // 左空白削除
   static OString leftTrim(const OString& str)
   {
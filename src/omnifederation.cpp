@@ -0,0 +1,469 @@
+﻿#include "omnifederation.h"
+#include "omnidb.h"
+#include "fetcher.h"
+
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// 既定の接続先ごとの最大接続数
+#define FEDERATION_DEFAULT_MAX 2
+// 既定の接続待ち上限(ミリ秒)
+#define FEDERATION_DEFAULT_ACQUIRE_TIMEOUT 30000
+
+
+/**
+* オプションの数値を取得します(無ければ既定値)
+*/
+static uint32_t GetUint32Option(Napi::Object options, const char *name, uint32_t def)
+{
+  if(!options.Has(name)) {
+    return def;
+  }
+  Napi::Value v = options.Get(name);
+  if(!v.IsNumber()) {
+    return def;
+  }
+  double d = v.As<Napi::Number>().DoubleValue();
+  return d < 0 ? 0 : (uint32_t)d;
+}
+
+
+/**
+* 列の指定(列名の文字列または列番号)を文字列で取得します
+*
+* @param[in] value 列の指定
+* @param[out] name 列名(列番号は"#番号")
+* @return bool 成否
+*/
+static bool GetColumnName(Napi::Value value, OString &name)
+{
+  if(value.IsString()) {
+    std::unique_ptr<SQLTCHAR[]> s(OmniDb::NapiStringToSQLTCHAR(value.As<Napi::String>()));
+    name = _S2O(s.get());
+    return true;
+  }
+  if(value.IsNumber()) {
+    name = _O("#") + to_ostring(value.As<Napi::Number>().Uint32Value());
+    return true;
+  }
+  return false;
+}
+
+
+/**
+* 列名・列番号を列番号にします
+*
+* @param[in] columns 列名の一覧
+* @param[in] name 列名(列番号は"#番号")
+* @param[out] index 列番号
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+static bool ColumnIndex(const json &columns, const OString &name, size_t &index, OString &error)
+{
+  if(!name.empty() && name[0] == _O('#')) {
+    index = (size_t)std::stoul(name.substr(1));
+    if(index < columns.size()) {
+      return true;
+    }
+  } else {
+    for(size_t c = 0; c < columns.size(); c++) {
+      if(columns[c].is_string() && columns[c].get_ref<const std::string &>() == to_jsonstr(name)) {
+        index = c;
+        return true;
+      }
+    }
+  }
+  error = _O("結果に無い列が指定されました: ") + name;
+  return false;
+}
+
+
+//
+// query(merge)の指定(列名は最初の接続先の結果で列番号にする)
+//
+struct MergeSpec {
+  enum Mode { CONCAT, ORDERED, AGGREGATE } mode;
+  // orderedのキー
+  std::vector<OString> orderBy;
+  std::vector<bool> desc;
+  // aggregateのグループキーと集計値の列
+  std::vector<OString> groupBy;
+  std::vector<std::pair<OString, StreamAggregate> > aggregates;
+
+  // マージしたストリームを作ります(ワーカースレッド)
+  ResultStream *Build(std::vector<std::unique_ptr<ResultStream> > &sources, const json &columns, OString &error)
+  {
+    // 列の型(整数・DECIMALは数値として比較・合計する)
+    std::vector<SQLSMALLINT> types;
+    if(mode != CONCAT && !sources.empty() && !sources[0]->ColumnTypes(types, error)) {
+      return NULL;
+    }
+    struct Kind {
+      static StreamValueKind Of(const std::vector<SQLSMALLINT> &types, size_t column)
+      {
+        return column < types.size() ? StreamValueKindOf(types[column]) : STREAM_VALUE_OTHER;
+      }
+    };
+    if(mode == ORDERED) {
+      std::vector<StreamSortKey> keys;
+      for(size_t k = 0; k < orderBy.size(); k++) {
+        StreamSortKey key;
+        if(!ColumnIndex(columns, orderBy[k], key.column, error)) {
+          return NULL;
+        }
+        key.desc = desc[k];
+        key.kind = Kind::Of(types, key.column);
+        // 接続先は照合順序(EBCDIC等)で並べるため、バイト順のマージでは順序が崩れる
+        if(key.kind == STREAM_VALUE_CHAR) {
+          error = _O("文字列の列はorderedのキーにできません(接続先の照合順序とバイト順が異なるため): ") + orderBy[k];
+          return NULL;
+        }
+        keys.push_back(key);
+      }
+      return new MergeStream(sources, keys);
+    }
+    if(mode == AGGREGATE) {
+      std::vector<StreamSortKey> keys;
+      for(size_t g = 0; g < groupBy.size(); g++) {
+        StreamSortKey key;
+        if(!ColumnIndex(columns, groupBy[g], key.column, error)) {
+          return NULL;
+        }
+        key.desc = false;
+        key.kind = Kind::Of(types, key.column);
+        keys.push_back(key);
+      }
+      std::vector<StreamAggregateSpec> specs;
+      for(size_t a = 0; a < aggregates.size(); a++) {
+        StreamAggregateSpec spec;
+        if(!ColumnIndex(columns, aggregates[a].first, spec.column, error)) {
+          return NULL;
+        }
+        spec.fn = aggregates[a].second;
+        spec.kind = Kind::Of(types, spec.column);
+        specs.push_back(spec);
+      }
+      return new AggregateStream(sources, keys, specs);
+    }
+    return new ConcatStream(sources);
+  }
+};
+
+
+/**
+* 並列クエリモジュール初期化
+*
+* @param[in] env Node.js環境
+* @param[in] exports 公開オブジェクト登録先
+* @return Napi::Object 公開オブジェクト
+*/
+Napi::Object OmniFederation::Init(Napi::Env env, Napi::Object exports)
+{
+  Napi::Function func = DefineClass(
+    env, "federation", {
+      InstanceMethod("query", &OmniFederation::Query),
+      InstanceMethod("fetch", &OmniFederation::Fetch),
+      InstanceMethod("closeCursor", &OmniFederation::CloseCursor),
+      InstanceMethod("stats", &OmniFederation::Stats),
+      InstanceMethod("close", &OmniFederation::Close),
+  });
+
+  exports.Set("federation", func);
+  return exports;
+}
+
+
+/**
+* コンストラクタ
+*
+* new federation(connectionStrings, options)
+*   options.max            接続先ごとの最大接続数(同時に開けるカーソル数)
+*   options.acquireTimeout 接続待ちの上限(ミリ秒)
+*   options.init           全接続で接続直後に実行するSQL(;区切りの文字列または配列)
+*   options.loginTimeout   ログインタイムアウト(秒)
+*/
+OmniFederation::OmniFederation(const Napi::CallbackInfo &info) : Napi::ObjectWrap<OmniFederation>(info)
+{
+  Napi::Env env = info.Env();
+  m_acquireTimeout = FEDERATION_DEFAULT_ACQUIRE_TIMEOUT;
+  m_queries = 0;
+  m_closed = false;
+
+  if(info.Length() < 1 || !info[0].IsArray() || info[0].As<Napi::Array>().Length() == 0) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("federation(connectionStrings, options) connectionStringsは接続文字列の配列で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return;
+  }
+  uint32_t max = FEDERATION_DEFAULT_MAX;
+  uint32_t loginTimeout = 0;
+  std::vector<OString> init;
+  OString error;
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    max = GetUint32Option(options, "max", max);
+    m_acquireTimeout = GetUint32Option(options, "acquireTimeout", m_acquireTimeout);
+    loginTimeout = GetUint32Option(options, "loginTimeout", loginTimeout);
+    if(options.Has("init") && !OmniDb::ToSessionScript(options.Get("init"), init, error)) {
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return;
+    }
+  }
+  if(max == 0) {
+    max = 1;
+  }
+
+  Napi::Array list = info[0].As<Napi::Array>();
+  for(uint32_t i = 0; i < list.Length(); i++) {
+    if(!list.Get(i).IsString()) {
+      OmniDb::CreateTypeError(
+        env,
+        OString(_O("connectionStringsは接続文字列の配列で指定してください"))
+      ).ThrowAsJavaScriptException();
+      return;
+    }
+    std::unique_ptr<SQLTCHAR[]> connectionString(OmniDb::NapiStringToSQLTCHAR(list.Get(i).As<Napi::String>()));
+    std::unique_ptr<ConnectionPool> pool(new ConnectionPool());
+    if(!pool->Init(_S2O(connectionString.get()), max, init, error)) {
+      OmniDb::CreateError(env, error).ThrowAsJavaScriptException();
+      return;
+    }
+    pool->SetLoginTimeout(loginTimeout);
+    m_pools.push_back(std::move(pool));
+  }
+
+  // fetchとカーソルの解放(接続先ごとの取得は各ストリームのスレッド)
+  m_executor.reset(new Executor(max));
+  m_bridge.Init(env, this, "omnidb.federation");
+  m_cursors.Init(m_executor.get(), &m_bridge);
+}
+
+
+/**
+* デストラクタ
+*/
+OmniFederation::~OmniFederation()
+{
+  // 取得スレッドを止めてからワーカースレッドを待つ
+  m_cursors.CancelAll();
+  if(m_executor) {
+    m_executor->Shutdown();
+  }
+  m_cursors.Clear();
+  for(size_t i = 0; i < m_pools.size(); i++) {
+    m_pools[i]->Close();
+  }
+  m_bridge.Release();
+}
+
+
+/**
+* 全接続先で実行してカーソルを開きます
+*
+* 接続先ごとの最初の結果セットだけを読みます。aggregateは各接続先が
+* グループごとの部分集計(SUM・COUNT・MIN・MAX)を返すSQLを想定しています。
+* 整数・DECIMALの列は丸めずに合計・比較します。orderedのキーに文字列の列は
+* 使えません(接続先の照合順序とマージのバイト順が異なるため)。
+*
+* @param[in] info Node.jsパラメータ(sql, options)
+*   options.merge     'concat'(既定)・'ordered'・'aggregate'
+*   options.orderBy   orderedのキー(列名・列番号、または{column, desc}の配列)
+*   options.groupBy   aggregateのグループキー(列名・列番号の配列)
+*   options.aggregates aggregateの列と結合方法({列名: 'sum'|'count'|'min'|'max'})
+*   options.batchRows 接続先ごとに1回で取得する行数('auto'は取得時間から自動調整)
+*   options.fetchLatency 自動調整の1回の取得の目標時間(ミリ秒)
+*   options.fetchMemory 接続先ごとの行セット領域の上限(バイト)
+* @return Napi::Value カーソル番号
+*/
+Napi::Value OmniFederation::Query(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() < 1 || !info[0].IsString()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("query(sql, options) sqlは文字列で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("並列クエリは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::shared_ptr<MergeSpec> spec(new MergeSpec());
+  spec->mode = MergeSpec::CONCAT;
+  size_t batchRows = FETCH_DEFAULT_ROWS;
+  FetchTuning tuning;
+  bool valid = true;
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    OString error;
+    if(!OmniDb::ToFetchTuning(options, batchRows, tuning, error)) {
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    if(options.Has("merge") && options.Get("merge").IsString()) {
+      std::string merge = options.Get("merge").As<Napi::String>().Utf8Value();
+      if(merge == "ordered") {
+        spec->mode = MergeSpec::ORDERED;
+      } else if(merge == "aggregate") {
+        spec->mode = MergeSpec::AGGREGATE;
+      } else if(merge != "concat") {
+        valid = false;
+      }
+    }
+    if(valid && options.Has("orderBy") && options.Get("orderBy").IsArray()) {
+      Napi::Array keys = options.Get("orderBy").As<Napi::Array>();
+      for(uint32_t i = 0; valid && i < keys.Length(); i++) {
+        Napi::Value key = keys.Get(i);
+        OString name;
+        bool desc = false;
+        if(key.IsObject() && !key.IsArray()) {
+          Napi::Object o = key.As<Napi::Object>();
+          desc = o.Has("desc") && o.Get("desc").ToBoolean();
+          key = o.Get("column");
+        }
+        valid = GetColumnName(key, name);
+        spec->orderBy.push_back(name);
+        spec->desc.push_back(desc);
+      }
+    }
+    if(valid && options.Has("groupBy") && options.Get("groupBy").IsArray()) {
+      Napi::Array keys = options.Get("groupBy").As<Napi::Array>();
+      for(uint32_t i = 0; valid && i < keys.Length(); i++) {
+        OString name;
+        valid = GetColumnName(keys.Get(i), name);
+        spec->groupBy.push_back(name);
+      }
+    }
+    if(valid && options.Has("aggregates") && options.Get("aggregates").IsObject()) {
+      Napi::Object aggregates = options.Get("aggregates").As<Napi::Object>();
+      Napi::Array names = aggregates.GetPropertyNames();
+      for(uint32_t i = 0; valid && i < names.Length(); i++) {
+        OString name;
+        GetColumnName(names.Get(i).ToString(), name);
+        Napi::Value fn = aggregates.Get(names.Get(i).ToString().Utf8Value());
+        std::string f = fn.IsString() ? fn.As<Napi::String>().Utf8Value() : std::string();
+        // 部分COUNTの結合は合計
+        if(f == "sum" || f == "count") {
+          spec->aggregates.push_back(std::make_pair(name, STREAM_AGG_SUM));
+        } else if(f == "min") {
+          spec->aggregates.push_back(std::make_pair(name, STREAM_AGG_MIN));
+        } else if(f == "max") {
+          spec->aggregates.push_back(std::make_pair(name, STREAM_AGG_MAX));
+        } else {
+          valid = false;
+        }
+      }
+    }
+  }
+  if(valid && spec->mode == MergeSpec::ORDERED && spec->orderBy.empty()) {
+    valid = false;
+  }
+  if(!valid) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("mergeは'concat'・'ordered'(orderBy必須)・'aggregate'(aggregatesは'sum'|'count'|'min'|'max')で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // 全接続先で並列に実行開始
+  std::shared_ptr<StreamCursor> cursor(new StreamCursor());
+  std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(info[0].As<Napi::String>()));
+  OString statement = _S2O(sql.get());
+  for(size_t i = 0; i < m_pools.size(); i++) {
+    std::unique_ptr<QueryStream> stream(new QueryStream(*m_pools[i], statement, NULL, m_acquireTimeout, batchRows));
+    stream->SetTuning(tuning);
+    stream->Start();
+    cursor->sources.push_back(std::unique_ptr<ResultStream>(stream.release()));
+  }
+  cursor->merge = [spec](std::vector<std::unique_ptr<ResultStream> > &sources, const json &columns, OString &error) {
+    return spec->Build(sources, columns, error);
+  };
+
+  uint32_t id = m_cursors.Add(cursor);
+  m_queries++;
+  return Napi::Number::New(env, id);
+}
+
+
+/**
+* カーソルから行を取得します
+*
+* @param[in] info Node.jsパラメータ(cursor, rows)
+* @return Napi::Value {columns, rows, done}(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniFederation::Fetch(const Napi::CallbackInfo &info)
+{
+  return m_cursors.Fetch(info);
+}
+
+
+/**
+* カーソルを閉じます(読み残した結果は取得を取り消す)
+*
+* @param[in] info Node.jsパラメータ(cursor)
+* @return Napi::Value 閉じたか
+*/
+Napi::Value OmniFederation::CloseCursor(const Napi::CallbackInfo &info)
+{
+  return m_cursors.Close(info);
+}
+
+
+/**
+* 統計を取得します
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 統計(JSON形式の文字列)
+*/
+Napi::Value OmniFederation::Stats(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  json result = json::object();
+  result["queries"] = m_queries;
+  result["rows"] = m_cursors.Rows();
+  result["cursors"] = m_cursors.Size();
+  result["inFlight"] = m_bridge.Pending();
+  json sources = json::array();
+  for(size_t i = 0; i < m_pools.size(); i++) {
+    ConnectionPoolStats ps = m_pools[i]->Stats();
+    json source = json::object();
+    source["total"] = ps.total;
+    source["idle"] = ps.idle;
+    source["waiting"] = ps.waiting;
+    source["timeouts"] = ps.timeouts;
+    source["fetches"] = ps.fetches;
+    source["fetchRows"] = ps.fetchRows;
+    source["fetchBytes"] = ps.fetchBytes;
+    source["fetchMillis"] = ps.fetchMicros / 1000;
+    sources.push_back(source);
+  }
+  result["sources"] = sources;
+  return Napi::String::New(env, result.dump());
+}
+
+
+/**
+* 閉じます(開いているカーソルを全て閉じ、空き接続を切断)
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 成否
+*/
+Napi::Value OmniFederation::Close(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  m_closed = true;
+  m_cursors.CloseAll();
+  for(size_t i = 0; i < m_pools.size(); i++) {
+    m_pools[i]->Close();
+  }
+  return Napi::Boolean::New(env, true);
+}
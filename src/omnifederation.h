@@ -0,0 +1,59 @@
+﻿#ifndef _OMNIFEDERATION_H
+#define _OMNIFEDERATION_H
+#include <napi.h>
+
+#include <memory>
+#include <vector>
+
+#include "omnicommon.h"
+#include "connpool.h"
+#include "executor.h"
+#include "asyncbridge.h"
+#include "resultstream.h"
+#include "cursortable.h"
+
+//
+// 複数接続先への並列クエリ(Node.js公開クラス)
+//
+// 同じSQLを全接続先で並列に実行し、結果をネイティブでマージして1つの
+// カーソルとして返します。マージは連結(concat)・キー順のマージ(ordered)・
+// 部分集計の結合(aggregate)のいずれかです。接続先ごとの取得は専用の
+// スレッドで先読みし、fetchの処理はExecutorのワーカースレッドで行います。
+//
+class OmniFederation : public Napi::ObjectWrap<OmniFederation> {
+public:
+  // 初期化
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+  OmniFederation(const Napi::CallbackInfo& info);
+  ~OmniFederation() override;
+
+  // 全接続先で実行してカーソルを開く
+  Napi::Value Query(const Napi::CallbackInfo& info);
+  // カーソルから行を取得
+  Napi::Value Fetch(const Napi::CallbackInfo& info);
+  // カーソルを閉じる
+  Napi::Value CloseCursor(const Napi::CallbackInfo& info);
+  // 統計
+  Napi::Value Stats(const Napi::CallbackInfo& info);
+  // 閉じる
+  Napi::Value Close(const Napi::CallbackInfo& info);
+
+private:
+  // 接続先ごとの接続プール
+  std::vector<std::unique_ptr<ConnectionPool> > m_pools;
+  // ワーカースレッド
+  std::unique_ptr<Executor> m_executor;
+  // 完了通知
+  AsyncBridge m_bridge;
+  // 開いているカーソル
+  CursorTable m_cursors;
+  // 接続待ちの上限(ミリ秒)
+  uint32_t m_acquireTimeout;
+  // 統計(JSスレッドのみ)
+  uint64_t m_queries;
+  // 閉じたか
+  bool m_closed;
+};
+
+#endif
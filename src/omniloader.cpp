@@ -0,0 +1,604 @@
+﻿#include "omniloader.h"
+#include "omnidb.h"
+
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// 既定のスロット数(実行中+変換中)
+#define LOADER_DEFAULT_DEPTH 2
+// 結果に残すエラーの最大数
+#define LOADER_MAX_ERRORS 100
+
+
+/**
+* ローダーモジュール初期化
+*
+* @param[in] env Node.js環境
+* @param[in] exports 公開オブジェクト登録先
+* @return Napi::Object 公開オブジェクト
+*/
+Napi::Object OmniLoader::Init(Napi::Env env, Napi::Object exports)
+{
+  Napi::Function func = DefineClass(
+    env, "loader", {
+      InstanceMethod("add", &OmniLoader::Add),
+      InstanceMethod("finish", &OmniLoader::Finish),
+      InstanceMethod("stats", &OmniLoader::Stats),
+      InstanceMethod("close", &OmniLoader::Close),
+  });
+
+  exports.Set("loader", func);
+  return exports;
+}
+
+
+/**
+* コンストラクタ(接続・SQL準備)
+*
+* new loader(connectionString, sql, options)
+*   options.batchSize      1回に実行する行数(SQL_ATTR_PARAMSET_SIZE)
+*   options.commitInterval コミットする行数の間隔(0は自動コミット)
+*   options.depth          スロット数(2以上、実行待ちにできるバッチ数+1)
+*   options.stopOnError    失敗したバッチで中止するか(既定はtrue)
+*   options.init           接続直後に実行するSQL(;区切りの文字列または配列)
+*/
+OmniLoader::OmniLoader(const Napi::CallbackInfo &info) : Napi::ObjectWrap<OmniLoader>(info)
+{
+  Napi::Env env = info.Env();
+  SQLRETURN ret;
+
+  m_hEnv = NULL;
+  m_hdbc = NULL;
+  m_batchSize = BULK_DEFAULT_BATCH_SIZE;
+  m_commitInterval = 0;
+  m_stopOnError = true;
+  m_uncommitted = 0;
+  m_abort = false;
+  m_submitted = 0;
+  m_inFlight = 0;
+  m_rows = 0;
+  m_batches = 0;
+  m_affected = 0;
+  m_failedRows = 0;
+  m_commits = 0;
+  m_started = false;
+  m_failed = false;
+  m_finishing = false;
+  m_finished = false;
+  m_closed = false;
+
+  //
+  // パラメータチェック
+  //
+  if(info.Length() < 2 || !info[0].IsString() || !info[1].IsString()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("loader(connectionString, sql, options) connectionString, sqlは文字列で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return;
+  }
+  size_t depth = LOADER_DEFAULT_DEPTH;
+  std::vector<OString> init;
+  if(info.Length() >= 3 && info[2].IsObject()) {
+    Napi::Object options = info[2].As<Napi::Object>();
+    if(options.Has("batchSize") && options.Get("batchSize").IsNumber()) {
+      double n = options.Get("batchSize").As<Napi::Number>().DoubleValue();
+      m_batchSize = n >= 1 ? (size_t)n : 1;
+    }
+    if(options.Has("commitInterval") && options.Get("commitInterval").IsNumber()) {
+      double n = options.Get("commitInterval").As<Napi::Number>().DoubleValue();
+      m_commitInterval = n >= 1 ? (size_t)n : 0;
+    }
+    if(options.Has("depth") && options.Get("depth").IsNumber()) {
+      double n = options.Get("depth").As<Napi::Number>().DoubleValue();
+      depth = n >= 2 ? (size_t)n : 2;
+    }
+    if(options.Has("stopOnError")) {
+      m_stopOnError = options.Get("stopOnError").ToBoolean();
+    }
+    OString error;
+    if(options.Has("init") && !OmniDb::ToSessionScript(options.Get("init"), init, error)) {
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return;
+    }
+  }
+
+  //
+  // 接続(ワーカースレッド専用)
+  //
+  if(!SQL_SUCCEEDED(ret = SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &m_hEnv))) {
+    m_hEnv = NULL;
+    OmniDb::CreateError(env, OString(_O("SQLAllocHandle(ENV)に失敗しました"))).ThrowAsJavaScriptException();
+    return;
+  }
+  SQLSetEnvAttr(m_hEnv, SQL_ATTR_ODBC_VERSION, (SQLPOINTER)SQL_OV_ODBC3, SQL_IS_UINTEGER);
+  if(!SQL_SUCCEEDED(ret = SQLAllocHandle(SQL_HANDLE_DBC, m_hEnv, &m_hdbc))) {
+    m_hdbc = NULL;
+    OmniDb::CreateError(
+      env, OmniDb::ErrorMessage(_O("SQLAllocHandle"), ret, SQL_HANDLE_ENV, m_hEnv)
+    ).ThrowAsJavaScriptException();
+    return;
+  }
+  std::unique_ptr<SQLTCHAR[]> connectionString(OmniDb::NapiStringToSQLTCHAR(info[0].As<Napi::String>()));
+  ret = SQLDriverConnect(
+    m_hdbc, NULL, connectionString.get(), SQL_NTS, NULL, 0, NULL, SQL_DRIVER_NOPROMPT);
+  if(!SQL_SUCCEEDED(ret)) {
+    OmniDb::CreateError(
+      env, OmniDb::ErrorMessage(_O("SQLDriverConnect"), ret, SQL_HANDLE_DBC, m_hdbc)
+    ).ThrowAsJavaScriptException();
+    SQLFreeHandle(SQL_HANDLE_DBC, m_hdbc);
+    m_hdbc = NULL;
+    return;
+  }
+  OString initError;
+  if(!RunSessionScript(m_hdbc, init, initError)) {
+    OmniDb::CreateError(env, initError).ThrowAsJavaScriptException();
+    Disconnect();
+    return;
+  }
+  if(m_commitInterval > 0) {
+    SQLSetConnectAttr(m_hdbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_OFF, SQL_IS_UINTEGER);
+  }
+
+  //
+  // SQL準備
+  //
+  std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(info[1].As<Napi::String>()));
+  OString error;
+  if(!m_stmt.Prepare(m_hdbc, sql.get(), error)) {
+    OmniDb::CreateError(env, error).ThrowAsJavaScriptException();
+    Disconnect();
+    return;
+  }
+  m_stmt.DescribeParams(m_types);
+
+  for(size_t i = 0; i < depth; i++) {
+    m_slots.push_back(std::unique_ptr<Slot>(new Slot()));
+    m_free.push_back(depth - 1 - i);
+  }
+  m_executor.reset(new Executor(1));
+  m_bridge.Init(env, this, "omnidb.loader");
+}
+
+
+/**
+* デストラクタ
+*/
+OmniLoader::~OmniLoader()
+{
+  if(m_executor) {
+    m_executor->Shutdown();
+  }
+  m_bridge.Release();
+  for(size_t i = 0; i < m_waiting.size(); i++) {
+    delete m_waiting[i];
+  }
+  m_waiting.clear();
+  Disconnect();
+}
+
+
+/**
+* 切断(未コミット分はロールバック)
+*/
+void OmniLoader::Disconnect()
+{
+  m_stmt.Free();
+  if(m_hdbc) {
+    if(m_commitInterval > 0) {
+      SQLEndTran(SQL_HANDLE_DBC, m_hdbc, SQL_ROLLBACK);
+    }
+    SQLDisconnect(m_hdbc);
+    SQLFreeHandle(SQL_HANDLE_DBC, m_hdbc);
+    m_hdbc = NULL;
+  }
+  if(m_hEnv) {
+    SQLFreeHandle(SQL_HANDLE_ENV, m_hEnv);
+    m_hEnv = NULL;
+  }
+}
+
+
+/**
+* JSの値をスロットのパラメータ配列に変換します(JSスレッド)
+*
+* @param[in] columns 列ごとの値
+* @param[in] index スロット番号
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool OmniLoader::Fill(Napi::Value columns, size_t index, OString &error)
+{
+  Slot &slot = *m_slots[index];
+  size_t rows = 0;
+  slot.pins.clear();
+  if(!ToBulkColumns(columns, m_types, slot.columns, slot.pins, rows, error)) {
+    slot.pins.clear();
+    return false;
+  }
+  slot.rows = rows;
+  slot.base = m_submitted;
+  m_submitted += rows;
+  if(!m_started) {
+    m_started = true;
+    m_start = std::chrono::steady_clock::now();
+  }
+  return true;
+}
+
+
+/**
+* スロットをワーカースレッドで実行します
+*
+* @param[in] env Node.js環境
+* @param[in] index スロット番号
+*/
+void OmniLoader::Submit(Napi::Env env, size_t index)
+{
+  m_inFlight++;
+  m_bridge.BeginWork(env);
+  OmniLoader *self = this;
+  m_executor->Submit([self, index]() {
+    self->Run(index);
+    self->m_bridge.Post([self, index](Napi::Env env) { self->Completed(env, index); });
+  });
+}
+
+
+/**
+* スロットの実行(ワーカースレッド)
+*
+* @param[in] index スロット番号
+*/
+void OmniLoader::Run(size_t index)
+{
+  Slot &slot = *m_slots[index];
+  slot.result.Clear();
+  slot.committed = false;
+  slot.commitError.clear();
+  if(m_abort) {
+    return;
+  }
+
+  m_stmt.ExecuteAll(slot.columns, slot.rows, m_batchSize, m_stopOnError, slot.result);
+  bool failed = !slot.result.errors.empty() && m_stopOnError;
+  if(failed) {
+    m_abort = true;
+    return;
+  }
+
+  // commitInterval行ごとにコミット
+  if(m_commitInterval > 0) {
+    m_uncommitted += slot.rows;
+    if(m_uncommitted >= m_commitInterval) {
+      SQLRETURN ret = SQLEndTran(SQL_HANDLE_DBC, m_hdbc, SQL_COMMIT);
+      if(!SQL_SUCCEEDED(ret)) {
+        slot.commitError = OdbcErrorMessage(_O("SQLEndTran"), ret, SQL_HANDLE_DBC, m_hdbc);
+        m_abort = true;
+        return;
+      }
+      slot.committed = true;
+      m_uncommitted = 0;
+    }
+  }
+}
+
+
+/**
+* スロットの完了(JSスレッド)
+*
+* @param[in] env Node.js環境
+* @param[in] index スロット番号
+*/
+void OmniLoader::Completed(Napi::Env env, size_t index)
+{
+  Napi::HandleScope scope(env);
+  Slot &slot = *m_slots[index];
+  m_inFlight--;
+  m_end = std::chrono::steady_clock::now();
+
+  m_rows += slot.result.processed;
+  m_batches += slot.result.batches;
+  m_affected += slot.result.affected;
+  for(size_t i = 0; i < slot.result.status.size(); i++) {
+    if(slot.result.status[i] == SQL_PARAM_ERROR) {
+      m_failedRows++;
+    }
+  }
+  for(size_t i = 0; i < slot.result.errors.size() && m_errors.size() < LOADER_MAX_ERRORS; i++) {
+    BulkBatchError e = slot.result.errors[i];
+    e.offset += slot.base;
+    m_errors.push_back(e);
+  }
+  if(slot.committed) {
+    m_commits++;
+  }
+  if(!m_failed) {
+    if(!slot.commitError.empty()) {
+      m_failed = true;
+      m_error = slot.commitError;
+    } else if(!slot.result.errors.empty() && m_stopOnError) {
+      m_failed = true;
+      m_error = slot.result.errors[0].message;
+    }
+  }
+
+  // 実行し終えたのでJSオブジェクトの参照を外して空きに戻す
+  // (直接バインドしたバッチはここで呼び出し元に領域を返す)
+  if(slot.accepted) {
+    slot.accepted->Resolve(Napi::Boolean::New(env, true));
+    slot.accepted.reset();
+  }
+  slot.pins.clear();
+  m_free.push_back(index);
+
+  if(!m_closed) {
+    Drain(env);
+  }
+  m_bridge.EndWork(env);
+}
+
+
+/**
+* 空きスロットに待ちのバッチを入れます。全バッチが終わっていればコミットします
+*
+* @param[in] env Node.js環境
+*/
+void OmniLoader::Drain(Napi::Env env)
+{
+  while(!m_failed && !m_free.empty() && !m_waiting.empty()) {
+    Waiting *w = m_waiting.front();
+    m_waiting.pop_front();
+    size_t index = m_free.back();
+    m_free.pop_back();
+
+    OString error;
+    if(Fill(w->columns.Value(), index, error)) {
+      if(m_slots[index]->pins.empty()) {
+        w->deferred.Resolve(Napi::Boolean::New(env, true));
+      } else {
+        m_slots[index]->accepted.reset(new Napi::Promise::Deferred(w->deferred));
+      }
+      Submit(env, index);
+    } else {
+      m_free.push_back(index);
+      w->deferred.Reject(OmniDb::CreateTypeError(env, error).Value());
+    }
+    delete w;
+  }
+
+  // 失敗後の待ちは実行しない
+  while(m_failed && !m_waiting.empty()) {
+    Waiting *w = m_waiting.front();
+    m_waiting.pop_front();
+    w->deferred.Reject(OmniDb::CreateError(env, m_error).Value());
+    delete w;
+  }
+
+  if(m_finishing && !m_finished && m_inFlight == 0 && m_waiting.empty()) {
+    SubmitFinish(env);
+  }
+}
+
+
+/**
+* 最後のコミット(失敗していればロールバック)をワーカースレッドで行います
+*
+* 実行前にcloseされた場合はコミットせずにロールバックして拒否します。
+*
+* @param[in] env Node.js環境
+*/
+void OmniLoader::SubmitFinish(Napi::Env env)
+{
+  m_finished = true;
+  m_bridge.BeginWork(env);
+  OmniLoader *self = this;
+  bool failed = m_failed;
+  m_executor->Submit([self, failed]() {
+    OString error;
+    // closeはShutdownで待ち行列のタスクも実行するので、ここで中止を確かめる
+    bool aborted = self->m_abort;
+    if(self->m_commitInterval > 0) {
+      SQLRETURN ret = SQLEndTran(SQL_HANDLE_DBC, self->m_hdbc, (failed || aborted) ? SQL_ROLLBACK : SQL_COMMIT);
+      if(!SQL_SUCCEEDED(ret)) {
+        error = OdbcErrorMessage(_O("SQLEndTran"), ret, SQL_HANDLE_DBC, self->m_hdbc);
+      }
+      self->m_uncommitted = 0;
+    }
+    self->m_bridge.Post([self, failed, aborted, error](Napi::Env env) {
+      Napi::HandleScope scope(env);
+      if(aborted && !failed) {
+        self->m_finish->Reject(OmniDb::CreateError(env, OString(_O("ローダーは中止されました(未コミット分はロールバックしました)"))).Value());
+      } else if(failed) {
+        self->m_finish->Reject(OmniDb::CreateError(env, self->m_error).Value());
+      } else if(!error.empty()) {
+        self->m_finish->Reject(OmniDb::CreateError(env, error).Value());
+      } else {
+        if(self->m_commitInterval > 0) {
+          self->m_commits++;
+        }
+        self->m_finish->Resolve(Napi::String::New(env, self->StatsJson(true)));
+      }
+      self->m_bridge.EndWork(env);
+    });
+  });
+}
+
+
+/**
+* 統計をJSON形式の文字列にします
+*
+* @param[in] summary エラーの一覧を含めるか
+* @return std::string JSON形式の文字列
+*/
+std::string OmniLoader::StatsJson(bool summary)
+{
+  double elapsed = 0;
+  if(m_started) {
+    std::chrono::steady_clock::time_point end =
+      (m_inFlight == 0 && m_waiting.empty()) ? m_end : std::chrono::steady_clock::now();
+    elapsed = std::chrono::duration<double, std::milli>(end - m_start).count();
+    if(elapsed < 0) {
+      elapsed = 0;
+    }
+  }
+
+  json result = json::object();
+  result["rows"] = m_rows;
+  result["submitted"] = m_submitted;
+  result["batches"] = m_batches;
+  result["affected"] = m_affected;
+  result["failed"] = m_failedRows;
+  result["commits"] = m_commits;
+  result["inFlight"] = m_inFlight;
+  result["waiting"] = m_waiting.size();
+  result["depth"] = m_slots.size();
+  result["batchSize"] = m_batchSize;
+  result["commitInterval"] = m_commitInterval;
+  result["elapsedMs"] = elapsed;
+  result["rowsPerSecond"] = elapsed > 0 ? m_rows * 1000.0 / elapsed : 0;
+  if(summary) {
+    json errors = json::array();
+    for(size_t i = 0; i < m_errors.size(); i++) {
+      json e = json::object();
+      e["offset"] = m_errors[i].offset;
+      e["rows"] = m_errors[i].rows;
+      e["message"] = to_jsonstr(m_errors[i].message);
+      e["sqlState"] = m_errors[i].sqlState;
+      errors.push_back(e);
+    }
+    result["errors"] = errors;
+  }
+  return result.dump(-1, ' ', true, json::error_handler_t::replace);
+}
+
+
+/**
+* バッチを追加します
+*
+* 空きスロットがあればすぐに変換して実行を登録し、無ければ空くまで待ちます。
+* TypedArray・固定長バッファをコピーせずにバインドした場合は、ドライバが
+* 読み終わるまで呼び出し元が書き換えないよう、実行し終えてから解決します。
+*
+* @param[in] info Node.jsパラメータ(columns: 列ごとの値の配列)
+* @return Napi::Value 実行を登録したら(直接バインドした場合は実行し終えたら)解決するPromise
+*/
+Napi::Value OmniLoader::Add(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() < 1 || !info[0].IsArray()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("add(columns) columnsは配列で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed || m_finishing) {
+    OmniDb::CreateError(env, OString(_O("ローダーは終了しています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if(m_failed) {
+    Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+    deferred.Reject(OmniDb::CreateError(env, m_error).Value());
+    return deferred.Promise();
+  }
+
+  // 空きスロットがあれば変換してすぐに実行
+  if(!m_free.empty()) {
+    size_t index = m_free.back();
+    m_free.pop_back();
+    OString error;
+    if(!Fill(info[0], index, error)) {
+      m_free.push_back(index);
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+    if(m_slots[index]->pins.empty()) {
+      deferred.Resolve(Napi::Boolean::New(env, true));
+    } else {
+      m_slots[index]->accepted.reset(new Napi::Promise::Deferred(deferred));
+    }
+    Submit(env, index);
+    return deferred.Promise();
+  }
+
+  // 全スロットが実行中なら空くまで待つ
+  Waiting *w = new Waiting(env);
+  w->columns = Napi::Persistent(info[0].As<Napi::Object>());
+  m_waiting.push_back(w);
+  return w->deferred.Promise();
+}
+
+
+/**
+* 全バッチの完了を待ってコミットします
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 集計(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniLoader::Finish(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(m_closed || m_finishing) {
+    OmniDb::CreateError(env, OString(_O("ローダーは終了しています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  m_finishing = true;
+  m_finish.reset(new Napi::Promise::Deferred(Napi::Promise::Deferred::New(env)));
+  Drain(env);
+  return m_finish->Promise();
+}
+
+
+/**
+* 統計
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 統計をJSON形式の文字列で返します
+*/
+Napi::Value OmniLoader::Stats(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+  return Napi::String::New(env, StatsJson(false));
+}
+
+
+/**
+* 中止します(実行中のバッチの終了を待ち、未コミット分はロールバック)
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 成否
+*/
+Napi::Value OmniLoader::Close(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(m_closed) {
+    return Napi::Boolean::New(env, true);
+  }
+  m_closed = true;
+  m_abort = true;
+  while(!m_waiting.empty()) {
+    Waiting *w = m_waiting.front();
+    m_waiting.pop_front();
+    w->deferred.Reject(OmniDb::CreateError(env, OString(_O("ローダーは中止されました"))).Value());
+    delete w;
+  }
+  if(m_executor) {
+    m_executor->Shutdown();
+  }
+  Disconnect();
+  // 実行し終える前に中止した直接バインドのバッチ
+  for(size_t i = 0; i < m_slots.size(); i++) {
+    if(m_slots[i]->accepted) {
+      m_slots[i]->accepted->Reject(OmniDb::CreateError(env, OString(_O("ローダーは中止されました"))).Value());
+      m_slots[i]->accepted.reset();
+    }
+  }
+  return Napi::Boolean::New(env, true);
+}
@@ -0,0 +1,128 @@
+﻿#ifndef _OMNILOADER_H
+#define _OMNILOADER_H
+#include <napi.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "omnicommon.h"
+#include "bulkexec.h"
+#include "bulkparams.h"
+#include "executor.h"
+#include "asyncbridge.h"
+
+//
+// パイプライン一括ローダー(Node.js公開クラス)
+//
+// depth個のパラメータ配列(スロット)を持ち、JSスレッドで次のバッチを
+// 変換している間に前のバッチを専用の接続・ワーカースレッドで実行します。
+//
+class OmniLoader : public Napi::ObjectWrap<OmniLoader> {
+public:
+  // 初期化
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+  OmniLoader(const Napi::CallbackInfo& info);
+  ~OmniLoader() override;
+
+  // バッチ追加
+  Napi::Value Add(const Napi::CallbackInfo& info);
+  // 全バッチの完了を待ってコミット
+  Napi::Value Finish(const Napi::CallbackInfo& info);
+  // 統計
+  Napi::Value Stats(const Napi::CallbackInfo& info);
+  // 中止(未コミット分はロールバック)
+  Napi::Value Close(const Napi::CallbackInfo& info);
+
+private:
+  // パラメータ配列のセット
+  struct Slot {
+    // 列ごとのパラメータ配列(領域は使い回す)
+    std::vector<BulkColumn> columns;
+    // 直接バインドしたJSオブジェクト
+    BulkPins pins;
+    // 直接バインドしたバッチのadd()のPromise(実行し終えたら解決する)
+    std::unique_ptr<Napi::Promise::Deferred> accepted;
+    // 先頭行(ローダー全体での行番号)
+    size_t base;
+    // 行数
+    size_t rows;
+    // 実行結果
+    BulkResult result;
+    // このバッチの後でコミットしたか
+    bool committed;
+    // コミットの失敗
+    OString commitError;
+  };
+  // 空きスロット待ちのバッチ
+  struct Waiting {
+    Napi::ObjectReference columns;
+    Napi::Promise::Deferred deferred;
+    Waiting(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {}
+  };
+
+  // スロットへの変換・実行登録(JSスレッド)
+  bool Fill(Napi::Value columns, size_t index, OString &error);
+  void Submit(Napi::Env env, size_t index);
+  // スロットの実行(ワーカースレッド)
+  void Run(size_t index);
+  // スロットの完了(JSスレッド)
+  void Completed(Napi::Env env, size_t index);
+  // 空きスロットに待ちのバッチを入れ、全完了ならコミット
+  void Drain(Napi::Env env);
+  // 最後のコミット・ロールバック
+  void SubmitFinish(Napi::Env env);
+  // 統計(JSON)
+  std::string StatsJson(bool summary);
+  // 切断
+  void Disconnect();
+
+  // 接続
+  SQLHENV m_hEnv;
+  SQLHDBC m_hdbc;
+  BulkStatement m_stmt;
+  std::vector<BulkParamType> m_types;
+
+  // スロット
+  std::vector<std::unique_ptr<Slot>> m_slots;
+  std::vector<size_t> m_free;
+  std::deque<Waiting *> m_waiting;
+
+  // ワーカースレッド(1本で順に実行)
+  std::unique_ptr<Executor> m_executor;
+  AsyncBridge m_bridge;
+
+  // オプション
+  size_t m_batchSize;
+  size_t m_commitInterval;
+  bool m_stopOnError;
+
+  // ワーカースレッドのみ
+  size_t m_uncommitted;
+  // 中止(stopOnErrorで失敗した後の実行待ちは実行しない)
+  std::atomic<bool> m_abort;
+
+  // JSスレッドのみ
+  size_t m_submitted;
+  size_t m_inFlight;
+  uint64_t m_rows;
+  uint64_t m_batches;
+  uint64_t m_affected;
+  uint64_t m_failedRows;
+  uint64_t m_commits;
+  std::vector<BulkBatchError> m_errors;
+  bool m_started;
+  std::chrono::steady_clock::time_point m_start;
+  std::chrono::steady_clock::time_point m_end;
+  bool m_failed;
+  OString m_error;
+  bool m_finishing;
+  bool m_finished;
+  bool m_closed;
+  std::unique_ptr<Napi::Promise::Deferred> m_finish;
+};
+
+#endif
@@ -0,0 +1,2335 @@
+﻿#include "omnipool.h"
+#include "omnidb.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// 既定の最大接続数
+#define POOL_DEFAULT_MAX 4
+// 既定の接続待ち上限(ミリ秒)
+#define POOL_DEFAULT_ACQUIRE_TIMEOUT 30000
+// 既定の再試行回数
+#define POOL_DEFAULT_RETRIES 2
+// 既定の再試行間隔(ミリ秒、回数ごとに倍)
+#define POOL_DEFAULT_RETRY_DELAY 100
+// 既定の進捗通知間隔(ミリ秒)
+#define POOL_DEFAULT_PROGRESS_INTERVAL 1000
+// パラメータの型を覚えておくSQLの数
+#define POOL_PARAM_TYPES_CACHE 256
+// 既定の死活確認SQLのタイムアウト(秒)
+#define POOL_DEFAULT_HEALTH_TIMEOUT 5
+
+
+/**
+* オプションの数値を取得します(無ければ既定値)
+*/
+static uint32_t GetUint32Option(Napi::Object options, const char *name, uint32_t def)
+{
+  if(!options.Has(name)) {
+    return def;
+  }
+  Napi::Value v = options.Get(name);
+  if(!v.IsNumber()) {
+    return def;
+  }
+  double d = v.As<Napi::Number>().DoubleValue();
+  return d < 0 ? 0 : (uint32_t)d;
+}
+
+
+/**
+* オプションのセッション初期化SQLを取得します
+*
+* @param[in] options オプション
+* @param[in] name オプション名
+* @param[out] session セッション(指定が無ければnullptrのまま)
+* @param[out] error エラーメッセージ
+* @return bool 成否(文字列・文字列の配列以外はfalse)
+*/
+static bool GetSessionOption(
+  Napi::Object options, const char *name, std::shared_ptr<PoolSession> &session, OString &error)
+{
+  if(!options.Has(name) || options.Get(name).IsUndefined() || options.Get(name).IsNull()) {
+    return true;
+  }
+  std::vector<OString> statements;
+  if(!OmniDb::ToSessionScript(options.Get(name), statements, error)) {
+    return false;
+  }
+  session.reset(new PoolSession(statements));
+  return true;
+}
+
+
+/**
+* オプションの優先度を取得します
+*
+* priority: 'interactive'(対話的な短い処理)または'batch'(バッチ処理)
+*
+* @param[in] options オプション
+* @param[in,out] lane レーン(指定が無ければそのまま)
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+static bool GetLaneOption(Napi::Object options, ExecutorLane &lane, OString &error)
+{
+  if(!options.Has("priority") || options.Get("priority").IsUndefined()) {
+    return true;
+  }
+  std::string priority = options.Get("priority").ToString().Utf8Value();
+  if(priority == "interactive") {
+    lane = LANE_INTERACTIVE;
+  } else if(priority == "batch") {
+    lane = LANE_BATCH;
+  } else {
+    error = _O("priorityは'interactive'または'batch'で指定してください");
+    return false;
+  }
+  return true;
+}
+
+
+/**
+* カタログの取得条件を取得します(空白のみの条件は指定なし)
+*
+* @param[in] condition 取得条件
+* @param[in] name 条件名
+* @param[in,out] value 条件の値
+*/
+static void GetConditionOption(Napi::Object condition, const char *name, OString &value)
+{
+  if(!condition.Has(name)) {
+    return;
+  }
+  Napi::String v = condition.Get(name).ToString();
+  std::string utf8 = v.Utf8Value();
+  if(utf8.find_first_not_of(" \t\r\n") == std::string::npos) {
+    return;
+  }
+  std::unique_ptr<SQLTCHAR[]> s(OmniDb::NapiStringToSQLTCHAR(v));
+  value = _S2O(s.get());
+}
+
+
+/**
+* オプションの同時実行数の制限を取得します
+*
+* limiter: true で既定の設定、オブジェクトで個別に指定します。
+*   algorithm      'gradient'(既定)または'aimd'
+*   initial/min/max 同時実行数の初期値・最小値・最大値(既定はmax/2・1・最大接続数)
+*   maxQueue       処理待ちの上限(超えた要求はすぐにエラー)
+*   queueTimeout   実行の許可を待つ上限(ミリ秒)
+*   latencyThreshold AIMDで遅いと判断する処理時間(ミリ秒)
+*   tolerance      GRADIENTで許容する処理時間の増加率
+*
+* @param[in] value オプションの値
+* @param[in] maxSize 最大接続数
+* @param[out] limiter 同時実行数の制限(無効ならnullptrのまま)
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+static bool GetLimiterOption(
+  Napi::Value value, size_t maxSize, std::unique_ptr<ConcurrencyLimiter> &limiter, OString &error)
+{
+  if(value.IsUndefined() || value.IsNull() || (value.IsBoolean() && !value.As<Napi::Boolean>().Value())) {
+    return true;
+  }
+  LimiterOptions options = ConcurrencyLimiter::DefaultOptions(maxSize);
+  if(value.IsObject()) {
+    Napi::Object o = value.As<Napi::Object>();
+    if(o.Has("algorithm")) {
+      std::string algorithm = o.Get("algorithm").ToString().Utf8Value();
+      if(algorithm == "aimd") {
+        options.algorithm = LIMITER_AIMD;
+      } else if(algorithm == "gradient") {
+        options.algorithm = LIMITER_GRADIENT;
+      } else {
+        error = _O("limiter.algorithmは'aimd'または'gradient'で指定してください");
+        return false;
+      }
+    }
+    options.maxLimit = GetUint32Option(o, "max", (uint32_t)options.maxLimit);
+    options.minLimit = GetUint32Option(o, "min", (uint32_t)options.minLimit);
+    options.initialLimit = GetUint32Option(o, "initial", (uint32_t)options.initialLimit);
+    options.maxQueue = GetUint32Option(o, "maxQueue", (uint32_t)options.maxQueue);
+    options.queueTimeoutMs = GetUint32Option(o, "queueTimeout", options.queueTimeoutMs);
+    options.latencyThresholdMs = GetUint32Option(o, "latencyThreshold", (uint32_t)options.latencyThresholdMs);
+    if(o.Has("tolerance") && o.Get("tolerance").IsNumber()) {
+      options.tolerance = std::max(1.0, o.Get("tolerance").As<Napi::Number>().DoubleValue());
+    }
+  } else if(!value.IsBoolean()) {
+    error = _O("limiterはtrueまたはオブジェクトで指定してください");
+    return false;
+  }
+  // ワーカースレッド数(最大接続数)を超えて実行することはできない
+  options.maxLimit = std::min(options.maxLimit, (double)maxSize);
+  limiter.reset(new ConcurrencyLimiter(options));
+  return true;
+}
+
+
+/**
+* オプションのヘッジ実行の設定を取得します
+*
+* hedge: true で既定の設定、オブジェクトで個別に指定します。
+*   percentile  待ち時間に使う処理時間のパーセンタイル(既定は95)
+*   minDelay/maxDelay 待ち時間の最小・最大(ミリ秒)
+*   budget      要求数に対するヘッジの割合(%、既定は10)
+*   burst       予算を貯めておける上限(回)
+*
+* @param[in] value オプションの値
+* @param[out] hedge ヘッジ実行(無効ならnullptrのまま)
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+static bool GetHedgeOption(Napi::Value value, std::unique_ptr<HedgeController> &hedge, OString &error)
+{
+  if(value.IsUndefined() || value.IsNull() || (value.IsBoolean() && !value.As<Napi::Boolean>().Value())) {
+    return true;
+  }
+  HedgeOptions options = HedgeController::DefaultOptions();
+  if(value.IsObject()) {
+    Napi::Object o = value.As<Napi::Object>();
+    options.percentile = GetUint32Option(o, "percentile", (uint32_t)options.percentile);
+    options.minDelayMs = GetUint32Option(o, "minDelay", options.minDelayMs);
+    options.maxDelayMs = GetUint32Option(o, "maxDelay", options.maxDelayMs);
+    if(o.Has("budget") && o.Get("budget").IsNumber()) {
+      options.budgetPercent = std::max(0.0, std::min(100.0, o.Get("budget").As<Napi::Number>().DoubleValue()));
+    }
+    options.burst = GetUint32Option(o, "burst", (uint32_t)options.burst);
+  } else if(!value.IsBoolean()) {
+    error = _O("hedgeはtrueまたはオブジェクトで指定してください");
+    return false;
+  }
+  hedge.reset(new HedgeController(options));
+  return true;
+}
+
+
+/**
+* 借りている接続の準備済みの文を使います(無ければ準備して覚えておく)
+*
+* @param[in] lease 借りている接続
+* @param[out] stmt 文(接続を返す前にFreeすること)
+* @param[in] sql SQL
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+static bool AttachCached(PoolLease &lease, BulkStatement &stmt, const OString &sql, OString &error)
+{
+  SQLHSTMT prepared = lease.get()->Prepare(sql, error);
+  return prepared != NULL && stmt.Attach(prepared, error);
+}
+
+
+/**
+* 区画の境界値をSQLのリテラルにします
+*
+* @param[in] value 境界値(数値・文字列)
+* @param[out] literal リテラル(文字列は'で囲む)
+* @return bool 成否(数値・文字列以外、NaN・Infinityはfalse)
+*/
+static bool ToSqlLiteral(Napi::Value value, OString &literal)
+{
+  if(value.IsNumber()) {
+    double number = value.As<Napi::Number>().DoubleValue();
+    // nan・infはSQLのリテラルにならない
+    if(!std::isfinite(number)) {
+      return false;
+    }
+    OStringStream ss;
+    ss.precision(17);
+    ss << number;
+    literal = ss.str();
+    return true;
+  }
+  if(!value.IsString()) {
+    return false;
+  }
+  std::unique_ptr<SQLTCHAR[]> s(OmniDb::NapiStringToSQLTCHAR(value.As<Napi::String>()));
+  OString text = _S2O(s.get());
+  literal = _O("'");
+  for(size_t i = 0; i < text.size(); i++) {
+    if(text[i] == _O('\'')) {
+      literal += _O('\'');
+    }
+    literal += text[i];
+  }
+  literal += _O("'");
+  return true;
+}
+
+
+/**
+* 経過時間(ミリ秒)
+*/
+static double ElapsedMillis(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/**
+* 接続プールモジュール初期化
+*
+* @param[in] env Node.js環境
+* @param[in] exports 公開オブジェクト登録先
+* @return Napi::Object 公開オブジェクト
+*/
+Napi::Object OmniPool::Init(Napi::Env env, Napi::Object exports)
+{
+  Napi::Function func = DefineClass(
+    env, "pool", {
+      InstanceMethod("query", &OmniPool::Query),
+      InstanceMethod("describeAll", &OmniPool::DescribeAll),
+      InstanceMethod("executeBulk", &OmniPool::ExecuteBulk),
+      InstanceMethod("warmup", &OmniPool::Warmup),
+      InstanceMethod("execute", &OmniPool::Execute),
+      InstanceMethod("tables", &OmniPool::Tables),
+      InstanceMethod("columns", &OmniPool::Columns),
+      InstanceMethod("scan", &OmniPool::Scan),
+      InstanceMethod("materialize", &OmniPool::Materialize),
+      InstanceMethod("fetch", &OmniPool::Fetch),
+      InstanceMethod("closeCursor", &OmniPool::CloseCursor),
+      InstanceMethod("paginate", &OmniPool::Paginate),
+      InstanceMethod("page", &OmniPool::Page),
+      InstanceMethod("closePager", &OmniPool::ClosePager),
+      InstanceMethod("stats", &OmniPool::Stats),
+      InstanceMethod("close", &OmniPool::Close),
+  });
+
+  exports.Set("pool", func);
+  return exports;
+}
+
+
+/**
+* コンストラクタ
+*
+* new pool(connectionString, options)
+*   options.max            最大接続数(ワーカースレッド数)
+*   options.acquireTimeout 接続待ちの上限(ミリ秒)
+*   options.init           全接続で接続直後に実行するSQL(;区切りの文字列または配列)
+*   options.min            最小接続数(warmupで接続しておく数)
+*   options.loginTimeout   ログインタイムアウト(秒)
+*   options.healthInterval 空き接続の死活確認の間隔(ミリ秒、0は確認しない)
+*   options.healthIdle     この時間以上使われていない空き接続を確認(ミリ秒、既定は確認の間隔)
+*   options.healthTimeout  確認SQLのタイムアウト(秒)
+*   options.healthProbe    確認SQL(空文字はSQL_ATTR_CONNECTION_DEADのみ、失敗した接続は破棄する)
+*/
+OmniPool::OmniPool(const Napi::CallbackInfo &info) : Napi::ObjectWrap<OmniPool>(info)
+{
+  Napi::Env env = info.Env();
+  m_acquireTimeout = POOL_DEFAULT_ACQUIRE_TIMEOUT;
+  m_closed = false;
+  m_nextPager = 1;
+  m_pages = 0;
+  m_prefetches = 0;
+  m_prefetchHits = 0;
+
+  if(info.Length() < 1 || !info[0].IsString()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("pool(connectionString, options) connectionStringは必須です"))
+    ).ThrowAsJavaScriptException();
+    return;
+  }
+  uint32_t max = POOL_DEFAULT_MAX;
+  uint32_t min = 0;
+  uint32_t loginTimeout = 0;
+  // 既定で1本は対話的な処理のために空けておく(max=1の場合は予約なし)
+  int32_t reserveInteractive = -1;
+  uint32_t reserveBatch = 0;
+  PoolHealthOptions health;
+  health.intervalMs = 0;
+  health.idleMs = 0;
+  health.timeoutSec = POOL_DEFAULT_HEALTH_TIMEOUT;
+  health.probe = POOL_DEFAULT_PROBE;
+  std::vector<OString> init;
+  Napi::Value limiter = env.Undefined();
+  Napi::Value hedge = env.Undefined();
+  std::vector<OString> replicas;
+  uint32_t routeCooldown = ROUTE_DEFAULT_COOLDOWN;
+  OString error;
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    max = GetUint32Option(options, "max", max);
+    m_acquireTimeout = GetUint32Option(options, "acquireTimeout", m_acquireTimeout);
+    min = GetUint32Option(options, "min", min);
+    loginTimeout = GetUint32Option(options, "loginTimeout", loginTimeout);
+    if(options.Has("reserveInteractive") && options.Get("reserveInteractive").IsNumber()) {
+      reserveInteractive = (int32_t)GetUint32Option(options, "reserveInteractive", 0);
+    }
+    reserveBatch = GetUint32Option(options, "reserveBatch", reserveBatch);
+    health.intervalMs = GetUint32Option(options, "healthInterval", health.intervalMs);
+    health.idleMs = GetUint32Option(options, "healthIdle", health.intervalMs);
+    health.timeoutSec = GetUint32Option(options, "healthTimeout", health.timeoutSec);
+    if(options.Has("healthProbe") && options.Get("healthProbe").IsString()) {
+      std::unique_ptr<SQLTCHAR[]> probe(OmniDb::NapiStringToSQLTCHAR(options.Get("healthProbe").As<Napi::String>()));
+      health.probe = _S2O(probe.get());
+    }
+    if(options.Has("init") && !OmniDb::ToSessionScript(options.Get("init"), init, error)) {
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return;
+    }
+    if(options.Has("limiter")) {
+      limiter = options.Get("limiter");
+    }
+    if(options.Has("hedge")) {
+      hedge = options.Get("hedge");
+    }
+    if(options.Has("replicas") && !options.Get("replicas").IsUndefined()) {
+      Napi::Value v = options.Get("replicas");
+      bool valid = v.IsArray();
+      Napi::Array list = valid ? v.As<Napi::Array>() : Napi::Array::New(env);
+      for(uint32_t i = 0; valid && i < list.Length(); i++) {
+        if(!list.Get(i).IsString()) {
+          valid = false;
+          break;
+        }
+        std::unique_ptr<SQLTCHAR[]> replica(OmniDb::NapiStringToSQLTCHAR(list.Get(i).As<Napi::String>()));
+        replicas.push_back(_S2O(replica.get()));
+      }
+      if(!valid) {
+        OmniDb::CreateTypeError(
+          env,
+          OString(_O("replicas は接続文字列の配列で指定してください"))
+        ).ThrowAsJavaScriptException();
+        return;
+      }
+    }
+    routeCooldown = GetUint32Option(options, "routeCooldown", routeCooldown);
+  }
+
+  std::unique_ptr<SQLTCHAR[]> connectionString(OmniDb::NapiStringToSQLTCHAR(info[0].As<Napi::String>()));
+  std::unique_ptr<ConnectionPool> pool(new ConnectionPool());
+  if(!pool->Init(_S2O(connectionString.get()), max, init, error)) {
+    OmniDb::CreateError(env, error).ThrowAsJavaScriptException();
+    return;
+  }
+  pool->SetMinSize(min);
+  pool->SetLoginTimeout(loginTimeout);
+  pool->StartHealthCheck(health);
+  m_pool.reset(pool.release());
+
+  // 読み取りレプリカ(プライマリと同じ設定)
+  for(size_t i = 0; i < replicas.size(); i++) {
+    std::unique_ptr<ConnectionPool> replica(new ConnectionPool());
+    if(!replica->Init(replicas[i], max, init, error)) {
+      OmniDb::CreateError(env, error).ThrowAsJavaScriptException();
+      return;
+    }
+    replica->SetMinSize(min);
+    replica->SetLoginTimeout(loginTimeout);
+    replica->StartHealthCheck(health);
+    m_replicas.push_back(std::move(replica));
+  }
+  if(!m_replicas.empty()) {
+    m_router.reset(new EndpointRouter(1 + m_replicas.size(), routeCooldown));
+  }
+
+  // 全接続先の接続を同時に使えるだけのワーカースレッド
+  size_t threads = m_pool->MaxSize() * (1 + m_replicas.size());
+  m_executor.reset(new Executor(threads));
+  m_executor->SetReserved(LANE_INTERACTIVE, reserveInteractive < 0 ? 1 : (size_t)reserveInteractive);
+  m_executor->SetReserved(LANE_BATCH, reserveBatch);
+  if(!GetLimiterOption(limiter, threads, m_limiter, error)
+    || !GetHedgeOption(hedge, m_hedge, error)) {
+    OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+    return;
+  }
+
+  m_bridge.Init(env, this, "omnidb.pool");
+  m_cursors.Init(m_executor.get(), &m_bridge);
+}
+
+
+/**
+* デストラクタ
+*/
+OmniPool::~OmniPool()
+{
+  // ヘッジの予定を捨ててから実行中のタスクを待つ
+  if(m_hedge) {
+    m_hedge->Close();
+  }
+  m_cursors.CancelAll();
+  if(m_executor) {
+    m_executor->Shutdown();
+  }
+  m_cursors.Clear();
+  if(m_pool) {
+    m_pool->Close();
+  }
+  for(size_t i = 0; i < m_replicas.size(); i++) {
+    m_replicas[i]->Close();
+  }
+  m_bridge.Release();
+}
+
+
+/**
+* 接続先のプール
+*
+* @param[in] endpoint 接続先の番号(0はプライマリ)
+* @return ConnectionPool& プール
+*/
+ConnectionPool &OmniPool::Endpoint(size_t endpoint)
+{
+  if(endpoint == ROUTE_PRIMARY || endpoint > m_replicas.size()) {
+    return *m_pool;
+  }
+  return *m_replicas[endpoint - 1];
+}
+
+
+/**
+* 借りている接続の接続先
+*
+* @param[in] lease 借りている接続
+* @return size_t 接続先の番号(0はプライマリ)
+*/
+size_t OmniPool::EndpointOf(const PoolLease &lease)
+{
+  for(size_t i = 0; i < m_replicas.size(); i++) {
+    if(lease.pool() == m_replicas[i].get()) {
+      return i + 1;
+    }
+  }
+  return ROUTE_PRIMARY;
+}
+
+
+/**
+* 接続先を選んで接続を借ります(ワーカースレッド)
+*
+* 読み取り専用の処理は処理時間・使用中の接続の割合から接続先を選び、
+* 接続できなければその接続先を切り離して別の接続先で借り直します。
+* 切り離すのは接続先に接続できなかった(08xxx、ログインのタイムアウト)場合だけで、
+* 使用中で待ち時間を超えただけの接続先は切り離しません。
+*
+* @param[in,out] lease 借りる接続(借りる先のプールを替えます)
+* @param[in] readOnly 読み取り専用の処理か(falseはプライマリ)
+* @param[in] session セッション(NULLは既定)
+* @param[out] error エラーメッセージ
+* @param[in] exclude 他に正常な接続先があれば避ける接続先
+* @return bool 成否
+*/
+bool OmniPool::AcquireRouted(
+  PoolLease &lease, bool readOnly, const PoolSession *session, OString &error, size_t exclude)
+{
+  if(!m_router) {
+    return lease.Acquire(m_acquireTimeout, error, session);
+  }
+  for(size_t tries = 0; tries < m_router->Size(); tries++) {
+    std::vector<double> load;
+    for(size_t i = 0; i < m_router->Size(); i++) {
+      ConnectionPoolStats stats = Endpoint(i).Stats();
+      size_t max = Endpoint(i).MaxSize();
+      load.push_back(max == 0 ? 1.0 : (double)(stats.total - stats.idle) / max);
+    }
+    size_t endpoint = m_router->Pick(readOnly, load, exclude);
+    lease.Bind(Endpoint(endpoint));
+    if(lease.Acquire(m_acquireTimeout, error, session)) {
+      return true;
+    }
+    const std::string &state = lease.SqlState();
+    if(IsConnectionSqlState(state) || state == "HYT00" || state == "HYT01") {
+      m_router->Fail(endpoint);
+    }
+    if(!readOnly) {
+      break;
+    }
+  }
+  return false;
+}
+
+
+/**
+* 再試行付きでSQLを解析します(ワーカースレッド)
+*
+* 一時的な失敗(通信断・デッドロック・タイムアウト)は間隔を倍にしながら
+* retries回まで再試行します。通信断の場合は接続を破棄して別の接続で行います。
+* 同時実行数の制限がある場合は試行ごとに実行の許可を待ち、処理時間を記録します。
+*
+* @param[in,out] lease 借りている接続(無ければ借ります)
+* @param[in] enqueued 同時実行数の制限に受け付け済みか
+* @param[in] lane 優先度(同時実行数の制限の許可の順番)
+* @param[in] session セッション(NULLは既定)
+* @param[in] sql SQL
+* @param[in] label ラベルを出力するか
+* @param[in] retries 再試行回数
+* @param[in] retryDelay 再試行間隔(ミリ秒)
+* @param[out] result SQLの情報(JSON形式の文字列)
+* @param[out] error エラーメッセージ
+* @param[out] attempts 試行回数
+* @return bool 成否
+*/
+bool OmniPool::DescribeWithRetry(
+  PoolLease &lease, bool enqueued, ExecutorLane lane, const PoolSession *session, const OString &sql, bool label,
+  int retries, uint32_t retryDelay, std::string &result, OString &error, int &attempts)
+{
+  attempts = 0;
+  for(int attempt = 0; attempt <= retries; attempt++) {
+    if(attempt > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds((uint64_t)retryDelay << (attempt - 1)));
+    }
+    attempts++;
+
+    // 許可待ちのタイムアウトは過負荷なので再試行しない
+    LimiterPermit permit(m_limiter.get());
+    if(!permit.Acquire(enqueued && attempt == 0, lane == LANE_INTERACTIVE, error)) {
+      return false;
+    }
+
+    // 接続の取得失敗(接続上限待ち・接続エラー)も再試行の対象
+    if(!lease.get() && !AcquireRouted(lease, true, session, error)) {
+      permit.MarkOverload();
+      continue;
+    }
+
+    std::string sqlState;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // 解析中の確保はアリーナから(1回の解析ごとにまとめて解放)
+    CallArena arena;
+    CallArenaScope scope(arena);
+    if(OmniDb::DescribeQuery(lease.hdbc(), (SQLTCHAR *)sql.c_str(), label, result, error, sqlState)) {
+      if(m_router) {
+        m_router->Complete(EndpointOf(lease), ElapsedMillis(start));
+      }
+      return true;
+    }
+    if(!IsTransientSqlState(sqlState)) {
+      return false;
+    }
+    permit.MarkOverload();
+    if(IsConnectionSqlState(sqlState)) {
+      if(m_router) {
+        m_router->Fail(EndpointOf(lease));
+      }
+      lease.MarkBroken();
+      lease.Reset();
+    }
+  }
+  return false;
+}
+
+
+/**
+* パラメータ付きSQL文字列を解析します(OmniDb.queryのプール版)
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value SQLの情報(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniPool::Query(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  //
+  // query(queryString, options)
+  // のパラメータチェック ※optionsは任意
+  //
+  if(info.Length() < 1 || !info[0].IsString()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("query(queryString) queryStringは文字列で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("接続プールは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  struct QueryTask {
+    OString sql;
+    std::shared_ptr<PoolSession> session;
+    ExecutorLane lane;
+    bool label;
+    int retries;
+    uint32_t retryDelay;
+    bool ok;
+    std::string result;
+    OString error;
+    Napi::Promise::Deferred deferred;
+    QueryTask(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {}
+  };
+  std::shared_ptr<QueryTask> task(new QueryTask(env));
+  std::unique_ptr<SQLTCHAR[]> queryString(OmniDb::NapiStringToSQLTCHAR(info[0].As<Napi::String>()));
+  task->sql = _S2O(queryString.get());
+  task->label = false;
+  task->retries = POOL_DEFAULT_RETRIES;
+  task->retryDelay = POOL_DEFAULT_RETRY_DELAY;
+  task->lane = LANE_INTERACTIVE;
+  task->ok = false;
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    if(options.Has("label")) {
+      task->label = options.Get("label").ToBoolean();
+    }
+    task->retries = (int)GetUint32Option(options, "retries", task->retries);
+    task->retryDelay = GetUint32Option(options, "retryDelay", task->retryDelay);
+    OString error;
+    if(!GetSessionOption(options, "session", task->session, error)
+      || !GetLaneOption(options, task->lane, error)) {
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+  // 処理待ちが上限を超える場合は実行せずに断る
+  OString rejected;
+  if(m_limiter && !m_limiter->Enqueue(rejected)) {
+    task->deferred.Reject(OmniDb::CreateError(env, rejected).Value());
+    return task->deferred.Promise();
+  }
+
+  m_bridge.BeginWork(env);
+  OmniPool *self = this;
+  m_executor->Submit([self, task]() {
+    PoolLease lease(*self->m_pool);
+    int attempts = 0;
+    task->ok = self->DescribeWithRetry(
+      lease, true, task->lane, task->session.get(), task->sql, task->label, task->retries, task->retryDelay,
+      task->result, task->error, attempts);
+    lease.Reset();
+
+    self->m_bridge.Post([self, task](Napi::Env env) {
+      Napi::HandleScope scope(env);
+      if(task->ok) {
+        task->deferred.Resolve(Napi::String::New(env, task->result));
+      } else {
+        task->deferred.Reject(OmniDb::CreateError(env, task->error).Value());
+      }
+      self->m_bridge.EndWork(env);
+    });
+  }, task->lane);
+
+  return task->deferred.Promise();
+}
+
+
+/**
+* SQLを直接実行して結果を返します(OmniDb.executeのプール版)
+*
+* プールにhedgeを指定し、options.idempotentを指定した読み取り専用のSQLは、
+* 処理時間のパーセンタイルを過ぎても終わらない場合に別の接続でも実行します。
+* 先に返った方の結果を使い、負けた方はSQLCancelで取り消します。
+*
+* execute(sql, options)
+*   options.results     結果(結果セット・更新行数)を返すか(既定はtrue)
+*   options.maxRows     1つの結果セットから返す最大行数(0は無制限)
+*   options.idempotent  何度実行しても同じ結果の読み取り専用のSQLか(ヘッジの条件)
+*   options.readOnly    読み取り専用のSQLか(レプリカに振り分ける、既定はプライマリ)
+*   options.hedge       falseでこの呼び出しはヘッジしない
+*   options.priority    優先度(既定は'interactive')
+*   options.session     接続に求めるセッション初期化SQL
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 結果(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniPool::Execute(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() < 1 || !info[0].IsString()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("execute(sql, options) sqlは文字列で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("接続プールは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::shared_ptr<ExecuteTask> task(new ExecuteTask(env));
+  std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(info[0].As<Napi::String>()));
+  task->sql = _S2O(sql.get());
+  task->lane = LANE_INTERACTIVE;
+  task->results = true;
+  task->maxRows = 0;
+  task->hedge = false;
+  task->readOnly = false;
+  task->endpoint[0] = ROUTE_PRIMARY;
+  task->endpoint[1] = ROUTE_PRIMARY;
+  task->settled = false;
+  task->running = 1;
+  task->ok = false;
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    if(options.Has("results")) {
+      task->results = options.Get("results").ToBoolean();
+    }
+    task->maxRows = GetUint32Option(options, "maxRows", 0);
+    bool idempotent = options.Has("idempotent") && options.Get("idempotent").ToBoolean();
+    bool hedge = !options.Has("hedge") || options.Get("hedge").ToBoolean();
+    task->hedge = m_hedge && idempotent && hedge;
+    // 何度実行しても同じ結果のSQLは読み取り専用として扱う
+    task->readOnly = idempotent || (options.Has("readOnly") && options.Get("readOnly").ToBoolean());
+    OString error;
+    if(!GetSessionOption(options, "session", task->session, error)
+      || !GetLaneOption(options, task->lane, error)) {
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+  OString rejected;
+  if(m_limiter && !m_limiter->Enqueue(rejected)) {
+    task->deferred.Reject(OmniDb::CreateError(env, rejected).Value());
+    return task->deferred.Promise();
+  }
+
+  m_bridge.BeginWork(env);
+  OmniPool *self = this;
+  if(task->hedge) {
+    // 待ち時間を過ぎても終わらなければ予算の範囲で別の接続でも実行
+    m_hedge->Begin();
+    m_hedge->Schedule(m_hedge->Delay(), [self, task]() {
+      {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        if(task->settled || !self->m_hedge->TryHedge()) {
+          return;
+        }
+        task->running++;
+      }
+      self->m_executor->Submit([self, task]() { self->ExecuteAttempt(task, 1); }, task->lane);
+    });
+  }
+  m_executor->Submit([self, task]() { self->ExecuteAttempt(task, 0); }, task->lane);
+
+  return task->deferred.Promise();
+}
+
+
+/**
+* SQLを実行します(ワーカースレッド、ヘッジした場合は2つの試行が競争)
+*
+* 成功した試行は先着1つが勝ち、もう一方を取り消します。失敗した試行は
+* もう一方がまだ実行中であればその結果を待ちます。
+*
+* @param[in] task 実行の要求
+* @param[in] attempt 試行番号(0は最初の試行、1はヘッジ)
+*/
+void OmniPool::ExecuteAttempt(std::shared_ptr<ExecuteTask> task, int attempt)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  CancelToken &cancel = task->cancel[attempt];
+  bool ok = false;
+  nlohmann::json outcome = nlohmann::json::object();
+  OString error;
+  std::string sqlState;
+  {
+    LimiterPermit permit(m_limiter.get());
+    PoolLease lease(*m_pool);
+    // ヘッジはできれば最初の試行と別の接続先で実行
+    size_t exclude = (size_t)-1;
+    if(attempt == 1) {
+      std::lock_guard<std::mutex> lock(task->mutex);
+      exclude = task->endpoint[0];
+    }
+    if(cancel.Cancelled()) {
+      // 実行前に勝負がついた
+    } else if(permit.Acquire(attempt == 0, task->lane == LANE_INTERACTIVE, error)
+      && AcquireRouted(lease, task->readOnly, task->session.get(), error, exclude)) {
+      size_t endpoint = EndpointOf(lease);
+      {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->endpoint[attempt] = endpoint;
+      }
+      std::chrono::steady_clock::time_point executed = std::chrono::steady_clock::now();
+      ok = OmniDb::ExecuteBatch(
+        lease.hdbc(), (SQLTCHAR *)task->sql.c_str(), task->results, task->maxRows,
+        outcome, error, sqlState, &cancel);
+      if(ok && m_router) {
+        m_router->Complete(endpoint, ElapsedMillis(executed));
+      }
+      if(!ok && IsConnectionSqlState(sqlState)) {
+        if(m_router) {
+          m_router->Fail(endpoint);
+        }
+        lease.MarkBroken();
+      }
+      if(!ok && IsTransientSqlState(sqlState)) {
+        permit.MarkOverload();
+      }
+    }
+  }
+
+  //
+  // 勝敗の判定
+  //
+  bool won = false;
+  int other = 1 - attempt;
+  {
+    std::lock_guard<std::mutex> lock(task->mutex);
+    task->running--;
+    if(!task->settled && !cancel.Cancelled() && (ok || task->running == 0)) {
+      won = true;
+      task->settled = true;
+      task->ok = ok;
+      if(ok) {
+        task->result = outcome.dump(-1, ' ', true, json::error_handler_t::replace);
+      } else {
+        task->error = error;
+      }
+    } else if(!task->settled && task->running == 0) {
+      // 取り消された試行しか残っていない(通常は起きない)
+      won = true;
+      task->settled = true;
+      task->error = error.empty() ? OString(_O("実行は取り消されました")) : error;
+    }
+  }
+  if(!won) {
+    if(m_hedge && cancel.Cancelled()) {
+      m_hedge->Cancelled();
+    }
+    return;
+  }
+  // 負けた方(未実行・実行中)を取り消す
+  task->cancel[other].Cancel();
+  if(task->hedge) {
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    m_hedge->Complete(ok ? ms : -1, attempt == 1);
+  }
+
+  OmniPool *self = this;
+  m_bridge.Post([self, task](Napi::Env env) {
+    Napi::HandleScope scope(env);
+    if(task->ok) {
+      task->deferred.Resolve(Napi::String::New(env, task->result));
+    } else {
+      task->deferred.Reject(OmniDb::CreateError(env, task->error).Value());
+    }
+    self->m_bridge.EndWork(env);
+  });
+}
+
+
+/**
+* テーブル情報を取得します(OmniDb.tablesのプール版、既定は対話的な処理)
+*
+* @param[in] info Node.jsパラメータ(condition, options)
+* @return Napi::Value テーブル情報(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniPool::Tables(const Napi::CallbackInfo &info)
+{
+  return Catalog(info, false);
+}
+
+
+/**
+* カラム情報を取得します(OmniDb.columnsのプール版、既定は対話的な処理)
+*
+* @param[in] info Node.jsパラメータ(condition, options)
+* @return Napi::Value カラム情報(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniPool::Columns(const Napi::CallbackInfo &info)
+{
+  return Catalog(info, true);
+}
+
+
+/**
+* テーブル・カラム情報を取得します
+*
+* condition  取得条件(catalog, schema, table, tableTypeまたはcolumn)
+* options.priority 優先度(既定は'interactive')
+* options.session  接続に求めるセッション初期化SQL
+*
+* @param[in] info Node.jsパラメータ
+* @param[in] columns カラム情報か(falseはテーブル情報)
+* @return Napi::Value JSON形式の文字列を返すPromise
+*/
+Napi::Value OmniPool::Catalog(const Napi::CallbackInfo &info, bool columns)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() >= 1 && !info[0].IsUndefined() && !info[0].IsNull() && !info[0].IsObject()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("condition はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("接続プールは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  struct CatalogTask {
+    bool columns;
+    OString catalog;
+    OString schema;
+    OString table;
+    // テーブル種別(tables)またはカラム(columns)
+    OString filter;
+    std::shared_ptr<PoolSession> session;
+    ExecutorLane lane;
+    bool ok;
+    std::string result;
+    OString error;
+    Napi::Promise::Deferred deferred;
+    CatalogTask(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {}
+  };
+  std::shared_ptr<CatalogTask> task(new CatalogTask(env));
+  task->columns = columns;
+  // tables()のデフォルトはテーブルのみ
+  task->filter = columns ? OString() : OString(_O("TABLE"));
+  task->lane = LANE_INTERACTIVE;
+  task->ok = false;
+  if(info.Length() >= 1 && info[0].IsObject()) {
+    Napi::Object condition = info[0].As<Napi::Object>();
+    GetConditionOption(condition, "catalog", task->catalog);
+    GetConditionOption(condition, "schema", task->schema);
+    GetConditionOption(condition, "table", task->table);
+    GetConditionOption(condition, columns ? "column" : "tableType", task->filter);
+  }
+  if(info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    OString error;
+    if(!GetSessionOption(options, "session", task->session, error)
+      || !GetLaneOption(options, task->lane, error)) {
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+  OString rejected;
+  if(m_limiter && !m_limiter->Enqueue(rejected)) {
+    task->deferred.Reject(OmniDb::CreateError(env, rejected).Value());
+    return task->deferred.Promise();
+  }
+
+  m_bridge.BeginWork(env);
+  OmniPool *self = this;
+  m_executor->Submit([self, task]() {
+    LimiterPermit permit(self->m_limiter.get());
+    PoolLease lease(*self->m_pool);
+    if(permit.Acquire(true, task->lane == LANE_INTERACTIVE, task->error)
+      && self->AcquireRouted(lease, true, task->session.get(), task->error)) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      SQLTCHAR *catalog = task->catalog.empty() ? nullptr : (SQLTCHAR *)task->catalog.c_str();
+      SQLTCHAR *schema = task->schema.empty() ? nullptr : (SQLTCHAR *)task->schema.c_str();
+      SQLTCHAR *table = task->table.empty() ? nullptr : (SQLTCHAR *)task->table.c_str();
+      SQLTCHAR *filter = task->filter.empty() ? nullptr : (SQLTCHAR *)task->filter.c_str();
+      CallArena arena;
+      CallArenaScope scope(arena);
+      if(task->columns) {
+        std::vector<CatalogColumn> columns;
+        task->ok = FetchCatalogColumns(lease.hdbc(), catalog, schema, table, filter, columns, task->error);
+        if(task->ok) {
+          ArenaString text = CatalogColumnsToJson(columns);
+          task->result.assign(text.data(), text.size());
+        }
+      } else {
+        std::vector<CatalogTable> tables;
+        task->ok = FetchCatalogTables(lease.hdbc(), catalog, schema, table, filter, tables, task->error);
+        if(task->ok) {
+          ArenaString text = CatalogTablesToJson(tables);
+          task->result.assign(text.data(), text.size());
+        }
+      }
+      if(task->ok && self->m_router) {
+        self->m_router->Complete(self->EndpointOf(lease), ElapsedMillis(start));
+      }
+    }
+    lease.Reset();
+    permit.Release();
+
+    self->m_bridge.Post([self, task](Napi::Env env) {
+      Napi::HandleScope scope(env);
+      if(task->ok) {
+        task->deferred.Resolve(Napi::String::New(env, task->result));
+      } else {
+        task->deferred.Reject(OmniDb::CreateError(env, task->error).Value());
+      }
+      self->m_bridge.EndWork(env);
+    });
+  }, task->lane);
+
+  return task->deferred.Promise();
+}
+
+
+/**
+* テーブルを区画に分けて並列に読みます
+*
+* 区画ごとに別の接続(レプリカがあれば接続先も分散)でSELECTを実行し、専用の
+* スレッドで先読みします。既定は全区画を到着順に合流した1つのカーソル、
+* perPartitionでは区画ごとのカーソルです。区画は式の値で分けます。
+*   boundsなし MOD(ABS(expression), partitions) = 区画番号(NULLは区画0)
+*   boundsあり expression < bounds[0](NULLを含む)、bounds[i-1] <= expression < bounds[i]、
+*              bounds[n-1] <= expression の n+1区画
+*
+* @param[in] info Node.jsパラメータ(table, options)
+*   options.expression   区画を分ける式(必須、例: RRN(T)・主キー)
+*   options.partitions   MODの区画数(既定は最大接続数)
+*   options.bounds       範囲の境界値(有限の数値、または文字列の昇順で重複の無い配列)
+*   options.columns      取得する列(既定は*)
+*   options.where        全区画に共通の条件
+*   options.perPartition 区画ごとのカーソルを返すか
+*   options.batchRows    区画ごとに1回で取得する行数('auto'は取得時間から自動調整)
+*   options.fetchLatency 自動調整の1回の取得の目標時間(ミリ秒)
+*   options.fetchMemory  区画ごとの行セット領域の上限(バイト)
+*   options.session      接続に求めるセッション初期化SQL
+* @return Napi::Value カーソル番号(perPartitionでは区画順の配列)
+*/
+Napi::Value OmniPool::Scan(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() < 2 || !info[0].IsString() || !info[1].IsObject()
+    || !info[1].As<Napi::Object>().Has("expression") || !info[1].As<Napi::Object>().Get("expression").IsString()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("scan(table, options) tableとoptions.expression(区画を分ける式)は必須です"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("接続プールは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Object options = info[1].As<Napi::Object>();
+  std::unique_ptr<SQLTCHAR[]> table(OmniDb::NapiStringToSQLTCHAR(info[0].As<Napi::String>()));
+  std::unique_ptr<SQLTCHAR[]> expression(OmniDb::NapiStringToSQLTCHAR(options.Get("expression").As<Napi::String>()));
+  OString expr = _S2O(expression.get());
+  OString columns = _O("*");
+  if(options.Has("columns") && options.Get("columns").IsString()) {
+    std::unique_ptr<SQLTCHAR[]> c(OmniDb::NapiStringToSQLTCHAR(options.Get("columns").As<Napi::String>()));
+    columns = _S2O(c.get());
+  }
+  OString where;
+  if(options.Has("where") && options.Get("where").IsString()) {
+    std::unique_ptr<SQLTCHAR[]> w(OmniDb::NapiStringToSQLTCHAR(options.Get("where").As<Napi::String>()));
+    where = _S2O(w.get());
+  }
+  bool perPartition = options.Has("perPartition") && options.Get("perPartition").ToBoolean();
+  size_t batchRows = FETCH_DEFAULT_ROWS;
+  FetchTuning tuning;
+  std::shared_ptr<PoolSession> session;
+  OString error;
+  if(!OmniDb::ToFetchTuning(options, batchRows, tuning, error)
+    || !GetSessionOption(options, "session", session, error)) {
+    OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // 区画ごとの条件
+  std::vector<OString> conditions;
+  if(options.Has("bounds") && !options.Get("bounds").IsUndefined()) {
+    Napi::Value v = options.Get("bounds");
+    std::vector<OString> bounds;
+    bool valid = v.IsArray() && v.As<Napi::Array>().Length() > 0;
+    // 昇順でないと区画が重なる・空になるので確かめる(文字列の順は接続先の
+    // 照合順序によるので、型が揃っていて重複が無いことだけを確かめる)
+    bool numbers = valid && v.As<Napi::Array>().Get((uint32_t)0).IsNumber();
+    double last = 0;
+    for(uint32_t i = 0; valid && i < v.As<Napi::Array>().Length(); i++) {
+      Napi::Value bound = v.As<Napi::Array>().Get(i);
+      OString literal;
+      valid = ToSqlLiteral(bound, literal) && bound.IsNumber() == numbers;
+      if(valid && numbers) {
+        double number = bound.As<Napi::Number>().DoubleValue();
+        valid = i == 0 || number > last;
+        last = number;
+      } else if(valid) {
+        valid = std::find(bounds.begin(), bounds.end(), literal) == bounds.end();
+      }
+      bounds.push_back(literal);
+    }
+    if(!valid) {
+      OmniDb::CreateTypeError(
+        env,
+        OString(_O("bounds は有限の数値、または文字列の昇順(重複なし)の配列で指定してください"))
+      ).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    conditions.push_back(_O("(") + expr + _O(") < ") + bounds[0] + _O(" OR (") + expr + _O(") IS NULL"));
+    for(size_t i = 1; i < bounds.size(); i++) {
+      conditions.push_back(
+        _O("(") + expr + _O(") >= ") + bounds[i - 1] + _O(" AND (") + expr + _O(") < ") + bounds[i]);
+    }
+    conditions.push_back(_O("(") + expr + _O(") >= ") + bounds.back());
+  } else {
+    uint32_t partitions = GetUint32Option(options, "partitions", (uint32_t)m_pool->MaxSize());
+    if(partitions == 0) {
+      partitions = 1;
+    }
+    // 負の値は剰余が負になるので絶対値で分け、NULLは区画0に入れる
+    for(uint32_t i = 0; i < partitions; i++) {
+      OString condition = _O("MOD(ABS(") + expr + _O("), ") + to_ostring(partitions) + _O(") = ") + to_ostring(i);
+      if(i == 0) {
+        condition += _O(" OR (") + expr + _O(") IS NULL");
+      }
+      conditions.push_back(condition);
+    }
+  }
+  // 区画ごとのカーソルは読む順序によっては接続を返さないので、接続数を超えると待ち続ける
+  size_t endpoints = 1 + m_replicas.size();
+  if(perPartition && conditions.size() > m_pool->MaxSize() * endpoints) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("perPartitionの区画数は接続先の最大接続数の合計以下にしてください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // 全区画の実行開始
+  OString base = _O("SELECT ") + columns + _O(" FROM ") + _S2O(table.get()) + _O(" WHERE ");
+  if(!where.empty()) {
+    base += _O("(") + where + _O(") AND ");
+  }
+  std::shared_ptr<StreamSignal> signal(new StreamSignal());
+  std::vector<std::unique_ptr<QueryStream> > streams;
+  for(size_t i = 0; i < conditions.size(); i++) {
+    std::unique_ptr<QueryStream> stream(new QueryStream(
+      Endpoint(i % endpoints), base + _O("(") + conditions[i] + _O(")"), session.get(), m_acquireTimeout, batchRows));
+    if(!perPartition) {
+      stream->SetSignal(signal);
+    }
+    stream->SetTuning(tuning);
+    stream->Start();
+    streams.push_back(std::move(stream));
+  }
+
+  if(perPartition) {
+    Napi::Array ids = Napi::Array::New(env, streams.size());
+    for(size_t i = 0; i < streams.size(); i++) {
+      std::shared_ptr<StreamCursor> cursor(new StreamCursor());
+      cursor->session = session;
+      cursor->stream.reset(streams[i].release());
+      ids.Set((uint32_t)i, Napi::Number::New(env, m_cursors.Add(cursor)));
+    }
+    return ids;
+  }
+  std::shared_ptr<StreamCursor> cursor(new StreamCursor());
+  cursor->session = session;
+  cursor->stream.reset(new InterleaveStream(streams, signal));
+  return Napi::Number::New(env, m_cursors.Add(cursor));
+}
+
+
+/**
+* SELECTの全行を取得してからカーソルで読みます
+*
+* 取得スレッドは読む側を待たずに全行を行形式で保管し、終われば接続を返します。
+* 保管はクエリごと・プロセス全体のメモリ予算の内側に置き、超えた分は一時
+* ファイルへ書き出して、読むときにその範囲をマップします。
+*
+* @param[in] info Node.jsパラメータ(sql, options)
+*   options.memoryBudget このクエリのメモリ上の保管の上限(バイト)
+*   options.batchRows    1回で取得する行数('auto'は取得時間から自動調整)
+*   options.fetchLatency 自動調整の1回の取得の目標時間(ミリ秒)
+*   options.fetchMemory  行セット領域の上限(バイト)
+*   options.session      接続に求めるセッション初期化SQL
+* @return Napi::Value カーソル番号
+*/
+Napi::Value OmniPool::Materialize(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() < 1 || !info[0].IsString()) {
+    OmniDb::CreateTypeError(env, OString(_O("materialize(sql, options) sqlは必須です"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("接続プールは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(info[0].As<Napi::String>()));
+  Napi::Object options = info.Length() > 1 && info[1].IsObject() ? info[1].As<Napi::Object>() : Napi::Object::New(env);
+  size_t budget = SPILL_DEFAULT_QUERY_BUDGET;
+  if(options.Has("memoryBudget") && !options.Get("memoryBudget").IsUndefined()) {
+    if(!options.Get("memoryBudget").IsNumber() || options.Get("memoryBudget").As<Napi::Number>().DoubleValue() < 0) {
+      OmniDb::CreateTypeError(
+        env,
+        OString(_O("memoryBudget は0以上のバイト数で指定してください"))
+      ).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    budget = (size_t)options.Get("memoryBudget").As<Napi::Number>().DoubleValue();
+  }
+  size_t batchRows = FETCH_DEFAULT_ROWS;
+  FetchTuning tuning;
+  std::shared_ptr<PoolSession> session;
+  OString error;
+  if(!OmniDb::ToFetchTuning(options, batchRows, tuning, error)
+    || !GetSessionOption(options, "session", session, error)) {
+    OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::unique_ptr<QueryStream> stream(
+    new QueryStream(*m_pool, _S2O(sql.get()), session.get(), m_acquireTimeout, batchRows));
+  stream->SetTuning(tuning);
+  stream->SetMaterialize(budget);
+  stream->Start();
+
+  std::shared_ptr<StreamCursor> cursor(new StreamCursor());
+  cursor->session = session;
+  cursor->stream.reset(stream.release());
+  return Napi::Number::New(env, m_cursors.Add(cursor));
+}
+
+
+/**
+* カーソルから行を取得します
+*
+* @param[in] info Node.jsパラメータ(cursor, rows)
+* @return Napi::Value {columns, rows, done}(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniPool::Fetch(const Napi::CallbackInfo &info)
+{
+  return m_cursors.Fetch(info);
+}
+
+
+/**
+* カーソルを閉じます(読み残した結果は取得を取り消す)
+*
+* @param[in] info Node.jsパラメータ(cursor)
+* @return Napi::Value 閉じたか
+*/
+Napi::Value OmniPool::CloseCursor(const Napi::CallbackInfo &info)
+{
+  return m_cursors.Close(info);
+}
+
+
+/**
+* キーセットページングを開始します
+*
+* OFFSETの代わりに前のページの最後の行のキーより後を読みます。キーは
+* 結果の行を一意に決める列の組で、NULLを含まないことが必要です。
+*
+* @param[in] info Node.jsパラメータ(sql, options)
+*   options.keys     キー(列名、または{column, desc}の配列、必須)
+*   options.pageSize ページの行数(既定は100)
+*   options.prefetch ページを返した後で空き接続があれば次のページを先読みするか(既定はtrue)
+*   options.priority 'interactive'(既定)・'batch'
+*   options.session  接続に求めるセッション初期化SQL
+* @return Napi::Value ページング番号
+*/
+Napi::Value OmniPool::Paginate(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() < 2 || !info[0].IsString() || !info[1].IsObject()
+    || !info[1].As<Napi::Object>().Has("keys") || !info[1].As<Napi::Object>().Get("keys").IsArray()
+    || info[1].As<Napi::Object>().Get("keys").As<Napi::Array>().Length() == 0) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("paginate(sql, options) sqlとoptions.keys(キーの列の配列)は必須です"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("接続プールは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Object options = info[1].As<Napi::Object>();
+  std::vector<KeysetKey> keys;
+  Napi::Array list = options.Get("keys").As<Napi::Array>();
+  for(uint32_t i = 0; i < list.Length(); i++) {
+    Napi::Value v = list.Get(i);
+    KeysetKey key;
+    key.desc = false;
+    if(v.IsObject() && !v.IsArray()) {
+      Napi::Object o = v.As<Napi::Object>();
+      key.desc = o.Has("desc") && o.Get("desc").ToBoolean();
+      v = o.Get("column");
+    }
+    if(!v.IsString()) {
+      OmniDb::CreateTypeError(
+        env,
+        OString(_O("keysは列名または{column, desc}の配列で指定してください"))
+      ).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    std::unique_ptr<SQLTCHAR[]> column(OmniDb::NapiStringToSQLTCHAR(v.As<Napi::String>()));
+    key.column = _S2O(column.get());
+    keys.push_back(key);
+  }
+
+  std::shared_ptr<Pager> pager(new Pager());
+  pager->lane = LANE_INTERACTIVE;
+  pager->prefetch = !options.Has("prefetch") || options.Get("prefetch").ToBoolean();
+  pager->done = false;
+  pager->closed = false;
+  OString error;
+  if(!GetSessionOption(options, "session", pager->session, error)
+    || !GetLaneOption(options, pager->lane, error)) {
+    OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(info[0].As<Napi::String>()));
+  pager->query.reset(new KeysetQuery(_S2O(sql.get()), keys, GetUint32Option(options, "pageSize", 100)));
+
+  uint32_t id = m_nextPager++;
+  m_pagers[id] = pager;
+  return Napi::Number::New(env, id);
+}
+
+
+/**
+* 次のページを取得します
+*
+* 先読み済みならすぐに返し、先読み中ならその完了を待ちます。
+*
+* @param[in] info Node.jsパラメータ(pager)
+* @return Napi::Value {columns, rows, done}(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniPool::Page(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  std::unique_ptr<Napi::Promise::Deferred> deferred(new Napi::Promise::Deferred(Napi::Promise::Deferred::New(env)));
+  Napi::Promise promise = deferred->Promise();
+  std::map<uint32_t, std::shared_ptr<Pager> >::iterator it = info.Length() >= 1 && info[0].IsNumber()
+    ? m_pagers.find(info[0].As<Napi::Number>().Uint32Value()) : m_pagers.end();
+  if(it == m_pagers.end()) {
+    deferred->Reject(OmniDb::CreateError(env, OString(_O("ページングは終了しています"))).Value());
+    return promise;
+  }
+  std::shared_ptr<Pager> pager = it->second;
+  std::shared_ptr<PageTask> task = pager->pending;
+  if(task && task->finished) {
+    // 先読み済み
+    pager->pending.reset();
+    m_prefetchHits++;
+    DeliverPage(env, pager, task, *deferred);
+  } else if(task && task->waiter) {
+    deferred->Reject(OmniDb::CreateError(env, OString(_O("前のページの取得が終わっていません"))).Value());
+  } else if(task) {
+    // 先読みの完了を待つ
+    m_prefetchHits++;
+    task->waiter = std::move(deferred);
+  } else if(pager->done) {
+    deferred->Resolve(Napi::String::New(env, "{\"columns\":[],\"rows\":[],\"done\":true}"));
+  } else {
+    OString rejected;
+    if(m_limiter && !m_limiter->Enqueue(rejected)) {
+      deferred->Reject(OmniDb::CreateError(env, rejected).Value());
+      return promise;
+    }
+    StartPage(env, pager, std::move(deferred));
+  }
+  return promise;
+}
+
+
+/**
+* ページの取得を登録します
+*
+* 要求されたページは指定の優先度・同時実行数の制限の内で、先読みは
+* バッチの優先度・制限の外(空き接続がある場合のみ)で実行します。
+*
+* @param[in] env Node.js環境
+* @param[in] pager ページング
+* @param[in] waiter ページを待っているPromise(nullptrは先読み、同時実行数の制限に受け付け済みであること)
+*/
+void OmniPool::StartPage(Napi::Env env, std::shared_ptr<Pager> pager, std::unique_ptr<Napi::Promise::Deferred> waiter)
+{
+  std::shared_ptr<PageTask> task(new PageTask());
+  task->after = pager->after;
+  task->finished = false;
+  task->ok = false;
+  bool prefetch = !waiter;
+  task->waiter = std::move(waiter);
+  pager->pending = task;
+  ExecutorLane lane = prefetch ? LANE_BATCH : pager->lane;
+
+  m_bridge.BeginWork(env);
+  OmniPool *self = this;
+  m_executor->Submit([self, pager, task, prefetch, lane]() {
+    LimiterPermit permit(prefetch ? NULL : self->m_limiter.get());
+    PoolLease lease(*self->m_pool);
+    std::string sqlState;
+    if(permit.Acquire(true, lane == LANE_INTERACTIVE, task->error)
+      && self->AcquireRouted(lease, true, pager->session.get(), task->error)) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      task->ok = pager->query->Fetch(lease.hdbc(), task->after, task->page, task->error, sqlState);
+      if(!task->ok && IsConnectionSqlState(sqlState)) {
+        lease.MarkBroken();
+      }
+      if(task->ok && self->m_router) {
+        self->m_router->Complete(self->EndpointOf(lease), ElapsedMillis(start));
+      }
+    }
+    lease.Reset();
+    permit.Release();
+
+    self->m_bridge.Post([self, pager, task](Napi::Env env) {
+      Napi::HandleScope scope(env);
+      task->finished = true;
+      if(task->waiter) {
+        std::unique_ptr<Napi::Promise::Deferred> waiter = std::move(task->waiter);
+        if(pager->closed) {
+          waiter->Reject(OmniDb::CreateError(env, OString(_O("ページングは終了しています"))).Value());
+        } else {
+          pager->pending.reset();
+          self->DeliverPage(env, pager, task, *waiter);
+        }
+      }
+      self->m_bridge.EndWork(env);
+    });
+  }, lane);
+}
+
+
+/**
+* 取得したページを返して次のページを先読みします
+*
+* @param[in] env Node.js環境
+* @param[in] pager ページング
+* @param[in] task 完了した取得
+* @param[in] deferred ページを返すPromise
+*/
+void OmniPool::DeliverPage(
+  Napi::Env env, std::shared_ptr<Pager> pager, std::shared_ptr<PageTask> task, Napi::Promise::Deferred &deferred)
+{
+  if(!task->ok) {
+    // キーは進めないので同じページを取得し直せる
+    deferred.Reject(OmniDb::CreateError(env, task->error).Value());
+    return;
+  }
+  if(task->page.rows > 0) {
+    pager->after = task->page.last;
+  }
+  pager->done = task->page.done;
+  m_pages++;
+  deferred.Resolve(Napi::String::New(env, task->page.json));
+
+  if(pager->prefetch && !pager->done && !m_closed && HasSpareConnection()) {
+    m_prefetches++;
+    StartPage(env, pager, std::unique_ptr<Napi::Promise::Deferred>());
+  }
+}
+
+
+/**
+* 空き接続があるか(いずれかの接続先に空き接続・接続の余地がある)
+*
+* @return bool 空き接続があるか
+*/
+bool OmniPool::HasSpareConnection()
+{
+  for(size_t i = 0; i < 1 + m_replicas.size(); i++) {
+    ConnectionPoolStats stats = Endpoint(i).Stats();
+    if(stats.idle > 0 || stats.total < Endpoint(i).MaxSize()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+* キーセットページングを終了します(先読み中のページは捨てる)
+*
+* @param[in] info Node.jsパラメータ(pager)
+* @return Napi::Value 終了したか
+*/
+Napi::Value OmniPool::ClosePager(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  std::map<uint32_t, std::shared_ptr<Pager> >::iterator it = info.Length() >= 1 && info[0].IsNumber()
+    ? m_pagers.find(info[0].As<Napi::Number>().Uint32Value()) : m_pagers.end();
+  if(it == m_pagers.end()) {
+    return Napi::Boolean::New(env, false);
+  }
+  it->second->closed = true;
+  m_pagers.erase(it);
+  return Napi::Boolean::New(env, true);
+}
+
+
+/**
+* 複数のSQLを並列で解析します
+*
+* describeAll(statements, options, onResult, onProgress)
+*   options.parallelism   同時に解析する数(既定は最大接続数)
+*   options.retries       一時的な失敗の再試行回数
+*   options.retryDelay    再試行間隔(ミリ秒)
+*   options.label         ラベルを出力するか
+*   options.progressInterval 進捗通知間隔(ミリ秒)
+*   options.session       接続に求めるセッション初期化SQL
+*   options.priority      優先度(既定は'batch')
+*   onResult(index, error, result) 入力順に呼び出します
+*   onProgress(progress)  進捗(JSON形式の文字列)
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 集計(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniPool::DescribeAll(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  //
+  // パラメータチェック
+  //
+  if(info.Length() < 3 || !info[0].IsArray() || !info[2].IsFunction()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("describeAll(statements, options, onResult, onProgress) statementsは配列、onResultは関数で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(info.Length() >= 4 && !info[3].IsUndefined() && !info[3].IsNull() && !info[3].IsFunction()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("onProgress は関数のみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("接続プールは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  //
+  // ジョブの状態
+  //
+  struct DescribeOutcome {
+    bool ok;
+    int attempts;
+    std::string result;
+    OString error;
+  };
+  struct DescribeJob {
+    // 入力(ワーカースレッドは読むだけ)
+    std::vector<OString> statements;
+    std::shared_ptr<PoolSession> session;
+    ExecutorLane lane;
+    bool label;
+    int retries;
+    uint32_t retryDelay;
+    // 次に処理する番号
+    std::atomic<size_t> next;
+    // 結果(各要素は1つのワーカーだけが書き込む)
+    std::vector<DescribeOutcome> outcomes;
+
+    // 以下はJSスレッドのみ
+    std::vector<bool> ready;
+    size_t emitted;
+    size_t completed;
+    size_t failed;
+    size_t retried;
+    size_t workers;
+    size_t workersDone;
+    // 中断(コールバックの例外、ワーカーも参照)
+    std::atomic<bool> aborted;
+    uint32_t progressInterval;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point lastProgress;
+    Napi::FunctionReference onResult;
+    Napi::FunctionReference onProgress;
+    Napi::Promise::Deferred deferred;
+    DescribeJob(Napi::Env env) : next(0), aborted(false), deferred(Napi::Promise::Deferred::New(env)) {}
+  };
+  std::shared_ptr<DescribeJob> job(new DescribeJob(env));
+
+  Napi::Array statements = info[0].As<Napi::Array>();
+  uint32_t count = statements.Length();
+  for(uint32_t i = 0; i < count; i++) {
+    Napi::Value v = statements.Get(i);
+    if(!v.IsString()) {
+      OmniDb::CreateTypeError(
+        env,
+        OString(_O("statements は文字列の配列で指定してください"))
+      ).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(v.As<Napi::String>()));
+    job->statements.push_back(_S2O(sql.get()));
+  }
+
+  uint32_t parallelism = (uint32_t)m_executor->Threads();
+  job->label = false;
+  job->retries = POOL_DEFAULT_RETRIES;
+  job->retryDelay = POOL_DEFAULT_RETRY_DELAY;
+  job->progressInterval = POOL_DEFAULT_PROGRESS_INTERVAL;
+  job->lane = LANE_BATCH;
+  if(info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    parallelism = GetUint32Option(options, "parallelism", parallelism);
+    if(options.Has("label")) {
+      job->label = options.Get("label").ToBoolean();
+    }
+    job->retries = (int)GetUint32Option(options, "retries", job->retries);
+    job->retryDelay = GetUint32Option(options, "retryDelay", job->retryDelay);
+    job->progressInterval = GetUint32Option(options, "progressInterval", job->progressInterval);
+    OString error;
+    if(!GetSessionOption(options, "session", job->session, error)
+      || !GetLaneOption(options, job->lane, error)) {
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+  // ワーカースレッド数・件数を超える並列度は意味が無い
+  parallelism = std::min(parallelism, (uint32_t)m_executor->Threads());
+  parallelism = std::min(parallelism, count);
+  if(parallelism == 0 && count > 0) {
+    parallelism = 1;
+  }
+
+  job->outcomes.resize(count);
+  job->ready.assign(count, false);
+  job->emitted = 0;
+  job->completed = 0;
+  job->failed = 0;
+  job->retried = 0;
+  job->workers = parallelism;
+  job->workersDone = 0;
+  job->start = std::chrono::steady_clock::now();
+  job->lastProgress = job->start;
+  job->onResult = Napi::Persistent(info[2].As<Napi::Function>());
+  if(info.Length() >= 4 && info[3].IsFunction()) {
+    job->onProgress = Napi::Persistent(info[3].As<Napi::Function>());
+  }
+
+  //
+  // 進捗・集計(JSスレッド)
+  //
+  std::function<json()> progress = [job]() {
+    double elapsed = ElapsedMillis(job->start);
+    json p = json::object();
+    p["total"] = job->statements.size();
+    p["done"] = job->completed;
+    p["failed"] = job->failed;
+    p["retries"] = job->retried;
+    p["parallelism"] = job->workers;
+    p["elapsedMs"] = elapsed;
+    p["perSecond"] = elapsed > 0 ? job->completed * 1000.0 / elapsed : 0;
+    return p;
+  };
+
+  // 終了処理(全ワーカー終了時)
+  OmniPool *self = this;
+  std::function<void(Napi::Env)> finish = [self, job, progress](Napi::Env env) {
+    if(!job->aborted) {
+      job->deferred.Resolve(Napi::String::New(env, progress().dump()));
+    }
+    job->onResult.Reset();
+    job->onProgress.Reset();
+    self->m_bridge.EndWork(env);
+  };
+
+  m_bridge.BeginWork(env);
+  if(parallelism == 0) {
+    finish(env);
+    return job->deferred.Promise();
+  }
+
+  //
+  // 1件解析するごとにJSスレッドへ通知し、入力順に揃った分だけ返します
+  //
+  std::function<void(Napi::Env, size_t)> described = [job, progress](Napi::Env env, size_t index) {
+    Napi::HandleScope scope(env);
+    const DescribeOutcome &o = job->outcomes[index];
+    job->ready[index] = true;
+    job->completed++;
+    job->failed += o.ok ? 0 : 1;
+    job->retried += o.attempts > 1 ? o.attempts - 1 : 0;
+    if(job->aborted) {
+      return;
+    }
+
+    while(job->emitted < job->ready.size() && job->ready[job->emitted]) {
+      size_t i = job->emitted++;
+      DescribeOutcome &r = job->outcomes[i];
+      Napi::Value err = r.ok ? env.Null() : OmniDb::CreateError(env, r.error).Value();
+      Napi::Value res = r.ok ? (Napi::Value)Napi::String::New(env, r.result) : env.Null();
+      job->onResult.Call({ Napi::Number::New(env, (double)i), err, res });
+      // 返却済みの結果は解放
+      std::string().swap(r.result);
+      if(env.IsExceptionPending()) {
+        // コールバックの例外はジョブの失敗として返す
+        job->aborted = true;
+        job->deferred.Reject(env.GetAndClearPendingException().Value());
+        return;
+      }
+    }
+
+    if(!job->onProgress.IsEmpty()) {
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      bool last = job->completed == job->statements.size();
+      if(last || ElapsedMillis(job->lastProgress) >= job->progressInterval) {
+        job->lastProgress = now;
+        job->onProgress.Call({ Napi::String::New(env, progress().dump()) });
+        if(env.IsExceptionPending()) {
+          job->aborted = true;
+          job->deferred.Reject(env.GetAndClearPendingException().Value());
+        }
+      }
+    }
+  };
+
+  for(uint32_t w = 0; w < parallelism; w++) {
+    m_executor->Submit([self, job, described, finish]() {
+      // ワーカーごとに1接続を使い続ける
+      PoolLease lease(*self->m_pool);
+      for(;;) {
+        size_t index = job->next.fetch_add(1);
+        if(index >= job->statements.size()) {
+          break;
+        }
+        if(job->aborted) {
+          // 中断後は解析せずに順番だけ進める
+          job->outcomes[index].ok = false;
+          job->outcomes[index].attempts = 0;
+        } else {
+          DescribeOutcome &o = job->outcomes[index];
+          o.ok = self->DescribeWithRetry(
+            lease, false, job->lane, job->session.get(), job->statements[index], job->label, job->retries, job->retryDelay,
+            o.result, o.error, o.attempts);
+        }
+        self->m_bridge.Post([described, index](Napi::Env env) { described(env, index); });
+      }
+      lease.Reset();
+      self->m_bridge.Post([job, finish](Napi::Env env) {
+        if(++job->workersDone == job->workers) {
+          finish(env);
+        }
+      });
+    }, job->lane);
+  }
+
+  return job->deferred.Promise();
+}
+
+
+/**
+* 配列パラメータでSQLを一括実行します(OmniDb.executeBulkのプール版)
+*
+* パラメータの型はSQLごとに1度だけワーカースレッドで取得して覚えておき、
+* 2回目以降はすぐに変換して実行を登録します。
+*
+* @param[in] info Node.jsパラメータ(sql, columns, options)
+* @return Napi::Value 行ごとの状態・更新行数(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniPool::ExecuteBulk(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  //
+  // executeBulk(sql, columns, options)
+  // のパラメータチェック ※optionsは任意
+  //
+  if(info.Length() < 2 || !info[0].IsString() || !info[1].IsArray()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("executeBulk(sql, columns, options) sqlは文字列、columnsは配列で指定してください"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("接続プールは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::shared_ptr<BulkTask> task(new BulkTask(env));
+  std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(info[0].As<Napi::String>()));
+  task->sql = _S2O(sql.get());
+  task->values = Napi::Persistent(info[1].As<Napi::Object>());
+  task->rows = 0;
+  task->batchSize = BULK_DEFAULT_BATCH_SIZE;
+  task->stopOnError = true;
+  task->lane = LANE_BATCH;
+  task->ok = false;
+  if(info.Length() >= 3 && info[2].IsObject()) {
+    Napi::Object options = info[2].As<Napi::Object>();
+    task->batchSize = GetUint32Option(options, "batchSize", (uint32_t)task->batchSize);
+    if(options.Has("stopOnError")) {
+      task->stopOnError = options.Get("stopOnError").ToBoolean();
+    }
+    if(!GetSessionOption(options, "session", task->session, task->error)
+      || !GetLaneOption(options, task->lane, task->error)) {
+      OmniDb::CreateTypeError(env, task->error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+
+  m_bridge.BeginWork(env);
+  std::map<OString, std::vector<BulkParamType> >::const_iterator it = m_paramTypes.find(task->sql);
+  if(it != m_paramTypes.end()) {
+    StartBulk(env, task, it->second);
+    return task->deferred.Promise();
+  }
+
+  //
+  // 初回はパラメータの型を取得してから変換
+  //
+  OmniPool *self = this;
+  m_executor->Submit([self, task]() {
+    std::shared_ptr<std::vector<BulkParamType> > types(new std::vector<BulkParamType>());
+    {
+      PoolLease lease(*self->m_pool);
+      BulkStatement stmt;
+      if(lease.Acquire(self->m_acquireTimeout, task->error, task->session.get())
+        && AttachCached(lease, stmt, task->sql, task->error)) {
+        stmt.DescribeParams(*types);
+        task->ok = true;
+      }
+    }
+    self->m_bridge.Post([self, task, types](Napi::Env env) {
+      Napi::HandleScope scope(env);
+      if(!task->ok) {
+        self->FinishBulk(env, task);
+        return;
+      }
+      if(self->m_paramTypes.size() >= POOL_PARAM_TYPES_CACHE) {
+        self->m_paramTypes.clear();
+      }
+      self->m_paramTypes[task->sql] = *types;
+      self->StartBulk(env, task, *types);
+    });
+  }, task->lane);
+  return task->deferred.Promise();
+}
+
+
+/**
+* パラメータを変換して一括実行を登録します(JSスレッド)
+*
+* @param[in] env Node.js環境
+* @param[in] task 一括実行の要求
+* @param[in] types パラメータの型
+*/
+void OmniPool::StartBulk(Napi::Env env, std::shared_ptr<BulkTask> task, const std::vector<BulkParamType> &types)
+{
+  task->ok = false;
+  if(!ToBulkColumns(task->values.Value(), types, task->columns, task->pins, task->rows, task->error)) {
+    FinishBulk(env, task);
+    return;
+  }
+  // 処理待ちが上限を超える場合は実行せずに断る
+  if(m_limiter && !m_limiter->Enqueue(task->error)) {
+    FinishBulk(env, task);
+    return;
+  }
+
+  OmniPool *self = this;
+  m_executor->Submit([self, task]() {
+    LimiterPermit permit(self->m_limiter.get());
+    PoolLease lease(*self->m_pool);
+    BulkStatement stmt;
+    if(!permit.Acquire(true, task->lane == LANE_INTERACTIVE, task->error)) {
+      // 許可待ちのタイムアウト
+    } else if(lease.Acquire(self->m_acquireTimeout, task->error, task->session.get())
+      && AttachCached(lease, stmt, task->sql, task->error)) {
+      stmt.ExecuteAll(task->columns, task->rows, task->batchSize, task->stopOnError, task->result);
+      task->ok = true;
+      // 通信断の接続はプールに戻さない
+      for(size_t i = 0; i < task->result.errors.size(); i++) {
+        if(IsConnectionSqlState(task->result.errors[i].sqlState)) {
+          lease.MarkBroken();
+        }
+        if(IsTransientSqlState(task->result.errors[i].sqlState)) {
+          permit.MarkOverload();
+        }
+      }
+    } else {
+      permit.MarkOverload();
+    }
+    stmt.Free();
+    lease.Reset();
+    permit.Release();
+    self->m_bridge.Post([self, task](Napi::Env env) {
+      Napi::HandleScope scope(env);
+      self->FinishBulk(env, task);
+    });
+  }, task->lane);
+}
+
+
+/**
+* 一括実行の完了(JSスレッド)
+*
+* @param[in] env Node.js環境
+* @param[in] task 一括実行の要求
+*/
+void OmniPool::FinishBulk(Napi::Env env, std::shared_ptr<BulkTask> task)
+{
+  if(task->ok) {
+    task->deferred.Resolve(Napi::String::New(env, OmniDb::BulkResultToJson(task->result)));
+  } else {
+    task->deferred.Reject(OmniDb::CreateError(env, task->error).Value());
+  }
+  // 実行し終えたのでJSオブジェクトの参照を外す
+  task->pins.clear();
+  task->values.Reset();
+  m_bridge.EndWork(env);
+}
+
+
+/**
+* ウォームアップ
+*
+* 最小接続数の接続を並列に開き、各接続で頻繁に使うSQLを準備しておきます。
+* 準備した文は接続ごとに覚えておき、executeBulkで再利用します。
+*
+* warmup(options)
+*   options.min         接続しておく数(既定はプールのmin、未指定の場合はmax)
+*   options.statements  準備しておくSQLの配列
+*   options.session     接続に求めるセッション初期化SQL
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 段階ごとの所要時間(JSON形式の文字列)を返すPromise
+*/
+Napi::Value OmniPool::Warmup(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if(info.Length() >= 1 && !info[0].IsUndefined() && !info[0].IsNull() && !info[0].IsObject()) {
+    OmniDb::CreateTypeError(
+      env,
+      OString(_O("warmup(options) options はオブジェクトのみ指定できます"))
+    ).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(m_closed) {
+    OmniDb::CreateError(env, OString(_O("接続プールは閉じられています"))).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  //
+  // ジョブの状態
+  //
+  struct WarmConnection {
+    // 接続先(0はプライマリ)
+    size_t endpoint;
+    uint64_t id;
+    double connectMs;
+    double prepareMs;
+    size_t prepared;
+    OString error;
+  };
+  struct WarmJob {
+    std::vector<OString> statements;
+    std::shared_ptr<PoolSession> session;
+    size_t count;
+    std::vector<WarmConnection> connections;
+    std::chrono::steady_clock::time_point start;
+    // 全接続がそろうまで借りたままにする(同じ接続を使い回さないように)
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t arrived;
+    double connectMs;
+    // 以下はJSスレッドのみ
+    size_t done;
+    Napi::Promise::Deferred deferred;
+    WarmJob(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {}
+  };
+  std::shared_ptr<WarmJob> job(new WarmJob(env));
+
+  size_t count = m_pool->MinSize() > 0 ? m_pool->MinSize() : m_pool->MaxSize();
+  if(info.Length() >= 1 && info[0].IsObject()) {
+    Napi::Object options = info[0].As<Napi::Object>();
+    count = GetUint32Option(options, "min", (uint32_t)count);
+    if(options.Has("statements")) {
+      Napi::Value v = options.Get("statements");
+      bool valid = v.IsArray();
+      Napi::Array statements = valid ? v.As<Napi::Array>() : Napi::Array::New(env);
+      for(uint32_t i = 0; valid && i < statements.Length(); i++) {
+        if(!statements.Get(i).IsString()) {
+          valid = false;
+          break;
+        }
+        std::unique_ptr<SQLTCHAR[]> sql(OmniDb::NapiStringToSQLTCHAR(statements.Get(i).As<Napi::String>()));
+        job->statements.push_back(_S2O(sql.get()));
+      }
+      if(!valid) {
+        OmniDb::CreateTypeError(
+          env,
+          OString(_O("statements は文字列の配列で指定してください"))
+        ).ThrowAsJavaScriptException();
+        return env.Null();
+      }
+    }
+    OString error;
+    if(!GetSessionOption(options, "session", job->session, error)) {
+      OmniDb::CreateTypeError(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+  // 接続先ごとの最大接続数を超えて同時に借りることはできない
+  // (ワーカースレッドは最大接続数×接続先の数、バッチ処理の予約分を除く)
+  size_t endpoints = 1 + m_replicas.size();
+  count = std::min(count, m_pool->MaxSize());
+  count = std::min(count * endpoints, m_executor->Threads() - m_executor->Reserved(LANE_BATCH));
+  job->count = count;
+  job->connections.resize(count);
+  for(size_t w = 0; w < count; w++) {
+    // レプリカも同じ数だけ接続(準備するSQLは更新に使うプライマリのみ)
+    job->connections[w].endpoint = w % endpoints;
+  }
+  job->arrived = 0;
+  job->connectMs = 0;
+  job->done = 0;
+  job->start = std::chrono::steady_clock::now();
+
+  //
+  // 集計(JSスレッド)
+  //
+  OmniPool *self = this;
+  std::function<void(Napi::Env)> finish = [self, job](Napi::Env env) {
+    Napi::HandleScope scope(env);
+    json result = json::object();
+    json connections = json::array();
+    size_t opened = 0;
+    size_t prepared = 0;
+    size_t failed = 0;
+    double prepareMs = 0;
+    for(size_t i = 0; i < job->connections.size(); i++) {
+      const WarmConnection &c = job->connections[i];
+      json item = json::object();
+      item["connectMs"] = c.connectMs;
+      item["prepareMs"] = c.prepareMs;
+      item["prepared"] = c.prepared;
+      if(!self->m_replicas.empty()) {
+        item["endpoint"] = c.endpoint;
+      }
+      if(c.id > 0) {
+        item["id"] = c.id;
+        opened++;
+      }
+      if(!c.error.empty()) {
+        item["error"] = to_jsonstr(c.error);
+        failed++;
+      }
+      prepared += c.prepared;
+      prepareMs = std::max(prepareMs, c.prepareMs);
+      connections.push_back(item);
+    }
+    result["connections"] = opened;
+    result["statements"] = job->statements.size();
+    result["prepared"] = prepared;
+    result["failed"] = failed;
+    result["connectMs"] = job->connectMs;
+    result["prepareMs"] = prepareMs;
+    result["totalMs"] = ElapsedMillis(job->start);
+    result["details"] = connections;
+    job->deferred.Resolve(Napi::String::New(env, result.dump(-1, ' ', true, json::error_handler_t::replace)));
+    self->m_bridge.EndWork(env);
+  };
+
+  m_bridge.BeginWork(env);
+  if(count == 0) {
+    finish(env);
+    return job->deferred.Promise();
+  }
+
+  for(size_t w = 0; w < count; w++) {
+    m_executor->Submit([self, job, finish, w]() {
+      WarmConnection &c = job->connections[w];
+      c.id = 0;
+      c.connectMs = 0;
+      c.prepareMs = 0;
+      c.prepared = 0;
+
+      //
+      // 接続(空きが無ければ新しく接続される)
+      //
+      PoolLease lease(self->Endpoint(c.endpoint));
+      bool ok = lease.Acquire(self->m_acquireTimeout, c.error, job->session.get());
+      c.connectMs = ElapsedMillis(job->start);
+      if(ok) {
+        c.id = lease.get()->id;
+      }
+
+      // 全ワーカーが借りるまで待つ(失敗したワーカーも数える)
+      {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        if(++job->arrived == job->count) {
+          job->connectMs = ElapsedMillis(job->start);
+          job->cv.notify_all();
+        } else {
+          job->cv.wait_for(lock, std::chrono::milliseconds(self->m_acquireTimeout), [job]() {
+            return job->arrived == job->count;
+          });
+        }
+      }
+
+      //
+      // SQLの準備
+      //
+      std::chrono::steady_clock::time_point prepareStart = std::chrono::steady_clock::now();
+      for(size_t i = 0; ok && c.endpoint == ROUTE_PRIMARY && i < job->statements.size(); i++) {
+        OString error;
+        if(lease.get()->Prepare(job->statements[i], error)) {
+          c.prepared++;
+        } else if(c.error.empty()) {
+          c.error = error;
+        }
+      }
+      c.prepareMs = ElapsedMillis(prepareStart);
+      lease.Reset();
+
+      self->m_bridge.Post([job, finish](Napi::Env env) {
+        if(++job->done == job->count) {
+          finish(env);
+        }
+      });
+    });
+  }
+
+  return job->deferred.Promise();
+}
+
+
+/**
+* 統計
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 統計をJSON形式の文字列で返します
+*/
+Napi::Value OmniPool::Stats(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  ConnectionPoolStats stats = m_pool ? m_pool->Stats() : ConnectionPoolStats();
+  json result = json::object();
+  result["total"] = m_pool ? stats.total : 0;
+  result["min"] = m_pool ? stats.min : 0;
+  result["idle"] = m_pool ? stats.idle : 0;
+  result["waiting"] = m_pool ? stats.waiting : 0;
+  result["created"] = m_pool ? stats.created : 0;
+  result["destroyed"] = m_pool ? stats.destroyed : 0;
+  result["acquired"] = m_pool ? stats.acquired : 0;
+  result["timeouts"] = m_pool ? stats.timeouts : 0;
+  result["sessionHits"] = m_pool ? stats.sessionHits : 0;
+  result["sessionInits"] = m_pool ? stats.sessionInits : 0;
+  result["sessionEvictions"] = m_pool ? stats.sessionEvictions : 0;
+  result["probes"] = m_pool ? stats.probes : 0;
+  result["probeFailures"] = m_pool ? stats.probeFailures : 0;
+  result["replacements"] = m_pool ? stats.replacements : 0;
+  result["deadOnAcquire"] = m_pool ? stats.deadOnAcquire : 0;
+  result["queued"] = m_executor ? m_executor->Pending() : 0;
+  result["inFlight"] = m_bridge.Pending();
+  result["cursors"] = m_cursors.Size();
+  result["scannedRows"] = m_cursors.Rows();
+  // scan・materializeのストリームの取得(全接続先の合計)
+  json fetch = json::object();
+  uint64_t fetches = 0;
+  uint64_t fetchRows = 0;
+  uint64_t fetchBytes = 0;
+  uint64_t fetchMicros = 0;
+  for(size_t i = 0; m_pool && i < 1 + m_replicas.size(); i++) {
+    ConnectionPoolStats es = Endpoint(i).Stats();
+    fetches += es.fetches;
+    fetchRows += es.fetchRows;
+    fetchBytes += es.fetchBytes;
+    fetchMicros += es.fetchMicros;
+  }
+  fetch["fetches"] = fetches;
+  fetch["rows"] = fetchRows;
+  fetch["bytes"] = fetchBytes;
+  fetch["millis"] = fetchMicros / 1000;
+  result["fetch"] = fetch;
+  json pages = json::object();
+  pages["pagers"] = m_pagers.size();
+  pages["pages"] = m_pages;
+  pages["prefetches"] = m_prefetches;
+  pages["prefetchHits"] = m_prefetchHits;
+  result["pages"] = pages;
+  if(m_router) {
+    json endpoints = json::array();
+    for(size_t i = 0; i < m_router->Size(); i++) {
+      EndpointStats es = m_router->Stats(i);
+      ConnectionPoolStats ps = Endpoint(i).Stats();
+      json endpoint = json::object();
+      endpoint["role"] = i == ROUTE_PRIMARY ? "primary" : "replica";
+      endpoint["latencyMs"] = es.latencyMs;
+      endpoint["routed"] = es.routed;
+      endpoint["failures"] = es.failures;
+      endpoint["healthy"] = es.healthy;
+      endpoint["total"] = ps.total;
+      endpoint["idle"] = ps.idle;
+      endpoints.push_back(endpoint);
+    }
+    result["endpoints"] = endpoints;
+  }
+  if(m_hedge) {
+    HedgeStats hs = m_hedge->Stats();
+    json hedge = json::object();
+    hedge["delayMs"] = hs.delayMs;
+    hedge["requests"] = hs.requests;
+    hedge["hedged"] = hs.hedged;
+    hedge["hedgeWins"] = hs.hedgeWins;
+    hedge["budgetDenied"] = hs.budgetDenied;
+    hedge["cancelled"] = hs.cancelled;
+    result["hedge"] = hedge;
+  }
+  if(m_executor) {
+    const char *names[LANE_COUNT] = { "interactive", "batch" };
+    json lanes = json::object();
+    for(int i = 0; i < LANE_COUNT; i++) {
+      json lane = json::object();
+      lane["queued"] = m_executor->Pending((ExecutorLane)i);
+      lane["running"] = m_executor->Running((ExecutorLane)i);
+      lane["reserved"] = m_executor->Reserved((ExecutorLane)i);
+      lanes[names[i]] = lane;
+    }
+    result["lanes"] = lanes;
+  }
+  if(m_limiter) {
+    LimiterStats ls = m_limiter->Stats();
+    json limiter = json::object();
+    limiter["limit"] = ls.limit;
+    limiter["inFlight"] = ls.inFlight;
+    limiter["waiting"] = ls.waiting;
+    limiter["completed"] = ls.completed;
+    limiter["rejected"] = ls.rejected;
+    limiter["timeouts"] = ls.timeouts;
+    limiter["overloads"] = ls.overloads;
+    limiter["minLatencyMs"] = ls.minLatencyMs;
+    limiter["shortLatencyMs"] = ls.shortLatencyMs;
+    limiter["longLatencyMs"] = ls.longLatencyMs;
+    result["limiter"] = limiter;
+  }
+  return Napi::String::New(env, result.dump());
+}
+
+
+/**
+* プールを閉じます(空き接続を切断し、以降の要求を受け付けません)
+*
+* @param[in] info Node.jsパラメータ
+* @return Napi::Value 成否
+*/
+Napi::Value OmniPool::Close(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  m_closed = true;
+  if(m_hedge) {
+    m_hedge->Close();
+  }
+  m_cursors.CloseAll();
+  for(std::map<uint32_t, std::shared_ptr<Pager> >::iterator it = m_pagers.begin(); it != m_pagers.end(); it++) {
+    it->second->closed = true;
+  }
+  m_pagers.clear();
+  if(m_pool) {
+    m_pool->Close();
+  }
+  for(size_t i = 0; i < m_replicas.size(); i++) {
+    m_replicas[i]->Close();
+  }
+  return Napi::Boolean::New(env, true);
+}
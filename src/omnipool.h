@@ -0,0 +1,207 @@
+﻿#ifndef _OMNIPOOL_H
+#define _OMNIPOOL_H
+#include <napi.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "omnicommon.h"
+#include "connpool.h"
+#include "executor.h"
+#include "asyncbridge.h"
+#include "bulkexec.h"
+#include "bulkparams.h"
+#include "limiter.h"
+#include "hedge.h"
+#include "router.h"
+#include "cursortable.h"
+#include "keyset.h"
+
+//
+// 接続プール(Node.js公開クラス)
+//
+// ODBCの処理はExecutorのワーカースレッドで実行し、結果はThreadSafeFunction
+// 経由でJSスレッドに戻してPromiseを解決します。
+//
+// replicasオプションで読み取りレプリカを指定した場合は接続先ごとにプールを持ち、
+// 読み取り専用の処理(SQL解析・カタログ・読み取りのexecute)は処理時間の
+// 短い接続先に振り分けます。更新(executeBulk等)は常にプライマリです。
+//
+class OmniPool : public Napi::ObjectWrap<OmniPool> {
+public:
+  // 初期化
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+  OmniPool(const Napi::CallbackInfo& info);
+  ~OmniPool() override;
+
+  // SQL情報取得
+  Napi::Value Query(const Napi::CallbackInfo& info);
+  // SQL実行(読み取り専用のSQLはヘッジ実行)
+  Napi::Value Execute(const Napi::CallbackInfo& info);
+  // テーブル情報取得
+  Napi::Value Tables(const Napi::CallbackInfo& info);
+  // カラム情報取得
+  Napi::Value Columns(const Napi::CallbackInfo& info);
+  // 複数SQLの情報を並列で取得
+  Napi::Value DescribeAll(const Napi::CallbackInfo& info);
+  // 配列パラメータで一括実行
+  Napi::Value ExecuteBulk(const Napi::CallbackInfo& info);
+  // ウォームアップ(最小接続数の接続・SQLの準備)
+  Napi::Value Warmup(const Napi::CallbackInfo& info);
+  // テーブルを区画に分けて並列に読む
+  Napi::Value Scan(const Napi::CallbackInfo& info);
+  // SELECTの全行を取得してから読む(予算を超えた分は一時ファイル)
+  Napi::Value Materialize(const Napi::CallbackInfo& info);
+  // カーソルから行を取得
+  Napi::Value Fetch(const Napi::CallbackInfo& info);
+  // カーソルを閉じる
+  Napi::Value CloseCursor(const Napi::CallbackInfo& info);
+  // キーセットページングを開始
+  Napi::Value Paginate(const Napi::CallbackInfo& info);
+  // 次のページを取得
+  Napi::Value Page(const Napi::CallbackInfo& info);
+  // キーセットページングを終了
+  Napi::Value ClosePager(const Napi::CallbackInfo& info);
+  // 統計
+  Napi::Value Stats(const Napi::CallbackInfo& info);
+  // プールを閉じる
+  Napi::Value Close(const Napi::CallbackInfo& info);
+
+private:
+  // SQL実行の要求(ヘッジした場合は2つの試行で共有)
+  struct ExecuteTask {
+    OString sql;
+    std::shared_ptr<PoolSession> session;
+    ExecutorLane lane;
+    bool results;
+    size_t maxRows;
+    // ヘッジするか
+    bool hedge;
+    // 読み取り専用か(レプリカに振り分ける)
+    bool readOnly;
+    // 試行ごとの接続先
+    size_t endpoint[2];
+    // 試行ごとの取り消し
+    CancelToken cancel[2];
+    // 以下はmutexで保護
+    std::mutex mutex;
+    bool settled;
+    int running;
+    bool ok;
+    std::string result;
+    OString error;
+    Napi::Promise::Deferred deferred;
+    ExecuteTask(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {}
+  };
+  // SQLを実行します(ワーカースレッド)
+  void ExecuteAttempt(std::shared_ptr<ExecuteTask> task, int attempt);
+
+  // 一括実行の要求
+  struct BulkTask {
+    OString sql;
+    // 接続に求めるセッション(nullptrは既定)
+    std::shared_ptr<PoolSession> session;
+    // 優先度
+    ExecutorLane lane;
+    // 列ごとの値(変換するまで保持)
+    Napi::ObjectReference values;
+    std::vector<BulkColumn> columns;
+    BulkPins pins;
+    size_t rows;
+    size_t batchSize;
+    bool stopOnError;
+    bool ok;
+    OString error;
+    BulkResult result;
+    Napi::Promise::Deferred deferred;
+    BulkTask(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {}
+  };
+  // パラメータを変換して一括実行を登録します(JSスレッド)
+  void StartBulk(Napi::Env env, std::shared_ptr<BulkTask> task, const std::vector<BulkParamType> &types);
+  // 一括実行の完了(JSスレッド)
+  void FinishBulk(Napi::Env env, std::shared_ptr<BulkTask> task);
+
+  // 1ページの取得(先読みを含む)
+  struct PageTask {
+    // 前のページの最後の行のキー
+    std::vector<KeysetValue> after;
+    // 以下は完了後にJSスレッドで参照
+    bool finished;
+    bool ok;
+    KeysetPage page;
+    OString error;
+    // ページを待っているPromise(先読みは要求されるまでnullptr)
+    std::unique_ptr<Napi::Promise::Deferred> waiter;
+  };
+  // キーセットページング(JSスレッドのみ)
+  struct Pager {
+    std::shared_ptr<KeysetQuery> query;
+    std::shared_ptr<PoolSession> session;
+    ExecutorLane lane;
+    // 次のページを先読みするか
+    bool prefetch;
+    // 次のページのシーク条件のキー(最初のページは空)
+    std::vector<KeysetValue> after;
+    bool done;
+    bool closed;
+    // 取得中・先読み済みのページ
+    std::shared_ptr<PageTask> pending;
+  };
+  // ページの取得を登録します(waiterがnullptrなら先読み)
+  void StartPage(Napi::Env env, std::shared_ptr<Pager> pager, std::unique_ptr<Napi::Promise::Deferred> waiter);
+  // 取得したページを返して次のページを先読みします
+  void DeliverPage(
+    Napi::Env env, std::shared_ptr<Pager> pager, std::shared_ptr<PageTask> task, Napi::Promise::Deferred &deferred);
+  // 空き接続があるか(先読みは空きがある場合のみ)
+  bool HasSpareConnection();
+
+  // 接続先のプール(0はプライマリ)
+  ConnectionPool &Endpoint(size_t endpoint);
+  // 接続先を選んで接続を借ります(ワーカースレッド、excludeは避ける接続先)
+  bool AcquireRouted(
+    PoolLease &lease, bool readOnly, const PoolSession *session, OString &error, size_t exclude = (size_t)-1);
+  // 借りている接続の接続先
+  size_t EndpointOf(const PoolLease &lease);
+
+  // テーブル・カラム情報取得(共通処理)
+  Napi::Value Catalog(const Napi::CallbackInfo& info, bool columns);
+
+  // 再試行付きのSQL解析(ワーカースレッド)
+  bool DescribeWithRetry(
+    PoolLease &lease, bool enqueued, ExecutorLane lane, const PoolSession *session, const OString &sql, bool label,
+    int retries, uint32_t retryDelay, std::string &result, OString &error, int &attempts);
+
+  // 接続プール(プライマリ)
+  std::unique_ptr<ConnectionPool> m_pool;
+  // 読み取りレプリカの接続プール
+  std::vector<std::unique_ptr<ConnectionPool> > m_replicas;
+  // 接続先の振り分け(レプリカがある場合のみ)
+  std::unique_ptr<EndpointRouter> m_router;
+  // ワーカースレッド
+  std::unique_ptr<Executor> m_executor;
+  // 同時実行数の制限(limiterオプション、nullptrは制限なし)
+  std::unique_ptr<ConcurrencyLimiter> m_limiter;
+  // ヘッジ実行(hedgeオプション、nullptrはヘッジしない)
+  std::unique_ptr<HedgeController> m_hedge;
+  // 完了通知
+  AsyncBridge m_bridge;
+  // scanで開いたカーソル
+  CursorTable m_cursors;
+  // 接続待ちの上限(ミリ秒)
+  uint32_t m_acquireTimeout;
+  // 閉じたか
+  bool m_closed;
+  // キーセットページング(JSスレッドのみ)
+  std::map<uint32_t, std::shared_ptr<Pager> > m_pagers;
+  uint32_t m_nextPager;
+  uint64_t m_pages;
+  uint64_t m_prefetches;
+  uint64_t m_prefetchHits;
+  // SQLごとのパラメータの型(JSスレッドのみ)
+  std::map<OString, std::vector<BulkParamType> > m_paramTypes;
+};
+
+#endif
@@ -0,0 +1,453 @@
+﻿#include "procedure.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using json = nlohmann::json;
+
+#ifdef UNICODE
+  #define PROC_C_TEXT SQL_C_WCHAR
+#else
+  #define PROC_C_TEXT SQL_C_CHAR
+#endif
+
+// カタログの名前の長さ
+#define PROC_NAME_LENGTH 256
+
+
+/**
+* 識別子を必要に応じて二重引用符で囲みます
+*
+* 通常の識別子(英大文字・数字・_#$@)はそのまま使います。
+*/
+static OString QuoteIdentifier(const OString &name)
+{
+  bool plain = !name.empty() && !(name[0] >= '0' && name[0] <= '9');
+  for(size_t i = 0; i < name.size() && plain; i++) {
+    OString::value_type ch = name[i];
+    plain = (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9')
+      || ch == '_' || ch == '#' || ch == '$' || ch == '@';
+  }
+  if(plain) {
+    return name;
+  }
+  OString quoted = _O("\"");
+  for(size_t i = 0; i < name.size(); i++) {
+    if(name[i] == '"') {
+      quoted += _O("\"");
+    }
+    quoted += name[i];
+  }
+  return quoted + _O("\"");
+}
+
+
+/**
+* 検索パターンの特殊文字(% _ とエスケープ文字)をエスケープします
+*
+* @param[in] text 名前
+* @param[in] escape エスケープ文字(SQL_SEARCH_PATTERN_ESCAPE、空はエスケープしない)
+* @return OString エスケープした名前
+*/
+static OString EscapeSearchPattern(const OString &text, const OString &escape)
+{
+  if(escape.empty()) {
+    return text;
+  }
+  OString escaped;
+  for(size_t i = 0; i < text.size(); i++) {
+    if(text[i] == '%' || text[i] == '_' || escape.find(text[i]) != OString::npos) {
+      escaped += escape;
+    }
+    escaped += text[i];
+  }
+  return escaped;
+}
+
+
+/**
+* プロシージャのパラメータ定義を取得します
+*
+* スキーマ・名前は検索パターンとして扱われないようにエスケープし、一致したのが
+* 別の名前・複数のスキーマの場合はエラーにします。
+* 結果セットの列(SQL_RESULT_COL)は除き、ORDINAL_POSITIONの順に並べます。
+* 同じ名前で引数の異なるプロシージャ(オーバーロード)は区別できないのでエラーにします。
+*
+* @param[in] hdbc 接続ハンドル
+* @param[in] schema スキーマ(空の場合は全スキーマから探し、1つに決まらなければエラー)
+* @param[in] name プロシージャ名
+* @param[out] definition パラメータ定義
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool DescribeProcedure(
+  SQLHDBC hdbc, const OString &schema, const OString &name, ProcDefinition &definition, OString &error)
+{
+  SQLRETURN ret;
+
+  // https://www.ibm.com/docs/ja/i/7.3?topic=functions-sqlprocedurecolumns-get-inputoutput-parameter-information-procedure
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(hdbc));
+  if(!stmt) {
+    error = OdbcErrorMessage(_O("SQLAllocHandle"), SQL_ERROR, SQL_HANDLE_DBC, hdbc);
+    return false;
+  }
+  // 名前の_・%がパターンとして一致しないようにエスケープする
+  SQLTCHAR escapeChars[8];
+  SQLSMALLINT escapeLength = 0;
+  memset(escapeChars, 0x00, sizeof(escapeChars));
+  if(!SQL_SUCCEEDED(SQLGetInfo(hdbc, SQL_SEARCH_PATTERN_ESCAPE, escapeChars, sizeof(escapeChars), &escapeLength))) {
+    escapeChars[0] = 0;
+  }
+  OString escape = _S2O(escapeChars);
+  OString schemaPattern = EscapeSearchPattern(schema, escape);
+  OString namePattern = EscapeSearchPattern(name, escape);
+  ret = SQLProcedureColumns(
+    stmt.get(),
+    NULL, 0,
+    schema.empty() ? NULL : (SQLTCHAR *)schemaPattern.c_str(), schema.empty() ? 0 : SQL_NTS,
+    (SQLTCHAR *)namePattern.c_str(), SQL_NTS,
+    NULL, 0);
+  if(!SQL_SUCCEEDED(ret)) {
+    error = OdbcErrorMessage(_O("SQLProcedureColumns"), ret, SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
+
+  SQLTCHAR colSchema[PROC_NAME_LENGTH];
+  SQLTCHAR colName[PROC_NAME_LENGTH];
+  SQLTCHAR colColumn[PROC_NAME_LENGTH];
+  SQLSMALLINT colIoType = 0;
+  SQLSMALLINT colType = 0;
+  SQLINTEGER colSize = 0;
+  SQLSMALLINT colDecimalDigits = 0;
+  SQLSMALLINT colNullable = 0;
+  SQLINTEGER colOrdinal = 0;
+  SQLLEN sizSchema, sizName, sizColumn, sizIoType, sizType, sizSize, sizDecimalDigits, sizNullable, sizOrdinal;
+
+  SQLBindCol(stmt.get(),  2, PROC_C_TEXT, colSchema, sizeof(colSchema), &sizSchema);
+  SQLBindCol(stmt.get(),  3, PROC_C_TEXT, colName, sizeof(colName), &sizName);
+  SQLBindCol(stmt.get(),  4, PROC_C_TEXT, colColumn, sizeof(colColumn), &sizColumn);
+  SQLBindCol(stmt.get(),  5, SQL_C_SSHORT, &colIoType, 0, &sizIoType);
+  SQLBindCol(stmt.get(),  6, SQL_C_SSHORT, &colType, 0, &sizType);
+  SQLBindCol(stmt.get(),  8, SQL_C_SLONG, &colSize, 0, &sizSize);
+  SQLBindCol(stmt.get(), 10, SQL_C_SSHORT, &colDecimalDigits, 0, &sizDecimalDigits);
+  SQLBindCol(stmt.get(), 12, SQL_C_SSHORT, &colNullable, 0, &sizNullable);
+  SQLBindCol(stmt.get(), 18, SQL_C_SLONG, &colOrdinal, 0, &sizOrdinal);
+
+  std::vector<std::pair<SQLINTEGER, ProcParam> > params;
+  bool found = false;
+  while(SQL_SUCCEEDED(ret = SQLFetch(stmt.get()))) {
+    OString rowSchema = sizSchema == SQL_NULL_DATA ? OString() : _S2O(colSchema);
+    OString rowName = _S2O(colName);
+    if(rowName != name || (!schema.empty() && rowSchema != schema)) {
+      // エスケープできないドライバで別の名前に一致した行
+      continue;
+    }
+    if(!found) {
+      definition.schema = rowSchema;
+      definition.name = rowName;
+      found = true;
+    } else if(rowSchema != definition.schema) {
+      error = _O("複数のスキーマに同じ名前のプロシージャがあります(スキーマを指定してください): ") + name;
+      return false;
+    }
+    if(colIoType == SQL_RESULT_COL) {
+      continue;
+    }
+
+    ProcParam param;
+    param.ioType = colIoType;
+    param.column.name = sizColumn == SQL_NULL_DATA ? OString() : _S2O(colColumn);
+    param.column.sqlType = colType;
+    param.column.columnSize = sizSize == SQL_NULL_DATA ? 0 : (SQLULEN)colSize;
+    param.column.decimalDigits = sizDecimalDigits == SQL_NULL_DATA ? 0 : colDecimalDigits;
+    param.column.nullable = colNullable;
+    param.column.dataOffset = 0;
+    param.column.indicatorOffset = 0;
+    ChooseFetchBinding(param.column);
+    // ORDINAL_POSITIONを返さないドライバは取得順
+    SQLINTEGER ordinal = sizOrdinal == SQL_NULL_DATA
+      ? (SQLINTEGER)params.size() + (colIoType == SQL_RETURN_VALUE ? 0 : 1) : colOrdinal;
+    if(colIoType == SQL_RETURN_VALUE) {
+      ordinal = 0;
+    }
+    params.push_back(std::make_pair(ordinal, param));
+  }
+  if(ret != SQL_NO_DATA) {
+    error = OdbcErrorMessage(_O("SQLFetch"), ret, SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
+  if(!found) {
+    error = _O("プロシージャが見つかりません: ") + name;
+    return false;
+  }
+
+  std::stable_sort(params.begin(), params.end(),
+    [](const std::pair<SQLINTEGER, ProcParam> &a, const std::pair<SQLINTEGER, ProcParam> &b) {
+      return a.first < b.first;
+    });
+  for(size_t i = 1; i < params.size(); i++) {
+    if(params[i].first == params[i - 1].first) {
+      error = _O("同じ名前で引数の異なるプロシージャは呼び出せません: ") + name;
+      return false;
+    }
+  }
+
+  //
+  // CALL文の作成(戻り値はODBCのエスケープ構文で受け取る)
+  //
+  definition.params.clear();
+  definition.hasReturnValue = false;
+  definition.hasOutput = false;
+  OString marks;
+  for(size_t i = 0; i < params.size(); i++) {
+    const ProcParam &param = params[i].second;
+    definition.params.push_back(param);
+    if(param.ioType != SQL_PARAM_INPUT) {
+      definition.hasOutput = true;
+    }
+    if(param.ioType == SQL_RETURN_VALUE) {
+      definition.hasReturnValue = true;
+      continue;
+    }
+    marks += marks.empty() ? _O("?") : _O(", ?");
+  }
+  OString target = definition.schema.empty()
+    ? QuoteIdentifier(definition.name)
+    : QuoteIdentifier(definition.schema) + _O(".") + QuoteIdentifier(definition.name);
+  definition.callSql = definition.hasReturnValue
+    ? _O("{? = CALL ") + target + _O("(") + marks + _O(")}")
+    : _O("CALL ") + target + _O("(") + marks + _O(")");
+  return true;
+}
+
+
+/**
+* コンストラクタ
+*
+* 全パラメータをNULLで初期化します。
+*
+* @param[in] definition パラメータ定義(呼び出しが終わるまで保持すること)
+*/
+ProcCall::ProcCall(const ProcDefinition &definition)
+  : m_definition(definition)
+{
+  m_values.resize(definition.params.size());
+  for(size_t i = 0; i < m_values.size(); i++) {
+    Value &value = m_values[i];
+    value.column = definition.params[i].column;
+    value.data.assign(value.column.width, 0);
+    value.indicator = SQL_NULL_DATA;
+  }
+}
+
+
+/**
+* 値の領域を確保します
+*
+* 入力のみのパラメータは指定の型・幅に変更し、入出力パラメータは
+* 定義の型のまま幅だけ広げます(出力の受け取りに必要)。
+*
+* @param[in] index パラメータの位置
+* @param[in] cType 値のCの型
+* @param[in] width 値のバイト数
+* @return Value& 値
+*/
+ProcCall::Value &ProcCall::Reset(size_t index, SQLSMALLINT cType, size_t width)
+{
+  Value &value = m_values[index];
+  if(m_definition.params[index].ioType == SQL_PARAM_INPUT) {
+    value.column.cType = cType;
+    value.column.width = (SQLLEN)width;
+  } else if((SQLLEN)width > value.column.width) {
+    value.column.width = (SQLLEN)width;
+  }
+  value.data.assign(value.column.width, 0);
+  return value;
+}
+
+
+/**
+* NULLを設定します
+*
+* @param[in] index パラメータの位置
+*/
+void ProcCall::SetNull(size_t index)
+{
+  m_values[index].indicator = SQL_NULL_DATA;
+}
+
+
+/**
+* 数値を設定します
+*
+* @param[in] index パラメータの位置
+* @param[in] number 値
+*/
+void ProcCall::SetNumber(size_t index, double number)
+{
+  SQLSMALLINT cType = m_values[index].column.cType;
+  // int64_tに収まらない値(NaN・無限大を含む)はキャストできないので実数で渡す
+  bool inRange = number >= -9223372036854775808.0 && number < 9223372036854775808.0;
+  bool integral = inRange && number == (double)(int64_t)number;
+  if(m_definition.params[index].ioType == SQL_PARAM_INPUT) {
+    cType = integral ? SQL_C_SBIGINT : SQL_C_DOUBLE;
+  } else if(cType == SQL_C_SBIGINT && !inRange) {
+    cType = SQL_C_DOUBLE;
+  }
+
+  switch(cType) {
+    case SQL_C_SBIGINT: {
+      Value &value = Reset(index, SQL_C_SBIGINT, sizeof(int64_t));
+      int64_t n = (int64_t)number;
+      memcpy(&value.data[0], &n, sizeof(n));
+      value.indicator = sizeof(n);
+      return;
+    }
+    case SQL_C_DOUBLE: {
+      Value &value = Reset(index, SQL_C_DOUBLE, sizeof(double));
+      memcpy(&value.data[0], &number, sizeof(number));
+      value.indicator = sizeof(number);
+      return;
+    }
+    case SQL_C_BIT: {
+      Value &value = Reset(index, SQL_C_BIT, 1);
+      value.data[0] = number != 0 ? 1 : 0;
+      value.indicator = 1;
+      return;
+    }
+  }
+
+  // 文字列の型(10進数・日付時刻等)は文字列にして渡す
+  char text[32];
+  if(integral) {
+    snprintf(text, sizeof(text), "%lld", (long long)number);
+  } else {
+    snprintf(text, sizeof(text), "%.17g", number);
+  }
+  OString s;
+  for(const char *p = text; *p; p++) {
+    s += (OString::value_type)*p;
+  }
+  SetText(index, s);
+}
+
+
+/**
+* 文字列を設定します
+*
+* 入出力パラメータの型が数値の場合は数値に変換します。
+*
+* @param[in] index パラメータの位置
+* @param[in] text 値
+*/
+void ProcCall::SetText(size_t index, const OString &text)
+{
+  SQLSMALLINT cType = m_values[index].column.cType;
+  if(m_definition.params[index].ioType != SQL_PARAM_INPUT
+    && (cType == SQL_C_SBIGINT || cType == SQL_C_DOUBLE || cType == SQL_C_BIT)) {
+    std::string s = to_jsonstr(text);
+    SetNumber(index, strtod(s.c_str(), NULL));
+    return;
+  }
+
+  size_t bytes = (text.size() + 1) * sizeof(OString::value_type);
+  Value &value = Reset(index, PROC_C_TEXT, bytes);
+  memcpy(&value.data[0], text.c_str(), bytes);
+  value.indicator = SQL_NTS;
+}
+
+
+/**
+* バイナリを設定します
+*
+* @param[in] index パラメータの位置
+* @param[in] data 値
+* @param[in] length バイト数
+*/
+void ProcCall::SetBinary(size_t index, const char *data, size_t length)
+{
+  Value &value = Reset(index, SQL_C_BINARY, std::max(length, (size_t)1));
+  if(length > 0) {
+    memcpy(&value.data[0], data, length);
+  }
+  value.indicator = (SQLLEN)length;
+}
+
+
+/**
+* 実行して結果セット・出力パラメータを取得します
+*
+* 出力パラメータはドライバによって全ての結果セットを読み終えてから
+* 設定されるので、結果を読み切った後で取得します。
+*
+* @param[in] hdbc 接続ハンドル
+* @param[in] keep 結果セットを返すか
+* @param[in] maxRows 1つの結果セットから返す最大行数(0は無制限)
+* @param[out] outcome 結果({returnValue, outputs, results})
+* @param[out] error エラーメッセージ
+* @param[out] sqlState SQLSTATE
+* @return bool 成否
+*/
+bool ProcCall::Execute(
+  SQLHDBC hdbc, bool keep, size_t maxRows,
+  json &outcome, OString &error, std::string &sqlState)
+{
+  SQLRETURN ret;
+
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(hdbc));
+  if(!stmt) {
+    error = OdbcErrorMessage(_O("SQLAllocHandle"), SQL_ERROR, SQL_HANDLE_DBC, hdbc);
+    return false;
+  }
+
+  for(size_t i = 0; i < m_values.size(); i++) {
+    Value &value = m_values[i];
+    const ProcParam &param = m_definition.params[i];
+    SQLSMALLINT ioType = param.ioType == SQL_RETURN_VALUE ? (SQLSMALLINT)SQL_PARAM_OUTPUT : param.ioType;
+    ret = SQLBindParameter(
+      stmt.get(), (SQLUSMALLINT)(i + 1), ioType, value.column.cType, param.column.sqlType,
+      param.column.columnSize, param.column.decimalDigits,
+      &value.data[0], value.column.width, &value.indicator);
+    if(!SQL_SUCCEEDED(ret)) {
+      error = OdbcErrorMessage(_O("SQLBindParameter"), ret, SQL_HANDLE_STMT, stmt.get());
+      sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+      return false;
+    }
+  }
+
+  ret = SQLExecDirect(stmt.get(), (SQLTCHAR *)m_definition.callSql.c_str(), SQL_NTS);
+  if(!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+    error = OdbcErrorMessage(_O("SQLExecDirect"), ret, SQL_HANDLE_STMT, stmt.get());
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
+
+  json results;
+  if(!FetchResults(stmt.get(), keep, maxRows, results, error)) {
+    sqlState = OdbcSqlState(SQL_HANDLE_STMT, stmt.get());
+    return false;
+  }
+
+  //
+  // 出力パラメータ
+  //
+  json outputs = json::object();
+  for(size_t i = 0; i < m_values.size(); i++) {
+    const Value &value = m_values[i];
+    const ProcParam &param = m_definition.params[i];
+    if(param.ioType == SQL_PARAM_INPUT) {
+      continue;
+    }
+    json v = FetchValue(value.column, &value.data[0], value.indicator);
+    if(param.ioType == SQL_RETURN_VALUE) {
+      outcome["returnValue"] = v;
+    } else {
+      outputs[to_jsonstr(param.column.name)] = v;
+    }
+  }
+  outcome["outputs"] = outputs;
+  outcome["results"] = results;
+  return true;
+}
@@ -0,0 +1,90 @@
+﻿#ifndef _PROCEDURE_H
+#define _PROCEDURE_H
+//
+// ストアドプロシージャの呼び出し
+//
+// SQLProcedureColumnsで取得したパラメータ定義に合わせてIN/OUT/INOUTを
+// バインドし、結果セットと出力パラメータを取得します。
+// napiに依存しないのでワーカースレッドからも使えます。
+//
+#include <vector>
+
+#include "omnicommon.h"
+#include "fetcher.h"
+#include "nlohmann/json.hpp"
+
+// パラメータ定義のキャッシュ数(超えたら全て破棄)
+#define PROC_CACHE_SIZE 256
+
+// プロシージャのパラメータ
+struct ProcParam {
+  // 入出力の種類(SQL_PARAM_INPUT・SQL_PARAM_INPUT_OUTPUT・SQL_PARAM_OUTPUT・SQL_RETURN_VALUE)
+  SQLSMALLINT ioType;
+  // 名前・型とバインドするCの型(出力は結果セットの列と同じ型で受け取る)
+  FetchColumn column;
+};
+
+// プロシージャの定義
+struct ProcDefinition {
+  // スキーマ
+  OString schema;
+  // 名前
+  OString name;
+  // パラメータ(戻り値を含む、呼び出し順)
+  std::vector<ProcParam> params;
+  // 戻り値があるか
+  bool hasReturnValue;
+  // 出力パラメータ(INOUT・OUT・戻り値)があるか
+  bool hasOutput;
+  // CALL文
+  OString callSql;
+};
+
+// プロシージャのパラメータ定義を取得します(schemaが空の場合は全スキーマから探し、複数あればエラー)
+bool DescribeProcedure(
+  SQLHDBC hdbc, const OString &schema, const OString &name, ProcDefinition &definition, OString &error);
+
+//
+// 1回の呼び出し
+//
+// 値を設定してからExecuteします。入力のみのパラメータは値に合わせて
+// 領域を広げ、入出力パラメータは定義の型に変換して設定します。
+//
+class ProcCall {
+public:
+  ProcCall(const ProcDefinition &definition);
+
+  // パラメータ数(戻り値を含む)
+  size_t ParamCount() const { return m_values.size(); }
+
+  // 値の設定(indexは戻り値を含むパラメータの位置)
+  void SetNull(size_t index);
+  void SetNumber(size_t index, double value);
+  void SetText(size_t index, const OString &value);
+  void SetBinary(size_t index, const char *value, size_t length);
+
+  // 実行して結果セット・出力パラメータを取得します
+  // outcome: {returnValue, outputs: {名前: 値}, results: [...]}
+  bool Execute(
+    SQLHDBC hdbc, bool keep, size_t maxRows,
+    nlohmann::json &outcome, OString &error, std::string &sqlState);
+
+private:
+  // パラメータの値
+  struct Value {
+    // バインドする型・幅
+    FetchColumn column;
+    // 値の領域
+    std::vector<char> data;
+    // 長さ
+    SQLLEN indicator;
+  };
+
+  // 値の領域を確保します(入力のみのパラメータは型も変更)
+  Value &Reset(size_t index, SQLSMALLINT cType, size_t width);
+
+  const ProcDefinition &m_definition;
+  std::vector<Value> m_values;
+};
+
+#endif
@@ -0,0 +1,1104 @@
+﻿#include "resultstream.h"
+
+#include <algorithm>
+
+using json = nlohmann::json;
+
+// JSの数値で正確に表せる整数の範囲
+#define STREAM_SAFE_INTEGER 9007199254740991LL
+
+
+/**
+* SQLの型から列の値の種類を決めます
+*
+* @param[in] sqlType SQLの型
+* @return StreamValueKind 値の種類
+*/
+StreamValueKind StreamValueKindOf(SQLSMALLINT sqlType)
+{
+  switch(sqlType) {
+    case SQL_TINYINT:
+    case SQL_SMALLINT:
+    case SQL_INTEGER:
+    case SQL_BIGINT:
+      return STREAM_VALUE_INTEGER;
+    case SQL_DECIMAL:
+    case SQL_NUMERIC:
+      return STREAM_VALUE_DECIMAL;
+    case SQL_CHAR:
+    case SQL_VARCHAR:
+    case SQL_LONGVARCHAR:
+    case SQL_WCHAR:
+    case SQL_WVARCHAR:
+    case SQL_WLONGVARCHAR:
+      return STREAM_VALUE_CHAR;
+  }
+  return STREAM_VALUE_OTHER;
+}
+
+
+//
+// 10進数(整数・DECIMALの値を丸めずに比較・合計する)
+//
+struct StreamDecimal {
+  bool negative;
+  // 整数部(先頭の0を除く、0は空)
+  std::string integer;
+  // 小数部(桁数は元の値のまま)
+  std::string fraction;
+
+  /**
+  * 値を10進数にします
+  *
+  * @param[in] v 値(整数または"-123.45"形式の文字列)
+  * @return bool 10進数にできたか
+  */
+  bool Parse(const json &v)
+  {
+    std::string text;
+    if(v.is_number_unsigned()) {
+      text = std::to_string(v.get<uint64_t>());
+    } else if(v.is_number_integer()) {
+      text = std::to_string(v.get<int64_t>());
+    } else if(v.is_string()) {
+      text = v.get_ref<const std::string &>();
+    } else {
+      return false;
+    }
+    size_t i = 0;
+    size_t n = text.size();
+    while(i < n && text[i] == ' ') i++;
+    while(n > i && text[n - 1] == ' ') n--;
+    negative = false;
+    if(i < n && (text[i] == '-' || text[i] == '+')) {
+      negative = text[i] == '-';
+      i++;
+    }
+    integer.clear();
+    fraction.clear();
+    bool digits = false;
+    while(i < n && text[i] >= '0' && text[i] <= '9') {
+      if(!integer.empty() || text[i] != '0') {
+        integer += text[i];
+      }
+      digits = true;
+      i++;
+    }
+    if(i < n && text[i] == '.') {
+      i++;
+      while(i < n && text[i] >= '0' && text[i] <= '9') {
+        fraction += text[i];
+        digits = true;
+        i++;
+      }
+    }
+    if(!digits || i != n) {
+      return false;
+    }
+    if(IsZero()) {
+      negative = false;
+    }
+    return true;
+  }
+
+  // 0か
+  bool IsZero() const
+  {
+    return integer.empty() && fraction.find_first_not_of('0') == std::string::npos;
+  }
+
+  /**
+  * 絶対値を比較します
+  *
+  * @return int 小さければ負、同じなら0、大きければ正
+  */
+  static int CompareAbs(const StreamDecimal &a, const StreamDecimal &b)
+  {
+    if(a.integer.size() != b.integer.size()) {
+      return a.integer.size() < b.integer.size() ? -1 : 1;
+    }
+    int cmp = a.integer.compare(b.integer);
+    if(cmp != 0) {
+      return cmp < 0 ? -1 : 1;
+    }
+    size_t scale = std::max(a.fraction.size(), b.fraction.size());
+    for(size_t i = 0; i < scale; i++) {
+      char x = i < a.fraction.size() ? a.fraction[i] : '0';
+      char y = i < b.fraction.size() ? b.fraction[i] : '0';
+      if(x != y) {
+        return x < y ? -1 : 1;
+      }
+    }
+    return 0;
+  }
+
+  /**
+  * 比較します
+  *
+  * @return int aが小さければ負、同じなら0、大きければ正
+  */
+  static int Compare(const StreamDecimal &a, const StreamDecimal &b)
+  {
+    if(a.negative != b.negative) {
+      return a.negative ? -1 : 1;
+    }
+    int cmp = CompareAbs(a, b);
+    return a.negative ? -cmp : cmp;
+  }
+
+  /**
+  * 合計します(小数部の桁数は多い方に合わせる)
+  *
+  * @return StreamDecimal a + b
+  */
+  static StreamDecimal Add(const StreamDecimal &a, const StreamDecimal &b)
+  {
+    size_t scale = std::max(a.fraction.size(), b.fraction.size());
+    size_t width = std::max(a.integer.size(), b.integer.size()) + 1;
+    // 整数部と小数部を桁を揃えて並べた数字列
+    std::string x = std::string(width - a.integer.size(), '0') + a.integer + a.fraction + std::string(scale - a.fraction.size(), '0');
+    std::string y = std::string(width - b.integer.size(), '0') + b.integer + b.fraction + std::string(scale - b.fraction.size(), '0');
+    StreamDecimal sum;
+    std::string digits(x.size(), '0');
+    if(a.negative == b.negative) {
+      sum.negative = a.negative;
+      int carry = 0;
+      for(size_t i = x.size(); i-- > 0;) {
+        int d = (x[i] - '0') + (y[i] - '0') + carry;
+        digits[i] = (char)('0' + d % 10);
+        carry = d / 10;
+      }
+    } else {
+      // 絶対値の大きい方から小さい方を引く
+      if(CompareAbs(a, b) < 0) {
+        std::swap(x, y);
+        sum.negative = b.negative;
+      } else {
+        sum.negative = a.negative;
+      }
+      int borrow = 0;
+      for(size_t i = x.size(); i-- > 0;) {
+        int d = (x[i] - '0') - (y[i] - '0') - borrow;
+        borrow = d < 0 ? 1 : 0;
+        digits[i] = (char)('0' + d + borrow * 10);
+      }
+    }
+    size_t first = digits.find_first_not_of('0');
+    size_t point = digits.size() - scale;
+    sum.integer = (first == std::string::npos || first >= point) ? std::string() : digits.substr(first, point - first);
+    sum.fraction = digits.substr(point);
+    if(sum.IsZero()) {
+      sum.negative = false;
+    }
+    return sum;
+  }
+
+  /**
+  * 値にします
+  *
+  * @param[in] kind 列の値の種類(整数はJSの数値で表せれば数値、それ以外は文字列)
+  * @return json 値
+  */
+  json ToJson(StreamValueKind kind) const
+  {
+    std::string text = (negative ? "-" : "") + (integer.empty() ? std::string("0") : integer);
+    if(!fraction.empty()) {
+      text += "." + fraction;
+    }
+    if(kind == STREAM_VALUE_INTEGER && fraction.empty() && integer.size() <= 16) {
+      long long n = std::stoll(text);
+      if(n <= STREAM_SAFE_INTEGER && n >= -STREAM_SAFE_INTEGER) {
+        return json((int64_t)n);
+      }
+    }
+    return json(text);
+  }
+};
+
+
+/**
+* 値を比較します
+*
+* @param[in] a 値
+* @param[in] b 値
+* @param[in] kind 列の値の種類(整数・DECIMALは数値の文字列も大きさで比べる)
+* @return int aが先なら負、同じなら0、後なら正
+*/
+int CompareStreamValues(const json &a, const json &b, StreamValueKind kind)
+{
+  if(kind == STREAM_VALUE_INTEGER || kind == STREAM_VALUE_DECIMAL) {
+    StreamDecimal x;
+    StreamDecimal y;
+    if(x.Parse(a) && y.Parse(b)) {
+      return StreamDecimal::Compare(x, y);
+    }
+  }
+  // 型の順(null < 真偽値 < 数値 < 文字列 < その他)
+  struct Rank {
+    static int Of(const json &v)
+    {
+      if(v.is_null()) return 0;
+      if(v.is_boolean()) return 1;
+      if(v.is_number()) return 2;
+      if(v.is_string()) return 3;
+      return 4;
+    }
+  };
+  int ra = Rank::Of(a);
+  int rb = Rank::Of(b);
+  if(ra != rb) {
+    return ra < rb ? -1 : 1;
+  }
+  switch(ra) {
+  case 1:
+    return (int)a.get<bool>() - (int)b.get<bool>();
+  case 2:
+    if(a.is_number_integer() && b.is_number_integer()) {
+      int64_t x = a.get<int64_t>();
+      int64_t y = b.get<int64_t>();
+      return x < y ? -1 : (x > y ? 1 : 0);
+    } else {
+      double x = a.get<double>();
+      double y = b.get<double>();
+      return x < y ? -1 : (x > y ? 1 : 0);
+    }
+  case 3:
+    return a.get_ref<const std::string &>().compare(b.get_ref<const std::string &>());
+  case 4:
+    return a.dump().compare(b.dump());
+  }
+  return 0;
+}
+
+
+/**
+* 最大maxRows行を読みます
+*
+* @param[in] maxRows 最大行数
+* @param[out] rows 行(JSON配列)
+* @param[out] done 終わりまで読んだか
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool ResultStream::Read(size_t maxRows, json &rows, bool &done, OString &error)
+{
+  rows = json::array();
+  done = false;
+  while(rows.size() < maxRows) {
+    json row;
+    if(!Next(row, error)) {
+      done = true;
+      return error.empty();
+    }
+    rows.push_back(std::move(row));
+  }
+  return true;
+}
+
+
+//
+// QueryStream
+//
+
+/**
+* コンストラクタ
+*
+* @param[in] pool 接続を借りるプール
+* @param[in] sql SQL
+* @param[in] session セッション(NULLは既定)
+* @param[in] acquireTimeoutMs 接続待ちの上限(ミリ秒)
+* @param[in] batchRows 1回に取得する行数
+*/
+QueryStream::QueryStream(
+  ConnectionPool &pool, const OString &sql, const PoolSession *session, uint32_t acquireTimeoutMs, size_t batchRows)
+  : m_pool(pool), m_sql(sql), m_session(session), m_acquireTimeoutMs(acquireTimeoutMs)
+{
+  m_batchRows = batchRows > 0 ? batchRows : FETCH_DEFAULT_ROWS;
+  m_columns = json::array();
+  m_columnsReady = false;
+  m_finished = false;
+  m_cancelled = false;
+  m_fetched = 0;
+  m_stored = 0;
+  m_taken = 0;
+  m_position = 0;
+}
+
+
+/**
+* デストラクタ(取り消して取得スレッドの終了を待つ)
+*/
+QueryStream::~QueryStream()
+{
+  Cancel();
+  if(m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+
+/**
+* 実行を開始します
+*/
+void QueryStream::Start()
+{
+  m_thread = std::thread(&QueryStream::Produce, this);
+}
+
+
+/**
+* 取り消します(実行中のSQLはSQLCancelで中断)
+*/
+void QueryStream::Cancel()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cancelled = true;
+  }
+  m_cancel.Cancel();
+  m_cv.notify_all();
+  if(m_signal) {
+    m_signal->Notify();
+  }
+}
+
+
+/**
+* 取得した行数
+*/
+uint64_t QueryStream::Fetched()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_fetched;
+}
+
+
+/**
+* 取得の終わり
+*
+* @param[in] error エラーメッセージ(空は正常終了)
+*/
+void QueryStream::Finish(const OString &error)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_finished = true;
+    m_columnsReady = true;
+    if(!m_cancelled) {
+      m_error = error;
+    }
+  }
+  m_cv.notify_all();
+  if(m_signal) {
+    m_signal->Notify();
+  }
+}
+
+
+/**
+* 行形式のまとまりを保管します
+*
+* @param[in,out] pending まとまり(空になる)
+* @param[in,out] rows まとまりの行数(0になる)
+* @param[out] error エラーメッセージ
+* @return bool 保管したか(取り消し済み・書き出しの失敗はfalse)
+*/
+bool QueryStream::Store(std::vector<char> &pending, size_t &rows, OString &error)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_cancelled) {
+      return false;
+    }
+  }
+  size_t count = rows;
+  if(!m_spill->Append(pending, count, error)) {
+    return false;
+  }
+  pending.clear();
+  pending.reserve(SPILL_BATCH_BYTES + SPILL_BATCH_BYTES / 4);
+  rows = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fetched += count;
+    m_stored++;
+  }
+  m_cv.notify_all();
+  if(m_signal) {
+    m_signal->Notify();
+  }
+  return true;
+}
+
+
+/**
+* 取得スレッド
+*
+* 行セットごとに行のJSON配列を作り、待ち行列がいっぱいの間は取得を止めます。
+* SQLFetchはRowsetPipelineの取得スレッドで行い、このスレッドは変換します。
+* 全行を保管する場合は行形式でまとめてSpillBufferに入れ、読む側を待ちません
+* (取得が終われば読み終わる前に接続を返します)。
+*/
+void QueryStream::Produce()
+{
+  OString error;
+  PoolLease lease(m_pool);
+  if(!lease.Acquire(m_acquireTimeoutMs, error, m_session)) {
+    Finish(error);
+    return;
+  }
+
+  std::unique_ptr<SQLHSTMT, StmtAcc> stmt(StmtAcc::alloc(lease.hdbc()));
+  if(!m_cancel.Attach(stmt.get())) {
+    Finish(OString());
+    return;
+  }
+  SQLRETURN ret = SQLExecDirect(stmt.get(), (SQLTCHAR *)m_sql.c_str(), SQL_NTS);
+  RowsetFetcher fetcher;
+  fetcher.SetTuning(m_tuning);
+  SQLSMALLINT columnCount = 0;
+  if(SQL_SUCCEEDED(ret)) {
+    SQLNumResultCols(stmt.get(), &columnCount);
+  }
+  if(!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+    error = OdbcErrorMessage(_O("SQLExecDirect"), ret, SQL_HANDLE_STMT, stmt.get());
+    if(IsConnectionSqlState(OdbcSqlState(SQL_HANDLE_STMT, stmt.get()))) {
+      lease.MarkBroken();
+    }
+  } else if(columnCount == 0) {
+    // 結果セットの無いSQL(行なし)
+  } else if(fetcher.Bind(stmt.get(), m_batchRows, error, FETCH_PIPELINE_SLOTS)) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_columns = fetcher.ColumnsJson();
+      for(size_t c = 0; c < fetcher.ColumnCount(); c++) {
+        m_types.push_back(fetcher.Column(c).sqlType);
+      }
+      m_columnsReady = true;
+    }
+    m_cv.notify_all();
+
+    // 次の行セットを取得している間に変換する
+    RowsetPipeline pipeline(fetcher);
+    pipeline.Start();
+    std::vector<char> pending;
+    size_t pendingRows = 0;
+    while(pipeline.Next(error)) {
+      if(m_spill) {
+        for(size_t r = 0; r < fetcher.RowCount(); r++) {
+          for(size_t c = 0; c < fetcher.ColumnCount(); c++) {
+            SpillEncodeValue(fetcher.Value(c, r), pending);
+          }
+        }
+        pendingRows += fetcher.RowCount();
+        if(pending.size() >= SPILL_BATCH_BYTES && !Store(pending, pendingRows, error)) {
+          break;
+        }
+        continue;
+      }
+      std::vector<json> batch;
+      batch.reserve(fetcher.RowCount());
+      for(size_t r = 0; r < fetcher.RowCount(); r++) {
+        json row = json::array();
+        for(size_t c = 0; c < fetcher.ColumnCount(); c++) {
+          row.push_back(fetcher.Value(c, r));
+        }
+        batch.push_back(std::move(row));
+      }
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this]() { return m_cancelled || m_queue.size() < STREAM_QUEUE_BATCHES; });
+      if(m_cancelled) {
+        break;
+      }
+      m_fetched += batch.size();
+      m_queue.push_back(std::move(batch));
+      lock.unlock();
+      m_cv.notify_all();
+      if(m_signal) {
+        m_signal->Notify();
+      }
+    }
+    pipeline.Stop();
+    FetchStats stats = fetcher.Stats();
+    m_pool.RecordFetch(stats.fetches, stats.rows, stats.bytes, stats.micros);
+    if(m_spill && error.empty() && pendingRows > 0) {
+      Store(pending, pendingRows, error);
+    }
+    if(!error.empty() && IsConnectionSqlState(OdbcSqlState(SQL_HANDLE_STMT, stmt.get()))) {
+      lease.MarkBroken();
+    }
+  }
+  // 結果を読み切らずに終わる場合もあるので閉じてから返す
+  SQLFreeStmt(stmt.get(), SQL_CLOSE);
+  SQLFreeStmt(stmt.get(), SQL_UNBIND);
+  m_cancel.Detach();
+  stmt.reset();
+  lease.Reset();
+  Finish(error);
+}
+
+
+/**
+* 列名の一覧
+*/
+bool QueryStream::Columns(json &columns, OString &error)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [this]() { return m_columnsReady || m_cancelled; });
+  if(!m_error.empty()) {
+    error = m_error;
+    return false;
+  }
+  columns = m_columns;
+  return true;
+}
+
+
+/**
+* 列のSQLの型
+*/
+bool QueryStream::ColumnTypes(std::vector<SQLSMALLINT> &types, OString &error)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [this]() { return m_columnsReady || m_cancelled; });
+  if(!m_error.empty()) {
+    error = m_error;
+    return false;
+  }
+  types = m_types;
+  return true;
+}
+
+
+/**
+* 待たずに次の行を取り出します
+*
+* @param[out] row 行
+* @param[out] error エラーメッセージ(終わりの場合のみ)
+* @param[out] ended 終わったか(取り消し・取得の終わり)
+* @return bool 行を取り出したか
+*/
+bool QueryStream::TryNext(json &row, OString &error, bool &ended)
+{
+  ended = false;
+  if(m_spill && m_position >= m_current.size()) {
+    return TakeStored(row, error, ended);
+  }
+  if(m_position >= m_current.size()) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(m_position >= m_current.size()) {
+      if(m_cancelled) {
+        ended = true;
+        return false;
+      }
+      if(m_queue.empty()) {
+        if(m_finished) {
+          ended = true;
+          error = m_error;
+        }
+        return false;
+      }
+      m_current = std::move(m_queue.front());
+      m_queue.pop_front();
+      m_position = 0;
+    }
+    lock.unlock();
+    // 待ち行列が空いたので取得を再開させる
+    m_cv.notify_all();
+  }
+  row = std::move(m_current[m_position++]);
+  return true;
+}
+
+
+/**
+* 保管したまとまりから次の行を取り出します
+*
+* まとまりを1つ取り出して(書き出したまとまりはその範囲をマップして)行に
+* 戻し、マップはすぐに解放します。
+*
+* @param[out] row 行
+* @param[out] error エラーメッセージ(終わりの場合のみ)
+* @param[out] ended 終わったか
+* @return bool 行を取り出したか
+*/
+bool QueryStream::TakeStored(json &row, OString &error, bool &ended)
+{
+  bool finished;
+  size_t columns;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_cancelled) {
+      ended = true;
+      return false;
+    }
+    // 終わった後に保管されるまとまりは無いので、先に終わりを見ておく
+    finished = m_finished;
+    columns = m_columns.size();
+  }
+
+  SpillBatch batch;
+  OString takeError;
+  if(!m_spill->Take(batch, takeError)) {
+    if(!takeError.empty()) {
+      ended = true;
+      error = takeError;
+    } else if(finished) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      ended = true;
+      error = m_error;
+    }
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_taken++;
+  }
+
+  m_current.clear();
+  m_position = 0;
+  const char *p = batch.data();
+  const char *end = p + batch.size();
+  for(size_t r = 0; r < batch.rows(); r++) {
+    json decoded;
+    if(!SpillDecodeRow(p, end, columns, decoded)) {
+      ended = true;
+      error = _O("保管した行を読めません");
+      return false;
+    }
+    m_current.push_back(std::move(decoded));
+  }
+  if(m_current.empty()) {
+    return false;
+  }
+  row = std::move(m_current[m_position++]);
+  return true;
+}
+
+
+/**
+* 次の行
+*/
+bool QueryStream::Next(json &row, OString &error)
+{
+  bool ended = false;
+  while(!TryNext(row, error, ended)) {
+    if(ended) {
+      return false;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_cancelled || m_finished || !m_queue.empty() || m_stored > m_taken; });
+  }
+  return true;
+}
+
+
+//
+// InterleaveStream
+//
+
+/**
+* コンストラクタ
+*
+* @param[in,out] sources ストリーム(所有権を移す)
+* @param[in] signal ストリームの通知先
+*/
+InterleaveStream::InterleaveStream(std::vector<std::unique_ptr<QueryStream> > &sources, std::shared_ptr<StreamSignal> signal)
+  : m_sources(std::move(sources)), m_signal(signal), m_index(0)
+{
+  for(size_t i = 0; i < m_sources.size(); i++) {
+    m_active.push_back(i);
+  }
+}
+
+
+/**
+* 列名の一覧(最初のストリームの列)
+*/
+bool InterleaveStream::Columns(json &columns, OString &error)
+{
+  columns = json::array();
+  for(size_t i = 0; i < m_sources.size(); i++) {
+    json c;
+    if(!m_sources[i]->Columns(c, error)) {
+      return false;
+    }
+    if(columns.empty()) {
+      columns = c;
+    }
+  }
+  return true;
+}
+
+
+/**
+* 次の行(前回と同じストリームから優先して、無ければ行のあるストリーム)
+*/
+bool InterleaveStream::Next(json &row, OString &error)
+{
+  while(!m_active.empty()) {
+    // 確認の前の版で待つので、確認中の通知も取りこぼさない
+    uint64_t seen = m_signal->Version();
+    std::vector<size_t> ended;
+    for(size_t n = 0; n < m_active.size(); n++) {
+      size_t i = (m_index + n) % m_active.size();
+      bool end = false;
+      if(m_sources[m_active[i]]->TryNext(row, error, end)) {
+        m_index = i;
+        return true;
+      }
+      if(end) {
+        if(!error.empty()) {
+          return false;
+        }
+        ended.push_back(m_active[i]);
+      }
+    }
+    if(ended.empty()) {
+      m_signal->Wait(seen);
+      continue;
+    }
+    for(size_t e = 0; e < ended.size(); e++) {
+      m_active.erase(std::find(m_active.begin(), m_active.end(), ended[e]));
+    }
+    m_index = 0;
+  }
+  return false;
+}
+
+
+/**
+* 取り消します
+*/
+void InterleaveStream::Cancel()
+{
+  for(size_t i = 0; i < m_sources.size(); i++) {
+    m_sources[i]->Cancel();
+  }
+  m_signal->Notify();
+}
+
+
+//
+// ConcatStream
+//
+
+/**
+* コンストラクタ
+*
+* @param[in,out] sources ストリーム(所有権を移す)
+*/
+ConcatStream::ConcatStream(std::vector<std::unique_ptr<ResultStream> > &sources)
+  : m_sources(std::move(sources)), m_index(0)
+{
+}
+
+
+/**
+* 列名の一覧(最初のストリームの列、列数が違うストリームがあればエラー)
+*/
+bool ConcatStream::Columns(json &columns, OString &error)
+{
+  columns = json::array();
+  for(size_t i = 0; i < m_sources.size(); i++) {
+    json c;
+    if(!m_sources[i]->Columns(c, error)) {
+      return false;
+    }
+    if(i == 0) {
+      columns = c;
+    } else if(c.size() != columns.size() && !c.empty() && !columns.empty()) {
+      error = _O("接続先によって結果の列数が違います");
+      return false;
+    }
+    if(columns.empty()) {
+      columns = c;
+    }
+  }
+  return true;
+}
+
+
+/**
+* 次の行
+*/
+bool ConcatStream::Next(json &row, OString &error)
+{
+  while(m_index < m_sources.size()) {
+    if(m_sources[m_index]->Next(row, error)) {
+      return true;
+    }
+    if(!error.empty()) {
+      return false;
+    }
+    m_index++;
+  }
+  return false;
+}
+
+
+/**
+* 取り消します
+*/
+void ConcatStream::Cancel()
+{
+  for(size_t i = 0; i < m_sources.size(); i++) {
+    m_sources[i]->Cancel();
+  }
+}
+
+
+//
+// MergeStream
+//
+
+/**
+* コンストラクタ
+*
+* @param[in,out] sources ストリーム(所有権を移す、それぞれキー順に並んでいること)
+* @param[in] keys 並べ替えのキー
+*/
+MergeStream::MergeStream(std::vector<std::unique_ptr<ResultStream> > &sources, const std::vector<StreamSortKey> &keys)
+  : m_sources(std::move(sources)), m_keys(keys), m_primed(false)
+{
+  m_heads.resize(m_sources.size());
+}
+
+
+/**
+* aがbより先か(キーが同じ場合はfalse)
+*/
+bool MergeStream::Before(const json &a, const json &b) const
+{
+  for(size_t k = 0; k < m_keys.size(); k++) {
+    size_t c = m_keys[k].column;
+    static const json null;
+    int cmp = CompareStreamValues(c < a.size() ? a[c] : null, c < b.size() ? b[c] : null, m_keys[k].kind);
+    if(cmp != 0) {
+      return m_keys[k].desc ? cmp > 0 : cmp < 0;
+    }
+  }
+  return false;
+}
+
+
+/**
+* 全ストリームの先頭行を読みます
+*/
+bool MergeStream::Prime(OString &error)
+{
+  m_primed = true;
+  for(size_t i = 0; i < m_sources.size(); i++) {
+    if(m_sources[i]->Next(m_heads[i], error)) {
+      m_heap.push_back(i);
+    } else if(!error.empty()) {
+      return false;
+    }
+  }
+  // キーが同じ場合はストリームの番号順(安定)
+  MergeStream *self = this;
+  std::make_heap(m_heap.begin(), m_heap.end(), [self](size_t a, size_t b) {
+    return self->Before(self->m_heads[b], self->m_heads[a])
+      || (!self->Before(self->m_heads[a], self->m_heads[b]) && b < a);
+  });
+  return true;
+}
+
+
+/**
+* 列名の一覧
+*/
+bool MergeStream::Columns(json &columns, OString &error)
+{
+  columns = json::array();
+  for(size_t i = 0; i < m_sources.size(); i++) {
+    json c;
+    if(!m_sources[i]->Columns(c, error)) {
+      return false;
+    }
+    if(columns.empty()) {
+      columns = c;
+    }
+  }
+  return true;
+}
+
+
+/**
+* 次の行(先頭行のうちキー順で最初の行)
+*/
+bool MergeStream::Next(json &row, OString &error)
+{
+  if(!m_primed && !Prime(error)) {
+    return false;
+  }
+  if(m_heap.empty()) {
+    return false;
+  }
+  MergeStream *self = this;
+  auto later = [self](size_t a, size_t b) {
+    return self->Before(self->m_heads[b], self->m_heads[a])
+      || (!self->Before(self->m_heads[a], self->m_heads[b]) && b < a);
+  };
+  std::pop_heap(m_heap.begin(), m_heap.end(), later);
+  size_t source = m_heap.back();
+  row = std::move(m_heads[source]);
+  if(m_sources[source]->Next(m_heads[source], error)) {
+    std::push_heap(m_heap.begin(), m_heap.end(), later);
+  } else {
+    m_heap.pop_back();
+    if(!error.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/**
+* 取り消します
+*/
+void MergeStream::Cancel()
+{
+  for(size_t i = 0; i < m_sources.size(); i++) {
+    m_sources[i]->Cancel();
+  }
+}
+
+
+//
+// AggregateStream
+//
+
+/**
+* コンストラクタ
+*
+* @param[in,out] sources ストリーム(所有権を移す)
+* @param[in] groupBy グループキーの列(descは使わない)
+* @param[in] aggregates 集計値の列と結合方法(指定の無い列は最初の値)
+*/
+AggregateStream::AggregateStream(
+  std::vector<std::unique_ptr<ResultStream> > &sources,
+  const std::vector<StreamSortKey> &groupBy, const std::vector<StreamAggregateSpec> &aggregates)
+  : m_input(sources), m_groupBy(groupBy), m_aggregates(aggregates), m_position(0), m_combined(false)
+{
+}
+
+
+/**
+* 列名の一覧
+*/
+bool AggregateStream::Columns(json &columns, OString &error)
+{
+  return m_input.Columns(columns, error);
+}
+
+
+/**
+* 全行を読んでグループキーごとに結合します(グループキーの順に返す)
+*/
+bool AggregateStream::Combine(OString &error)
+{
+  m_combined = true;
+  // グループキー(JSON)→結合中の行
+  std::map<std::string, size_t> groups;
+  json row;
+  while(m_input.Next(row, error)) {
+    json key = json::array();
+    for(size_t g = 0; g < m_groupBy.size(); g++) {
+      key.push_back(m_groupBy[g].column < row.size() ? row[m_groupBy[g].column] : json());
+    }
+    std::string k = key.dump();
+    std::map<std::string, size_t>::iterator it = groups.find(k);
+    if(it == groups.end()) {
+      groups[k] = m_rows.size();
+      m_rows.push_back(std::move(row));
+      continue;
+    }
+    json &acc = m_rows[it->second];
+    for(size_t a = 0; a < m_aggregates.size(); a++) {
+      size_t c = m_aggregates[a].column;
+      if(c >= row.size() || c >= acc.size() || row[c].is_null()) {
+        continue;
+      }
+      if(acc[c].is_null()) {
+        acc[c] = row[c];
+        continue;
+      }
+      switch(m_aggregates[a].fn) {
+      case STREAM_AGG_SUM:
+        if(m_aggregates[a].kind == STREAM_VALUE_INTEGER || m_aggregates[a].kind == STREAM_VALUE_DECIMAL) {
+          // 丸め・桁あふれの無いよう10進数で合計する(大きな整数・DECIMALは文字列)
+          StreamDecimal x;
+          StreamDecimal y;
+          if(!x.Parse(acc[c]) || !y.Parse(row[c])) {
+            error = _O("数値以外の列は合計できません");
+            return false;
+          }
+          acc[c] = StreamDecimal::Add(x, y).ToJson(m_aggregates[a].kind);
+        } else if(acc[c].is_number_integer() && row[c].is_number_integer()) {
+          acc[c] = acc[c].get<int64_t>() + row[c].get<int64_t>();
+        } else if(acc[c].is_number() && row[c].is_number()) {
+          acc[c] = acc[c].get<double>() + row[c].get<double>();
+        } else {
+          error = _O("数値以外の列は合計できません");
+          return false;
+        }
+        break;
+      case STREAM_AGG_MIN:
+        if(CompareStreamValues(row[c], acc[c], m_aggregates[a].kind) < 0) {
+          acc[c] = row[c];
+        }
+        break;
+      case STREAM_AGG_MAX:
+        if(CompareStreamValues(row[c], acc[c], m_aggregates[a].kind) > 0) {
+          acc[c] = row[c];
+        }
+        break;
+      case STREAM_AGG_FIRST:
+        break;
+      }
+    }
+  }
+  if(!error.empty()) {
+    return false;
+  }
+  // グループキーの順に並べる
+  std::vector<StreamSortKey> groupBy = m_groupBy;
+  std::stable_sort(m_rows.begin(), m_rows.end(), [&groupBy](const json &a, const json &b) {
+    for(size_t g = 0; g < groupBy.size(); g++) {
+      size_t c = groupBy[g].column;
+      int cmp = CompareStreamValues(a[c], b[c], groupBy[g].kind);
+      if(cmp != 0) {
+        return cmp < 0;
+      }
+    }
+    return false;
+  });
+  return true;
+}
+
+
+/**
+* 次の行
+*/
+bool AggregateStream::Next(json &row, OString &error)
+{
+  if(!m_combined && !Combine(error)) {
+    return false;
+  }
+  if(m_position >= m_rows.size()) {
+    return false;
+  }
+  row = std::move(m_rows[m_position++]);
+  return true;
+}
+
+
+/**
+* 取り消します
+*/
+void AggregateStream::Cancel()
+{
+  m_input.Cancel();
+}
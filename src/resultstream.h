@@ -0,0 +1,291 @@
+﻿#ifndef _RESULTSTREAM_H
+#define _RESULTSTREAM_H
+//
+// 結果セットのストリーム
+//
+// 行(値のJSON配列)を1行ずつ返すストリームです。QueryStreamは専用の
+// スレッドで接続を借りてSQLを実行し、行セットを有限の待ち行列に入れます
+// (読む側が遅ければ取得を止める)。複数のストリームはConcatStream(連結)・
+// MergeStream(キー順のk-wayマージ)・AggregateStream(部分集計の結合)で
+// 1つのストリームにまとめます。napiに依存しません。
+//
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "omnicommon.h"
+#include "connpool.h"
+#include "fetcher.h"
+#include "spillbuffer.h"
+#include "nlohmann/json.hpp"
+
+// QueryStreamが先読みしておく行セットの数
+#define STREAM_QUEUE_BATCHES 4
+
+// 列の値の種類(SQLの型から決める)
+enum StreamValueKind {
+  // その他(浮動小数点・日時・バイナリ等、JSONの値のまま比べる)
+  STREAM_VALUE_OTHER,
+  // 整数(JSの数値で表せない値は文字列)
+  STREAM_VALUE_INTEGER,
+  // DECIMAL・NUMERIC(文字列)
+  STREAM_VALUE_DECIMAL,
+  // 文字列(接続先の照合順序はバイト順と異なる場合がある)
+  STREAM_VALUE_CHAR
+};
+
+// SQLの型から列の値の種類を決めます
+StreamValueKind StreamValueKindOf(SQLSMALLINT sqlType);
+
+// 並べ替えのキー
+struct StreamSortKey {
+  // 列番号
+  size_t column;
+  // 降順か
+  bool desc;
+  // 値の種類(整数・DECIMALは文字列も数値として比べる)
+  StreamValueKind kind;
+};
+
+// 部分集計の結合方法
+enum StreamAggregate {
+  // 合計(COUNTの結合も合計)
+  STREAM_AGG_SUM,
+  // 最小
+  STREAM_AGG_MIN,
+  // 最大
+  STREAM_AGG_MAX,
+  // 最初の値
+  STREAM_AGG_FIRST
+};
+
+// 部分集計の列
+struct StreamAggregateSpec {
+  size_t column;
+  StreamAggregate fn;
+  // 値の種類(整数・DECIMALは文字列も正確に合計・比較する)
+  StreamValueKind kind;
+};
+
+// ストリームの行が増えた通知(複数のストリームを1つのスレッドで待つ)
+struct StreamSignal {
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint64_t version;
+
+  StreamSignal() : version(0) {}
+  // 通知します
+  void Notify()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      version++;
+    }
+    cv.notify_all();
+  }
+  // 現在の版
+  uint64_t Version()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return version;
+  }
+  // 版がseenから進むまで待ちます
+  void Wait(uint64_t seen)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this, seen]() { return version != seen; });
+  }
+};
+
+// 値の比較(null < 真偽値 < 数値 < 文字列、数値は大きさ、文字列はバイト順)
+// 整数・DECIMALの列は数値の文字列も含めて大きさで比べます
+int CompareStreamValues(const nlohmann::json &a, const nlohmann::json &b, StreamValueKind kind = STREAM_VALUE_OTHER);
+
+class ResultStream {
+public:
+  virtual ~ResultStream() {}
+
+  // 列名の一覧(列が分かるまで待つ、失敗はfalse)
+  virtual bool Columns(nlohmann::json &columns, OString &error) = 0;
+  // 列のSQLの型(分からない場合は空)
+  virtual bool ColumnTypes(std::vector<SQLSMALLINT> &types, OString &error) { types.clear(); return true; }
+  // 次の行(終わり・失敗はfalse、失敗の場合はerrorを設定)
+  virtual bool Next(nlohmann::json &row, OString &error) = 0;
+  // 取り消します(別スレッドから呼べる、以降のNextはfalse)
+  virtual void Cancel() = 0;
+
+  // 最大maxRows行を読みます(doneは終わりまで読んだか)
+  bool Read(size_t maxRows, nlohmann::json &rows, bool &done, OString &error);
+};
+
+//
+// SQLの実行結果(最初の結果セット)のストリーム
+//
+class QueryStream : public ResultStream {
+public:
+  // sessionはNULLで既定のセッション(QueryStreamより長く生存すること)
+  QueryStream(
+    ConnectionPool &pool, const OString &sql, const PoolSession *session, uint32_t acquireTimeoutMs, size_t batchRows);
+  ~QueryStream() override;
+
+  // 行が増えた・終わった時の通知先(Startの前に設定)
+  void SetSignal(std::shared_ptr<StreamSignal> signal) { m_signal = signal; }
+  // 行数の自動調整(Startの前に設定)
+  void SetTuning(const FetchTuning &tuning) { m_tuning = tuning; }
+  // 読む側を待たずに全行を取得して保管します(Startの前に設定、queryBudgetはメモリに置く上限)
+  void SetMaterialize(size_t queryBudget) { m_spill.reset(new SpillBuffer(queryBudget)); }
+  // 実行を開始します(専用のスレッド)
+  void Start();
+  // 待たずに次の行を取り出します(行が無ければfalse、終わりならendedをtrue)
+  bool TryNext(nlohmann::json &row, OString &error, bool &ended);
+
+  bool Columns(nlohmann::json &columns, OString &error) override;
+  bool ColumnTypes(std::vector<SQLSMALLINT> &types, OString &error) override;
+  bool Next(nlohmann::json &row, OString &error) override;
+  void Cancel() override;
+
+  // 取得した行数
+  uint64_t Fetched();
+
+private:
+  QueryStream(const QueryStream &);
+  QueryStream &operator=(const QueryStream &);
+
+  // 取得スレッド
+  void Produce();
+  // 取得の終わり(errorは空で正常終了)
+  void Finish(const OString &error);
+  // 行形式のまとまりを保管します(取り消された・失敗はfalse)
+  bool Store(std::vector<char> &pending, size_t &rows, OString &error);
+  // 保管したまとまりから次の行を取り出します
+  bool TakeStored(nlohmann::json &row, OString &error, bool &ended);
+
+  ConnectionPool &m_pool;
+  OString m_sql;
+  const PoolSession *m_session;
+  uint32_t m_acquireTimeoutMs;
+  size_t m_batchRows;
+  FetchTuning m_tuning;
+  std::shared_ptr<StreamSignal> m_signal;
+  std::thread m_thread;
+  CancelToken m_cancel;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::vector<nlohmann::json> > m_queue;
+  nlohmann::json m_columns;
+  std::vector<SQLSMALLINT> m_types;
+  bool m_columnsReady;
+  bool m_finished;
+  bool m_cancelled;
+  OString m_error;
+  uint64_t m_fetched;
+  // 全行を保管する場合の保管先と、保管した・取り出したまとまりの数
+  std::unique_ptr<SpillBuffer> m_spill;
+  uint64_t m_stored;
+  uint64_t m_taken;
+  // 読んでいる行セット(読む側のスレッドのみ)
+  std::vector<nlohmann::json> m_current;
+  size_t m_position;
+};
+
+//
+// 連結(ストリームの順に全行)
+//
+class ConcatStream : public ResultStream {
+public:
+  explicit ConcatStream(std::vector<std::unique_ptr<ResultStream> > &sources);
+
+  bool Columns(nlohmann::json &columns, OString &error) override;
+  bool Next(nlohmann::json &row, OString &error) override;
+  void Cancel() override;
+
+private:
+  std::vector<std::unique_ptr<ResultStream> > m_sources;
+  size_t m_index;
+};
+
+//
+// 到着順の合流(行がある取得スレッドから順に、取得の並列度を保つ)
+//
+class InterleaveStream : public ResultStream {
+public:
+  // sourcesは全てsignalを通知先に設定して開始したもの
+  InterleaveStream(std::vector<std::unique_ptr<QueryStream> > &sources, std::shared_ptr<StreamSignal> signal);
+
+  bool Columns(nlohmann::json &columns, OString &error) override;
+  bool Next(nlohmann::json &row, OString &error) override;
+  void Cancel() override;
+
+private:
+  std::vector<std::unique_ptr<QueryStream> > m_sources;
+  std::shared_ptr<StreamSignal> m_signal;
+  // 終わっていないストリーム
+  std::vector<size_t> m_active;
+  // 前回行を返したストリーム(m_activeの位置)
+  size_t m_index;
+};
+
+//
+// キー順のk-wayマージ(各ストリームがキー順に並んでいること)
+//
+// キーはこのクラスの比較(数値は大きさ、文字列はバイト順)で並んでいる必要が
+// あります。接続先の照合順序(EBCDIC等)で並べた文字列のキーは順序が合わない
+// ため、文字列の列をキーにしないでください(OmniFederationでは拒否します)。
+//
+class MergeStream : public ResultStream {
+public:
+  MergeStream(std::vector<std::unique_ptr<ResultStream> > &sources, const std::vector<StreamSortKey> &keys);
+
+  bool Columns(nlohmann::json &columns, OString &error) override;
+  bool Next(nlohmann::json &row, OString &error) override;
+  void Cancel() override;
+
+private:
+  // aがbより先か
+  bool Before(const nlohmann::json &a, const nlohmann::json &b) const;
+  // 全ストリームの先頭行を読みます(初回)
+  bool Prime(OString &error);
+
+  std::vector<std::unique_ptr<ResultStream> > m_sources;
+  std::vector<StreamSortKey> m_keys;
+  // ストリームごとの先頭行
+  std::vector<nlohmann::json> m_heads;
+  // 先頭行があるストリーム(キー順の二分ヒープ)
+  std::vector<size_t> m_heap;
+  bool m_primed;
+};
+
+//
+// 部分集計の結合(グループキーごとに各ストリームの集計値を結合)
+//
+// 文字列の列のmin・maxと結果の並び(グループキーの順)はバイト順です。
+//
+class AggregateStream : public ResultStream {
+public:
+  AggregateStream(
+    std::vector<std::unique_ptr<ResultStream> > &sources,
+    const std::vector<StreamSortKey> &groupBy, const std::vector<StreamAggregateSpec> &aggregates);
+
+  bool Columns(nlohmann::json &columns, OString &error) override;
+  bool Next(nlohmann::json &row, OString &error) override;
+  void Cancel() override;
+
+private:
+  // 全行を読んで結合します(初回)
+  bool Combine(OString &error);
+
+  ConcatStream m_input;
+  std::vector<StreamSortKey> m_groupBy;
+  std::vector<StreamAggregateSpec> m_aggregates;
+  std::vector<nlohmann::json> m_rows;
+  size_t m_position;
+  bool m_combined;
+};
+
+#endif
@@ -0,0 +1,147 @@
+﻿#include "router.h"
+
+#include <algorithm>
+
+// 処理時間の平滑化係数
+#define ROUTE_ALPHA 0.2
+
+
+/**
+* コンストラクタ
+*
+* @param[in] endpoints 接続先の数(0番がプライマリ)
+* @param[in] cooldownMs 接続できなかった接続先を切り離す時間(ミリ秒)
+*/
+EndpointRouter::EndpointRouter(size_t endpoints, uint32_t cooldownMs)
+{
+  Endpoint e;
+  e.latencyMs = 0;
+  e.routed = 0;
+  e.failures = 0;
+  e.consecutive = 0;
+  e.downUntil = std::chrono::steady_clock::now();
+  e.lastSample = e.downUntil;
+  m_endpoints.assign(std::max((size_t)1, endpoints), e);
+  m_cooldownMs = cooldownMs;
+  m_reads = 0;
+}
+
+
+/**
+* 接続先を選びます
+*
+* 読み取り専用の処理は正常な接続先のうち、処理時間×(1+使用中の割合)が
+* 最も小さい接続先を選びます。未計測の接続先は計測済みの接続先の中央値
+* (全て未計測なら同じ値)とみなして使用中の割合で比べ、一定の回数ごとに
+* 最も長く計測していない接続先を選んで処理時間を更新します。
+* 正常な接続先が無い場合はプライマリを返します。
+*
+* @param[in] readOnly 読み取り専用の処理か
+* @param[in] load 接続先ごとの使用中の接続の割合(0～1、足りない分は0)
+* @param[in] exclude 他に正常な接続先があれば選ばない接続先
+* @return size_t 接続先の番号
+*/
+size_t EndpointRouter::Pick(bool readOnly, const std::vector<double> &load, size_t exclude)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(!readOnly || m_endpoints.size() == 1) {
+    m_endpoints[ROUTE_PRIMARY].routed++;
+    return ROUTE_PRIMARY;
+  }
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  bool explore = (++m_reads % ROUTE_EXPLORE_INTERVAL) == 0;
+
+  // 未計測の接続先の処理時間(計測済みの中央値)
+  std::vector<double> measured;
+  for(size_t i = 0; i < m_endpoints.size(); i++) {
+    if(m_endpoints[i].latencyMs > 0) {
+      measured.push_back(m_endpoints[i].latencyMs);
+    }
+  }
+  double unmeasured = 1;
+  if(!measured.empty()) {
+    std::nth_element(measured.begin(), measured.begin() + measured.size() / 2, measured.end());
+    unmeasured = measured[measured.size() / 2];
+  }
+
+  size_t best = m_endpoints.size();
+  double bestScore = 0;
+  for(size_t i = 0; i < m_endpoints.size(); i++) {
+    const Endpoint &e = m_endpoints[i];
+    if(!Available(e, now) || i == exclude) {
+      continue;
+    }
+    double score;
+    if(explore) {
+      // 最後に計測した時刻が古いほど小さい
+      score = (double)e.lastSample.time_since_epoch().count();
+    } else {
+      score = (e.latencyMs > 0 ? e.latencyMs : unmeasured) * (1 + (i < load.size() ? load[i] : 0));
+    }
+    if(best == m_endpoints.size() || score < bestScore) {
+      best = i;
+      bestScore = score;
+    }
+  }
+  if(best == m_endpoints.size()) {
+    best = exclude < m_endpoints.size() && Available(m_endpoints[exclude], now) ? exclude : ROUTE_PRIMARY;
+  }
+  m_endpoints[best].routed++;
+  return best;
+}
+
+
+/**
+* 処理の完了
+*
+* @param[in] endpoint 接続先の番号
+* @param[in] latencyMs 処理時間(ミリ秒)
+*/
+void EndpointRouter::Complete(size_t endpoint, double latencyMs)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(endpoint >= m_endpoints.size()) {
+    return;
+  }
+  Endpoint &e = m_endpoints[endpoint];
+  e.latencyMs = e.latencyMs == 0 ? latencyMs : e.latencyMs + (latencyMs - e.latencyMs) * ROUTE_ALPHA;
+  e.consecutive = 0;
+  e.lastSample = std::chrono::steady_clock::now();
+}
+
+
+/**
+* 接続できなかった接続先を切り離します(連続して失敗するたびに倍の時間)
+*
+* @param[in] endpoint 接続先の番号
+*/
+void EndpointRouter::Fail(size_t endpoint)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(endpoint >= m_endpoints.size()) {
+    return;
+  }
+  Endpoint &e = m_endpoints[endpoint];
+  e.failures++;
+  uint64_t cooldown = (uint64_t)m_cooldownMs << std::min(e.consecutive, (uint32_t)16);
+  cooldown = std::min(cooldown, (uint64_t)std::max(m_cooldownMs, (uint32_t)ROUTE_MAX_COOLDOWN));
+  e.consecutive++;
+  e.downUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(cooldown);
+}
+
+
+/**
+* 接続先の統計
+*/
+EndpointStats EndpointRouter::Stats(size_t endpoint)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const Endpoint &e = m_endpoints[endpoint < m_endpoints.size() ? endpoint : ROUTE_PRIMARY];
+  EndpointStats stats;
+  stats.latencyMs = e.latencyMs;
+  stats.routed = e.routed;
+  stats.failures = e.failures;
+  stats.healthy = Available(e, std::chrono::steady_clock::now());
+  return stats;
+}
@@ -0,0 +1,81 @@
+﻿#ifndef _ROUTER_H
+#define _ROUTER_H
+//
+// 複数の接続先(プライマリ・読み取りレプリカ)の振り分け
+//
+// 接続先ごとに処理時間の移動平均を持ち、読み取り専用の処理は
+// 処理時間×(1+使用中の接続の割合)が最も小さい正常な接続先に振り分けます。
+// 更新・トランザクションは常にプライマリ(0番)です。未計測の接続先は計測済みの
+// 中央値とみなします。接続できなかった接続先はしばらく(失敗が続くほど長く)
+// 振り分けの対象から外します。
+// napiに依存しません。
+//
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// プライマリの番号
+#define ROUTE_PRIMARY 0
+// 既定の切り離し時間(ミリ秒、連続して失敗するたびに倍)
+#define ROUTE_DEFAULT_COOLDOWN 5000
+// 切り離し時間の上限(ミリ秒)
+#define ROUTE_MAX_COOLDOWN 60000
+// この回数に1回は最も長く計測していない接続先に振り分ける(処理時間の更新)
+#define ROUTE_EXPLORE_INTERVAL 20
+
+// 接続先の統計
+struct EndpointStats {
+  // 処理時間の移動平均(ミリ秒、未計測は0)
+  double latencyMs;
+  // 振り分けた数
+  uint64_t routed;
+  // 失敗した数
+  uint64_t failures;
+  // 正常か(切り離し中でないか)
+  bool healthy;
+};
+
+class EndpointRouter {
+public:
+  // endpointsは接続先の数(0番がプライマリ)、cooldownMsは切り離し時間
+  EndpointRouter(size_t endpoints, uint32_t cooldownMs);
+
+  // 接続先を選びます(readOnlyでなければプライマリ、loadは接続先ごとの使用中の割合)
+  // ※excludeは他に正常な接続先があれば選ばない接続先(ヘッジで別の接続先を使う場合)
+  size_t Pick(bool readOnly, const std::vector<double> &load, size_t exclude = (size_t)-1);
+  // 処理の完了(処理時間を記録)
+  void Complete(size_t endpoint, double latencyMs);
+  // 接続できなかった(しばらく切り離す)
+  void Fail(size_t endpoint);
+
+  // 接続先の数
+  size_t Size() const { return m_endpoints.size(); }
+  EndpointStats Stats(size_t endpoint);
+
+private:
+  struct Endpoint {
+    double latencyMs;
+    uint64_t routed;
+    uint64_t failures;
+    // 連続した失敗の数
+    uint32_t consecutive;
+    // 切り離しの終わり
+    std::chrono::steady_clock::time_point downUntil;
+    // 最後に処理時間を記録した時刻
+    std::chrono::steady_clock::time_point lastSample;
+  };
+
+  // 振り分けの対象か(ロック中に呼ぶ)
+  bool Available(const Endpoint &e, std::chrono::steady_clock::time_point now) const
+  {
+    return e.consecutive == 0 || now >= e.downUntil;
+  }
+
+  std::mutex m_mutex;
+  std::vector<Endpoint> m_endpoints;
+  uint32_t m_cooldownMs;
+  uint64_t m_reads;
+};
+
+#endif
@@ -0,0 +1,500 @@
+﻿#include "spillbuffer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using json = nlohmann::json;
+
+
+/**
+* errnoをエラー文字列に変換します
+*/
+static OString SystemError(const OString &api)
+{
+  OString msg = api + _O("エラー (");
+  msg += to_ostring(errno);
+  msg += _O(": ");
+#ifndef _WIN32
+  msg += _S2O(strerror(errno));
+#endif
+  msg += _O(")");
+  return msg;
+}
+
+
+//
+// MemoryBudget
+//
+
+/**
+* プロセスで共有する上限
+*
+* 終了時に他のスレッドが返却しても壊れないように破棄しません。
+*/
+MemoryBudget &MemoryBudget::Shared()
+{
+  static MemoryBudget *budget = new MemoryBudget();
+  return *budget;
+}
+
+
+/**
+* コンストラクタ
+*/
+MemoryBudget::MemoryBudget()
+  : m_used(0), m_limit(SPILL_DEFAULT_PROCESS_BUDGET), m_spills(0), m_spilledBytes(0), m_files(0)
+{
+}
+
+
+/**
+* 確保します
+*
+* @param[in] bytes バイト数
+* @return bool 上限内で確保できたか
+*/
+bool MemoryBudget::TryReserve(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(m_used + bytes > m_limit) {
+    return false;
+  }
+  m_used += bytes;
+  return true;
+}
+
+
+/**
+* 確保したバイト数を返します
+*
+* @param[in] bytes バイト数
+*/
+void MemoryBudget::Release(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_used = bytes > m_used ? 0 : m_used - bytes;
+}
+
+
+/**
+* 上限を設定します(確保済みの分はそのまま)
+*
+* @param[in] limit 上限(バイト)
+*/
+void MemoryBudget::SetLimit(size_t limit)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_limit = limit;
+}
+
+
+/**
+* 書き出しを記録します
+*
+* @param[in] bytes 書き出したバイト数
+* @param[in] newFile 一時ファイルを作ったか
+*/
+void MemoryBudget::RecordSpill(size_t bytes, bool newFile)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_spills++;
+  m_spilledBytes += bytes;
+  if(newFile) {
+    m_files++;
+  }
+}
+
+
+/**
+* 統計
+*
+* @return SpillStats 統計
+*/
+SpillStats MemoryBudget::Stats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  SpillStats stats;
+  stats.memoryBytes = m_used;
+  stats.limit = m_limit;
+  stats.spills = m_spills;
+  stats.spilledBytes = m_spilledBytes;
+  stats.files = m_files;
+  return stats;
+}
+
+
+//
+// 行形式
+//
+
+/**
+* 値を行形式で書きます
+*
+* 型の1バイトに続けて、数値は8バイト、文字列は4バイトの長さとutf-8の内容。
+* 真偽値・nullは型のみです。
+*
+* @param[in] value 値(FetchValueの結果)
+* @param[in,out] out 書き込み先(末尾に追加)
+*/
+void SpillEncodeValue(const json &value, std::vector<char> &out)
+{
+  switch(value.type()) {
+    case json::value_t::null:
+      out.push_back((char)SPILL_NULL);
+      return;
+    case json::value_t::boolean:
+      out.push_back((char)(value.get<bool>() ? SPILL_TRUE : SPILL_FALSE));
+      return;
+    case json::value_t::number_integer: {
+      int64_t n = value.get<int64_t>();
+      out.push_back((char)SPILL_INT);
+      out.insert(out.end(), (const char *)&n, (const char *)&n + sizeof(n));
+      return;
+    }
+    case json::value_t::number_unsigned: {
+      uint64_t n = value.get<uint64_t>();
+      out.push_back((char)SPILL_UINT);
+      out.insert(out.end(), (const char *)&n, (const char *)&n + sizeof(n));
+      return;
+    }
+    case json::value_t::number_float: {
+      double d = value.get<double>();
+      out.push_back((char)SPILL_DOUBLE);
+      out.insert(out.end(), (const char *)&d, (const char *)&d + sizeof(d));
+      return;
+    }
+    default:
+      break;
+  }
+
+  // 文字列(それ以外の型はJSONの文字列にする)
+  std::string s = value.is_string() ? value.get_ref<const std::string &>() : value.dump();
+  uint32_t length = (uint32_t)s.size();
+  out.push_back((char)SPILL_STRING);
+  out.insert(out.end(), (const char *)&length, (const char *)&length + sizeof(length));
+  out.insert(out.end(), s.begin(), s.end());
+}
+
+
+/**
+* 1行を読みます
+*
+* @param[in,out] p 読む位置(次の行に進む)
+* @param[in] end 終わり
+* @param[in] columns 列数
+* @param[out] row 行(値の配列)
+* @return bool 成否(範囲を超える・不明な型はfalse)
+*/
+bool SpillDecodeRow(const char *&p, const char *end, size_t columns, json &row)
+{
+  row = json::array();
+  for(size_t c = 0; c < columns; c++) {
+    if(p >= end) {
+      return false;
+    }
+    char tag = *p++;
+    switch(tag) {
+      case SPILL_NULL:
+        row.push_back(json());
+        break;
+      case SPILL_FALSE:
+      case SPILL_TRUE:
+        row.push_back(json(tag == SPILL_TRUE));
+        break;
+      case SPILL_INT:
+      case SPILL_UINT:
+      case SPILL_DOUBLE: {
+        if(end - p < 8) {
+          return false;
+        }
+        if(tag == SPILL_INT) {
+          int64_t n;
+          memcpy(&n, p, sizeof(n));
+          row.push_back(json(n));
+        } else if(tag == SPILL_UINT) {
+          uint64_t n;
+          memcpy(&n, p, sizeof(n));
+          row.push_back(json(n));
+        } else {
+          double d;
+          memcpy(&d, p, sizeof(d));
+          row.push_back(json(d));
+        }
+        p += 8;
+        break;
+      }
+      case SPILL_STRING: {
+        uint32_t length;
+        if(end - p < (ptrdiff_t)sizeof(length)) {
+          return false;
+        }
+        memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        if((size_t)(end - p) < length) {
+          return false;
+        }
+        row.push_back(json(std::string(p, length)));
+        p += length;
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+
+//
+// SpillBatch
+//
+
+/**
+* コンストラクタ
+*/
+SpillBatch::SpillBatch()
+  : m_map(NULL), m_mapLength(0), m_data(NULL), m_size(0), m_rows(0)
+{
+}
+
+
+/**
+* デストラクタ
+*/
+SpillBatch::~SpillBatch()
+{
+  Reset();
+}
+
+
+/**
+* メモリ・マップを解放します
+*/
+void SpillBatch::Reset()
+{
+#ifndef _WIN32
+  if(m_map) {
+    munmap(m_map, m_mapLength);
+  }
+#endif
+  m_map = NULL;
+  m_mapLength = 0;
+  std::vector<char>().swap(m_memory);
+  m_data = NULL;
+  m_size = 0;
+  m_rows = 0;
+}
+
+
+//
+// SpillBuffer
+//
+
+/**
+* コンストラクタ
+*
+* @param[in] queryBudget メモリに置く上限(バイト)
+*/
+SpillBuffer::SpillBuffer(size_t queryBudget)
+  : m_budget(queryBudget), m_memoryBytes(0), m_fd(-1), m_fileSize(0), m_spills(0), m_spilledBytes(0)
+{
+}
+
+
+/**
+* デストラクタ(メモリの分を上限に返し、一時ファイルを閉じる)
+*/
+SpillBuffer::~SpillBuffer()
+{
+  MemoryBudget::Shared().Release(m_memoryBytes);
+#ifndef _WIN32
+  if(m_fd >= 0) {
+    close(m_fd);
+  }
+#endif
+}
+
+
+/**
+* まとまりを追加します
+*
+* 1クエリの上限とプロセス全体の上限に収まればメモリに置き、収まらなければ
+* 一時ファイルの末尾に書き出します。
+*
+* @param[in,out] data 行形式のまとまり(空になる)
+* @param[in] rows 行数
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool SpillBuffer::Append(std::vector<char> &data, size_t rows, OString &error)
+{
+  Entry entry;
+  entry.size = data.size();
+  entry.rows = rows;
+  entry.offset = 0;
+  entry.spilled = false;
+
+  bool fits;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    fits = m_memoryBytes + entry.size <= m_budget;
+  }
+  if(fits && MemoryBudget::Shared().TryReserve(entry.size)) {
+    entry.data.swap(data);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_memoryBytes += entry.size;
+    m_entries.push_back(std::move(entry));
+    return true;
+  }
+
+  bool created = false;
+  if(!Spill(data, entry.offset, created, error)) {
+    return false;
+  }
+  MemoryBudget::Shared().RecordSpill(entry.size, created);
+  data.clear();
+  entry.spilled = true;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_spills++;
+  m_spilledBytes += entry.size;
+  m_entries.push_back(std::move(entry));
+  return true;
+}
+
+
+/**
+* 一時ファイルの末尾に書き出します
+*
+* 一時ファイルはTMPDIR(無ければ/tmp)に作り、開いたらすぐに削除します。
+*
+* @param[in] data 書き出す内容
+* @param[out] offset 書き出した位置
+* @param[out] created 一時ファイルを作ったか
+* @param[out] error エラーメッセージ
+* @return bool 成否
+*/
+bool SpillBuffer::Spill(const std::vector<char> &data, uint64_t &offset, bool &created, OString &error)
+{
+#ifdef _WIN32
+  error = _O("結果がメモリの上限を超えました(一時ファイルへの退避はこのOSでは未対応です)");
+  return false;
+#else
+  created = false;
+  if(m_fd < 0) {
+    const char *dir = getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp") + "/omnidb-spill-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back(0);
+    int fd = mkstemp(&name[0]);
+    if(fd < 0) {
+      error = SystemError(_O("mkstemp"));
+      return false;
+    }
+    unlink(&name[0]);
+    m_fd = fd;
+    created = true;
+  }
+
+  offset = m_fileSize;
+  size_t written = 0;
+  while(written < data.size()) {
+    ssize_t n = pwrite(m_fd, &data[written], data.size() - written, (off_t)(offset + written));
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      error = SystemError(_O("pwrite"));
+      return false;
+    }
+    written += (size_t)n;
+  }
+  m_fileSize += data.size();
+  return true;
+#endif
+}
+
+
+/**
+* 次のまとまりを取り出します
+*
+* メモリのまとまりは移し、書き出したまとまりはその範囲をマップします。
+*
+* @param[out] batch まとまり
+* @param[out] error エラーメッセージ
+* @return bool 取り出せたか(無い場合はerrorが空)
+*/
+bool SpillBuffer::Take(SpillBatch &batch, OString &error)
+{
+  batch.Reset();
+  Entry entry;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_entries.empty()) {
+      return false;
+    }
+    entry = std::move(m_entries.front());
+    m_entries.pop_front();
+    if(!entry.spilled) {
+      m_memoryBytes -= entry.size;
+    }
+  }
+  batch.m_rows = entry.rows;
+  batch.m_size = entry.size;
+
+  if(!entry.spilled) {
+    MemoryBudget::Shared().Release(entry.size);
+    batch.m_memory.swap(entry.data);
+    batch.m_data = batch.m_memory.empty() ? NULL : &batch.m_memory[0];
+    return true;
+  }
+
+#ifdef _WIN32
+  error = _O("一時ファイルはこのOSでは未対応です");
+  return false;
+#else
+  if(entry.size == 0) {
+    return true;
+  }
+  // ページ境界からマップする
+  uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+  uint64_t start = entry.offset - entry.offset % page;
+  size_t length = (size_t)(entry.offset + entry.size - start);
+  void *map = mmap(NULL, length, PROT_READ, MAP_SHARED, m_fd, (off_t)start);
+  if(map == MAP_FAILED) {
+    error = SystemError(_O("mmap"));
+    return false;
+  }
+  batch.m_map = map;
+  batch.m_mapLength = length;
+  batch.m_data = (const char *)map + (entry.offset - start);
+  return true;
+#endif
+}
+
+
+/**
+* 書き出したまとまりの数
+*/
+uint64_t SpillBuffer::Spills()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_spills;
+}
+
+
+/**
+* 書き出したバイト数
+*/
+uint64_t SpillBuffer::SpilledBytes()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_spilledBytes;
+}
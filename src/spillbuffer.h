@@ -0,0 +1,160 @@
+﻿#ifndef _SPILLBUFFER_H
+#define _SPILLBUFFER_H
+//
+// 取得した結果の保管(メモリの上限を超えた分は一時ファイルに退避)
+//
+// 行は列ごとに型の1バイトと値を並べたバイナリ形式で、まとまり単位に保持
+// します。まとまりは1クエリの上限とプロセス全体の上限(MemoryBudget)の範囲で
+// メモリに置き、超えた分は一時ファイルに書き出して、読む時にその範囲だけ
+// メモリにマップします。一時ファイルは作成直後に削除するので、異常終了しても
+// 残りません。書く側(1スレッド)と読む側(1スレッド)は別でもかまいません。
+// napiに依存しません。
+//
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "omnicommon.h"
+#include "nlohmann/json.hpp"
+
+// 既定の1クエリのメモリ上限(バイト)
+#define SPILL_DEFAULT_QUERY_BUDGET (64 * 1024 * 1024)
+// 既定のプロセス全体のメモリ上限(バイト)
+#define SPILL_DEFAULT_PROCESS_BUDGET (512 * 1024 * 1024)
+// まとまりの大きさの目安(バイト)
+#define SPILL_BATCH_BYTES (256 * 1024)
+
+// 値の型
+enum SpillTag {
+  SPILL_NULL = 0,
+  SPILL_FALSE,
+  SPILL_TRUE,
+  SPILL_INT,
+  SPILL_UINT,
+  SPILL_DOUBLE,
+  SPILL_STRING
+};
+
+// 統計
+struct SpillStats {
+  // メモリに置いているバイト数とその上限
+  size_t memoryBytes;
+  size_t limit;
+  // 書き出したまとまりの数・バイト数・作った一時ファイルの数
+  uint64_t spills;
+  uint64_t spilledBytes;
+  uint64_t files;
+};
+
+//
+// プロセス全体のメモリ上限
+//
+class MemoryBudget {
+public:
+  // プロセスで共有する上限
+  static MemoryBudget &Shared();
+
+  MemoryBudget();
+
+  // bytesを確保します(上限を超える場合はfalse)
+  bool TryReserve(size_t bytes);
+  // 確保したbytesを返します
+  void Release(size_t bytes);
+  // 上限を設定します
+  void SetLimit(size_t limit);
+  // 書き出しを記録します
+  void RecordSpill(size_t bytes, bool newFile);
+  // 統計
+  SpillStats Stats();
+
+private:
+  MemoryBudget(const MemoryBudget &);
+  MemoryBudget &operator=(const MemoryBudget &);
+
+  std::mutex m_mutex;
+  size_t m_used;
+  size_t m_limit;
+  uint64_t m_spills;
+  uint64_t m_spilledBytes;
+  uint64_t m_files;
+};
+
+// 値を行形式で書きます
+void SpillEncodeValue(const nlohmann::json &value, std::vector<char> &out);
+// 1行(columns列)を読みます(pは次の行に進む、壊れていればfalse)
+bool SpillDecodeRow(const char *&p, const char *end, size_t columns, nlohmann::json &row);
+
+//
+// 取り出したまとまり(破棄でメモリ・マップを解放)
+//
+class SpillBatch {
+public:
+  SpillBatch();
+  ~SpillBatch();
+
+  // 解放します
+  void Reset();
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  size_t rows() const { return m_rows; }
+
+private:
+  SpillBatch(const SpillBatch &);
+  SpillBatch &operator=(const SpillBatch &);
+  friend class SpillBuffer;
+
+  std::vector<char> m_memory;
+  // マップした範囲(ページ境界から)
+  void *m_map;
+  size_t m_mapLength;
+  const char *m_data;
+  size_t m_size;
+  size_t m_rows;
+};
+
+//
+// 結果の保管
+//
+class SpillBuffer {
+public:
+  // queryBudgetはこのバッファがメモリに置く上限(バイト)
+  explicit SpillBuffer(size_t queryBudget);
+  ~SpillBuffer();
+
+  // まとまりを追加します(書く側、dataは空になる)
+  bool Append(std::vector<char> &data, size_t rows, OString &error);
+  // 次のまとまりを取り出します(読む側、無ければfalseでerrorは空)
+  bool Take(SpillBatch &batch, OString &error);
+
+  // 書き出したまとまりの数とバイト数
+  uint64_t Spills();
+  uint64_t SpilledBytes();
+
+private:
+  SpillBuffer(const SpillBuffer &);
+  SpillBuffer &operator=(const SpillBuffer &);
+
+  struct Entry {
+    std::vector<char> data;
+    bool spilled;
+    uint64_t offset;
+    size_t size;
+    size_t rows;
+  };
+
+  // 一時ファイルに書き出します(書く側のスレッドのみ)
+  bool Spill(const std::vector<char> &data, uint64_t &offset, bool &created, OString &error);
+
+  std::mutex m_mutex;
+  std::deque<Entry> m_entries;
+  size_t m_budget;
+  size_t m_memoryBytes;
+  // 一時ファイル(書き込みの末尾は書く側のスレッドのみ)
+  int m_fd;
+  uint64_t m_fileSize;
+  uint64_t m_spills;
+  uint64_t m_spilledBytes;
+};
+
+#endif